@@ -1,32 +1,184 @@
 
+// The controller answers an unchanged /api/data with a 304, so the same body
+// can come back for a while. Uptime is kept ticking locally in the meantime.
+let uptimeText = null;
+let uptimeSeconds = 0;
+let uptimeSeenAt = 0;
+
+function tickUptime(text) {
+    const match = /(\d+)d (\d+)h (\d+)m (\d+)s/.exec(text || '');
+    if (!match) { return text || 'Error'; }
+
+    if (text !== uptimeText) {
+        uptimeText = text;
+        uptimeSeconds = ((+match[1] * 24 + +match[2]) * 60 + +match[3]) * 60 + +match[4];
+        uptimeSeenAt = Date.now();
+    }
+
+    let seconds = uptimeSeconds + Math.floor((Date.now() - uptimeSeenAt) / 1000);
+    const days = Math.floor(seconds / 86400);
+    const hours = Math.floor(seconds / 3600) % 24;
+    const minutes = Math.floor(seconds / 60) % 60;
+    seconds %= 60;
+    return days + 'd ' + hours + 'h ' + minutes + 'm ' + seconds + 's';
+}
+
+function showData(data) {
+    document.getElementById('controller-uptime').innerText = tickUptime(data.controllerUptime);
+    document.getElementById('firmware-version').innerText = data.firmwareVersion || 'Error';
+    document.getElementById('enclosure-temp').innerText = data.enclosureTemp || 'Error';
+    document.getElementById('local-time').innerText = data.localTime || 'Error';
+    document.getElementById('pump-status').innerText = data.pumpStatus || 'Error';
+    document.getElementById('target-temp').innerText = data.targetTemp || 'Error';
+    document.getElementById('pool-temp').innerText = data.poolTemp || 'Error';
+
+    const poolTempTimeElement = document.getElementById('pool-temp-time');
+    const poolTempTimeValue = data.poolTempTime || 'Error';
+    
+    if (poolTempTimeValue === '0 mins ago') {
+        poolTempTimeElement.innerText = 'Real-time';
+    } else if (poolTempTimeValue === '60 mins ago') {
+        poolTempTimeElement.innerText = 'Initializing';
+    } else {
+        poolTempTimeElement.innerText = poolTempTimeValue;
+    }
+
+    document.getElementById('input-temp').innerText = data.inputTemp || 'Error';
+    document.getElementById('output-temp').innerText = data.outputTemp || 'Error';
+    document.getElementById('flow-rate').innerText = data.flowRate || 'Error';
+    document.getElementById('energy-capture').innerText = data.energyCapture || 'Error';
+    document.getElementById('energy-24h').innerText = data.energy24h || 'Error';
+    document.getElementById('energy-72h').innerText = data.energy72h || 'Error';
+    document.getElementById('energy-week').innerText = data.energyWeek || 'Error';
+    document.getElementById('lifetime-litres').innerText = data.lifetimeLitres || 'Error';
+    document.getElementById('lifetime-energy').innerText = data.lifetimeEnergy || 'Error';
+    document.getElementById('pump-hours').innerText = data.pumpHours || 'Error';
+    document.getElementById('cycle-energy').innerText = data.cycleEnergy || 'Error';
+    document.getElementById('cycle-cop').innerText = data.cycleCop || 'Error';
+    document.getElementById('today-energy').innerText = data.todayEnergy || 'Error';
+    document.getElementById('today-cop').innerText = data.todayCop || 'Error';
+    document.getElementById('lifetime-net-energy').innerText = data.lifetimeNetEnergy || 'Error';
+    document.getElementById('lifetime-cop').innerText = data.lifetimeCop || 'Error';
+}
+
 function fetchData() {
-    fetch('/api/data').then(response => response.json()).then(data => {
-        document.getElementById('controller-uptime').innerText = data.controllerUptime || 'Error';
-        document.getElementById('firmware-version').innerText = data.firmwareVersion || 'Error';
-        document.getElementById('enclosure-temp').innerText = data.enclosureTemp || 'Error';
-        document.getElementById('local-time').innerText = data.localTime || 'Error';
-        document.getElementById('pump-status').innerText = data.pumpStatus || 'Error';
-        document.getElementById('target-temp').innerText = data.targetTemp || 'Error';
-        document.getElementById('pool-temp').innerText = data.poolTemp || 'Error';
-
-        const poolTempTimeElement = document.getElementById('pool-temp-time');
-        const poolTempTimeValue = data.poolTempTime || 'Error';
-        
-        if (poolTempTimeValue === '0 mins ago') {
-            poolTempTimeElement.innerText = 'Real-time';
-        } else if (poolTempTimeValue === '60 mins ago') {
-            poolTempTimeElement.innerText = 'Initializing';
-        } else {
-            poolTempTimeElement.innerText = poolTempTimeValue;
+    // no-cache still uses the cached copy, but only after the controller confirms it with a 304
+    fetch('/api/data', { cache: 'no-cache' }).then(response => response.json()).then(showData);
+}
+
+// Telemetry is pushed over /api/stream as it changes, each event only carries
+// the fields that did. Polling /api/data covers browsers without EventSource
+// and any time the stream is down, including the controller turning us away.
+const latestData = {};
+let pollTimer = null;
+
+function startPolling() {
+    if (pollTimer) { return; }
+    fetchData();
+    pollTimer = setInterval(fetchData, 3000);
+}
+
+function stopPolling() {
+    clearInterval(pollTimer);
+    pollTimer = null;
+}
+
+function openStream() {
+    if (!window.EventSource) {
+        startPolling();
+        return;
+    }
+
+    const source = new EventSource('/api/stream');
+    source.addEventListener('telemetry', event => {
+        stopPolling();
+        Object.assign(latestData, JSON.parse(event.data));
+        showData(latestData);
+    });
+    source.onerror = () => {
+        source.close();
+        startPolling();
+        setTimeout(openStream, 30000);
+    };
+}
+
+// Channel ids as sent by /api/history, values are integers in these units
+const HISTORY_CHANNELS = ['inputTemp', 'outputTemp', 'flowRate', 'energyCapture', 'pumpSeconds', 'state'];
+const HISTORY_SCALE = { inputTemp: 100, outputTemp: 100, flowRate: 100, energyCapture: 1, pumpSeconds: 1, state: 1 };
+
+// Fetches /api/history in its binary encoding: a 20 byte little endian header
+// ("PH", version, channel count, start, step, count, epochAtZero), the channel
+// ids, then per point a zigzag varint delta for each channel.
+function fetchHistory(params) {
+    return fetch('/api/history?' + new URLSearchParams(params)).then(response => response.arrayBuffer()).then(buffer => {
+        const bytes = new Uint8Array(buffer);
+        const view = new DataView(buffer);
+        if (bytes[0] !== 0x50 || bytes[1] !== 0x48 || bytes[2] !== 1) { throw new Error('Unexpected history format'); }
+
+        const channelCount = bytes[3];
+        const start = view.getUint32(4, true);
+        const step = view.getUint32(8, true);
+        const count = view.getUint32(12, true);
+        const epochAtZero = view.getUint32(16, true);
+        const names = Array.from(bytes.slice(20, 20 + channelCount), id => HISTORY_CHANNELS[id]);
+
+        const series = {};
+        names.forEach(name => { series[name] = new Float32Array(count); });
+        const previous = new Array(channelCount).fill(0);
+        let offset = 20 + channelCount;
+
+        for (let point = 0; point < count; point++) {
+            for (let channel = 0; channel < channelCount; channel++) {
+                let zigzag = 0, shift = 0, byte;
+                do {
+                    byte = bytes[offset++];
+                    zigzag += (byte & 0x7f) * 2 ** shift;
+                    shift += 7;
+                } while (byte & 0x80);
+
+                previous[channel] += zigzag % 2 ? -(zigzag + 1) / 2 : zigzag / 2;
+                series[names[channel]][point] = previous[channel] / HISTORY_SCALE[names[channel]];
+            }
         }
 
-        document.getElementById('input-temp').innerText = data.inputTemp || 'Error';
-        document.getElementById('output-temp').innerText = data.outputTemp || 'Error';
-        document.getElementById('flow-rate').innerText = data.flowRate || 'Error';
-        document.getElementById('energy-capture').innerText = data.energyCapture || 'Error';
+        const times = Array.from({ length: count }, (_, point) => start + point * step);
+        return { start, step, count, epochAtZero, times, series };
     });
 }
 
-// Call fetchData every 3 seconds and on load
-setInterval(fetchData, 3000);
-document.addEventListener('DOMContentLoaded', fetchData);
+function drawHistory() {
+    const canvas = document.getElementById('history-chart');
+    if (!canvas) { return; }
+
+    fetchHistory({ channel: 'inputTemp,outputTemp', from: -86400, res: 300 }).then(history => {
+        const context = canvas.getContext('2d');
+        const lines = [['inputTemp', '#4fc3f7'], ['outputTemp', '#ff8a65']];
+        const values = lines.flatMap(([name]) => Array.from(history.series[name]));
+        const low = Math.min(...values) - 0.5;
+        const high = Math.max(...values) + 0.5;
+
+        context.clearRect(0, 0, canvas.width, canvas.height);
+        if (history.count < 2) { return; }
+
+        lines.forEach(([name, colour]) => {
+            context.strokeStyle = colour;
+            context.beginPath();
+            history.series[name].forEach((value, point) => {
+                const x = point / (history.count - 1) * canvas.width;
+                const y = canvas.height - (value - low) / (high - low) * canvas.height;
+                point === 0 ? context.moveTo(x, y) : context.lineTo(x, y);
+            });
+            context.stroke();
+        });
+
+        context.fillStyle = '#bdbdbd';
+        context.fillText(high.toFixed(1) + ' C', 4, 12);
+        context.fillText(low.toFixed(1) + ' C', 4, canvas.height - 4);
+    }).catch(() => {});
+}
+
+document.addEventListener('DOMContentLoaded', openStream);
+
+// History chart, the 5 min points only change once a minute
+setInterval(drawHistory, 60000);
+document.addEventListener('DOMContentLoaded', drawHistory);
@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "PumpManager/EnergyHistory.h"
+#include <climits>
+#include <initializer_list>
+
+EnergyHistory::EnergyHistory()
+    : seconds_(),
+    secondStates_(),
+    minutes_(),
+    hours_(),
+    secondHead_(0),
+    minuteHead_(0),
+    hourHead_(0),
+    secondCount_(0),
+    minuteCount_(0),
+    hourCount_(0),
+    totalSamples_(0),
+    minuteAcc_(),
+    hourAcc_(),
+    energy24h_(0),
+    energy72h_(0),
+    energyWeek_(0) {}
+
+void EnergyHistory::record(float inputTemp, float outputTemp, float flowRate, float energyCapture, uint8_t state, bool pumpOn) {
+    sequence_.beginWrite();
+
+    Sample& sample = seconds_[secondHead_];
+    sample.inputTemp = toFixed(inputTemp, 100, INT16_MIN, INT16_MAX);
+    sample.outputTemp = toFixed(outputTemp, 100, INT16_MIN, INT16_MAX);
+    sample.flowRate = toFixed(flowRate, 100, 0, UINT16_MAX);
+    sample.energyCapture = toFixed(energyCapture, 1, INT16_MIN, INT16_MAX);
+    secondStates_[secondHead_] = (state & STATE_MASK) | (pumpOn ? PUMP_ON_FLAG : 0);
+
+    secondHead_ = (secondHead_ + 1) % HISTORY_SECONDS;
+    if (secondCount_ < HISTORY_SECONDS) { secondCount_++; }
+    totalSamples_++;
+
+    // Both open periods take the raw sample so hour averages carry no minute rounding
+    for (Accumulator* acc : { &minuteAcc_, &hourAcc_ }) {
+        acc->inputTemp += sample.inputTemp;
+        acc->outputTemp += sample.outputTemp;
+        acc->flowRate += sample.flowRate;
+        acc->energyCapture += sample.energyCapture;
+        acc->pumpSeconds += pumpOn ? 1 : 0;
+        acc->seconds++;
+    }
+    minuteAcc_.entries++;
+
+    if (minuteAcc_.seconds >= 60) {
+        closeMinute(state);
+    }
+
+    sequence_.endWrite();
+}
+
+void EnergyHistory::closeMinute(uint8_t state) {
+    // Entries about to leave each window, read before the ring slot is reused
+    if (minuteCount_ >= MINUTES_PER_DAY) {
+        energy24h_ -= joules(at(minutes_, minuteHead_, HISTORY_MINUTES, MINUTES_PER_DAY - 1), 1);
+    }
+
+    Rollup& minute = minutes_[minuteHead_];
+    minute = finish(minuteAcc_, state);
+    energy24h_ += joules(minute, 1);
+
+    minuteHead_ = (minuteHead_ + 1) % HISTORY_MINUTES;
+    if (minuteCount_ < HISTORY_MINUTES) { minuteCount_++; }
+    minuteAcc_ = Accumulator();
+
+    if (++hourAcc_.entries >= 60) {
+        closeHour(state);
+    }
+}
+
+void EnergyHistory::closeHour(uint8_t state) {
+    if (hourCount_ >= HOURS_PER_3_DAYS) {
+        energy72h_ -= joules(at(hours_, hourHead_, HISTORY_HOURS, HOURS_PER_3_DAYS - 1), 60);
+    }
+    if (hourCount_ >= HOURS_PER_WEEK) {
+        energyWeek_ -= joules(at(hours_, hourHead_, HISTORY_HOURS, HOURS_PER_WEEK - 1), 60);
+    }
+
+    Rollup& hour = hours_[hourHead_];
+    hour = finish(hourAcc_, state);
+    energy72h_ += joules(hour, 60);
+    energyWeek_ += joules(hour, 60);
+
+    hourHead_ = (hourHead_ + 1) % HISTORY_HOURS;
+    if (hourCount_ < HISTORY_HOURS) { hourCount_++; }
+    hourAcc_ = Accumulator();
+}
+
+size_t EnergyHistory::count(Tier tier) const {
+    switch (tier) {
+        case SECONDS: return secondCount_;
+        case MINUTES: return minuteCount_;
+        case HOURS: return hourCount_;
+        default: return 0;
+    }
+}
+
+bool EnergyHistory::get(Tier tier, size_t age, Rollup& entry) const {
+    if (age >= count(tier)) { return false; }
+
+    switch (tier) {
+        case SECONDS: {
+            size_t index = (secondHead_ + HISTORY_SECONDS - 1 - age) % HISTORY_SECONDS;
+            const Sample& sample = seconds_[index];
+            entry.inputTemp = sample.inputTemp;
+            entry.outputTemp = sample.outputTemp;
+            entry.flowRate = sample.flowRate;
+            entry.energyCapture = sample.energyCapture;
+            entry.pumpSeconds = secondStates_[index] & PUMP_ON_FLAG ? 1 : 0;
+            entry.state = secondStates_[index] & STATE_MASK;
+            entry.samples = 1;
+            return true;
+        }
+        case MINUTES: entry = at(minutes_, minuteHead_, HISTORY_MINUTES, age); return true;
+        case HOURS: entry = at(hours_, hourHead_, HISTORY_HOURS, age); return true;
+        default: return false;
+    }
+}
+
+float EnergyHistory::getEnergyKWh(Window window) const {
+    switch (window) {
+        case LAST_24H: return energy24h_ / 3.6e6f;
+        case LAST_72H: return energy72h_ / 3.6e6f;
+        case LAST_WEEK: return energyWeek_ / 3.6e6f;
+        default: return 0;
+    }
+}
+
+unsigned long EnergyHistory::periodSeconds(Tier tier) {
+    switch (tier) {
+        case SECONDS: return 1;
+        case MINUTES: return 60;
+        case HOURS: return 3600;
+        default: return 0;
+    }
+}
+
+bool EnergyHistory::getAt(Tier tier, uint32_t time, Rollup& entry) const {
+    uint32_t period = periodSeconds(tier);
+    uint32_t closed = totalSamples_ / period;      // Minutes and hours close on exact sample counts
+    uint32_t index = time / period;
+    if (index >= closed) { return false; }
+
+    return get(tier, closed - 1 - index, entry);
+}
+
+const char* EnergyHistory::channelName(Channel channel) {
+    switch (channel) {
+        case INPUT_TEMP: return "inputTemp";
+        case OUTPUT_TEMP: return "outputTemp";
+        case FLOW_RATE: return "flowRate";
+        case ENERGY_CAPTURE: return "energyCapture";
+        case PUMP_SECONDS: return "pumpSeconds";
+        case STATE: return "state";
+        default: return "unknown";
+    }
+}
+
+uint8_t EnergyHistory::parseChannels(const char* list) {
+    uint8_t mask = 0;
+
+    for (const char* name = list; *name; ) {
+        const char* comma = strchr(name, ',');
+        size_t length = comma ? (size_t)(comma - name) : strlen(name);
+
+        uint8_t found = 0;
+        for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+            const char* candidate = channelName((Channel)channel);
+            if (strlen(candidate) == length && strncmp(candidate, name, length) == 0) {
+                found = 1 << channel;
+            }
+        }
+        if (!found) { return 0; }
+
+        mask |= found;
+        name += comma ? length + 1 : length;
+    }
+    return mask;
+}
+
+EnergyHistory::StreamPlan EnergyHistory::planStream(long from, long to, uint32_t res) const {
+    long current = totalSamples_;
+    if (from < 0) { from += current; }
+    if (to < 0) { to += current; }
+    if (from < 0) { from = 0; }
+    if (to > current) { to = current; }
+    if (res == 0) { res = 1; }
+
+    // Finest tier that is fine enough and still reaches back to from, else whichever reaches furthest
+    StreamPlan plan = { HOURS, 0, 0, 0 };
+    long bestOldest = LONG_MAX;
+    for (Tier tier : { SECONDS, MINUTES, HOURS }) {
+        long period = periodSeconds(tier);
+        long oldest = (long)(totalSamples_ / period - count(tier)) * period;
+
+        if (period <= (long)res && oldest <= from) {
+            plan.tier = tier;
+            break;
+        }
+        if (oldest < bestOldest) {
+            bestOldest = oldest;
+            plan.tier = tier;
+        }
+    }
+
+    uint32_t period = periodSeconds(plan.tier);
+    long oldest = (long)(totalSamples_ / period - count(plan.tier)) * period;
+    long newest = (long)(totalSamples_ / period) * period;      // End of the last closed entry
+    if (from < oldest) { from = oldest; }
+    if (to > newest) { to = newest; }
+    // Points fall on multiples of step so repeated requests line up
+    plan.step = (res + period - 1) / period * period;
+    from = (from + plan.step - 1) / plan.step * plan.step;
+    plan.start = from;
+    if (to <= from) { return plan; }
+
+    uint32_t range = to - from;
+    if (range / plan.step > MAX_STREAM_POINTS) {
+        plan.step = (range / MAX_STREAM_POINTS + period) / period * period;
+    }
+    plan.count = range / plan.step;
+    return plan;
+}
+
+uint32_t EnergyHistory::now() const {
+    uint32_t samples;
+    uint32_t sequence;
+    do {
+        sequence = sequence_.beginRead();
+        samples = totalSamples_;
+    } while (sequence_.retry(sequence));
+    return samples;
+}
+
+uint32_t EnergyHistory::stream(hal::HttpServer& server, Format format, uint8_t channels, long from, long to, uint32_t res, uint32_t epochAtZero) const {
+    // Each point is worked out between reads of the sequence and redone if a
+    // record() overlapped it, record() never waits on a client taking its time.
+    // Points are addressed by history time, so samples recorded in between don't shift them.
+    StreamPlan plan;
+    uint32_t sequence;
+    do {
+        sequence = sequence_.beginRead();
+        plan = planStream(from, to, res);
+    } while (sequence_.retry(sequence));
+
+    uint32_t period = periodSeconds(plan.tier);
+    char chunk[512];
+    size_t used = 0;
+
+    uint8_t selected[CHANNEL_COUNT];
+    uint8_t selectedCount = 0;
+    for (uint8_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+        if (channels & (1 << channel)) { selected[selectedCount++] = channel; }
+    }
+
+    server.beginChunked(200, format == CSV ? "text/csv" : "application/octet-stream");
+
+    if (format == CSV) {
+        used += snprintf(chunk, sizeof(chunk), "time,epoch");
+        for (uint8_t i = 0; i < selectedCount; i++) {
+            used += snprintf(chunk + used, sizeof(chunk) - used, ",%s", channelName((Channel)selected[i]));
+        }
+        chunk[used++] = '\n';
+    } else {
+        // "PH", version, channel count, then start, step, count and epochAtZero as little endian uint32
+        const uint32_t fields[] = { plan.start, plan.step, plan.count, epochAtZero };
+        chunk[used++] = 'P';
+        chunk[used++] = 'H';
+        chunk[used++] = 1;
+        chunk[used++] = selectedCount;
+        for (uint32_t field : fields) {
+            for (uint8_t byte = 0; byte < 4; byte++) { chunk[used++] = (field >> (8 * byte)) & 0xFF; }
+        }
+        memcpy(chunk + used, selected, selectedCount);
+        used += selectedCount;
+    }
+
+    int32_t previous[CHANNEL_COUNT] = {};
+    for (uint32_t point = 0; point < plan.count; point++) {
+        uint32_t time = plan.start + point * plan.step;
+
+        // Average the tier entries under this point, nothing is buffered beyond the running sums
+        int32_t sums[CHANNEL_COUNT];
+        uint32_t entries;
+        uint8_t state;
+        do {
+            sequence = sequence_.beginRead();
+            memset(sums, 0, sizeof(sums));
+            entries = 0;
+            state = 0;
+
+            Rollup entry;
+            for (uint32_t t = time; t < time + plan.step; t += period) {
+                if (!getAt(plan.tier, t, entry)) { continue; }
+
+                sums[INPUT_TEMP] += entry.inputTemp;
+                sums[OUTPUT_TEMP] += entry.outputTemp;
+                sums[FLOW_RATE] += entry.flowRate;
+                sums[ENERGY_CAPTURE] += entry.energyCapture;
+                sums[PUMP_SECONDS] += entry.pumpSeconds;
+                state = entry.state;
+                entries++;
+            }
+        } while (sequence_.retry(sequence));
+
+        if (sizeof(chunk) - used < 24u + selectedCount * 16u) {
+            server.sendChunk(chunk, used);
+            used = 0;
+        }
+
+        if (format == CSV) {
+            used += snprintf(chunk + used, sizeof(chunk) - used, "%lu,", (unsigned long)time);
+            if (epochAtZero != 0) {
+                used += snprintf(chunk + used, sizeof(chunk) - used, "%lu", (unsigned long)(epochAtZero + time));
+            }
+        }
+
+        for (uint8_t i = 0; i < selectedCount; i++) {
+            Channel channel = (Channel)selected[i];
+            int32_t value = channelValue(channel, sums, entries, state);
+
+            if (format == BINARY) {
+                used += writeVarint(chunk + used, value - previous[channel]);
+                previous[channel] = value;
+            } else if (channel == INPUT_TEMP || channel == OUTPUT_TEMP || channel == FLOW_RATE) {
+                used += snprintf(chunk + used, sizeof(chunk) - used, ",%.2f", value / 100.0);
+            } else {
+                used += snprintf(chunk + used, sizeof(chunk) - used, ",%ld", (long)value);
+            }
+        }
+
+        if (format == CSV) { chunk[used++] = '\n'; }
+    }
+
+    server.sendChunk(chunk, used);
+    server.endChunked();
+    return plan.count;
+}
+
+int32_t EnergyHistory::channelValue(Channel channel, const int32_t* sums, uint32_t entries, uint8_t state) {
+    if (channel == STATE) { return state; }
+    if (channel == PUMP_SECONDS || entries == 0) { return sums[channel]; }
+
+    int32_t sum = sums[channel];
+    int32_t half = (int32_t)entries / 2;
+    return (sum + (sum < 0 ? -half : half)) / (int32_t)entries;
+}
+
+size_t EnergyHistory::writeVarint(char* output, int32_t value) {
+    // Zigzag so small negative deltas stay small, then 7 bits per byte, low bits first
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t length = 0;
+
+    while (zigzag >= 0x80) {
+        output[length++] = (char)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    output[length++] = (char)zigzag;
+    return length;
+}
+
+const EnergyHistory::Rollup& EnergyHistory::at(const Rollup* ring, size_t head, size_t capacity, size_t age) const {
+    return ring[(head + capacity - 1 - age) % capacity];
+}
+
+EnergyHistory::Rollup EnergyHistory::finish(const Accumulator& acc, uint8_t state) {
+    Rollup entry;
+    int32_t seconds = acc.seconds > 0 ? acc.seconds : 1;
+
+    // Rounded averages
+    entry.inputTemp = (acc.inputTemp + (acc.inputTemp < 0 ? -seconds : seconds) / 2) / seconds;
+    entry.outputTemp = (acc.outputTemp + (acc.outputTemp < 0 ? -seconds : seconds) / 2) / seconds;
+    entry.flowRate = (acc.flowRate + seconds / 2) / seconds;
+    entry.energyCapture = (acc.energyCapture + (acc.energyCapture < 0 ? -seconds : seconds) / 2) / seconds;
+    entry.pumpSeconds = acc.pumpSeconds;
+    entry.state = state;
+    entry.samples = acc.entries;
+    return entry;
+}
+
+int64_t EnergyHistory::joules(const Rollup& entry, unsigned long secondsPerEntry) {
+    // Same stored value going in and out of a window, so the running sums never drift
+    return (int64_t)entry.energyCapture * entry.samples * secondsPerEntry;
+}
+
+int32_t EnergyHistory::toFixed(float value, float scale, int32_t low, int32_t high) {
+    float scaled = value * scale;
+    if (!(scaled > low)) { return low; }        // Also catches NaN
+    if (scaled >= high) { return high; }
+    return (int32_t)lroundf(scaled);
+}
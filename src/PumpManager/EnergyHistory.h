@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef EnergyHistory_h
+#define EnergyHistory_h
+
+#include <Arduino.h>
+#include "hal/HAL.h"
+#include "util/config.h"
+#include "util/Seqlock/Seqlock.h"
+
+// Tiered time series of the pump channels: 1 s samples, 1 min rollups and
+// 1 h rollups, each a preallocated ring. record() is O(1), the open minute and
+// hour are accumulated as samples arrive and the energy window totals are
+// running sums, so nothing is ever rescanned.
+//
+// record() runs on the control task and never waits. stream() and now() run
+// on the web task and reread anything a record() overlapped, see
+// SequenceCounter. The other readers belong to the control task.
+class EnergyHistory {
+public:
+    enum Tier { SECONDS, MINUTES, HOURS };
+    enum Window { LAST_24H, LAST_72H, LAST_WEEK };
+    enum Channel : uint8_t { INPUT_TEMP, OUTPUT_TEMP, FLOW_RATE, ENERGY_CAPTURE, PUMP_SECONDS, STATE, CHANNEL_COUNT };
+    enum Format { BINARY, CSV };
+
+    static const uint8_t ALL_CHANNELS = (1 << CHANNEL_COUNT) - 1;
+    static const uint32_t MAX_STREAM_POINTS = 20000;        // Coarser res is forced past this
+
+    // One entry of any tier, averages over its period. Fixed point so a
+    // minute of history is 12 bytes.
+    struct Rollup {
+        int16_t inputTemp;                      // 1/100 C
+        int16_t outputTemp;                     // 1/100 C
+        uint16_t flowRate;                      // 1/100 L/min
+        int16_t energyCapture;                  // W
+        uint16_t pumpSeconds;                   // Seconds the pump ran during the period
+        uint8_t state;                          // PumpManager state at the end of the period
+        uint8_t samples;                        // Entries of the tier below that went into this one
+    };
+
+    EnergyHistory();
+
+    void record(float inputTemp, float outputTemp, float flowRate, float energyCapture, uint8_t state, bool pumpOn);
+
+    size_t count(Tier tier) const;
+    bool get(Tier tier, size_t age, Rollup& entry) const;   // age 0 is the newest, false past the oldest
+    uint32_t getSampleCount() const { return totalSamples_; }
+    float getEnergyKWh(Window window) const;
+
+    static unsigned long periodSeconds(Tier tier);
+    static const char* channelName(Channel channel);
+    static uint8_t parseChannels(const char* list);         // Comma separated names to a mask, 0 if any is unknown
+
+    // History time is seconds of sampling since boot, sample n covers [n, n + 1)
+    uint32_t now() const;
+
+    // Streams [from, to) at res seconds per point as a chunked response. from
+    // and to are history time, negative counts back from now(). The finest tier
+    // that reaches back to from is used and averaged down to res on the fly.
+    // Returns the number of points sent.
+    uint32_t stream(hal::HttpServer& server, Format format, uint8_t channels, long from, long to, uint32_t res, uint32_t epochAtZero) const;
+
+private:
+    struct Sample {
+        int16_t inputTemp;
+        int16_t outputTemp;
+        uint16_t flowRate;
+        int16_t energyCapture;
+    };
+
+    struct Accumulator {                        // Sums of the raw 1 s samples
+        int32_t inputTemp;
+        int32_t outputTemp;
+        uint32_t flowRate;
+        int32_t energyCapture;
+        uint16_t pumpSeconds;
+        uint16_t seconds;
+        uint8_t entries;                        // Entries of the tier below
+    };
+
+    static const uint8_t STATE_MASK = 0x7F;
+    static const uint8_t PUMP_ON_FLAG = 0x80;  // Kept in the seconds tier state byte
+    static const size_t MINUTES_PER_DAY = 60 * 24;
+    static const size_t HOURS_PER_3_DAYS = 24 * 3;
+    static const size_t HOURS_PER_WEEK = 24 * 7;
+    static_assert(HISTORY_MINUTES >= MINUTES_PER_DAY, "HISTORY_MINUTES must cover the 24h window");
+    static_assert(HISTORY_HOURS >= HOURS_PER_WEEK, "HISTORY_HOURS must cover the 72h and week windows");
+
+    // Seconds tier is split so the state byte doesn't pad every sample to 10 bytes,
+    // its top bit says whether the pump was on
+    Sample seconds_[HISTORY_SECONDS];
+    uint8_t secondStates_[HISTORY_SECONDS];
+    Rollup minutes_[HISTORY_MINUTES];
+    Rollup hours_[HISTORY_HOURS];
+
+    size_t secondHead_;                         // Slot the next entry goes into
+    size_t minuteHead_;
+    size_t hourHead_;
+    size_t secondCount_;
+    size_t minuteCount_;
+    size_t hourCount_;
+    uint32_t totalSamples_;
+    SequenceCounter sequence_;                  // Bumped around record() for the web task readers
+
+    Accumulator minuteAcc_;                     // Open minute
+    Accumulator hourAcc_;                       // Open hour, entries counts its closed minutes
+
+    int64_t energy24h_;                         // Running sums, joules. Over closed minutes
+    int64_t energy72h_;                         // Over closed hours, like the week
+    int64_t energyWeek_;
+
+    struct StreamPlan {
+        Tier tier;
+        uint32_t start;                         // History time of the first point
+        uint32_t step;                          // Seconds per point, a multiple of the tier period
+        uint32_t count;                         // Points
+    };
+
+    StreamPlan planStream(long from, long to, uint32_t res) const;
+    bool getAt(Tier tier, uint32_t time, Rollup& entry) const;     // Entry starting at time, aligned to the tier period
+    static int32_t channelValue(Channel channel, const int32_t* sums, uint32_t entries, uint8_t state);
+    static size_t writeVarint(char* output, int32_t value);
+
+    void closeMinute(uint8_t state);
+    void closeHour(uint8_t state);
+    const Rollup& at(const Rollup* ring, size_t head, size_t capacity, size_t age) const;
+    static Rollup finish(const Accumulator& acc, uint8_t state);
+    static int64_t joules(const Rollup& entry, unsigned long secondsPerEntry);
+    static int32_t toFixed(float value, float scale, int32_t low, int32_t high);
+};
+
+#endif // EnergyHistory_h
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "PumpManager/EnergyMeter.h"
+
+EnergyMeter::EnergyMeter()
+    : lastMicros_(0),
+    heatMilliWatts_(0),
+    pumpMilliWatts_(0),
+    pumpOn_(false),
+    heatNanoJoules_(0),
+    pumpNanoJoules_(0),
+    journalMilliJoules_(0),
+    day_(0),
+    totals_() {}
+
+void EnergyMeter::begin(unsigned long nowMicros) {
+    lastMicros_ = nowMicros;
+}
+
+void EnergyMeter::update(float flowRate, float tempDelta, bool pumpOn, unsigned long nowMicros) {
+    int32_t heatMilliWatts = (int32_t)lroundf(flowRate / 60 * WATER_HEAT_CAPACITY * tempDelta * 1000);
+    int32_t pumpMilliWatts = pumpOn ? (int32_t)(PUMP_POWER_WATTS * 1000) : 0;
+    unsigned long elapsed = nowMicros - lastMicros_;
+    lastMicros_ = nowMicros;
+
+    if (pumpOn && !pumpOn_) {
+        totals_[CYCLE] = {};                    // New run, the last one's figures are done with
+    }
+    pumpOn_ = pumpOn;
+
+    // Trapezoid between the last window's power and this one's, in mW x us (nJ)
+    heatNanoJoules_ += ((int64_t)heatMilliWatts_ + heatMilliWatts) * (int64_t)elapsed / 2;
+    pumpNanoJoules_ += ((int64_t)pumpMilliWatts_ + pumpMilliWatts) * (int64_t)elapsed / 2;
+    heatMilliWatts_ = heatMilliWatts;
+    pumpMilliWatts_ = pumpMilliWatts;
+
+    // Whole millijoules only, the rest waits so rounding never accumulates
+    int64_t heatMilliJoules = heatNanoJoules_ / 1000000;
+    int64_t pumpMilliJoules = pumpNanoJoules_ / 1000000;
+    heatNanoJoules_ -= heatMilliJoules * 1000000;
+    pumpNanoJoules_ -= pumpMilliJoules * 1000000;
+    add(heatMilliJoules, pumpMilliJoules);
+}
+
+void EnergyMeter::add(int64_t heatMilliJoules, int64_t pumpMilliJoules) {
+    for (Totals& totals : totals_) {
+        totals.heatMilliJoules += heatMilliJoules;
+        totals.pumpMilliJoules += pumpMilliJoules;
+    }
+    journalMilliJoules_ += heatMilliJoules;
+}
+
+void EnergyMeter::setDay(uint32_t day) {
+    // The first day seen once the time is known carries on what was counted since boot
+    if (day != day_ && day_ != 0) {
+        totals_[TODAY] = {};
+    }
+    day_ = day;
+}
+
+int32_t EnergyMeter::takeHeatJoules() {
+    int32_t joules = (int32_t)(journalMilliJoules_ / 1000);
+    journalMilliJoules_ -= (int64_t)joules * 1000;
+    return joules;
+}
+
+void EnergyMeter::restore(const Totals& cycle, const Totals& today, uint32_t day) {
+    totals_[CYCLE] = cycle;
+    totals_[TODAY] = today;
+    day_ = day;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef EnergyMeter_h
+#define EnergyMeter_h
+
+#include <Arduino.h>
+#include "util/config.h"
+
+// Heat captured and pump electrical energy, integrated on every flow window.
+//
+// Each window's heat power (flow x rise x the heat capacity of water) and
+// pump power are averaged with the previous window's (trapezoidal rule) and
+// multiplied by the window's length. Power is held in integer milliwatts and
+// energy in integer millijoules, the sub-millijoule part carried over, so
+// nothing drifts however long the totals run. Lifetime totals are kept by the
+// journal, this holds the current pump cycle and the current day.
+class EnergyMeter {
+public:
+    struct Totals {
+        int64_t heatMilliJoules;                // Into the water, negative when the panels lose heat
+        int64_t pumpMilliJoules;                // Pump electrical
+
+        float netKWh() const { return (heatMilliJoules - pumpMilliJoules) / 3.6e9f; }
+        float cop() const { return pumpMilliJoules > 0 ? (float)heatMilliJoules / pumpMilliJoules : 0; }   // 0 until the pump has run
+    };
+
+    enum Period : uint8_t {
+        CYCLE,                                  // Current pump run, or the last one while it's off
+        TODAY,                                  // Since midnight, since boot until NTP has synced
+        PERIOD_COUNT
+    };
+
+    static constexpr float WATER_HEAT_CAPACITY = 4180;      // J per litre per degree
+
+    EnergyMeter();
+
+    void begin(unsigned long nowMicros);        // Start of the first window
+    void update(float flowRate, float tempDelta, bool pumpOn, unsigned long nowMicros);    // L/min, degrees
+    void setDay(uint32_t day);                  // Days since the epoch, 0 while the time is unknown
+
+    const Totals& get(Period period) const { return totals_[period]; }
+    uint32_t getDay() const { return day_; }
+    int32_t getHeatWatts() const { return heatMilliWatts_ / 1000; }
+    int32_t takeHeatJoules();                   // Heat since the last call, for the totals journal
+
+    void restore(const Totals& cycle, const Totals& today, uint32_t day);      // After a restart that kept them
+
+private:
+    unsigned long lastMicros_;
+    int32_t heatMilliWatts_;                    // At the end of the last window
+    int32_t pumpMilliWatts_;
+    bool pumpOn_;
+    int64_t heatNanoJoules_;                    // Below a whole millijoule, carried to the next window
+    int64_t pumpNanoJoules_;
+    int64_t journalMilliJoules_;                // Not yet taken as whole joules
+    uint32_t day_;
+    Totals totals_[PERIOD_COUNT];
+
+    void add(int64_t heatMilliJoules, int64_t pumpMilliJoules);
+};
+
+#endif // EnergyMeter_h
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "PumpManager/FlowMeter.h"
+
+FlowMeter::FlowMeter(float calibrationFactor)
+    : calibrationFactor_(calibrationFactor),
+    haveEdge_(false),
+    lastEdgeMicros_(0),
+    lastUpdateMicros_(0),
+    frequency_(0),
+    instantRate_(0),
+    rate_(0),
+    samples_(),
+    sampleHead_(0),
+    sampleCount_(0),
+    sampleSum_(0),
+    pendingPulses_(0),
+    volumeRemainder_(0) {}
+
+void FlowMeter::begin(unsigned long nowMicros) {
+    reset();
+    lastUpdateMicros_ = nowMicros;
+}
+
+void FlowMeter::reset() {
+    haveEdge_ = false;
+    frequency_ = 0;
+    instantRate_ = 0;
+    rate_ = 0;
+    sampleHead_ = 0;
+    sampleCount_ = 0;
+    sampleSum_ = 0;
+}
+
+void FlowMeter::update(const hal::PulseReading& reading, unsigned long nowMicros) {
+    const unsigned long timeoutMicros = FLOW_TIMEOUT * 1000UL;
+
+    if (reading.count > 0) {
+        // Edge to edge covers exactly count periods, the first pulses after a
+        // stop only have the window to go on
+        unsigned long span = haveEdge_ ? reading.lastMicros - lastEdgeMicros_ : 0;
+        if (span == 0 || span > timeoutMicros) {
+            span = nowMicros - lastUpdateMicros_;
+        }
+        frequency_ = span > 0 ? reading.count * 1e6f / span : 0;
+
+        haveEdge_ = true;
+        lastEdgeMicros_ = reading.lastMicros;
+        pendingPulses_ += reading.count;
+    } else if (haveEdge_) {
+        unsigned long sinceEdge = nowMicros - lastEdgeMicros_;
+        if (sinceEdge > timeoutMicros) {
+            reset();
+        } else if (sinceEdge > 0 && 1e6f / sinceEdge < frequency_) {
+            frequency_ = 1e6f / sinceEdge;      // The next pulse is at least this far off
+        }
+    }
+    lastUpdateMicros_ = nowMicros;
+
+    if (!haveEdge_) {
+        return;                                 // Stopped, reads zero straight away rather than decaying
+    }
+
+    instantRate_ = frequency_ / calibrationFactor_;
+    addSample(instantRate_);
+}
+
+void FlowMeter::addSample(float rate) {
+    if (sampleCount_ == FLOW_AVERAGE_SAMPLES) {
+        sampleSum_ -= samples_[sampleHead_];
+    } else {
+        sampleCount_++;
+    }
+    samples_[sampleHead_] = rate;
+    sampleSum_ += rate;
+    sampleHead_ = (sampleHead_ + 1) % FLOW_AVERAGE_SAMPLES;
+
+    rate_ = sampleSum_ / sampleCount_;
+    if (rate_ < 0) { rate_ = 0; }               // Float drift in the running sum
+}
+
+uint32_t FlowMeter::takeMilliLitres() {
+    // Pulses per litre is the calibration factor times 60
+    float milliLitres = pendingPulses_ * 1000.0f / (calibrationFactor_ * 60) + volumeRemainder_;
+    pendingPulses_ = 0;
+
+    uint32_t whole = (uint32_t)milliLitres;
+    volumeRemainder_ = milliLitres - whole;
+    return whole;
+}
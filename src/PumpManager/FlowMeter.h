@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef FlowMeter_h
+#define FlowMeter_h
+
+#include <Arduino.h>
+#include "hal/HAL.h"
+#include "util/config.h"
+
+// Flow rate from the sensor's pulse train.
+//
+// Rate comes from the time between pulse edges rather than pulses per window,
+// so one or two pulses a second still give a steady reading instead of
+// jumping between whole counts. A window with no pulses caps the rate at one
+// pulse since the last edge, and FLOW_TIMEOUT without any reads as stopped.
+// The rate is smoothed over the last FLOW_AVERAGE_SAMPLES updates, volume is
+// counted from whole pulses so averaging never loses water.
+class FlowMeter {
+public:
+    explicit FlowMeter(float calibrationFactor);    // Pulses per second per L/min
+
+    void begin(unsigned long nowMicros);        // Start of the first window
+    void update(const hal::PulseReading& reading, unsigned long nowMicros);
+    void reset();                               // Reads zero until the next pulse
+
+    float getRate() const { return rate_; }                     // L/min, averaged
+    float getInstantRate() const { return instantRate_; }       // L/min, this update only
+    uint32_t takeMilliLitres();                                 // Volume since the last call
+
+private:
+    static_assert(FLOW_AVERAGE_SAMPLES > 0, "FLOW_AVERAGE_SAMPLES must be at least 1");
+
+    float calibrationFactor_;
+    bool haveEdge_;                             // lastEdgeMicros_ is a real pulse within FLOW_TIMEOUT
+    unsigned long lastEdgeMicros_;
+    unsigned long lastUpdateMicros_;
+    float frequency_;                           // Hz between the last two edges seen
+    float instantRate_;
+    float rate_;
+
+    float samples_[FLOW_AVERAGE_SAMPLES];       // Instant rates, ring
+    uint8_t sampleHead_;
+    uint8_t sampleCount_;
+    float sampleSum_;
+
+    uint32_t pendingPulses_;                    // Counted but not yet taken as volume
+    float volumeRemainder_;                     // mL below a whole one carried to the next take
+
+    void addSample(float rate);
+};
+
+#endif // FlowMeter_h
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "PumpManager/PumpCircuit.h"
+#include "PumpManager/SensorRegistry.h"
+
+PumpCircuit::PumpCircuit()
+    : index_(0),
+    pins_(),
+    settings_(),
+    state_(INITIALIZING),
+    inputTemp_(0),
+    outputTemp_(0),
+    collectorTemp_(0),
+    lastPoolTempTime_(0),
+    lastPoolTemp_(0),
+    stabilityStartTime_(0),
+    energyCapture_(0),
+    lastEnergyInsufficient_(0),
+    lastHibernationTime_(0),
+    lastMaintenanceToggle_(0),
+    flow_(FLOW_CALIBRATION_FACTOR),
+    energy_(),
+    flowRate_(0),
+    flowMilliLitres_(0),
+    totalMilliLitres_(0) {}
+
+void PumpCircuit::begin(uint8_t index, const CircuitPins& pins) {
+    index_ = index;
+    pins_ = pins;
+
+    hal::gpio().setMode(pins_.pumpPin, hal::PinMode::Output);
+    hal::gpio().write(pins_.pumpPin, false); // Pump OFF initially
+    if (!hal::pulseInput().attach(pins_.flowPin)) {
+        log(ERROR, true, "No pulse input left for flow sensor pin %u", (unsigned)pins_.flowPin);
+    }
+}
+
+void PumpCircuit::start(unsigned long nowMicros) {
+    flow_.begin(nowMicros);
+    energy_.begin(nowMicros);
+}
+
+void PumpCircuit::control(unsigned long currentMillis) {
+
+    // Calculate energy capture value in watts
+    float tempDelta = outputTemp_ - inputTemp_;             // Delta/difference between input/output
+    float flowJoulesPerDegree = (flowRate_ / 60) * EnergyMeter::WATER_HEAT_CAPACITY;   // Joules per litre/sec
+    energyCapture_ = flowJoulesPerDegree * tempDelta;       // Multiply per degrees of temps delta
+
+    switch (state_) {
+
+        case INITIALIZING:
+            stabilityStartTime_ = currentMillis;
+            lastHibernationTime_ = currentMillis;
+            lastMaintenanceToggle_ = currentMillis - MAINTENANCE_PERIOD;
+            lastEnergyInsufficient_ = currentMillis - settings_.hibernationTriggerDelay;
+
+            setPump(true); // Turn the pump on to cycle the system
+            log(INFO, true, "Pump controller initialized, sensors stabilizing");
+            state_ = SENSORS_STABILIZING;
+            break;
+
+
+        case SENSORS_STABILIZING:
+            lastPoolTempTime_ = currentMillis - (1000 * 3600);    // For now just hold the timer at an hour old
+
+            if (currentMillis - stabilityStartTime_ > settings_.sensorStabilityDelay) {
+                log(INFO, true, "Sensors stabilized");
+                state_ = ACTIVE;
+            }
+            break; // Do nothing, keep waiting for sensor values to be considered stable
+
+
+        case ACTIVE:
+            // Update the last known pool temp
+            lastPoolTemp_ = inputTemp_;
+            lastPoolTempTime_ = currentMillis;
+
+            // Temp target check
+            if (inputTemp_ > settings_.targetTemp) {
+                state_ = HIBERNATING;
+                log(INFO, true, "Input temp > target temp, hibernating");
+                setPump(false);
+                lastHibernationTime_ = currentMillis;
+            }
+            // Energy delta check
+            else if (energyCapture_ < settings_.energyCaptureThreshold && (currentMillis - lastEnergyInsufficient_) > settings_.hibernationTriggerDelay) {
+                state_ = HIBERNATING;
+                log(INFO, true, "Energy delta insufficient > trigger period, hibernating");
+                setPump(false);
+                lastHibernationTime_ = currentMillis;
+            }
+            else { // Reset the hibernation trigger if the delta goes positive again
+                lastEnergyInsufficient_ = currentMillis - settings_.hibernationTriggerDelay;
+            }
+            break;
+
+
+        case HIBERNATING:
+            // Check if hibernation timer is up and kick back to sensors stabilizing if so
+            if (currentMillis - lastHibernationTime_ > settings_.hibernationPeriod) {
+                stabilityStartTime_ = currentMillis;
+                setPump(true);
+                state_ = SENSORS_STABILIZING;
+                log(INFO, true, "Hibernation period reached, cycling system");
+            }
+            else {
+                // Sleepy time
+            }
+            break;
+
+
+        case MAINTENANCE:
+            // Check if maintenance timer has expired and go back to init if so
+            break;
+
+    }
+}
+
+void PumpCircuit::updateFlow(uint32_t energyDay) {
+    // The reading carries its latest edge time, so a late job doesn't skew the rate
+    hal::PulseReading reading = hal::pulseInput().take(pins_.flowPin);
+    unsigned long currentMicros = hal::clock().micros();
+    flow_.update(reading, currentMicros);
+    flowRate_ = flow_.getRate();
+
+    // Same window for the energy, flow and rise are both as of now
+    energy_.setDay(energyDay);
+    energy_.update(flowRate_, outputTemp_ - inputTemp_, pumpRunning(), currentMicros);
+
+    // Volume from whole pulses rather than the smoothed rate
+    uint32_t milliLitres = flow_.takeMilliLitres();
+    flowMilliLitres_ += milliLitres;
+    totalMilliLitres_ += milliLitres;
+}
+
+uint32_t PumpCircuit::takeMilliLitres() {
+    uint32_t milliLitres = flowMilliLitres_;
+    flowMilliLitres_ = 0;
+    return milliLitres;
+}
+
+void PumpCircuit::save(SavedState& state, unsigned long currentMillis) const {
+    state.pumpState = state_;
+    state.hibernationElapsed = state_ == HIBERNATING ? currentMillis - lastHibernationTime_ : 0;
+    state.cycleEnergy = energy_.get(EnergyMeter::CYCLE);
+    state.todayEnergy = energy_.get(EnergyMeter::TODAY);
+}
+
+void PumpCircuit::restore(const SavedState& state, uint32_t energyDay, unsigned long currentMillis) {
+    energy_.restore(state.cycleEnergy, state.todayEnergy, energyDay);
+    if (state.pumpState != HIBERNATING) {
+        // Every other state starts over from INITIALIZING, which runs the pump as they did
+        log(INFO, false, "Restarted to clear the heap, cycling system");
+        return;
+    }
+
+    // Pick the hibernation up where it left off, with the pump still off
+    stabilityStartTime_ = currentMillis;
+    lastHibernationTime_ = currentMillis - state.hibernationElapsed;
+    lastMaintenanceToggle_ = currentMillis - MAINTENANCE_PERIOD;
+    lastEnergyInsufficient_ = currentMillis - settings_.hibernationTriggerDelay;
+    state_ = HIBERNATING;
+    log(INFO, false, "Restarted to clear the heap, resuming hibernation");
+}
+
+void PumpCircuit::fillTelemetry(Telemetry& telemetry) const {
+    telemetry.pumpState = state_;
+    telemetry.targetTemp = settings_.targetTemp;
+    telemetry.poolTemp = lastPoolTemp_;
+    telemetry.poolTempTime = lastPoolTempTime_;
+    telemetry.inputTemp = inputTemp_;
+    telemetry.outputTemp = outputTemp_;
+    telemetry.collectorTemp = collectorTemp_;
+    telemetry.flowRate = flowRate_;
+    telemetry.energyCapture = energyCapture_;
+    telemetry.cycleEnergy = energy_.get(EnergyMeter::CYCLE);
+    telemetry.todayEnergy = energy_.get(EnergyMeter::TODAY);
+}
+
+float* PumpCircuit::temperature(uint8_t role) {
+    switch (role) {
+        case ROLE_INPUT: return &inputTemp_;
+        case ROLE_OUTPUT: return &outputTemp_;
+        case ROLE_COLLECTOR: return &collectorTemp_;
+        default: return nullptr;
+    }
+}
+
+void PumpCircuit::setPump(bool on) {
+    hal::gpio().write(pins_.pumpPin, on);
+}
+
+void PumpCircuit::log(LogLevel level, bool notify, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (CIRCUIT_COUNT == 1) {
+        LogManager::getInstance().vlogf(level, notify, format, args);
+    } else {
+        char message[MAX_LOG_MESSAGE_LENGTH + 1];
+        int length = snprintf(message, sizeof(message), "Circuit %u: ", (unsigned)index_);
+        vsnprintf(message + length, sizeof(message) - length, format, args);
+        LogManager::getInstance().log(level, message, notify);
+    }
+    va_end(args);
+}
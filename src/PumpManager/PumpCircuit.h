@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef PumpCircuit_h
+#define PumpCircuit_h
+
+#include <Arduino.h>
+#include "hal/HAL.h"
+#include "util/config.h"
+#include "PumpManager/EnergyMeter.h"
+#include "PumpManager/FlowMeter.h"
+#include "PumpManager/Telemetry.h"
+#include "util/LogManager/LogManager.h"
+
+// Control thresholds, defaults come from config.h. Runtime adjustable so the
+// host simulator can compare parameter sets without rebuilding.
+struct PumpSettings {
+    float targetTemp = TARGET_TEMP;                                     // Stop heating once the pool reaches this
+    float energyCaptureThreshold = ENERGY_CAPTURE_THRESHOLD;            // Minimum watts before hibernating
+    unsigned long sensorStabilityDelay = SENSOR_STABILITY_DELAY;        // Pump run time before readings are trusted
+    unsigned long hibernationTriggerDelay = HIBERNATION_TRIGGER_DELAY;  // How long energy must stay low before hibernating
+    unsigned long hibernationPeriod = HIBERNATION_PERIOD;               // Time to hibernate between cycles
+};
+
+// Where one circuit's pump and flow sensor are wired, an entry of CIRCUIT_PINS
+struct CircuitPins {
+    uint8_t pumpPin;
+    uint8_t flowPin;
+};
+
+// One collector circuit: its pump, flow meter, energy meter and the state
+// machine that decides when the pump runs. PumpManager reads every probe on
+// the shared bus and writes this circuit's into temperature(), runs the
+// circuits' jobs from its one scheduler and publishes their telemetry.
+// Control task only.
+class PumpCircuit {
+public:
+    enum State : uint8_t { INITIALIZING, SENSORS_STABILIZING, ACTIVE, HIBERNATING, MAINTENANCE };
+
+    // Kept across a memory watchdog restart, in PumpManager's RestartState
+    struct SavedState {
+        uint8_t pumpState;
+        uint32_t hibernationElapsed;            // millis into the hibernation period
+        EnergyMeter::Totals cycleEnergy;
+        EnergyMeter::Totals todayEnergy;
+    };
+
+    PumpCircuit();
+
+    void begin(uint8_t index, const CircuitPins& pins);     // Pump off, flow input attached
+    void start(unsigned long nowMicros);        // Start of the first flow window, after restore()
+    void control(unsigned long currentMillis);  // One control decision, every PUMP_UPDATE_INTERVAL
+    void updateFlow(uint32_t energyDay);         // Every flow window, energyDay as for EnergyMeter::setDay()
+
+    void save(SavedState& state, unsigned long currentMillis) const;
+    void restore(const SavedState& state, uint32_t energyDay, unsigned long currentMillis);
+    void fillTelemetry(Telemetry& telemetry) const;     // The circuit's own fields, the rest is the device's
+
+    void setSettings(const PumpSettings& settings) { settings_ = settings; }
+    const PumpSettings& getSettings() const { return settings_; }
+    uint8_t getIndex() const { return index_; }
+    const CircuitPins& getPins() const { return pins_; }
+    State getState() const { return state_; }
+    bool pumpRunning() const { return state_ == SENSORS_STABILIZING || state_ == ACTIVE; }
+
+    float* temperature(uint8_t role);           // Where readings for a SensorRole go, nullptr for the device's roles
+    float getInputTemp() const { return inputTemp_; }
+    float getOutputTemp() const { return outputTemp_; }
+    float getFlowRate() const { return flowRate_; }
+    float getEnergyCapture() const { return energyCapture_; }
+    uint32_t getEnergyDay() const { return energy_.getDay(); }
+    uint32_t takeMilliLitres();                 // Since the last call, for the totals journal
+    int32_t takeHeatJoules() { return energy_.takeHeatJoules(); }
+
+private:
+    uint8_t index_;
+    CircuitPins pins_;
+    PumpSettings settings_;
+    State state_;
+
+    float inputTemp_;
+    float outputTemp_;
+    float collectorTemp_;
+    unsigned long lastPoolTempTime_;
+    float lastPoolTemp_;
+
+    unsigned long stabilityStartTime_;          // millis to track how long waiting for stability
+    float energyCapture_;                       // The current energy being captured, in watts
+    unsigned long lastEnergyInsufficient_;      // millis of the last time the delta was too low
+    unsigned long lastHibernationTime_;         // millis to track time in hibernation
+    unsigned long lastMaintenanceToggle_;       // millis to track when it has been far enough from maintenance toggle to operate
+
+    FlowMeter flow_;
+    EnergyMeter energy_;                        // Integrated on each flow window
+    float flowRate_;
+    uint32_t flowMilliLitres_;                  // Not yet taken for the journal
+    unsigned long totalMilliLitres_;
+
+    void setPump(bool on);
+    void log(LogLevel level, bool notify, const char* format, ...) __attribute__((format(printf, 4, 5)));   // Says which circuit once there is more than one
+};
+
+#endif // PumpCircuit_h
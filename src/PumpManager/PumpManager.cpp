@@ -20,354 +20,1095 @@
 #include "PumpManager/PumpManager.h"
 
 PumpManager::PumpManager() 
-    : oneWire_(ONE_WIRE_BUS_PIN), 
-        sensors_(&oneWire_), 
-        server_(80),
-        httpUpdater_(),
-        inputTempAddr_({ 0x28, 0x37, 0xB0, 0x57, 0x04, 0xE1, 0x3C, 0x55 }),
-        outputTempAddr_({ 0x28, 0x43, 0xE7, 0x57, 0x04, 0xE1, 0x3C, 0xD5 }),
-        enclosureTempAddr_({ 0x28, 0xAF, 0x1A, 0x57, 0x04, 0xE1, 0x3C, 0xCB }),
-        lastTempPoll_(0),
-        lastPoolTempTime_(0),
-        lastPoolTemp_(0),
-        inputTemp_(0),
-        outputTemp_(0),
+    : tempBus_(hal::tempBus()),
+        server_(hal::httpServer()),
+        circuits_(),
+        lowPower_(false),
+        sensors_(hal::tempBus(), hal::settings()),
+        tempProbes_(),
+        tempStats_(),
+        sensorList_(),
+        tempProbeIndex_(0),
+        conversionTime_(750),
         enclosureTemp_(0),
-        lastPumpUpdate_(0),
-        stabilityStartTime_(0),
-        energyCapture_(0),
-        lastEnergyInsufficient_(0),
-        lastHibernationTime_(0),
-        lastMaintenanceToggle_(0),
-        flowRate_(0),
-        currentFlowMillis_(0),
-        previousFlowMillis_(0),
-        flowInterval_(1000),
-        calibrationFactor_(7.319),
-        pulse1Sec_(0),
-        flowMilliLitres_(0),
-        totalMilliLitres_(0) {}
-
-volatile byte PumpManager::pulseCount = 0;
-
-
-String PumpManager::calculatePoolLastTime() {
-    unsigned long currentTime = millis();
-    unsigned long elapsedTime = currentTime - lastPoolTempTime_;
-
-    unsigned long minutes = (elapsedTime / 1000) / 60;
-
-    // Format counter string
-    return String(minutes) + " mins ago";
+        ambientTemp_(0),
+        webTaskRunning_(false),
+        scheduler_(hal::clock()),
+        tempPollJob_([this](){ startTempConversion(); }),
+        tempReadJob_([this](){ readNextTempProbe(); }),
+        flowJob_([this](){ updateFlow(); }),
+        pumpJob_([this](){ Profiler::Scope scope(ProfileSection::PumpControl); pumpControlUpdater(); publishTelemetry(hal::clock().millis()); }),
+        historyJob_([this](){ Profiler::Scope scope(ProfileSection::History); recordHistory(); }),
+        journalJob_([this](){ Profiler::Scope scope(ProfileSection::JournalFlush); journal_.flush(); }),
+        history_(),
+        lastHistorySample_(0),
+        journal_(hal::journalFlash()),
+        publishing_(),
+        published_(),
+        telemetryHash_(),
+        controlTiming_(),
+        timing_(),
+        powerStats_(),
+        power_(),
+        dataBuffer_(),
+        stream_(),
+        streamedCount_(0),
+        sensorCommand_(),
+        sensorCommandPending_(false),
+        flowInterval_(1000) {
+
+    // Each circuit's probes read into the circuit, the device's into here
+    for (size_t i = 0; i < TEMP_PROBE_COUNT; i++) {
+        TempProbe& probe = tempProbes_[i];
+        probe.role = i % SENSOR_ROLE_COUNT;
+        probe.circuit = i / SENSOR_ROLE_COUNT;
+        probe.address = nullptr;
+        probe.surface = probe.role == ROLE_COLLECTOR || probe.role == ROLE_AMBIENT;
+        probe.reading = circuits_[probe.circuit].temperature(probe.role);
+        if (probe.role == ROLE_ENCLOSURE) { probe.reading = &enclosureTemp_; }
+        if (probe.role == ROLE_AMBIENT) { probe.reading = &ambientTemp_; }
+    }
 }
 
-String PumpManager::pumpStateToString(State pumpState) {
+const char* PumpManager::pumpStateToString(uint8_t pumpState) {
     switch (pumpState) {
-        case INITIALIZING: return "Initializing";
-        case SENSORS_STABILIZING: return "Sensors stabilizing";
-        case ACTIVE: return "Active";
-        case HIBERNATING: return "Hibernating";
-        case MAINTENANCE: return "MAINTENANCE";
+        case PumpCircuit::INITIALIZING: return "Initializing";
+        case PumpCircuit::SENSORS_STABILIZING: return "Sensors stabilizing";
+        case PumpCircuit::ACTIVE: return "Active";
+        case PumpCircuit::HIBERNATING: return "Hibernating";
+        case PumpCircuit::MAINTENANCE: return "MAINTENANCE";
         default: return "UNKNOWN STATE";
     }
 }
 
 void PumpManager::pumpControlUpdater() {
 
-    unsigned long currentMillis = millis();
+    unsigned long currentMillis = hal::clock().millis();
 
-    // Calculate energy capture value in watts
-    float tempDelta = outputTemp_ - inputTemp_;             // Delta/difference between input/output
-    float flowJoulesPerDegree = (flowRate_ / 60) * 4180;    // Joules per litre/sec
-    energyCapture_ = flowJoulesPerDegree * tempDelta;       // Multiply per degrees of temps delta
-
-    // TODO: Maintain a total energy captured last 24hrs, 72hrs, and week.
-
-    switch (pumpState) {
-
-        case INITIALIZING:
-            stabilityStartTime_ = currentMillis;
-            lastHibernationTime_ = currentMillis;
-            lastMaintenanceToggle_ = currentMillis - MAINTENANCE_PERIOD;
-            lastEnergyInsufficient_ = currentMillis - HIBERNATION_TRIGGER_DELAY;
+    // Between decisions, so the state kept across the restart is a settled one
+    if (MemoryMonitor::getInstance().restartRequested()) {
+        restartPreservingState();
+    }
 
-            digitalWrite(PUMP_CONTROL_PIN, HIGH); // Turn the pump on to cycle the system
-            LogManager::getInstance().log(INFO, "Pump controller initialized, sensors stabilizing");
-            pumpState = SENSORS_STABILIZING;
-            break;
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        circuits_[i].control(currentMillis);
+    }
+    updateLowPower();
+}
 
+void PumpManager::updateLowPower() {
+    bool hibernating = true;
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        hibernating = hibernating && circuits_[i].getState() == PumpCircuit::HIBERNATING;
+    }
 
-        case SENSORS_STABILIZING:
-            lastPoolTempTime_ = currentMillis - (1000 * 3600);    // For now just hold the timer at an hour old
+    if (hibernating != lowPower_) {
+        lowPower_ = hibernating;
+        setLowPower(hibernating);
+    }
+}
 
-            if (currentMillis - stabilityStartTime_ > SENSOR_STABILITY_DELAY) {
-                LogManager::getInstance().log(INFO, "Sensors stabilized");
-                pumpState = ACTIVE;
-            }
-            break; // Do nothing, keep waiting for sensor values to be considered stable
+void PumpManager::setLowPower(bool enabled) {
+    if (!LOW_POWER_HIBERNATION) { return; }
 
+    // Pulses keep waking the CPU so a flow that starts mid hibernation is still counted
+    hal::pulseInput().setWakeOnPulse(enabled);
+    bool lightSleep = hal::power().setLowPower(enabled);
+    if (!enabled) { return; }
 
-        case ACTIVE:
-            // Update the last known pool temp
-            lastPoolTemp_ = inputTemp_;
-            lastPoolTempTime_ = currentMillis;
+    powerStats_.lowPowerEntries++;
+    powerStats_.lightSleep = lightSleep;
+    if (!lightSleep && powerStats_.lowPowerEntries == 1) {
+        LogManager::getInstance().log(INFO, "Light sleep unavailable, hibernating on a reduced clock only");
+    }
+}
 
-            // Temp target check
-            if (inputTemp_ > TARGET_TEMP) {
-                pumpState = HIBERNATING;
-                LogManager::getInstance().log(INFO, "Input temp > target temp, hibernating");
-                digitalWrite(PUMP_CONTROL_PIN, LOW);
-                lastHibernationTime_ = currentMillis;
-            }
-            // Energy delta check
-            else if (energyCapture_ < ENERGY_CAPTURE_THRESHOLD && (currentMillis - lastEnergyInsufficient_) > HIBERNATION_TRIGGER_DELAY) {
-                pumpState = HIBERNATING;
-                LogManager::getInstance().log(INFO, "Energy delta insufficient > trigger period, hibernating");
-                digitalWrite(PUMP_CONTROL_PIN, LOW);
-                lastHibernationTime_ = currentMillis;
-            }
-            else { // Reset the hibernation trigger if the delta goes positive again
-                lastEnergyInsufficient_ = currentMillis - HIBERNATION_TRIGGER_DELAY;
-            }
-            break;
+void PumpManager::restartPreservingState() {
+    unsigned long currentMillis = hal::clock().millis();
+    RestartState state = {};
+    state.version = RESTART_STATE_VERSION;
+    state.circuitCount = CIRCUIT_COUNT;
+    state.restarts = MemoryMonitor::getInstance().getRestartCount() + 1;
+    state.energyDay = circuits_[0].getEnergyDay();       // Every circuit's meter is set to the same day
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        circuits_[i].save(state.circuits[i], currentMillis);
+    }
 
+    journal_.flush();                           // Totals since the last append would be lost otherwise
+    hal::system().restart(&state, sizeof(state));
+}
 
-        case HIBERNATING:
-            // Check if hibernation timer is up and kick back to sensors stabilizing if so
-            if (currentMillis - lastHibernationTime_ > HIBERNATION_PERIOD) {
-                stabilityStartTime_ = currentMillis;
-                digitalWrite(PUMP_CONTROL_PIN, HIGH);
-                pumpState = SENSORS_STABILIZING;
-                LogManager::getInstance().log(INFO, "Hibernation period reached, cycling system");
-            }
-            else {
-                // Sleepy time
-            }
-            break;
+void PumpManager::restoreState() {
+    RestartState state;
+    if (hal::system().restoredState(&state, sizeof(state)) != sizeof(state) || state.version != RESTART_STATE_VERSION
+        || state.circuitCount != CIRCUIT_COUNT) { return; }
 
+    MemoryMonitor::getInstance().setRestartCount(state.restarts);
+    unsigned long currentMillis = hal::clock().millis();
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        circuits_[i].restore(state.circuits[i], state.energyDay, currentMillis);
+    }
+    updateLowPower();
+}
 
-        case MAINTENANCE:
-            // Check if maintenance timer has expired and go back to init if so
-            break;
+void PumpManager::recordHistory() {
+    // Fixed 1 s steps, a stalled tick catches up the samples it missed rather than skipping time
+    unsigned long currentMillis = hal::clock().millis();
+    while (currentMillis - lastHistorySample_ >= 1000) {
+        lastHistorySample_ += 1000;
+
+        // One history for the board, what every circuit moved and captured against circuit 0's temperatures
+        float flowRate = 0;
+        float energyCapture = 0;
+        uint32_t pumpsOn = 0;
+        for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+            flowRate += circuits_[i].getFlowRate();
+            energyCapture += circuits_[i].getEnergyCapture();
+            if (circuits_[i].pumpRunning()) { pumpsOn++; }
+        }
 
+        const PumpCircuit& first = circuits_[0];
+        history_.record(first.getInputTemp(), first.getOutputTemp(), flowRate, energyCapture, first.getState(), pumpsOn > 0);
+        journal_.add(0, 0, pumpsOn);            // Pump seconds of each pump, heat comes from the energy meters on each flow window
     }
 }
 
-String PumpManager::getUptime() {
-    unsigned long uptimeMillis = millis();
+uint32_t PumpManager::energyDay() const {
+    // Local days once NTP has given us something after 2020
+    unsigned long epoch = TimeManager::getInstance().getCurrentTimestamp();
+    return epoch > 1577836800UL ? epoch / 86400 : 0;
+}
 
+size_t PumpManager::formatUptime(char* output, size_t size, unsigned long uptimeMillis) {
     // Calculate days, hours, minutes, and seconds
     unsigned long seconds = uptimeMillis / 1000;
     unsigned long minutes = seconds / 60;
     unsigned long hours = minutes / 60;
     unsigned long days = hours / 24;
 
-    // Calculate remaining hours, minutes, and seconds
-    hours = hours % 24;
-    minutes = minutes % 60;
-    seconds = seconds % 60;
+    return snprintf(output, size, "%lud %luh %lum %lus", days, hours % 24, minutes % 60, seconds % 60);
+}
 
-    // Format the result as a string
-    String formattedUptime = String(days) + "d " + String(hours) + "h " + String(minutes) + "m " + String(seconds) + "s";
+size_t PumpManager::formatPower(char* output, size_t size, double powerInWatts) {
+    if (powerInWatts < 1000) {
+        return snprintf(output, size, "%.2f W", round(powerInWatts));
+    } else {
+        return snprintf(output, size, "%.2f kW", powerInWatts / 1000.0); // Round to two decimal places
+    }
+}
 
-    return formattedUptime;
+size_t PumpManager::formatCop(char* output, size_t size, float cop) {
+    if (cop == 0) { return snprintf(output, size, "-"); }      // Pump hasn't run
+    return snprintf(output, size, "%.1f", cop);
 }
 
-String PumpManager::formatPower(double powerInWatts) {
-    if (powerInWatts < 1000) {
-        return String(round(powerInWatts)) + " W";
+EnergyMeter::Totals PumpManager::lifetimeEnergy(const Telemetry& telemetry) {
+    // The journal keeps run time rather than pump energy, the draw is fixed
+    EnergyMeter::Totals totals;
+    totals.heatMilliJoules = telemetry.lifetimeJoules * 1000;
+    totals.pumpMilliJoules = (int64_t)telemetry.pumpSeconds * PUMP_POWER_WATTS * 1000;
+    return totals;
+}
+
+void PumpManager::startTempConversion() {
+    Profiler::Scope scope(ProfileSection::TempConversion);
+    // Broadcast convert to every sensor on the bus, then leave it alone for the datasheet conversion time
+    if (tempReadJob_.pending()) { return; }         // Last round still being read
+    applySensorCommand();
+    tempBus_.startConversion();
+    tempProbeIndex_ = nextTempProbe(0);
+    if (tempProbeIndex_ < TEMP_PROBE_COUNT) {
+        scheduler_.after(tempReadJob_, conversionTime_);
+    }
+}
+
+void PumpManager::readNextTempProbe() {
+    Profiler::Scope scope(ProfileSection::TempRead);
+    // One scratchpad per tick so each bus transaction stays short, the conversion was shared
+    readTempProbe(tempProbes_[tempProbeIndex_]);
+    publishTempStats();
+
+    tempProbeIndex_ = nextTempProbe(tempProbeIndex_ + 1);
+    if (tempProbeIndex_ < TEMP_PROBE_COUNT) {
+        scheduler_.after(tempReadJob_, 1);
     } else {
-        double powerInKW = powerInWatts / 1000.0;
-        return String(powerInKW, 2) + " kW"; // Round to two decimal places
+        publishSensorList();
     }
 }
 
-void PumpManager::pulseCounter() {
-    pulseCount++;
+uint8_t PumpManager::nextTempProbe(uint8_t from) const {
+    while (from < TEMP_PROBE_COUNT && tempProbes_[from].address == nullptr) { from++; }
+    return from;
 }
 
-void PumpManager::handleStyle() {
-    File file = SPIFFS.open("/style.css", "r");
-    if (!file) {
-        LogManager::getInstance().log(ERROR, "Failed to open files for web /style.css");
-        return;
+void PumpManager::applySensorCommand() {
+    if (!sensorCommandPending_.load(std::memory_order_acquire)) { return; }
+    SensorCommand command = sensorCommand_;
+    sensorCommandPending_.store(false, std::memory_order_release);     // The web task may queue the next one
+
+    if (command.rescan) {
+        size_t found = sensors_.discover();
+        LogManager::getInstance().logf(INFO, "Temp sensor search found %lu probe(s)", (unsigned long)found);
+    } else if (sensors_.assign(command.address, command.role, command.circuit)) {
+        char address[17];
+        char label[SensorRegistry::ROLE_LABEL_LENGTH];
+        SensorRegistry::formatAddress(address, sizeof(address), command.address);
+        LogManager::getInstance().logf(INFO, "Temp sensor %s assigned to %s", address,
+            SensorRegistry::roleLabel(label, sizeof(label), command.role, command.circuit));
     }
 
-    server_.streamFile(file, "text/css");
-    file.close();
+    refreshTempProbes();
+    publishSensorList();
 }
 
-void PumpManager::handleScript() {
-    File file = SPIFFS.open("/script.js", "r");
-    if (!file) {
-        LogManager::getInstance().log(ERROR, "Failed to open files for web /script.js");
-        return;
+bool PumpManager::tempProbeUsed(size_t probe) {
+    return probe < SENSOR_ROLE_COUNT || SensorRegistry::circuitRole(probe % SENSOR_ROLE_COUNT);
+}
+
+void PumpManager::refreshTempProbes() {
+    for (size_t i = 0; i < TEMP_PROBE_COUNT; i++) {
+        TempProbe& probe = tempProbes_[i];
+        if (!tempProbeUsed(i)) { continue; }
+
+        const uint8_t* address = sensors_.getAddress(probe.role, probe.circuit);
+        if (address == probe.address) { continue; }
+
+        // A different probe, nothing from the last one should carry into its readings
+        probe.address = address;
+        probe.consecutiveErrors = 0;
+        probe.consecutiveRejections = 0;
+        probe.resetFilter();
+        if (!address && probe.role <= ROLE_ENCLOSURE) {
+            char label[SensorRegistry::ROLE_LABEL_LENGTH];
+            LogManager::getInstance().logf(WARN, "No temp sensor has the %s role",
+                SensorRegistry::roleLabel(label, sizeof(label), probe.role, probe.circuit));
+        }
+    }
+}
+
+void PumpManager::publishSensorList() {
+    SensorList list;
+    list.count = sensors_.getCount();
+    for (uint8_t i = 0; i < list.count; i++) {
+        const SensorRegistry::Sensor& sensor = sensors_.getSensor(i);
+        SensorList::Entry& entry = list.sensors[i];
+        memcpy(entry.address, sensor.address, 8);
+        entry.role = sensor.role;
+        entry.circuit = sensor.circuit;
+        entry.present = sensor.present;
+
+        const TempProbe* probe = sensor.role < SENSOR_ROLE_COUNT ? &tempProbes_[sensor.circuit * SENSOR_ROLE_COUNT + sensor.role] : nullptr;
+        entry.read = probe && probe->address == sensor.address;
+        entry.temp = entry.read ? *probe->reading : 0;
+    }
+    sensorList_.write(list);
+}
+
+bool PumpManager::readTempProbe(TempProbe& probe) {
+    uint8_t scratchPad[9];
+    char label[SensorRegistry::ROLE_LABEL_LENGTH];
+    bool ok = true;
+
+    bool answered = tempBus_.readScratchpad(probe.address, scratchPad);
+    sensors_.setPresent(probe.role, probe.circuit, answered);
+
+    if (!answered) {
+        probe.readErrors++;             // No presence pulse
+        ok = false;
+    }
+    else if (hal::TempBus::crc8(scratchPad, 8) != scratchPad[8]) {
+        probe.crcErrors++;
+        ok = false;
+    }
+    else if ((scratchPad[0] | scratchPad[1] | scratchPad[4] | scratchPad[8]) == 0) {
+        probe.readErrors++;             // Bus held low reads as all zeros, which passes the CRC
+        ok = false;
+    }
+
+    if (!ok) {
+        if (++probe.consecutiveErrors == 1) {
+            LogManager::getInstance().logf(WARN, "Temp sensor read failed: %s (crc errors: %lu, read errors: %lu)",
+                SensorRegistry::roleLabel(label, sizeof(label), probe.role, probe.circuit),
+                (unsigned long)probe.crcErrors, (unsigned long)probe.readErrors);
+        }
+        return false;
     }
 
-    server_.streamFile(file, "application/javascript");
-    file.close();
+    if (probe.consecutiveErrors > 0) {
+        LogManager::getInstance().logf(INFO, "Temp sensor recovered: %s after %lu failed reads",
+            SensorRegistry::roleLabel(label, sizeof(label), probe.role, probe.circuit), (unsigned long)probe.consecutiveErrors);
+        probe.consecutiveErrors = 0;
+    }
+
+    // DS18B20 reports 1/16 C per LSB, little endian, two's complement
+    int32_t sample = (int16_t)((scratchPad[1] << 8) | scratchPad[0]);
+    float raw = sample / 16.0f;
+    if (!probe.applyFilter(sample)) {
+        // A few spikes in a row are the rate limit's business, more than that is a sensor worth hearing about
+        if (++probe.consecutiveRejections == TEMP_FILTER_RESYNC + 1) {
+            LogManager::getInstance().logf(WARN, "Temp sensor readings rejected: %s (%lu in a row, last %.2f C)",
+                SensorRegistry::roleLabel(label, sizeof(label), probe.role, probe.circuit),
+                (unsigned long)probe.consecutiveRejections, raw);
+        }
+        return false;
+    }
+
+    if (probe.consecutiveRejections > TEMP_FILTER_RESYNC) {
+        LogManager::getInstance().logf(INFO, "Temp sensor readings accepted again: %s after %lu rejected",
+            SensorRegistry::roleLabel(label, sizeof(label), probe.role, probe.circuit), (unsigned long)probe.consecutiveRejections);
+    }
+    probe.consecutiveRejections = 0;
+    *probe.reading = sample / 16.0f;
+    return true;
 }
 
-void PumpManager::handleRoot() {
-    File file = SPIFFS.open("/index.html", "r");
-    if (!file) {
-        LogManager::getInstance().log(ERROR, "Failed to open files for web /");
-        return;
+void PumpManager::publishTempStats() {
+    TempStats stats;
+    for (size_t i = 0; i < TEMP_PROBE_COUNT; i++) {
+        const TempProbe& probe = tempProbes_[i];
+        stats.probes[i].crcErrors = probe.crcErrors;
+        stats.probes[i].readErrors = probe.readErrors;
+        for (size_t stage = 0; stage < TempFilter::STAGE_COUNT; stage++) {
+            stats.probes[i].rejections[stage] = probe.getRejections(stage);
+        }
+    }
+    tempStats_.write(stats);
+}
+
+void PumpManager::writeTempStatsJson(hal::HttpServer& server) const {
+    static const size_t PROBE_JSON_MAX_LENGTH = 96 + TempFilter::STAGE_COUNT * 32;
+    TempStats stats = getTempStats();
+    char chunk[512];
+    size_t used = snprintf(chunk, sizeof(chunk), "\"temp_probes\":[");
+    bool first = true;
+
+    for (size_t i = 0; i < TEMP_PROBE_COUNT; i++) {
+        if (!tempProbeUsed(i)) { continue; }
+        if (sizeof(chunk) - used < PROBE_JSON_MAX_LENGTH) {
+            server.sendChunk(chunk, used);
+            used = 0;
+        }
+
+        const TempProbeStats& probe = stats.probes[i];
+        used += snprintf(chunk + used, sizeof(chunk) - used, "%s{\"name\":\"%s\",\"circuit\":%u,\"crc_errors\":%lu,\"read_errors\":%lu,\"rejected\":{",
+            first ? "" : ",", SensorRegistry::roleName(tempProbes_[i].role), tempProbes_[i].circuit,
+            (unsigned long)probe.crcErrors, (unsigned long)probe.readErrors);
+        for (size_t stage = 0; stage < TempFilter::STAGE_COUNT; stage++) {
+            used += snprintf(chunk + used, sizeof(chunk) - used, "%s\"%s\":%lu",
+                stage > 0 ? "," : "", TempFilter::stageName(stage), (unsigned long)probe.rejections[stage]);
+        }
+        used += snprintf(chunk + used, sizeof(chunk) - used, "}}");
+        first = false;
     }
 
-    server_.streamFile(file, "text/html");
-    file.close();
+    used += snprintf(chunk + used, sizeof(chunk) - used, "]");
+    server.sendChunk(chunk, used);
 }
 
-void PumpManager::handleMaintenance() {
-    File file = SPIFFS.open("/maintenance.html", "r");
-    if (!file) {
-        LogManager::getInstance().log(ERROR, "Failed to open files for web /");
-        return;
+void PumpManager::writeTempStatsPrometheus(hal::HttpServer& server) const {
+    static const size_t PROBE_LINES_MAX_LENGTH = 2 * 128 + TempFilter::STAGE_COUNT * 128;
+    TempStats stats = getTempStats();
+    char chunk[2048];
+    size_t used = 0;
+
+    // One family at a time, each probe's lines are flushed before they could overflow the chunk
+    for (int family = 0; family < 2; family++) {
+        used += snprintf(chunk + used, sizeof(chunk) - used, family == 0
+            ? "# HELP pool_heater_temp_read_errors_total Probe reads that failed, by cause.\n"
+              "# TYPE pool_heater_temp_read_errors_total counter\n"
+            : "# HELP pool_heater_temp_rejected_total Good probe reads dropped by each filter stage.\n"
+              "# TYPE pool_heater_temp_rejected_total counter\n");
+
+        for (size_t i = 0; i < TEMP_PROBE_COUNT; i++) {
+            if (!tempProbeUsed(i)) { continue; }
+            if (sizeof(chunk) - used < PROBE_LINES_MAX_LENGTH) {
+                server.sendChunk(chunk, used);
+                used = 0;
+            }
+
+            const char* name = SensorRegistry::roleName(tempProbes_[i].role);
+            unsigned circuit = tempProbes_[i].circuit;
+            if (family == 0) {
+                used += snprintf(chunk + used, sizeof(chunk) - used,
+                    "pool_heater_temp_read_errors_total{probe=\"%s\",circuit=\"%u\",cause=\"crc\"} %lu\n"
+                    "pool_heater_temp_read_errors_total{probe=\"%s\",circuit=\"%u\",cause=\"read\"} %lu\n",
+                    name, circuit, (unsigned long)stats.probes[i].crcErrors, name, circuit, (unsigned long)stats.probes[i].readErrors);
+                continue;
+            }
+            for (size_t stage = 0; stage < TempFilter::STAGE_COUNT; stage++) {
+                used += snprintf(chunk + used, sizeof(chunk) - used, "pool_heater_temp_rejected_total{probe=\"%s\",circuit=\"%u\",stage=\"%s\"} %lu\n",
+                    name, circuit, TempFilter::stageName(stage), (unsigned long)stats.probes[i].rejections[stage]);
+            }
+        }
+    }
+
+    server.sendChunk(chunk, used);
+}
+
+void PumpManager::writeControlTimingJson(hal::HttpServer& server) const {
+    ControlTiming timing = getControlTiming();
+    char chunk[192];
+    size_t used = snprintf(chunk, sizeof(chunk),
+        "\"control\":{\"ticks\":%lu,\"late\":%lu,\"overruns\":%lu,\"max_jitter_us\":%lu,\"max_tick_us\":%lu}",
+        (unsigned long)timing.ticks, (unsigned long)timing.lateTicks, (unsigned long)timing.overruns,
+        (unsigned long)timing.maxJitterMicros, (unsigned long)timing.maxTickMicros);
+    server.sendChunk(chunk, used);
+}
+
+void PumpManager::writeControlTimingPrometheus(hal::HttpServer& server) const {
+    ControlTiming timing = getControlTiming();
+    char chunk[1024];
+    size_t used = snprintf(chunk, sizeof(chunk),
+        "# HELP pool_heater_control_ticks_total Control ticks run.\n"
+        "# TYPE pool_heater_control_ticks_total counter\n"
+        "pool_heater_control_ticks_total %lu\n"
+        "# HELP pool_heater_control_late_ticks_total Control ticks started more than the jitter limit off their period.\n"
+        "# TYPE pool_heater_control_late_ticks_total counter\n"
+        "pool_heater_control_late_ticks_total %lu\n"
+        "# HELP pool_heater_control_overruns_total Whole control periods missed.\n"
+        "# TYPE pool_heater_control_overruns_total counter\n"
+        "pool_heater_control_overruns_total %lu\n"
+        "# HELP pool_heater_control_max_jitter_seconds Largest control tick jitter since boot.\n"
+        "# TYPE pool_heater_control_max_jitter_seconds gauge\n"
+        "pool_heater_control_max_jitter_seconds %lu.%06lu\n"
+        "# HELP pool_heater_control_max_tick_seconds Longest control tick since boot.\n"
+        "# TYPE pool_heater_control_max_tick_seconds gauge\n"
+        "pool_heater_control_max_tick_seconds %lu.%06lu\n",
+        (unsigned long)timing.ticks, (unsigned long)timing.lateTicks, (unsigned long)timing.overruns,
+        (unsigned long)(timing.maxJitterMicros / 1000000), (unsigned long)(timing.maxJitterMicros % 1000000),
+        (unsigned long)(timing.maxTickMicros / 1000000), (unsigned long)(timing.maxTickMicros % 1000000));
+    server.sendChunk(chunk, used);
+}
+
+void PumpManager::writePowerStatsJson(hal::HttpServer& server) const {
+    PowerStats power = getPowerStats();
+    char chunk[256];
+    size_t used = snprintf(chunk, sizeof(chunk),
+        "\"power\":{\"active_us\":%llu,\"asleep_us\":%llu,\"low_power_active_us\":%llu,\"low_power_asleep_us\":%llu,"
+        "\"low_power_entries\":%lu,\"light_sleep\":%s}",
+        (unsigned long long)power.activeMicros, (unsigned long long)power.asleepMicros,
+        (unsigned long long)power.lowPowerActiveMicros, (unsigned long long)power.lowPowerAsleepMicros,
+        (unsigned long)power.lowPowerEntries, power.lightSleep ? "true" : "false");
+    server.sendChunk(chunk, used);
+}
+
+void PumpManager::writePowerStatsPrometheus(hal::HttpServer& server) const {
+    PowerStats power = getPowerStats();
+    const uint64_t micros[4] = { power.activeMicros, power.lowPowerActiveMicros, power.asleepMicros, power.lowPowerAsleepMicros };
+    char seconds[4][24];
+    for (int i = 0; i < 4; i++) {               // Without floating point formatting, as the profiler does
+        snprintf(seconds[i], sizeof(seconds[i]), "%llu.%06lu", (unsigned long long)(micros[i] / 1000000), (unsigned long)(micros[i] % 1000000));
     }
 
-    server_.streamFile(file, "text/html");
-    file.close();
+    char chunk[1024];
+    size_t used = snprintf(chunk, sizeof(chunk),
+        "# HELP pool_heater_active_seconds_total Control task time spent running, by power mode.\n"
+        "# TYPE pool_heater_active_seconds_total counter\n"
+        "pool_heater_active_seconds_total{mode=\"full\"} %s\n"
+        "pool_heater_active_seconds_total{mode=\"low_power\"} %s\n"
+        "# HELP pool_heater_sleep_seconds_total Control task time spent waiting for its next tick or job, by power mode.\n"
+        "# TYPE pool_heater_sleep_seconds_total counter\n"
+        "pool_heater_sleep_seconds_total{mode=\"full\"} %s\n"
+        "pool_heater_sleep_seconds_total{mode=\"low_power\"} %s\n"
+        "# HELP pool_heater_low_power_entries_total Hibernations spent in low power.\n"
+        "# TYPE pool_heater_low_power_entries_total counter\n"
+        "pool_heater_low_power_entries_total %lu\n",
+        seconds[0], seconds[1], seconds[2], seconds[3], (unsigned long)power.lowPowerEntries);
+    server.sendChunk(chunk, used);
 }
 
 void PumpManager::handleLogs() {
-    String logs = LogManager::getInstance().getLastLogs(30);
-    JsonDocument doc;
-    deserializeJson(doc, logs);
+    // ?since=<seq> only returns entries from that sequence number on, ?limit= caps the count
+    uint32_t since = server_.hasArg("since") ? strtoul(server_.arg("since"), nullptr, 10) : 0;
+    size_t limit = server_.hasArg("limit") ? strtoul(server_.arg("limit"), nullptr, 10) : 30;
 
-    String jsonResponse;
-    serializeJson(doc, jsonResponse);
+    LogManager::getInstance().streamLogs(server_, since, limit);
+}
+
+void PumpManager::handleHistory() {
+    // ?channel=a,b  ?from=&to= history seconds, negative counts back from now  ?res= seconds per point  ?format=bin|csv
+    uint8_t channels = EnergyHistory::ALL_CHANNELS;
+    if (server_.hasArg("channel")) {
+        channels = EnergyHistory::parseChannels(server_.arg("channel"));
+        if (channels == 0) {
+            server_.send(400, "text/plain", "Unknown channel");
+            return;
+        }
+    }
+
+    long from = server_.hasArg("from") ? strtol(server_.arg("from"), nullptr, 10) : -3600;
+    long to = server_.hasArg("to") ? strtol(server_.arg("to"), nullptr, 10) : (long)history_.now();
+    uint32_t res = server_.hasArg("res") ? strtoul(server_.arg("res"), nullptr, 10) : 60;
+    EnergyHistory::Format format = strcmp(server_.arg("format"), "csv") == 0 ? EnergyHistory::CSV : EnergyHistory::BINARY;
 
-    server_.send(200, "application/json", jsonResponse);
+    history_.stream(server_, format, channels, from, to, res, getTelemetry().historyEpoch);
 }
 
-void PumpManager::handleNotFound() {
-    File file = SPIFFS.open("/not-found.html", "r");
-    if (!file) {
-        LogManager::getInstance().log(ERROR, "Failed to open files for web not-found");
+void PumpManager::handleStream() {
+    // ?telemetry=0 leaves telemetry out  ?logs=<seq> adds log entries from that sequence number on
+    bool telemetry = strcmp(server_.arg("telemetry"), "0") != 0;
+    bool logs = server_.hasArg("logs");
+    uint32_t logSince = logs ? strtoul(server_.arg("logs"), nullptr, 10) : 0;
+
+    if (!stream_.subscribe(server_, telemetry, logs, logSince)) {
+        server_.sendHeader("Retry-After", "30");
+        server_.send(503, "text/plain", "Too many streams open");
+    }
+}
+
+void PumpManager::handleMetrics() {
+    // JSON unless asked for the Prometheus text format, by ?format= or a scraper's Accept header
+    const char* format = server_.arg("format");
+    const char* accept = server_.header("Accept");
+    bool prometheus = strcmp(format, "prometheus") == 0 ||
+        (*format == '\0' && (strstr(accept, "text/plain") || strstr(accept, "openmetrics")));
+
+    if (prometheus) {
+        server_.beginChunked(200, "text/plain; version=0.0.4");
+        Profiler::getInstance().writePrometheus(server_);
+        writeControlTimingPrometheus(server_);
+        MemoryMonitor::getInstance().writePrometheus(server_);
+        writeTempStatsPrometheus(server_);
+        writePowerStatsPrometheus(server_);
+        server_.endChunked();
         return;
     }
 
-    server_.streamFile(file, "text/html");
-    file.close();
+    char head[32];
+    size_t length = snprintf(head, sizeof(head), "{\"uptime_ms\":%lu,", (unsigned long)hal::clock().millis());
+    server_.beginChunked(200, "application/json");
+    server_.sendChunk(head, length);
+    Profiler::getInstance().writeJson(server_);
+    server_.sendChunk(",", 1);
+    writeControlTimingJson(server_);
+    server_.sendChunk(",", 1);
+    MemoryMonitor::getInstance().writeJson(server_);
+    server_.sendChunk(",", 1);
+    writeTempStatsJson(server_);
+    server_.sendChunk(",", 1);
+    writePowerStatsJson(server_);
+    server_.sendChunk("}", 1);
+    server_.endChunked();
 }
 
-void PumpManager::handleUpdate() {
-    HTTPUpload& upload = server_.upload();
+void PumpManager::handleSensors() {
+    SensorList list = getSensorList();
+    char chunk[1024];
+    size_t used = snprintf(chunk, sizeof(chunk), "{\"sensors\":[");
+
+    for (uint8_t i = 0; i < list.count; i++) {
+        const SensorList::Entry& sensor = list.sensors[i];
+        char address[17];
+        SensorRegistry::formatAddress(address, sizeof(address), sensor.address);
+        used += snprintf(chunk + used, sizeof(chunk) - used, "%s{\"address\":\"%s\",\"role\":\"%s\",\"circuit\":%u,\"present\":%s,\"temp\":",
+            i > 0 ? "," : "", address, SensorRegistry::roleName(sensor.role), sensor.circuit, sensor.present ? "true" : "false");
+        used += sensor.read ? snprintf(chunk + used, sizeof(chunk) - used, "%.2f}", sensor.temp)
+            : snprintf(chunk + used, sizeof(chunk) - used, "null}");
+    }
+
+    used += snprintf(chunk + used, sizeof(chunk) - used, "],\"roles\":[");
+    for (uint8_t role = 0; role < SENSOR_ROLE_COUNT; role++) {
+        used += snprintf(chunk + used, sizeof(chunk) - used, "%s\"%s\"", role > 0 ? "," : "", SensorRegistry::roleName(role));
+    }
+    used += snprintf(chunk + used, sizeof(chunk) - used, "],\"circuits\":%u}", (unsigned)CIRCUIT_COUNT);
+
+    server_.sendHeader("Cache-Control", "no-cache");
+    server_.send(200, "application/json", chunk, used);
+}
 
-    if (upload.status == UPLOAD_FILE_START) {
-        Serial.printf("Update: %s\n", upload.filename.c_str());
+void PumpManager::handleSensorChange() {
+    // ?rescan=1 searches the bus again, ?address=<16 hex digits>&role=<role|none>&circuit=<n> assigns a role
+    if (sensorCommandPending_.load(std::memory_order_acquire)) {
+        server_.send(503, "text/plain", "Previous change still being applied");
+        return;
+    }
 
-        if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
-            Update.printError(Serial);
+    SensorCommand command = {};
+    command.rescan = server_.hasArg("rescan");
+    if (!command.rescan) {
+        command.role = SensorRegistry::parseRole(server_.arg("role"));
+        if (command.role == SENSOR_ROLE_COUNT) {
+            server_.send(400, "text/plain", "Unknown role");
+            return;
         }
-    } else if (upload.status == UPLOAD_FILE_WRITE) {
-        if (Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
-            Update.printError(Serial);
+        command.circuit = server_.hasArg("circuit") ? strtoul(server_.arg("circuit"), nullptr, 10) : 0;
+        if (!SensorRegistry::validRole(command.role, command.circuit)) {
+            server_.send(400, "text/plain", "No such circuit, or a role only circuit 0 has");
+            return;
         }
-    } else if (upload.status == UPLOAD_FILE_END) {
-        if (Update.end(true)) {
-            //logDebugMessage("Update Success: Rebooting...");
-        } else {
-            Update.printError(Serial);
-            //logDebugMessage("Update failed!");
+        if (!SensorRegistry::parseAddress(server_.arg("address"), command.address)) {
+            server_.send(400, "text/plain", "Address must be 16 hex digits");
+            return;
         }
+
+        SensorList list = getSensorList();
+        bool known = false;
+        for (uint8_t i = 0; i < list.count && !known; i++) {
+            known = memcmp(list.sensors[i].address, command.address, 8) == 0;
+        }
+        if (!known) {
+            server_.send(404, "text/plain", "No such sensor, try ?rescan=1");
+            return;
+        }
+    }
+
+    // Applied before the next conversion, GET shows the result once it has been
+    sensorCommand_ = command;
+    sensorCommandPending_.store(true, std::memory_order_release);
+    server_.send(202, "text/plain", "Queued");
+}
+
+void PumpManager::handleNotFound() {
+    const WebAsset* page = findWebAsset("/not-found");
+    if (!page) {
+        server_.send(404, "text/plain", "Not found");
+        return;
     }
+
+    server_.sendHeader("Content-Encoding", "gzip");
+    server_.send(404, page->contentType, (const char*)page->gzipped, page->length);
+}
+
+bool PumpManager::circuitArg(size_t& circuit) {
+    circuit = 0;
+    if (!server_.hasArg("circuit")) { return true; }
+
+    char* end;
+    const char* value = server_.arg("circuit");
+    circuit = strtoul(value, &end, 10);
+    if (*value != '\0' && *end == '\0' && circuit < CIRCUIT_COUNT) { return true; }
+
+    server_.send(404, "text/plain", "No such circuit");
+    return false;
 }
 
 void PumpManager::handleData() {
+    // ?circuit=<n> for that circuit's view, the device's fields are the same in each
+    size_t circuit;
+    if (!circuitArg(circuit)) { return; }
+    Published published = published_[circuit].read();
+
+    // Pollers revalidate every time, an unchanged generation costs a bodiless 304
+    server_.sendHeader("Cache-Control", "no-cache");
+    server_.sendHeader("ETag", published.tag);
+    if (notModified(published.tag)) { return; }
+
+    size_t length = formatTelemetry(dataBuffer_, sizeof(dataBuffer_), published.telemetry, hal::clock().millis());
+    server_.send(200, "application/json", dataBuffer_, length);
+}
 
-    String jsonString = "{"
-         "\"controllerUptime\":\"" + String(getUptime()) + "\","
-        "\"firmwareVersion\":\""  + String(FIRMWARE_VERSION) + "\","
-        "\"enclosureTemp\":\""    + String(enclosureTemp_) + " C\","
-        "\"localTime\":\""        + TimeManager::getInstance().getLongDate() + "\","
-        "\"pumpStatus\":\""       + pumpStateToString(pumpState) + "\","
-        "\"targetTemp\":\""       + String(TARGET_TEMP) + " C\","
-        "\"poolTemp\":\""         + String(lastPoolTemp_) + " C\","
-        "\"poolTempTime\":\""     + calculatePoolLastTime() + "\","
-        "\"inputTemp\":\""        + String(inputTemp_) + " C\","
-        "\"outputTemp\":\""       + String(outputTemp_) + " C\","
-        "\"flowRate\":\""         + String(flowRate_) + " L/min\","
-        "\"energyCapture\":\""    + formatPower(energyCapture_) + "\""
-        + "}";
+Telemetry PumpManager::getTelemetry(size_t circuit) const {
+    return published_[circuit].read().telemetry;
+}
+
+void PumpManager::publishTelemetry(unsigned long currentMillis) {
+    const TotalsJournal::Totals& totals = journal_.getTotals();
+
+    // Only map history to wall time once NTP has given us something after 2020
+    unsigned long epoch = TimeManager::getInstance().getCurrentTimestamp();
+    uint32_t historyEpoch = epoch > 1577836800UL ? epoch - history_.getSampleCount() : 0;
+
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        Published& publishing = publishing_[i];
+
+        // Built in the control task's own copy, readers only ever see it whole
+        Telemetry& snapshot = publishing.telemetry;
+        snapshot.publishedAt = currentMillis;
+        snapshot.enclosureTemp = enclosureTemp_;
+        snapshot.energy24h = history_.getEnergyKWh(EnergyHistory::LAST_24H);
+        snapshot.energy72h = history_.getEnergyKWh(EnergyHistory::LAST_72H);
+        snapshot.energyWeek = history_.getEnergyKWh(EnergyHistory::LAST_WEEK);
+        snapshot.lifetimeMilliLitres = totals.milliLitres;
+        snapshot.lifetimeJoules = totals.energyJoules;
+        snapshot.pumpSeconds = totals.pumpSeconds;
+        snapshot.historyEpoch = historyEpoch;
+        circuits_[i].fillTelemetry(snapshot);
+        snapshot.collectorRead = tempProbes_[i * SENSOR_ROLE_COUNT + ROLE_COLLECTOR].address != nullptr;
+
+        uint32_t hash = hashTelemetry(snapshot, currentMillis);
+        bool changed = hash != telemetryHash_[i] || snapshot.generation == 0;
+        if (changed) {
+            telemetryHash_[i] = hash;
+            snapshot.generation++;
+        }
 
-    server_.send(200, "application/json", jsonString);
+        publishing.count++;
+        if (changed) {
+            // Weak, uptime in the body still ticks within a generation
+            snprintf(publishing.tag, sizeof(publishing.tag), "W/\"%lx-%08lx\"", (unsigned long)snapshot.generation, (unsigned long)hash);
+        }
+        published_[i].write(publishing);
+    }
 }
 
-void PumpManager::setup() {
+void PumpManager::handleCircuits() {
+    // Every circuit side by side, as numbers rather than /api/data's display strings
+    char chunk[512];
+    size_t used = snprintf(chunk, sizeof(chunk), "{\"circuits\":[");
+    server_.sendHeader("Cache-Control", "no-cache");
+    server_.beginChunked(200, "application/json");
+
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        Telemetry telemetry = getTelemetry(i);
+        const CircuitPins& pins = circuits_[i].getPins();       // Fixed after setup()
+
+        // null without a collector probe, the circuit runs on input and output alone
+        char collectorTemp[16] = "null";
+        if (telemetry.collectorRead) { snprintf(collectorTemp, sizeof(collectorTemp), "%.2f", telemetry.collectorTemp); }
+
+        used += snprintf(chunk + used, sizeof(chunk) - used,
+            "%s{\"circuit\":%u,\"pump_pin\":%u,\"flow_pin\":%u,\"state\":\"%s\",\"target_temp\":%.2f,"
+            "\"input_temp\":%.2f,\"output_temp\":%.2f,\"collector_temp\":%s,\"flow_rate\":%.2f,\"energy_capture\":%.0f,"
+            "\"cycle_kwh\":%.3f,\"cycle_cop\":%.2f,\"today_kwh\":%.3f,\"today_cop\":%.2f}",
+            i > 0 ? "," : "", (unsigned)i, pins.pumpPin, pins.flowPin, pumpStateToString(telemetry.pumpState), telemetry.targetTemp,
+            telemetry.inputTemp, telemetry.outputTemp, collectorTemp, telemetry.flowRate, telemetry.energyCapture,
+            telemetry.cycleEnergy.netKWh(), telemetry.cycleEnergy.cop(), telemetry.todayEnergy.netKWh(), telemetry.todayEnergy.cop());
+        server_.sendChunk(chunk, used);
+        used = 0;
+    }
+
+    server_.sendChunk("]}", 2);
+    server_.endChunked();
+}
 
-    if (!SPIFFS.begin(true)) {
-        LogManager::getInstance().log(ERROR, "Failed to mount SPIFFS");
+void PumpManager::serviceWeb(unsigned long waitMs) {
+    server_.handleClient(waitMs);
+
+    // Snapshots reach the stream subscribers from here, so stream_ only ever runs on this task
+    Profiler::Scope scope(ProfileSection::Stream);
+    Published published = published_[0].read();
+    if (published.count != streamedCount_) {
+        stream_.publish(published.telemetry, published.telemetry.publishedAt);
+        streamedCount_ = published.count;
     }
 
-    sensors_.begin();
+    stream_.update(hal::clock().millis());
+}
 
-    // Pump GPIO setup
-    pinMode(PUMP_CONTROL_PIN, OUTPUT);
-    digitalWrite(PUMP_CONTROL_PIN, LOW); // Pump OFF initially
-    pinMode(FLOW_SENSOR_PIN, INPUT_PULLUP);
-    attachInterrupt(digitalPinToInterrupt(FLOW_SENSOR_PIN), PumpManager::pulseCounter, RISING);
-
-    // Web setup
-    httpUpdater_.setup(&server_);
-    server_.on("/style.css", [this](){ handleStyle(); });
-    server_.on("/script.js", [this](){ handleScript(); });
-    server_.on("/", [this](){ handleRoot(); });
-    server_.on("/maintenance", [this](){ handleMaintenance(); });
-    server_.on("/api/logs", [this](){ handleLogs(); });
-    server_.on("/update", HTTP_POST, [this](){ server_.send(200); }, [this](){ handleUpdate(); });
-    server_.on("/api/data", HTTP_GET, [this](){ handleData(); });
-    server_.onNotFound([this](){ handleNotFound(); });
-    server_.begin();
-    LogManager::getInstance().log(INFO, "HTTP server started");
+void PumpManager::webTask(void* arg) {
+    PumpManager* manager = static_cast<PumpManager*>(arg);
 
+    for (;;) {
+        // Streams only need servicing as often as telemetry changes, which is rarely while hibernating
+        manager->serviceWeb(hal::power().lowPower() ? LOW_POWER_POLL_INTERVAL : WEB_POLL_INTERVAL);
+    }
 }
 
-void PumpManager::update() {
+bool PumpManager::startControlTask() {
+    bool running = hal::startTask("control", PumpManager::controlTask, this, CONTROL_TASK_STACK_SIZE, CONTROL_TASK_PRIORITY, CONTROL_TASK_CORE);
+    if (running) {
+        LogManager::getInstance().logf(INFO, "Control task started, %lu ms tick", (unsigned long)CONTROL_TICK_INTERVAL);
+    } else {
+        LogManager::getInstance().log(ERROR, "Failed to start control task, pump control stays on the main loop");
+    }
+    return running;
+}
+
+void PumpManager::controlTask(void* arg) {
+    PumpManager* manager = static_cast<PumpManager*>(arg);
+    hal::Clock& clock = hal::clock();
+    ControlTiming& timing = manager->controlTiming_;
+    PowerStats& power = manager->powerStats_;
+
+    // Nothing here waits on another task, the only thing between ticks is the sleep
+    unsigned long wake = clock.millis();
+    unsigned long lastStart = 0;
+    unsigned long lastFinish = clock.micros();
+    unsigned long lastOverrunLog = 0;
+    bool periodic = false;                      // Last tick kept the fixed period, so the next one can be timed against it
+    for (;;) {
+        // Hibernating there is nothing to keep up with between jobs, sleep through to the next one.
+        // The update() fallback serves the web, that still needs the fixed tick.
+        bool lowPower = hal::power().lowPower() && manager->webTaskRunning_;
+        bool onTime = true;
+        if (lowPower) {
+            unsigned long idle = manager->scheduler_.idleTime();
+            clock.delay(idle < LOW_POWER_POLL_INTERVAL ? idle : LOW_POWER_POLL_INTERVAL);
+            wake = clock.millis();
+        } else {
+            // A tick that ran past the next one restarts the schedule rather than running the missed ones back to back
+            onTime = clock.delayUntil(wake, CONTROL_TICK_INTERVAL);
+        }
 
-    unsigned long currentMillis = millis();
+        unsigned long start = clock.micros();
+        manager->update();
+        unsigned long finish = clock.micros();
 
-    // Temp sensor updates
-    if (lastTempPoll_ == 0 || currentMillis - lastTempPoll_ >= TEMP_POLL_INTERVAL) {
-        sensors_.requestTemperatures();
+        if (lowPower) {
+            power.lowPowerAsleepMicros += start - lastFinish;
+            power.lowPowerActiveMicros += finish - start;
+        } else {
+            power.asleepMicros += start - lastFinish;
+            power.activeMicros += finish - start;
+        }
+        lastFinish = finish;
+        manager->power_.write(power);
+
+        if (lowPower) {
+            periodic = false;
+            continue;
+        }
+
+        if (periodic && onTime) {
+            uint32_t jitter = labs((long)(start - lastStart) - (long)CONTROL_TICK_INTERVAL * 1000);
+            if (jitter > CONTROL_JITTER_LIMIT) { timing.lateTicks++; }
+            if (jitter > timing.maxJitterMicros) { timing.maxJitterMicros = jitter; }
+        }
+        if (periodic && !onTime) {
+            timing.overruns++;
+            if (lastOverrunLog == 0 || wake - lastOverrunLog >= 60000) {
+                LogManager::getInstance().logf(WARN, "Control tick overran its period, %lu times so far", (unsigned long)timing.overruns);
+                lastOverrunLog = wake;
+            }
+        }
+        if (finish - start > timing.maxTickMicros) { timing.maxTickMicros = finish - start; }
+        timing.ticks++;
+        lastStart = start;
+        periodic = true;
+
+        manager->timing_.write(timing);
+    }
+}
+
+uint32_t PumpManager::hashTelemetry(const Telemetry& telemetry, unsigned long currentMillis) {
+    // "mins ago" and the uptime minutes move on each minute, so the minute counts as a change.
+    // Field by field, struct padding would make a hash of the whole thing unstable.
+    uint32_t minute = currentMillis / 60000;
+    uint32_t hash = fnv1a(2166136261u, &minute, sizeof(minute));
+    hash = fnv1a(hash, &telemetry.pumpState, sizeof(telemetry.pumpState));
+    hash = fnv1a(hash, &telemetry.targetTemp, sizeof(telemetry.targetTemp));
+    hash = fnv1a(hash, &telemetry.enclosureTemp, sizeof(telemetry.enclosureTemp));
+    hash = fnv1a(hash, &telemetry.poolTemp, sizeof(telemetry.poolTemp));
+    hash = fnv1a(hash, &telemetry.poolTempTime, sizeof(telemetry.poolTempTime));
+    hash = fnv1a(hash, &telemetry.inputTemp, sizeof(telemetry.inputTemp));
+    hash = fnv1a(hash, &telemetry.outputTemp, sizeof(telemetry.outputTemp));
+    hash = fnv1a(hash, &telemetry.flowRate, sizeof(telemetry.flowRate));
+    hash = fnv1a(hash, &telemetry.energyCapture, sizeof(telemetry.energyCapture));
+    hash = fnv1a(hash, &telemetry.energy24h, sizeof(telemetry.energy24h));
+    hash = fnv1a(hash, &telemetry.energy72h, sizeof(telemetry.energy72h));
+    hash = fnv1a(hash, &telemetry.energyWeek, sizeof(telemetry.energyWeek));
+    hash = fnv1a(hash, &telemetry.lifetimeMilliLitres, sizeof(telemetry.lifetimeMilliLitres));
+    hash = fnv1a(hash, &telemetry.lifetimeJoules, sizeof(telemetry.lifetimeJoules));
+    hash = fnv1a(hash, &telemetry.pumpSeconds, sizeof(telemetry.pumpSeconds));
+    hash = fnv1a(hash, &telemetry.cycleEnergy.heatMilliJoules, sizeof(telemetry.cycleEnergy.heatMilliJoules));
+    hash = fnv1a(hash, &telemetry.cycleEnergy.pumpMilliJoules, sizeof(telemetry.cycleEnergy.pumpMilliJoules));
+    hash = fnv1a(hash, &telemetry.todayEnergy.heatMilliJoules, sizeof(telemetry.todayEnergy.heatMilliJoules));
+    return fnv1a(hash, &telemetry.todayEnergy.pumpMilliJoules, sizeof(telemetry.todayEnergy.pumpMilliJoules));
+}
+
+uint32_t PumpManager::fnv1a(uint32_t hash, const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool PumpManager::notModified(const char* etag) {
+    // Caller has already set the ETag and Cache-Control headers, a 304 repeats them
+    const char* ifNoneMatch = server_.header("If-None-Match");
+    if (*ifNoneMatch == '\0' || !etagListMatches(ifNoneMatch, etag)) { return false; }
+
+    server_.send(304, "text/plain", "", 0);
+    return true;
+}
+
+bool PumpManager::etagListMatches(const char* list, const char* etag) {
+    // If-None-Match uses weak comparison, W/ is ignored on both sides
+    if (strncmp(etag, "W/", 2) == 0) { etag += 2; }
+    size_t etagLength = strlen(etag);
+
+    const char* entry = list;
+    while (*entry) {
+        while (*entry == ' ' || *entry == ',') { entry++; }
+        const char* end = entry;
+        while (*end && *end != ',') { end++; }
+        const char* last = end;
+        while (last > entry && last[-1] == ' ') { last--; }
+
+        if (last - entry == 1 && *entry == '*') { return true; }
+        if (strncmp(entry, "W/", 2) == 0) { entry += 2; }
+        if ((size_t)(last - entry) == etagLength && strncmp(entry, etag, etagLength) == 0) { return true; }
+        entry = end;
+    }
+    return false;
+}
+
+void PumpManager::sendAsset(const WebAsset& asset) {
+    // Pages link everything else as ?v=WEB_ASSET_VERSION, content at that URL never changes so it
+    // is cached for good. Pages, and anything asked for with an older version, revalidate.
+    bool versioned = asset.versioned && strcmp(server_.arg("v"), WEB_ASSET_VERSION) == 0;
+    server_.sendHeader("Cache-Control", versioned ? "public, max-age=31536000, immutable" : "no-cache");
+    server_.sendHeader("ETag", asset.etag);
+    if (notModified(asset.etag)) { return; }
+
+    // Straight out of flash, every browser takes gzip
+    server_.sendHeader("Content-Encoding", "gzip");
+    server_.send(200, asset.contentType, (const char*)asset.gzipped, asset.length);
+}
 
-        if (sensors_.getTempC(inputTempAddr_) != -127) { inputTemp_ = sensors_.getTempC(inputTempAddr_); }
-        if (sensors_.getTempC(outputTempAddr_) != -127) { outputTemp_ = sensors_.getTempC(outputTempAddr_); }
-        if (sensors_.getTempC(enclosureTempAddr_) != -127) { enclosureTemp_ = sensors_.getTempC(enclosureTempAddr_); }
+size_t PumpManager::formatTelemetry(char* output, size_t size, const Telemetry& telemetry, unsigned long currentMillis) {
+    // Each field needs its name, up to TELEMETRY_VALUE_MAX_LENGTH of value and 6 bytes of punctuation
+    size_t length = 0;
+    output[length++] = '{';
+    for (uint8_t field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+        const char* name = telemetryFieldName((TelemetryField)field);
+        if (size - length < strlen(name) + TELEMETRY_VALUE_MAX_LENGTH + 8) { return 0; }
+
+        length += snprintf(output + length, size - length, field == 0 ? "\"%s\":\"" : ",\"%s\":\"", name);
+        length += formatTelemetryField(output + length, TELEMETRY_VALUE_MAX_LENGTH, (TelemetryField)field, telemetry, currentMillis);
+        output[length++] = '"';
+    }
+    output[length++] = '}';
+    output[length] = '\0';
+    return length;
+}
+
+size_t PumpManager::formatTelemetryField(char* output, size_t size, TelemetryField field, const Telemetry& telemetry, unsigned long currentMillis) {
+    int length;
+    switch (field) {
+        case FIELD_CONTROLLER_UPTIME: length = formatUptime(output, size, currentMillis); break;
+        case FIELD_FIRMWARE_VERSION: length = snprintf(output, size, "%s", FIRMWARE_VERSION); break;
+        case FIELD_ENCLOSURE_TEMP: length = snprintf(output, size, "%.2f C", telemetry.enclosureTemp); break;
+        case FIELD_LOCAL_TIME: length = TimeManager::getInstance().formatLongDate(output, size); break;
+        case FIELD_PUMP_STATUS: length = snprintf(output, size, "%s", pumpStateToString(telemetry.pumpState)); break;
+        case FIELD_TARGET_TEMP: length = snprintf(output, size, "%.2f C", telemetry.targetTemp); break;
+        case FIELD_POOL_TEMP: length = snprintf(output, size, "%.2f C", telemetry.poolTemp); break;
+        case FIELD_POOL_TEMP_TIME: length = snprintf(output, size, "%lu mins ago", (currentMillis - telemetry.poolTempTime) / 1000 / 60); break;
+        case FIELD_INPUT_TEMP: length = snprintf(output, size, "%.2f C", telemetry.inputTemp); break;
+        case FIELD_OUTPUT_TEMP: length = snprintf(output, size, "%.2f C", telemetry.outputTemp); break;
+        case FIELD_FLOW_RATE: length = snprintf(output, size, "%.2f L/min", telemetry.flowRate); break;
+        case FIELD_ENERGY_CAPTURE: length = formatPower(output, size, telemetry.energyCapture); break;
+        case FIELD_ENERGY_24H: length = snprintf(output, size, "%.2f kWh", telemetry.energy24h); break;
+        case FIELD_ENERGY_72H: length = snprintf(output, size, "%.2f kWh", telemetry.energy72h); break;
+        case FIELD_ENERGY_WEEK: length = snprintf(output, size, "%.2f kWh", telemetry.energyWeek); break;
+        case FIELD_LIFETIME_LITRES: length = snprintf(output, size, "%lu L", (unsigned long)(telemetry.lifetimeMilliLitres / 1000)); break;
+        case FIELD_LIFETIME_ENERGY: length = snprintf(output, size, "%.2f kWh", telemetry.lifetimeJoules / 3.6e6); break;
+        case FIELD_PUMP_HOURS: length = snprintf(output, size, "%.1f h", telemetry.pumpSeconds / 3600.0); break;
+        case FIELD_CYCLE_ENERGY: length = snprintf(output, size, "%.2f kWh", telemetry.cycleEnergy.netKWh()); break;
+        case FIELD_CYCLE_COP: length = formatCop(output, size, telemetry.cycleEnergy.cop()); break;
+        case FIELD_TODAY_ENERGY: length = snprintf(output, size, "%.2f kWh", telemetry.todayEnergy.netKWh()); break;
+        case FIELD_TODAY_COP: length = formatCop(output, size, telemetry.todayEnergy.cop()); break;
+        case FIELD_LIFETIME_NET_ENERGY: length = snprintf(output, size, "%.2f kWh", lifetimeEnergy(telemetry).netKWh()); break;
+        case FIELD_LIFETIME_COP: length = formatCop(output, size, lifetimeEnergy(telemetry).cop()); break;
+        default: length = snprintf(output, size, "%s", "");
+    }
+
+    if (length < 0) { return 0; }
+    return (size_t)length < size ? length : size - 1;
+}
 
-        lastTempPoll_ = currentMillis;
+const char* PumpManager::telemetryFieldName(TelemetryField field) {
+    switch (field) {
+        case FIELD_CONTROLLER_UPTIME: return "controllerUptime";
+        case FIELD_FIRMWARE_VERSION: return "firmwareVersion";
+        case FIELD_ENCLOSURE_TEMP: return "enclosureTemp";
+        case FIELD_LOCAL_TIME: return "localTime";
+        case FIELD_PUMP_STATUS: return "pumpStatus";
+        case FIELD_TARGET_TEMP: return "targetTemp";
+        case FIELD_POOL_TEMP: return "poolTemp";
+        case FIELD_POOL_TEMP_TIME: return "poolTempTime";
+        case FIELD_INPUT_TEMP: return "inputTemp";
+        case FIELD_OUTPUT_TEMP: return "outputTemp";
+        case FIELD_FLOW_RATE: return "flowRate";
+        case FIELD_ENERGY_CAPTURE: return "energyCapture";
+        case FIELD_ENERGY_24H: return "energy24h";
+        case FIELD_ENERGY_72H: return "energy72h";
+        case FIELD_ENERGY_WEEK: return "energyWeek";
+        case FIELD_LIFETIME_LITRES: return "lifetimeLitres";
+        case FIELD_LIFETIME_ENERGY: return "lifetimeEnergy";
+        case FIELD_PUMP_HOURS: return "pumpHours";
+        case FIELD_CYCLE_ENERGY: return "cycleEnergy";
+        case FIELD_CYCLE_COP: return "cycleCop";
+        case FIELD_TODAY_ENERGY: return "todayEnergy";
+        case FIELD_TODAY_COP: return "todayCop";
+        case FIELD_LIFETIME_NET_ENERGY: return "lifetimeNetEnergy";
+        case FIELD_LIFETIME_COP: return "lifetimeCop";
+        default: return "";
     }
+}
 
-    // Flow meter update
-    currentFlowMillis_ = millis();
-    if (currentFlowMillis_ - previousFlowMillis_ > flowInterval_) {
+void PumpManager::setup() {
 
-        pulse1Sec_ = pulseCount;
-        pulseCount = 0;
+    if (!journal_.begin()) {
+        LogManager::getInstance().log(ERROR, "Totals journal unavailable, lifetime totals won't survive a restart");
+    } else {
+        LogManager::getInstance().logf(INFO, "Totals journal replayed %lu records", (unsigned long)journal_.getReplayedRecords());
+    }
 
-        // Because this loop may not complete in exactly 1 second intervals, calculate
-        // the number of milliseconds that have passed since the last execution and use
-        // that to scale the output. Also, apply the calibrationFactor to scale the output
-        // based on the number of pulses per second per units of measure (litres/minute in
-        // this case) coming from the sensor.
-        flowRate_ = ((1000.0 / (millis() - previousFlowMillis_)) * pulse1Sec_) / calibrationFactor_;
-        previousFlowMillis_ = millis();
+    tempBus_.begin();
+    sensors_.begin();
+    refreshTempProbes();
+    publishSensorList();
+    conversionTime_ = tempBus_.conversionTime();
+
+    // Pumps off and flow inputs attached before any circuit runs
+    const CircuitPins pins[CIRCUIT_COUNT] = CIRCUIT_PINS;
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        circuits_[i].begin(i, pins[i]);
+    }
+    restoreState();
 
-        // Divide the flow rate in litres/minute by 60 to determine how many litres have
-        // passed through the sensor in this 1 second interval, then multiply by 1000 to
-        // convert to millilitres.
-        flowMilliLitres_ = (flowRate_ / 60) * 1000;
+    // Control work, run from update() as it comes due
+    unsigned long currentMillis = hal::clock().millis();
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        circuits_[i].start(hal::clock().micros());
+    }
+    lastHistorySample_ = currentMillis;
+    scheduler_.every(tempPollJob_, TEMP_POLL_INTERVAL);
+    scheduler_.every(flowJob_, flowInterval_, flowInterval_);
+    scheduler_.every(pumpJob_, PUMP_UPDATE_INTERVAL);
+    scheduler_.every(historyJob_, 1000, 1000);
+    scheduler_.every(journalJob_, JOURNAL_INTERVAL, JOURNAL_INTERVAL);
+
+    // Web setup, every handler is timed as an http_request
+    auto profiled = [](hal::HttpServer::Handler handler) {
+        return [handler](){ Profiler::Scope scope(ProfileSection::HttpRequest); handler(); };
+    };
+    server_.enableFirmwareUpdate("/update");
+    for (size_t i = 0; i < WEB_ASSET_COUNT; i++) {
+        const WebAsset& asset = WEB_ASSETS[i];
+        server_.on(asset.uri, hal::HttpMethod::Any, profiled([this, &asset](){ sendAsset(asset); }));
+    }
+    server_.on("/api/logs", hal::HttpMethod::Any, profiled([this](){ handleLogs(); }));
+    server_.on("/api/data", hal::HttpMethod::Get, profiled([this](){ handleData(); }));
+    server_.on("/api/circuits", hal::HttpMethod::Get, profiled([this](){ handleCircuits(); }));
+    server_.on("/api/history", hal::HttpMethod::Get, profiled([this](){ handleHistory(); }));
+    server_.on("/api/stream", hal::HttpMethod::Get, profiled([this](){ handleStream(); }));
+    server_.on("/api/metrics", hal::HttpMethod::Get, profiled([this](){ handleMetrics(); }));
+    server_.on("/api/sensors", hal::HttpMethod::Get, profiled([this](){ handleSensors(); }));
+    server_.on("/api/sensors", hal::HttpMethod::Post, profiled([this](){ handleSensorChange(); }));
+    server_.onNotFound(profiled([this](){ handleNotFound(); }));
+    server_.begin();
 
-        // Add the millilitres passed in this second to the cumulative total
-        totalMilliLitres_ += flowMilliLitres_;
+    // Requests are served off the control loop so a slow client can't hold up pump decisions
+    webTaskRunning_ = hal::startTask("web", PumpManager::webTask, this, WEB_TASK_STACK_SIZE, WEB_TASK_PRIORITY, NETWORK_TASK_CORE);
+    if (webTaskRunning_) {
+        LogManager::getInstance().log(INFO, "HTTP server started");
+    } else {
+        LogManager::getInstance().log(WARN, "Failed to start web task, serving HTTP from the main loop");
     }
 
-    // Pump updater
-    if (lastPumpUpdate_ == 0 || currentMillis - lastPumpUpdate_ >= PUMP_UPDATE_INTERVAL) {
-        pumpControlUpdater();
-        lastPumpUpdate_ = currentMillis;
+}
+
+void PumpManager::updateFlow() {
+    Profiler::Scope scope(ProfileSection::Flow);
+
+    uint32_t day = energyDay();
+    for (size_t i = 0; i < CIRCUIT_COUNT; i++) {
+        PumpCircuit& circuit = circuits_[i];
+        circuit.updateFlow(day);
+        journal_.add(circuit.takeMilliLitres(), circuit.takeHeatJoules(), 0);
     }
+}
+
+void PumpManager::update() {
+    Profiler::Scope scope(ProfileSection::ControlTick);
+
+    scheduler_.run();
 
-    server_.handleClient(); // Handle webserver
+    // Fallback when the web task couldn't be started
+    if (!webTaskRunning_) {
+        serviceWeb(0);
+    }
 }
@@ -21,16 +21,93 @@
 #define PumpManager_h
 
 #include <Arduino.h>
-#include <WiFi.h>
-#include <SPIFFS.h>
-#include <WebServer.h>
-#include <HTTPUpdateServer.h>
-#include <ArduinoJson.h>
-#include <OneWire.h>
-#include <DallasTemperature.h>
+#include "hal/HAL.h"
 #include "util/config.h"
+#include "PumpManager/EnergyHistory.h"
+#include "PumpManager/EnergyMeter.h"
+#include "PumpManager/PumpCircuit.h"
+#include "PumpManager/SensorRegistry.h"
+#include "PumpManager/Telemetry.h"
+#include "PumpManager/TelemetryStream.h"
+#include "PumpManager/TotalsJournal.h"
 #include "util/LogManager/LogManager.h"
+#include "util/MemoryMonitor/MemoryMonitor.h"
+#include "util/Profiler/Profiler.h"
+#include "util/Scheduler/Scheduler.h"
+#include "util/Seqlock/Seqlock.h"
+#include "util/SensorFilter/SensorFilter.h"
 #include "util/TimeManager/TimeManager.h"
+#include "util/WebAssets/WebAssets.h"
+
+// How steadily the control tick keeps its period, kept by the control task
+struct ControlTiming {
+    uint32_t ticks;                             // Run on the control task so far
+    uint32_t lateTicks;                         // Started more than CONTROL_JITTER_LIMIT off the period
+    uint32_t overruns;                          // Missed a whole period, the schedule restarts from there
+    uint32_t maxJitterMicros;                   // Largest difference between a tick interval and CONTROL_TICK_INTERVAL
+    uint32_t maxTickMicros;                     // Longest update()
+};
+
+// Where the control task's time goes, split by power mode. Active is time in
+// update(), asleep is time blocked until the next tick or, in low power, the
+// next scheduled job. Kept by the control task.
+struct PowerStats {
+    uint32_t lowPowerEntries;                   // Hibernations spent in low power
+    bool lightSleep;                            // The board accepted light sleep on the last entry
+    uint64_t activeMicros;                      // Full power
+    uint64_t asleepMicros;
+    uint64_t lowPowerActiveMicros;
+    uint64_t lowPowerAsleepMicros;
+};
+
+// Applied to water and enclosure probe readings, in the DS18B20's 1/16 C
+typedef filter::FilterChain<
+    filter::RangeCheck<TEMP_FILTER_MIN * 16, TEMP_FILTER_MAX * 16>,
+    filter::RateLimit<TEMP_FILTER_MAX_STEP * 16, TEMP_FILTER_RESYNC>,
+    filter::Median<TEMP_FILTER_MEDIAN>,
+    filter::Ema<TEMP_FILTER_EMA_SHIFT>> TempFilter;
+
+// The same for the collector surface and outside air, which go well past the
+// water's range. A sunny collector over 70 C would otherwise never pass again
+typedef filter::FilterChain<
+    filter::RangeCheck<TEMP_SURFACE_FILTER_MIN * 16, TEMP_SURFACE_FILTER_MAX * 16>,
+    filter::RateLimit<TEMP_FILTER_MAX_STEP * 16, TEMP_FILTER_RESYNC>,
+    filter::Median<TEMP_FILTER_MEDIAN>,
+    filter::Ema<TEMP_FILTER_EMA_SHIFT>> SurfaceTempFilter;
+
+static_assert(SurfaceTempFilter::STAGE_COUNT == TempFilter::STAGE_COUNT, "Probe stats share one set of filter stages");
+
+// Read health of each temperature probe, kept by the control task
+struct TempProbeStats {
+    uint32_t crcErrors;                         // Scratchpad reads that failed the CRC check
+    uint32_t readErrors;                        // Reads with no presence pulse or an empty scratchpad
+    uint32_t rejections[TempFilter::STAGE_COUNT];   // Good reads each filter stage dropped
+};
+
+static_assert(CIRCUIT_COUNT >= 1 && CIRCUIT_COUNT <= 4, "CIRCUIT_COUNT must be 1 to 4, one pulse input each");
+
+// One per role for each circuit, circuit * SENSOR_ROLE_COUNT + role. The
+// device's own roles only have a probe in circuit 0's slots.
+static const size_t TEMP_PROBE_COUNT = SENSOR_ROLE_COUNT * CIRCUIT_COUNT;
+
+struct TempStats {
+    TempProbeStats probes[TEMP_PROBE_COUNT];
+};
+
+// The sensor registry as the web task sees it, published by the control task
+struct SensorList {
+    struct Entry {
+        uint8_t address[8];
+        uint8_t role;                           // SensorRole, ROLE_NONE if unassigned
+        uint8_t circuit;
+        bool present;
+        bool read;                              // The role is being read, temp is its latest filtered reading
+        float temp;
+    };
+
+    uint8_t count;
+    Entry sensors[MAX_TEMP_SENSORS];
+};
 
 class PumpManager {
 public:
@@ -41,7 +118,21 @@ public:
 
     void setup();
     void update();
-    static void pulseCounter();     // Interrupt service routine for pulse counting
+    bool startControlTask();                        // update() every CONTROL_TICK_INTERVAL from here on, false if the caller has to keep calling it
+    PumpCircuit& getCircuit(size_t circuit) { return circuits_[circuit]; }   // Before setup() or from the control task
+    const EnergyHistory& getHistory() const { return history_; }
+    const TotalsJournal::Totals& getTotals() const { return journal_.getTotals(); }
+    Telemetry getTelemetry(size_t circuit = 0) const;   // Copy of the latest snapshot, safe from any task
+    ControlTiming getControlTiming() const { return timing_.read(); }
+    PowerStats getPowerStats() const { return power_.read(); }
+    TempStats getTempStats() const { return tempStats_.read(); }
+    SensorList getSensorList() const { return sensorList_.read(); }
+
+    static const size_t TELEMETRY_JSON_MAX_LENGTH = 1024;
+    static size_t formatTelemetry(char* output, size_t size, const Telemetry& telemetry, unsigned long currentMillis);
+    static size_t formatTelemetryField(char* output, size_t size, TelemetryField field, const Telemetry& telemetry, unsigned long currentMillis);
+    static const char* telemetryFieldName(TelemetryField field);
+    static const char* pumpStateToString(uint8_t pumpState);
 
 private:
     PumpManager();                         // Private constructor/destructor for singleton
@@ -49,56 +140,150 @@ private:
     PumpManager(const PumpManager&) = delete;
     PumpManager& operator=(const PumpManager&) = delete;
 
-    enum State { INITIALIZING, SENSORS_STABILIZING, ACTIVE, HIBERNATING, MAINTENANCE } pumpState = INITIALIZING;
-
-    OneWire oneWire_;
-    DallasTemperature sensors_;
-    WebServer server_;
-    HTTPUpdateServer httpUpdater_;
-
-    static volatile byte pulseCount;
-
-    uint8_t inputTempAddr_[8];
-    uint8_t outputTempAddr_[8];
-    uint8_t enclosureTempAddr_[8];
-
-    long lastTempPoll_;
-    unsigned long lastPoolTempTime_;
-    float lastPoolTemp_;
-    float inputTemp_;
-    float outputTemp_;
-    float enclosureTemp_;
-    long lastPumpUpdate_;
-
-    unsigned long stabilityStartTime_;          // millis to track how long waiting for stability
-    float energyCapture_;                       // The current energy being captured, in watts
-    float lastEnergyInsufficient_;              // Unix stamp of the last time the delta was too low
-    unsigned long lastHibernationTime_;         // millis to track time in hibernation
-    unsigned long lastMaintenanceToggle_;       // unix stamp to track when it has been far enough from maintenance toggle to operate
-
-    float flowRate_;
-    long currentFlowMillis_;
-    long previousFlowMillis_;
-    int flowInterval_;
-    float calibrationFactor_;
-    byte pulse1Sec_;
-    unsigned int flowMilliLitres_;
-    unsigned long totalMilliLitres_;
+    static const uint32_t CONTROL_TASK_STACK_SIZE = 8192;
+    static const uint32_t WEB_TASK_STACK_SIZE = 8192;
+    static const unsigned long WEB_POLL_INTERVAL = 50;     // Longest the web task waits on the network before servicing streams
+
+    // Kept across a memory watchdog restart by hal::System
+    struct RestartState {
+        uint8_t version;                        // RESTART_STATE_VERSION
+        uint8_t circuitCount;                   // CIRCUIT_COUNT of the build that saved it
+        uint32_t restarts;                      // Memory watchdog restarts since power on
+        uint32_t energyDay;                     // EnergyMeter day the circuits' totals belong to
+        PumpCircuit::SavedState circuits[CIRCUIT_COUNT];
+    };
+    static const uint8_t RESTART_STATE_VERSION = 3;
+    static_assert(sizeof(RestartState) <= hal::System::RETAINED_STATE_SIZE, "RestartState must fit the retained state");
+
+    struct TempProbe {
+        uint8_t role;                           // SensorRole
+        uint8_t circuit;
+        const uint8_t* address;                 // ROM address on the OneWire bus, nullptr while nothing has the role
+        float* reading;                         // Where good readings are stored
+        unsigned long crcErrors;                // Scratchpad reads that failed the CRC check
+        unsigned long readErrors;               // Reads with no presence pulse or an empty scratchpad
+        unsigned long consecutiveErrors;        // Failed reads since the last good one
+        unsigned long consecutiveRejections;    // Good reads the filter dropped since the last it passed
+        bool surface;                           // Collector or ambient, filtered by surfaceFilter
+        TempFilter filter;
+        SurfaceTempFilter surfaceFilter;
+
+        bool applyFilter(int32_t& sample) { return surface ? surfaceFilter.apply(sample) : filter.apply(sample); }
+        uint32_t getRejections(size_t stage) const { return surface ? surfaceFilter.getRejections(stage) : filter.getRejections(stage); }
+        void resetFilter() { filter = TempFilter(); surfaceFilter = SurfaceTempFilter(); }
+    };
+
+    hal::TempBus& tempBus_;
+    hal::HttpServer& server_;
+
+    PumpCircuit circuits_[CIRCUIT_COUNT];       // Pins from CIRCUIT_PINS
+    bool lowPower_;                             // Every circuit is hibernating
+
+    SensorRegistry sensors_;                    // Which probe has which role
+    TempProbe tempProbes_[TEMP_PROBE_COUNT];    // See TEMP_PROBE_COUNT, only those with a probe assigned are read
+    Seqlock<TempStats> tempStats_;              // Republished after every probe read
+    Seqlock<SensorList> sensorList_;            // Republished after every round of reads
+    uint8_t tempProbeIndex_;                    // Next probe tempReadJob_ reads
+    unsigned long conversionTime_;              // millis the sensors need to finish a conversion
+
+    float enclosureTemp_;                       // The circuits keep their own probes' readings
+    float ambientTemp_;
+
+    bool webTaskRunning_;                       // Otherwise the web is served from update()
+
+    Scheduler scheduler_;                       // Control task work, update() runs whatever is due
+    Scheduler::Job tempPollJob_;                // Broadcast conversion every TEMP_POLL_INTERVAL
+    Scheduler::Job tempReadJob_;                // One scratchpad a tick once the conversion is done
+    Scheduler::Job flowJob_;                    // Every circuit's flow rate every flowInterval_
+    Scheduler::Job pumpJob_;                    // Every circuit's control decision and telemetry every PUMP_UPDATE_INTERVAL
+    Scheduler::Job historyJob_;                 // 1 s history samples and energy totals
+    Scheduler::Job journalJob_;                 // Appends changed totals every JOURNAL_INTERVAL
+
+    EnergyHistory history_;                     // The device's, see recordHistory()
+    unsigned long lastHistorySample_;           // millis of the last 1 s history sample
+    TotalsJournal journal_;                     // Lifetime totals of every circuit together, survive restarts
+    // Control task state reaches the web task only through these, written whole
+    // each tick and read without a lock, see Seqlock
+    struct Published {
+        Telemetry telemetry;                    // Latest snapshot
+        char tag[32];                           // Weak ETag of the current generation
+        uint32_t count;                         // Snapshots published so far
+    };
+    Published publishing_[CIRCUIT_COUNT];       // Control task copies, built up here then written to published_
+    Seqlock<Published> published_[CIRCUIT_COUNT];   // One per circuit, so a request only copies the one it shows
+    uint32_t telemetryHash_[CIRCUIT_COUNT];     // Of the published values, a change bumps the generation
+    ControlTiming controlTiming_;               // Control task copy of timing_
+    Seqlock<ControlTiming> timing_;
+    PowerStats powerStats_;                     // Control task copy of power_
+    Seqlock<PowerStats> power_;
+
+    // Web task only
+    char dataBuffer_[TELEMETRY_JSON_MAX_LENGTH];    // /api/data response, reused so requests never allocate
+    TelemetryStream stream_;                    // /api/stream subscribers, circuit 0's telemetry
+    uint32_t streamedCount_;                    // Published::count of the last snapshot given to stream_
+
+    // Registry changes asked for over HTTP, applied by the control task between
+    // rounds of reads while the bus is idle. The web task fills sensorCommand_
+    // only while nothing is pending.
+    struct SensorCommand {
+        bool rescan;                            // Search the bus, otherwise assign role to address
+        uint8_t address[8];
+        uint8_t role;
+        uint8_t circuit;
+    };
+    SensorCommand sensorCommand_;
+    std::atomic<bool> sensorCommandPending_;
+
+    unsigned long flowInterval_;
 
     void pumpControlUpdater();
-    void handleStyle();
-    void handleScript();
-    void handleRoot();
+    void updateLowPower();                      // Low power once every circuit hibernates, full power as soon as one wakes
+    void setLowPower(bool enabled);
+    void restartPreservingState();              // Never returns
+    void restoreState();                        // Resumes a hibernation a memory restart interrupted
+    void updateFlow();
+    uint32_t energyDay() const;                 // For EnergyMeter::setDay()
+    void recordHistory();
+    void publishTelemetry(unsigned long currentMillis);
+    void serviceWeb(unsigned long waitMs);
+    static void webTask(void* arg);
+    static void controlTask(void* arg);
+    void startTempConversion();
+    void readNextTempProbe();
+    bool readTempProbe(TempProbe& probe);
+    uint8_t nextTempProbe(uint8_t from) const;  // First probe with an address from here, TEMP_PROBE_COUNT if none
+    static bool tempProbeUsed(size_t probe);    // Has a role, the device's roles only exist for circuit 0
+    void applySensorCommand();
+    void refreshTempProbes();                   // Points each probe at its role's address
+    void publishSensorList();
+    void publishTempStats();
+    void writeTempStatsJson(hal::HttpServer& server) const;
+    void writeTempStatsPrometheus(hal::HttpServer& server) const;
+    void writeControlTimingJson(hal::HttpServer& server) const;
+    void writeControlTimingPrometheus(hal::HttpServer& server) const;
+    void writePowerStatsJson(hal::HttpServer& server) const;
+    void writePowerStatsPrometheus(hal::HttpServer& server) const;
+    bool circuitArg(size_t& circuit);           // ?circuit=, 0 without one. Sends a 404 and returns false for one that doesn't exist
     void handleData();
-    void handleMaintenance();
+    void handleCircuits();
     void handleLogs();
-    void handleUpdate();
+    void handleHistory();
+    void handleStream();
+    void handleMetrics();
+    void handleSensors();
+    void handleSensorChange();
     void handleNotFound();
 
-    String getUptime();
-    String formatPower(double powerInWatts);
-    String pumpStateToString(State pumpState);
-    String calculatePoolLastTime();
+    bool notModified(const char* etag);
+    void sendAsset(const WebAsset& asset);
+    static bool etagListMatches(const char* list, const char* etag);
+    static uint32_t hashTelemetry(const Telemetry& telemetry, unsigned long currentMillis);
+    static uint32_t fnv1a(uint32_t hash, const void* data, size_t length);
+
+    static size_t formatUptime(char* output, size_t size, unsigned long uptimeMillis);
+    static size_t formatPower(char* output, size_t size, double powerInWatts);
+    static size_t formatCop(char* output, size_t size, float cop);
+    static EnergyMeter::Totals lifetimeEnergy(const Telemetry& telemetry);     // From the journal's totals
 };
 
 #endif // PumpManager_h
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "PumpManager/SensorRegistry.h"
+#include "util/LogManager/LogManager.h"
+
+static const char* const SETTINGS_KEY = "sensors";
+
+SensorRegistry::SensorRegistry(hal::TempBus& bus, hal::SettingsStore& store)
+    : bus_(bus),
+    store_(store),
+    sensors_(),
+    count_(0),
+    changes_(0) {}
+
+void SensorRegistry::begin() {
+    if (!store_.begin()) {
+        LogManager::getInstance().log(WARN, "Settings store unavailable, temp sensor roles won't survive a restart");
+    }
+
+    if (!load()) {
+        seedFromConfig();
+        save();
+    }
+    discover();
+}
+
+size_t SensorRegistry::discover() {
+    uint8_t found[MAX_TEMP_SENSORS][8];
+    size_t foundCount = bus_.search(found, MAX_TEMP_SENSORS);
+    bool added = false;
+
+    for (uint8_t i = 0; i < count_; i++) { sensors_[i].present = false; }
+
+    for (size_t i = 0; i < foundCount; i++) {
+        Sensor* sensor = find(found[i]);
+        if (!sensor) {
+            sensor = add(found[i], ROLE_NONE, 0);
+            if (!sensor) {
+                LogManager::getInstance().log(WARN, "Temp sensor registry full, ignoring further probes");
+                break;
+            }
+
+            char address[17];
+            formatAddress(address, sizeof(address), found[i]);
+            LogManager::getInstance().logf(INFO, "New temp sensor %s, assign it a role with POST /api/sensors", address);
+            added = true;
+        }
+        sensor->present = true;
+    }
+
+    char label[ROLE_LABEL_LENGTH];
+    for (uint8_t i = 0; i < count_; i++) {
+        if (sensors_[i].role != ROLE_NONE && !sensors_[i].present) {
+            LogManager::getInstance().logf(WARN, "Temp sensor missing from the bus: %s",
+                roleLabel(label, sizeof(label), sensors_[i].role, sensors_[i].circuit));
+        }
+    }
+
+    if (added) { save(); }
+    return foundCount;
+}
+
+bool SensorRegistry::assign(const uint8_t* address, uint8_t role, uint8_t circuit) {
+    if (!validRole(role, circuit)) { return false; }
+    if (role == ROLE_NONE) { circuit = 0; }
+
+    Sensor* sensor = find(address);
+    if (!sensor) { return false; }
+    if (sensor->role == role && sensor->circuit == circuit) { return true; }
+
+    // One probe per role and circuit, whoever had it gives it up
+    for (uint8_t i = 0; i < count_; i++) {
+        if (role != ROLE_NONE && sensors_[i].role == role && sensors_[i].circuit == circuit) {
+            sensors_[i].role = ROLE_NONE;
+            sensors_[i].circuit = 0;
+        }
+    }
+    sensor->role = role;
+    sensor->circuit = circuit;
+    changes_++;
+    return save();
+}
+
+void SensorRegistry::setPresent(uint8_t role, uint8_t circuit, bool present) {
+    for (uint8_t i = 0; i < count_; i++) {
+        if (sensors_[i].role == role && sensors_[i].circuit == circuit) { sensors_[i].present = present; }
+    }
+}
+
+const uint8_t* SensorRegistry::getAddress(uint8_t role, uint8_t circuit) const {
+    for (uint8_t i = 0; i < count_; i++) {
+        if (sensors_[i].role == role && sensors_[i].circuit == circuit) { return sensors_[i].address; }
+    }
+    return nullptr;
+}
+
+bool SensorRegistry::load() {
+    Saved saved;
+    size_t length = store_.get(SETTINGS_KEY, &saved, sizeof(saved));
+    if (length < 2 || saved.count > MAX_TEMP_SENSORS) { return false; }
+
+    // Version 1 entries were a byte shorter, widen them in place from the last one back onto circuit 0
+    const size_t V1_SENSOR_SIZE = sizeof(SavedSensor) - 1;
+    if (saved.version == 1 && length >= 2 + saved.count * V1_SENSOR_SIZE) {
+        const uint8_t* packed = (const uint8_t*)saved.sensors;
+        for (int i = saved.count - 1; i >= 0; i--) {
+            memmove(&saved.sensors[i], packed + i * V1_SENSOR_SIZE, V1_SENSOR_SIZE);
+            saved.sensors[i].circuit = 0;
+        }
+        saved.version = SAVED_VERSION;
+        length = 2 + saved.count * sizeof(SavedSensor);
+    }
+
+    if (saved.version != SAVED_VERSION || length < 2 + saved.count * sizeof(SavedSensor)) { return false; }
+
+    count_ = 0;
+    for (uint8_t i = 0; i < saved.count; i++) {
+        const SavedSensor& entry = saved.sensors[i];
+        bool valid = entry.role != ROLE_NONE && validRole(entry.role, entry.circuit);   // A build with fewer circuits drops the rest
+        add(entry.address, valid ? entry.role : (uint8_t)ROLE_NONE, valid ? entry.circuit : 0);
+    }
+    return true;
+}
+
+bool SensorRegistry::save() {
+    Saved saved = {};
+    saved.version = SAVED_VERSION;
+    saved.count = count_;
+    for (uint8_t i = 0; i < count_; i++) {
+        memcpy(saved.sensors[i].address, sensors_[i].address, 8);
+        saved.sensors[i].role = sensors_[i].role;
+        saved.sensors[i].circuit = sensors_[i].circuit;
+    }
+
+    // Only the entries in use, the map grows with the bus
+    if (!store_.set(SETTINGS_KEY, &saved, 2 + count_ * sizeof(SavedSensor))) {
+        LogManager::getInstance().log(WARN, "Failed to save the temp sensor map");
+        return false;
+    }
+    return true;
+}
+
+void SensorRegistry::seedFromConfig() {
+    const uint8_t addresses[3][8] = { INPUT_TEMP_ADDR, OUTPUT_TEMP_ADDR, ENCLOSURE_TEMP_ADDR };
+    const uint8_t roles[3] = { ROLE_INPUT, ROLE_OUTPUT, ROLE_ENCLOSURE };
+
+    // Placeholder addresses fail the ROM CRC and are left out, the config's probes are the first circuit's
+    for (uint8_t i = 0; i < 3; i++) {
+        if (hal::TempBus::crc8(addresses[i], 7) == addresses[i][7]) { add(addresses[i], roles[i], 0); }
+    }
+}
+
+SensorRegistry::Sensor* SensorRegistry::find(const uint8_t* address) {
+    for (uint8_t i = 0; i < count_; i++) {
+        if (memcmp(sensors_[i].address, address, 8) == 0) { return &sensors_[i]; }
+    }
+    return nullptr;
+}
+
+SensorRegistry::Sensor* SensorRegistry::add(const uint8_t* address, uint8_t role, uint8_t circuit) {
+    if (count_ == MAX_TEMP_SENSORS) { return nullptr; }
+
+    Sensor& sensor = sensors_[count_++];
+    memcpy(sensor.address, address, 8);
+    sensor.role = role;
+    sensor.circuit = circuit;
+    sensor.present = false;
+    return &sensor;
+}
+
+const char* SensorRegistry::roleName(uint8_t role) {
+    switch (role) {
+        case ROLE_INPUT: return "input";
+        case ROLE_OUTPUT: return "output";
+        case ROLE_ENCLOSURE: return "enclosure";
+        case ROLE_COLLECTOR: return "collector";
+        case ROLE_AMBIENT: return "ambient";
+        default: return "none";
+    }
+}
+
+bool SensorRegistry::circuitRole(uint8_t role) {
+    return role == ROLE_INPUT || role == ROLE_OUTPUT || role == ROLE_COLLECTOR;
+}
+
+bool SensorRegistry::validRole(uint8_t role, uint8_t circuit) {
+    if (role == ROLE_NONE) { return true; }
+    if (role >= SENSOR_ROLE_COUNT || circuit >= CIRCUIT_COUNT) { return false; }
+    return circuit == 0 || circuitRole(role);
+}
+
+const char* SensorRegistry::roleLabel(char* output, size_t size, uint8_t role, uint8_t circuit) {
+    if (CIRCUIT_COUNT == 1 || !circuitRole(role)) {
+        snprintf(output, size, "%s", roleName(role));
+    } else {
+        snprintf(output, size, "circuit %u %s", circuit, roleName(role));
+    }
+    return output;
+}
+
+uint8_t SensorRegistry::parseRole(const char* name) {
+    if (strcmp(name, "none") == 0) { return ROLE_NONE; }
+    for (uint8_t role = 0; role < SENSOR_ROLE_COUNT; role++) {
+        if (strcmp(name, roleName(role)) == 0) { return role; }
+    }
+    return SENSOR_ROLE_COUNT;
+}
+
+bool SensorRegistry::parseAddress(const char* text, uint8_t* address) {
+    if (strlen(text) != 16) { return false; }
+
+    for (uint8_t i = 0; i < 8; i++) {
+        char byte[3] = { text[i * 2], text[i * 2 + 1], '\0' };
+        char* end;
+        address[i] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end != '\0' || !isxdigit((unsigned char)byte[0])) { return false; }
+    }
+    return true;
+}
+
+size_t SensorRegistry::formatAddress(char* output, size_t size, const uint8_t* address) {
+    return snprintf(output, size, "%02X%02X%02X%02X%02X%02X%02X%02X",
+        address[0], address[1], address[2], address[3], address[4], address[5], address[6], address[7]);
+}
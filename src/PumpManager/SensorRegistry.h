@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef SensorRegistry_h
+#define SensorRegistry_h
+
+#include <Arduino.h>
+#include "hal/HAL.h"
+#include "util/config.h"
+
+// What each temperature probe on the OneWire bus is for. Input, output and
+// collector are per circuit, enclosure and ambient are the device's own.
+enum SensorRole : uint8_t {
+    ROLE_INPUT,                                 // Pool water into the collector
+    ROLE_OUTPUT,                                // Heated water back to the pool
+    ROLE_ENCLOSURE,
+    ROLE_COLLECTOR,                             // Collector surface, optional
+    ROLE_AMBIENT,                               // Outside air, optional
+    SENSOR_ROLE_COUNT,
+    ROLE_NONE = 0xFF                            // Found on the bus, nothing assigned
+};
+
+// Every probe seen on the bus and the role and circuit each one has, kept in the settings
+// store so a swapped probe only needs its role assigned rather than a reflash.
+// The bus is searched at boot and on request, new probes are remembered
+// unassigned. On first boot the map starts from the addresses in config.h.
+// Only the control task touches this, others go through PumpManager.
+class SensorRegistry {
+public:
+    struct Sensor {
+        uint8_t address[8];                     // ROM code
+        uint8_t role;                           // SensorRole
+        uint8_t circuit;                        // Circuit the role is for, always 0 for the device's roles
+        bool present;                           // Answered the last search or read
+    };
+
+    SensorRegistry(hal::TempBus& bus, hal::SettingsStore& store);
+
+    void begin();                               // Loads the saved map, then searches the bus
+    size_t discover();                          // Probes found, new ones are added unassigned
+    bool assign(const uint8_t* address, uint8_t role, uint8_t circuit);    // Takes the role from any other probe, ROLE_NONE unassigns. Saved
+    void setPresent(uint8_t role, uint8_t circuit, bool present);
+
+    const uint8_t* getAddress(uint8_t role, uint8_t circuit) const;        // nullptr if no probe has the role
+    size_t getCount() const { return count_; }
+    const Sensor& getSensor(size_t index) const { return sensors_[index]; }
+    uint32_t getChanges() const { return changes_; }    // Bumped whenever a role moves
+
+    static const char* roleName(uint8_t role);
+    static bool circuitRole(uint8_t role);              // Each circuit has its own probe for it
+    static bool validRole(uint8_t role, uint8_t circuit);   // ROLE_NONE, or a role that circuit can have
+    static const char* roleLabel(char* output, size_t size, uint8_t role, uint8_t circuit);    // For logs, names the circuit once there is more than one. Returns output
+    static uint8_t parseRole(const char* name);         // "none" is ROLE_NONE, SENSOR_ROLE_COUNT if unknown
+    static bool parseAddress(const char* text, uint8_t* address);   // 16 hex digits, the ROM code's byte order
+    static size_t formatAddress(char* output, size_t size, const uint8_t* address);
+
+    static const size_t ROLE_LABEL_LENGTH = 24;         // Buffer size roleLabel() needs
+
+private:
+    static const uint8_t SAVED_VERSION = 2;     // 1 had no circuit, everything was circuit 0
+
+    struct SavedSensor {
+        uint8_t address[8];
+        uint8_t role;
+        uint8_t circuit;
+    };
+
+    struct Saved {
+        uint8_t version;                        // SAVED_VERSION
+        uint8_t count;
+        SavedSensor sensors[MAX_TEMP_SENSORS];
+    };
+
+    hal::TempBus& bus_;
+    hal::SettingsStore& store_;
+    Sensor sensors_[MAX_TEMP_SENSORS];
+    uint8_t count_;
+    uint32_t changes_;
+
+    bool load();
+    bool save();
+    void seedFromConfig();
+    Sensor* find(const uint8_t* address);
+    Sensor* add(const uint8_t* address, uint8_t role, uint8_t circuit);
+};
+
+#endif // SensorRegistry_h
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef Telemetry_h
+#define Telemetry_h
+
+#include <Arduino.h>
+#include "PumpManager/EnergyMeter.h"
+
+// Everything /api/data reports, published by the control tick. Requests
+// format a copy of it, nothing here is computed per request. The web task
+// only ever sees control state through this copy.
+struct Telemetry {
+    unsigned long publishedAt;                  // millis of the tick that published it
+    uint32_t generation;                        // Bumped whenever what /api/data shows changes, drives its ETag
+    uint8_t pumpState;
+    float targetTemp;
+    float enclosureTemp;
+    float poolTemp;
+    unsigned long poolTempTime;                 // millis of the last pool reading
+    float inputTemp;
+    float outputTemp;
+    float collectorTemp;                        // Only in /api/circuits, the probe is optional
+    bool collectorRead;                         // The circuit has a collector probe
+    float flowRate;                             // L/min
+    float energyCapture;                        // W
+    float energy24h;                            // kWh
+    float energy72h;
+    float energyWeek;
+    uint64_t lifetimeMilliLitres;
+    int64_t lifetimeJoules;
+    uint32_t pumpSeconds;
+    EnergyMeter::Totals cycleEnergy;            // Current or last pump run
+    EnergyMeter::Totals todayEnergy;
+    uint32_t historyEpoch;                      // Wall time of history time zero, 0 until NTP has synced
+};
+
+// The JSON fields telemetry is reported as, in /api/data order
+enum TelemetryField : uint8_t {
+    FIELD_CONTROLLER_UPTIME,
+    FIELD_FIRMWARE_VERSION,
+    FIELD_ENCLOSURE_TEMP,
+    FIELD_LOCAL_TIME,
+    FIELD_PUMP_STATUS,
+    FIELD_TARGET_TEMP,
+    FIELD_POOL_TEMP,
+    FIELD_POOL_TEMP_TIME,
+    FIELD_INPUT_TEMP,
+    FIELD_OUTPUT_TEMP,
+    FIELD_FLOW_RATE,
+    FIELD_ENERGY_CAPTURE,
+    FIELD_ENERGY_24H,
+    FIELD_ENERGY_72H,
+    FIELD_ENERGY_WEEK,
+    FIELD_LIFETIME_LITRES,
+    FIELD_LIFETIME_ENERGY,
+    FIELD_PUMP_HOURS,
+    FIELD_CYCLE_ENERGY,
+    FIELD_CYCLE_COP,
+    FIELD_TODAY_ENERGY,
+    FIELD_TODAY_COP,
+    FIELD_LIFETIME_NET_ENERGY,
+    FIELD_LIFETIME_COP,
+    TELEMETRY_FIELD_COUNT
+};
+
+static const size_t TELEMETRY_VALUE_MAX_LENGTH = 32;    // Longest formatted field, with its terminator
+
+#endif // Telemetry_h
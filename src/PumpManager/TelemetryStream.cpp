@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "PumpManager/TelemetryStream.h"
+#include "PumpManager/PumpManager.h"
+
+TelemetryStream::TelemetryStream()
+    : subscribers_(),
+    values_(),
+    published_(false),
+    event_(),
+    droppedEvents_(0) {}
+
+bool TelemetryStream::subscribe(hal::HttpServer& server, bool telemetry, bool logs, uint32_t logSince) {
+    for (Subscriber& subscriber : subscribers_) {
+        if (subscriber.stream) { continue; }
+
+        hal::HttpStream* stream = server.beginStream("text/event-stream");
+        if (!stream) { return false; }
+
+        unsigned long currentMillis = hal::clock().millis();
+        uint32_t nextLog = LogManager::getInstance().getNextSequence();
+
+        subscriber.stream = stream;
+        subscriber.telemetry = telemetry;
+        subscriber.logs = logs;
+        subscriber.resync = true;
+        subscriber.logSequence = logSince > nextLog ? 0 : logSince;     // Past the newest entry means we restarted under the client
+        subscriber.lastProgress = currentMillis;
+        subscriber.queued = 0;
+
+        // Reconnect quickly if the stream drops, and start telemetry subscribers off with everything
+        static const char RETRY[] = "retry: 5000\n\n";
+        enqueue(subscriber, RETRY, sizeof(RETRY) - 1, currentMillis);
+        if (telemetry && published_) {
+            bool fields[TELEMETRY_FIELD_COUNT];
+            memset(fields, true, sizeof(fields));
+            subscriber.resync = !enqueue(subscriber, event_, formatEvent(fields), currentMillis);
+        }
+
+        flush(subscriber, currentMillis);
+        return true;
+    }
+    return false;
+}
+
+void TelemetryStream::publish(const Telemetry& telemetry, unsigned long currentMillis) {
+    // Diff on the formatted text, a reading that only moves past the second decimal isn't news
+    bool changed[TELEMETRY_FIELD_COUNT];
+    bool anyChanged = false;
+    char value[TELEMETRY_VALUE_MAX_LENGTH];
+    for (uint8_t field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+        PumpManager::formatTelemetryField(value, sizeof(value), (TelemetryField)field, telemetry, currentMillis);
+        changed[field] = !published_ || strcmp(value, values_[field]) != 0;
+        if (changed[field]) {
+            memcpy(values_[field], value, sizeof(value));
+            anyChanged = true;
+        }
+    }
+    published_ = true;
+
+    bool resyncs = false;
+    if (anyChanged) {
+        size_t length = formatEvent(changed);
+        for (Subscriber& subscriber : subscribers_) {
+            if (!subscriber.stream || !subscriber.telemetry || subscriber.resync) { continue; }
+
+            if (!enqueue(subscriber, event_, length, currentMillis)) {
+                subscriber.resync = true;               // A skipped delta can't be patched up later, owe it everything
+                droppedEvents_++;
+            }
+        }
+    }
+
+    for (Subscriber& subscriber : subscribers_) {
+        resyncs |= subscriber.stream && subscriber.telemetry && subscriber.resync;
+    }
+
+    if (resyncs) {
+        bool fields[TELEMETRY_FIELD_COUNT];
+        memset(fields, true, sizeof(fields));
+        size_t length = formatEvent(fields);
+        for (Subscriber& subscriber : subscribers_) {
+            if (!subscriber.stream || !subscriber.telemetry || !subscriber.resync) { continue; }
+            subscriber.resync = !enqueue(subscriber, event_, length, currentMillis);
+        }
+    }
+
+    for (Subscriber& subscriber : subscribers_) {
+        if (subscriber.stream) { flush(subscriber, currentMillis); }
+    }
+}
+
+void TelemetryStream::update(unsigned long currentMillis) {
+    static const char HEARTBEAT[] = ":\n\n";
+
+    for (Subscriber& subscriber : subscribers_) {
+        if (!subscriber.stream) { continue; }
+
+        if (!subscriber.stream->connected()) {
+            drop(subscriber);
+            continue;
+        }
+
+        if (subscriber.logs) { sendLogs(subscriber, currentMillis); }
+        if (subscriber.queued == 0 && currentMillis - subscriber.lastWrite >= STREAM_HEARTBEAT_INTERVAL) {
+            enqueue(subscriber, HEARTBEAT, sizeof(HEARTBEAT) - 1, currentMillis);
+        }
+
+        flush(subscriber, currentMillis);
+        if (subscriber.queued > 0 && currentMillis - subscriber.lastProgress >= STREAM_STALL_TIMEOUT) {
+            drop(subscriber);
+        }
+    }
+}
+
+size_t TelemetryStream::getSubscriberCount() const {
+    size_t count = 0;
+    for (const Subscriber& subscriber : subscribers_) {
+        if (subscriber.stream) { count++; }
+    }
+    return count;
+}
+
+size_t TelemetryStream::formatEvent(const bool* fields) {
+    size_t length = snprintf(event_, sizeof(event_), "event: telemetry\ndata: {");
+    bool first = true;
+    for (uint8_t field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+        if (!fields[field]) { continue; }
+
+        length += snprintf(event_ + length, sizeof(event_) - length, first ? "\"%s\":\"" : ",\"%s\":\"",
+            PumpManager::telemetryFieldName((TelemetryField)field));
+        length += escapeJson(event_ + length, sizeof(event_) - length, values_[field]);
+        event_[length++] = '"';
+        first = false;
+    }
+
+    event_[length++] = '}';
+    event_[length++] = '\n';
+    event_[length++] = '\n';
+    return length;
+}
+
+void TelemetryStream::sendLogs(Subscriber& subscriber, unsigned long currentMillis) {
+    LogManager& logManager = LogManager::getInstance();
+    uint32_t nextLog = logManager.getNextSequence();
+    LogRecord record;
+
+    while (subscriber.logSequence < nextLog) {
+        if (!logManager.copyRecord(subscriber.logSequence, record)) {
+            // Overwritten before this subscriber got to it, carry on from the oldest still held
+            uint32_t oldest = nextLog - logManager.getCount();
+            subscriber.logSequence = subscriber.logSequence + 1 > oldest ? subscriber.logSequence + 1 : oldest;
+            continue;
+        }
+
+        size_t length = snprintf(event_, sizeof(event_), "event: log\ndata: ");
+        length += LogManager::formatJson(event_ + length, sizeof(event_) - length, record);
+        event_[length++] = '\n';
+        event_[length++] = '\n';
+
+        if (!enqueue(subscriber, event_, length, currentMillis)) { break; }    // Waits for the socket, logs aren't dropped
+        subscriber.logSequence++;
+    }
+}
+
+bool TelemetryStream::enqueue(Subscriber& subscriber, const char* data, size_t length, unsigned long currentMillis) {
+    if (subscriber.queued + length > sizeof(subscriber.outbox)) { return false; }
+
+    memcpy(subscriber.outbox + subscriber.queued, data, length);
+    subscriber.queued += length;
+    subscriber.lastWrite = currentMillis;
+    return true;
+}
+
+void TelemetryStream::flush(Subscriber& subscriber, unsigned long currentMillis) {
+    if (subscriber.queued > 0) {
+        size_t sent = subscriber.stream->write(subscriber.outbox, subscriber.queued);
+        if (sent == 0) { return; }
+
+        subscriber.queued -= sent;
+        memmove(subscriber.outbox, subscriber.outbox + sent, subscriber.queued);
+    }
+    subscriber.lastProgress = currentMillis;
+}
+
+void TelemetryStream::drop(Subscriber& subscriber) {
+    subscriber.stream->close();
+    subscriber.stream = nullptr;
+    subscriber.queued = 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef TelemetryStream_h
+#define TelemetryStream_h
+
+#include <Arduino.h>
+#include "hal/HAL.h"
+#include "util/config.h"
+#include "util/LogManager/LogManager.h"
+#include "PumpManager/Telemetry.h"
+
+// Server-sent events for /api/stream. Each control tick pushes a "telemetry"
+// event holding only the fields whose formatted value changed, subscribers
+// that asked for logs also get a "log" event per new entry.
+//
+// Every subscriber has a fixed outbox that update() drains into its socket
+// without blocking. An event that doesn't fit is dropped and the subscriber
+// is owed a full snapshot, which it gets once there is room again. A socket
+// that takes nothing for STREAM_STALL_TIMEOUT is closed.
+class TelemetryStream {
+public:
+    TelemetryStream();
+
+    // From the request handler. false if every slot is taken, nothing is sent then.
+    bool subscribe(hal::HttpServer& server, bool telemetry, bool logs, uint32_t logSince);
+    void publish(const Telemetry& telemetry, unsigned long currentMillis);
+    void update(unsigned long currentMillis);
+
+    size_t getSubscriberCount() const;
+    uint32_t getDroppedEvents() const { return droppedEvents_; }
+
+private:
+    struct Subscriber {
+        hal::HttpStream* stream;                // nullptr when the slot is free
+        bool telemetry;                         // Wants telemetry events
+        bool logs;                              // Wants log events
+        bool resync;                            // Missed a telemetry event, next one must carry every field
+        uint32_t logSequence;                   // Next log entry to send
+        unsigned long lastProgress;             // millis the socket last took bytes, or the outbox was empty
+        unsigned long lastWrite;                // millis anything was queued, for the heartbeat
+        size_t queued;
+        char outbox[STREAM_OUTBOX_SIZE];
+    };
+
+    static const size_t EVENT_MAX_LENGTH = 64 + TELEMETRY_FIELD_COUNT * (24 + TELEMETRY_VALUE_MAX_LENGTH);
+    static_assert(EVENT_MAX_LENGTH >= LogManager::LOG_JSON_MAX_LENGTH + 24, "Events must have room for a log entry");
+    static_assert(STREAM_OUTBOX_SIZE >= EVENT_MAX_LENGTH, "STREAM_OUTBOX_SIZE must hold the largest event");
+
+    Subscriber subscribers_[STREAM_MAX_CLIENTS];
+    char values_[TELEMETRY_FIELD_COUNT][TELEMETRY_VALUE_MAX_LENGTH];   // As last published
+    bool published_;                            // values_ holds a snapshot
+    char event_[EVENT_MAX_LENGTH];              // Scratch for building events
+    uint32_t droppedEvents_;
+
+    size_t formatEvent(const bool* fields);     // Telemetry event of the flagged fields into event_
+    void sendLogs(Subscriber& subscriber, unsigned long currentMillis);
+    bool enqueue(Subscriber& subscriber, const char* data, size_t length, unsigned long currentMillis);
+    void flush(Subscriber& subscriber, unsigned long currentMillis);
+    void drop(Subscriber& subscriber);
+};
+
+#endif // TelemetryStream_h
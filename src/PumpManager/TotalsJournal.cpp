@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "PumpManager/TotalsJournal.h"
+
+TotalsJournal::TotalsJournal(hal::FlashRegion& flash)
+    : flash_(flash),
+    ready_(false),
+    sectorCount_(0),
+    recordsPerSector_(0),
+    sector_(0),
+    slot_(0),
+    sequence_(0),
+    totals_(),
+    journaled_(),
+    replayedRecords_(0),
+    recordsWritten_(0) {}
+
+bool TotalsJournal::begin() {
+    if (!flash_.begin() || flash_.sectorSize() < 2 * sizeof(Record)) { return false; }
+
+    sectorCount_ = flash_.size() / flash_.sectorSize();
+    recordsPerSector_ = flash_.sectorSize() / sizeof(Record);
+    if (sectorCount_ < 2) { return false; }
+
+    // Newest sector is the one whose checkpoint has the highest sequence
+    Record record;
+    bool found = false;
+    for (size_t sector = 0; sector < sectorCount_; sector++) {
+        if (!readRecord(sector, 0, record) || record.type != CHECKPOINT) { continue; }
+        if (!found || (int32_t)(record.sequence - sequence_) > 0) {
+            found = true;
+            sector_ = sector;
+            sequence_ = record.sequence;
+        }
+    }
+
+    if (!found) {
+        // Blank or unreadable region, start over from zero
+        ready_ = startSector(0);
+        return ready_;
+    }
+
+    readRecord(sector_, 0, record);
+    totals_.milliLitres = record.milliLitres;
+    totals_.energyJoules = record.energyJoules;
+    totals_.pumpSeconds = record.pumpSeconds;
+    replayedRecords_ = 1;
+
+    // Apply deltas until the first slot that isn't the next record in sequence
+    for (slot_ = 1; slot_ < recordsPerSector_; slot_++) {
+        if (!readRecord(sector_, slot_, record) || record.type != DELTA || record.sequence != sequence_ + 1) { break; }
+
+        totals_.milliLitres += record.milliLitres;
+        totals_.energyJoules += record.energyJoules;
+        totals_.pumpSeconds += record.pumpSeconds;
+        sequence_ = record.sequence;
+        replayedRecords_++;
+    }
+
+    // A torn write leaves a slot that is neither valid nor erased, never program over it
+    if (slot_ < recordsPerSector_ && !isErased(sector_, slot_)) {
+        slot_ = recordsPerSector_;
+    }
+
+    journaled_ = totals_;
+    ready_ = true;
+    return true;
+}
+
+void TotalsJournal::add(uint32_t milliLitres, int32_t energyJoules, uint32_t pumpSeconds) {
+    totals_.milliLitres += milliLitres;
+    totals_.energyJoules += energyJoules;
+    totals_.pumpSeconds += pumpSeconds;
+}
+
+bool TotalsJournal::flush() {
+    if (!ready_) { return false; }
+
+    Totals delta;
+    delta.milliLitres = totals_.milliLitres - journaled_.milliLitres;
+    delta.energyJoules = totals_.energyJoules - journaled_.energyJoules;
+    delta.pumpSeconds = totals_.pumpSeconds - journaled_.pumpSeconds;
+    if (delta.milliLitres == 0 && delta.energyJoules == 0 && delta.pumpSeconds == 0) { return true; }    // Nothing to wear the flash for
+
+    bool ok;
+    if (slot_ >= recordsPerSector_) {
+        ok = startSector((sector_ + 1) % sectorCount_);     // Checkpoint carries the full totals
+    } else {
+        ok = writeRecord(DELTA, delta);
+    }
+
+    if (!ok) {
+        slot_ = recordsPerSector_;              // Whatever was half written stays behind, retry in a fresh sector
+        return false;
+    }
+    return true;
+}
+
+bool TotalsJournal::startSector(size_t sector) {
+    if (!flash_.eraseSector(sector)) { return false; }
+
+    sector_ = sector;
+    slot_ = 0;
+    return writeRecord(CHECKPOINT, totals_);
+}
+
+bool TotalsJournal::writeRecord(RecordType type, const Totals& values) {
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.sequence = sequence_ + 1;
+    record.milliLitres = values.milliLitres;
+    record.energyJoules = values.energyJoules;
+    record.pumpSeconds = values.pumpSeconds;
+    record.crc = crc32((const uint8_t*)&record, offsetof(Record, crc));
+
+    if (!flash_.write(sector_ * flash_.sectorSize() + slot_ * sizeof(Record), &record, sizeof(record))) { return false; }
+
+    sequence_ = record.sequence;
+    slot_++;
+    recordsWritten_++;
+
+    // Snapshot the live totals as journaled, adds since flush() started come in the next record
+    if (type == CHECKPOINT) {
+        journaled_ = values;
+    } else {
+        journaled_.milliLitres += values.milliLitres;
+        journaled_.energyJoules += values.energyJoules;
+        journaled_.pumpSeconds += values.pumpSeconds;
+    }
+    return true;
+}
+
+bool TotalsJournal::readRecord(size_t sector, size_t slot, Record& record) {
+    if (!flash_.read(sector * flash_.sectorSize() + slot * sizeof(Record), &record, sizeof(record))) { return false; }
+    return crc32((const uint8_t*)&record, offsetof(Record, crc)) == record.crc;
+}
+
+bool TotalsJournal::isErased(size_t sector, size_t slot) {
+    uint8_t bytes[sizeof(Record)];
+    if (!flash_.read(sector * flash_.sectorSize() + slot * sizeof(Record), bytes, sizeof(bytes))) { return false; }
+
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        if (bytes[i] != 0xFF) { return false; }
+    }
+    return true;
+}
+
+uint32_t TotalsJournal::crc32(const uint8_t* data, size_t length) {
+    // Bitwise CRC-32 (IEEE), a record every few minutes doesn't justify a table
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
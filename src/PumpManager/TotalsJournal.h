@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef TotalsJournal_h
+#define TotalsJournal_h
+
+#include <Arduino.h>
+#include "hal/HAL.h"
+#include "util/config.h"
+
+// Lifetime totals kept in an append-only journal on raw flash.
+//
+// Every sector opens with a checkpoint holding the full totals, followed by
+// delta records. Records are 32 bytes with a CRC, and each one carries a
+// sequence number that increases by one. At boot only the newest sector is
+// replayed (its checkpoint plus at most one sector of deltas), so replay time
+// is bounded no matter how long the device has run. Sectors are used round
+// robin, so erases are spread evenly across the region.
+class TotalsJournal {
+public:
+    struct Totals {
+        uint64_t milliLitres;                   // Water pumped
+        int64_t energyJoules;                   // Net heat captured
+        uint32_t pumpSeconds;                   // Pump run time
+    };
+
+    explicit TotalsJournal(hal::FlashRegion& flash);
+
+    bool begin();                               // Replays the journal, false if the flash region is unusable
+    bool flush();                               // Appends changed totals, the owner calls it every JOURNAL_INTERVAL
+
+    void add(uint32_t milliLitres, int32_t energyJoules, uint32_t pumpSeconds);
+    const Totals& getTotals() const { return totals_; }
+
+    uint32_t getReplayedRecords() const { return replayedRecords_; }
+    uint32_t getRecordsWritten() const { return recordsWritten_; }
+
+private:
+    enum RecordType : uint8_t { CHECKPOINT = 0xC1, DELTA = 0xD1 };
+
+    struct Record {
+        uint8_t type;
+        uint8_t reserved[3];
+        uint32_t sequence;
+        uint64_t milliLitres;
+        int64_t energyJoules;
+        uint32_t pumpSeconds;
+        uint32_t crc;                           // CRC-32 of everything above
+    };
+    static_assert(sizeof(Record) == 32, "Journal records must stay 32 bytes");
+
+    hal::FlashRegion& flash_;
+    bool ready_;
+    size_t sectorCount_;
+    size_t recordsPerSector_;
+    size_t sector_;                             // Sector being appended to
+    size_t slot_;                               // Next free record slot in it, recordsPerSector_ forces a new sector
+    uint32_t sequence_;                         // Sequence of the last record written or replayed
+
+    Totals totals_;                             // Live totals
+    Totals journaled_;                          // Totals as of the last record on flash
+    uint32_t replayedRecords_;
+    uint32_t recordsWritten_;
+
+    bool readRecord(size_t sector, size_t slot, Record& record);
+    bool writeRecord(RecordType type, const Totals& values);
+    bool startSector(size_t sector);
+    bool isErased(size_t sector, size_t slot);
+    static uint32_t crc32(const uint8_t* data, size_t length);
+};
+
+#endif // TotalsJournal_h
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef HAL_h
+#define HAL_h
+
+#include <Arduino.h>
+#include <functional>
+
+// Thin hardware abstraction layer. The managers only talk to the board through
+// these interfaces, hal/esp32 implements them on the real hardware and hal/native
+// provides fakes so the control logic builds and runs on Linux (env:native).
+namespace hal {
+
+class Clock {
+public:
+    virtual ~Clock() = default;
+
+    virtual unsigned long millis() = 0;
+    virtual unsigned long micros() = 0;
+    virtual uint32_t cycles() = 0;                  // Free running cycle counter, for timing short sections
+    virtual uint32_t cyclesPerMicro() = 0;          // At the current clock, it drops in low power
+    virtual void delay(unsigned long ms) = 0;
+    // Fixed rate sleep for periodic tasks: wakes at wakeMs + periodMs and moves wakeMs
+    // there. If that time has already gone it returns false straight away and the
+    // schedule restarts from now. Start wakeMs from millis().
+    virtual bool delayUntil(unsigned long& wakeMs, unsigned long periodMs) = 0;
+
+    virtual void beginNetworkTime() = 0;            // Prepare the NTP client
+    virtual bool networkTimeReady() = 0;            // True when the network is up and a sync can be attempted
+    virtual bool syncNetworkTime() = 0;             // Blocking NTP round trip, true on success
+    virtual unsigned long epochTime() = 0;          // Seconds since 1970 (plus TIMEZONE_OFFSET)
+};
+
+enum class PinMode { Input, InputPullup, Output };
+
+class Gpio {
+public:
+    virtual ~Gpio() = default;
+
+    virtual void setMode(uint8_t pin, PinMode mode) = 0;
+    virtual void write(uint8_t pin, bool high) = 0;
+    virtual bool read(uint8_t pin) = 0;
+};
+
+class TempBus {
+public:
+    virtual ~TempBus() = default;
+
+    virtual void begin() = 0;
+    virtual unsigned long conversionTime() = 0;                                 // ms a conversion takes at the current resolution
+    virtual void startConversion() = 0;                                         // Broadcast convert T, returns immediately
+    virtual bool readScratchpad(const uint8_t* address, uint8_t* scratchPad) = 0;   // 9 bytes, false if nothing answered
+    virtual size_t search(uint8_t (*addresses)[8], size_t max) = 0;            // ROM codes on the bus with a good CRC, up to max
+
+    // Dallas/Maxim CRC8 (polynomial x^8 + x^5 + x^4 + 1), same as OneWire::crc8
+    static uint8_t crc8(const uint8_t* data, uint8_t length) {
+        uint8_t crc = 0;
+        while (length--) {
+            uint8_t inbyte = *data++;
+            for (uint8_t i = 8; i; i--) {
+                uint8_t mix = (crc ^ inbyte) & 0x01;
+                crc >>= 1;
+                if (mix) { crc ^= 0x8C; }
+                inbyte >>= 1;
+            }
+        }
+        return crc;
+    }
+};
+
+struct PulseReading {
+    uint32_t count;                                 // Pulses since the last take()
+    unsigned long lastMicros;                       // micros() at the latest of them, only set when count > 0
+};
+
+class PulseInput {
+public:
+    virtual ~PulseInput() = default;
+
+    virtual bool attach(uint8_t pin) = 0;           // Start counting rising edges on pin
+    virtual PulseReading take(uint8_t pin) = 0;     // Pulses since the last call, read and reset atomically
+    virtual void setWakeOnPulse(bool enabled) = 0;  // Keep counting through light sleep, each edge wakes the CPU
+};
+
+class Power {
+public:
+    virtual ~Power() = default;
+
+    // Low power lets the CPU clock drop while nothing needs it and light sleep
+    // whenever every task is blocked, waking for the next timeout, a network
+    // packet or a pulse. WiFi stays associated in modem sleep. Returns true if
+    // light sleep is actually on, the clock scaling alone may be all a build has.
+    virtual bool setLowPower(bool enabled) = 0;
+    virtual bool lowPower() = 0;                    // Set by setLowPower(), polling tasks stretch their intervals
+};
+
+struct HeapInfo {
+    uint32_t freeBytes;
+    uint32_t largestFreeBlock;                      // Biggest single allocation that can still succeed
+    uint32_t minimumFreeBytes;                      // Lowest freeBytes has been since boot
+};
+
+struct TaskInfo {
+    const char* name;                               // As given to startTask()
+    uint32_t stackFreeBytes;                        // Least unused stack the task has had, 0 if unknown
+    uint32_t allocations;                           // Heap allocations made on the task since boot
+};
+
+class System {
+public:
+    virtual ~System() = default;
+
+    virtual HeapInfo heap() = 0;
+    // Tasks started with startTask(), up to max of them. Allocations anywhere
+    // else, the framework's own tasks included, add up in otherAllocations().
+    virtual size_t tasks(TaskInfo* tasks, size_t max) = 0;
+    virtual uint32_t otherAllocations() = 0;
+
+    // Restarts the board keeping up to RETAINED_STATE_SIZE bytes of state, which
+    // restoredState() hands back once after the restart. Never returns.
+    virtual void restart(const void* state, size_t length) = 0;
+    virtual size_t restoredState(void* state, size_t length) = 0;      // 0 if the last reset kept nothing
+
+    static const size_t RETAINED_STATE_SIZE = 192;
+};
+
+// Raw NOR flash set aside for the totals journal, offsets are relative to the
+// region. Writes can only clear bits, eraseSector() sets a sector back to 0xFF.
+class FlashRegion {
+public:
+    virtual ~FlashRegion() = default;
+
+    virtual bool begin() = 0;                       // false if the region is missing
+    virtual size_t size() = 0;
+    virtual size_t sectorSize() = 0;
+    virtual bool read(size_t offset, void* buffer, size_t length) = 0;
+    virtual bool write(size_t offset, const void* data, size_t length) = 0;
+    virtual bool eraseSector(size_t sector) = 0;
+};
+
+// Small named values kept across power cycles and firmware updates, NVS on
+// the ESP32. Writes are slow (a flash commit), keep them to config changes.
+class SettingsStore {
+public:
+    virtual ~SettingsStore() = default;
+
+    virtual bool begin() = 0;
+    virtual size_t get(const char* key, void* value, size_t length) = 0;        // Bytes read, 0 if missing or longer than length
+    virtual bool set(const char* key, const void* value, size_t length) = 0;
+};
+
+enum class HttpMethod { Any, Get, Post };
+
+// A response kept open after its handler returns, for server-sent events.
+// Writes never block, a full socket buffer takes fewer bytes or none.
+class HttpStream {
+public:
+    virtual ~HttpStream() = default;
+
+    virtual bool connected() = 0;
+    virtual size_t write(const char* data, size_t length) = 0;     // Bytes the socket took
+    virtual void close() = 0;                       // Hands the stream back, don't use it afterwards
+};
+
+class HttpServer {
+public:
+    using Handler = std::function<void()>;
+
+    virtual ~HttpServer() = default;
+
+    virtual void on(const char* uri, HttpMethod method, Handler handler) = 0;
+    virtual void onNotFound(Handler handler) = 0;
+    virtual void enableFirmwareUpdate(const char* uri) = 0;     // OTA upload endpoint
+    virtual void begin() = 0;
+    virtual void handleClient(unsigned long waitMs) = 0;       // Serves whatever is ready, waiting up to waitMs for the network
+
+    // Only valid inside a handler, for the request currently being served
+    virtual bool hasArg(const char* name) = 0;
+    virtual const char* arg(const char* name) = 0;                  // Decoded query value, empty if it wasn't sent
+    virtual const char* header(const char* name) = 0;               // Request header, empty if it wasn't sent
+    virtual void sendHeader(const char* name, const char* value) = 0;   // Added to the next response started
+    virtual void send(int code, const char* contentType, const String& content) = 0;
+    virtual void send(int code, const char* contentType, const char* content, size_t length) = 0;     // No String copy
+
+    // Chunked transfer for responses of unknown length, nothing is buffered whole
+    virtual void beginChunked(int code, const char* contentType) = 0;
+    virtual void sendChunk(const char* data, size_t length) = 0;
+    virtual void endChunked() = 0;
+
+    // Sends 200 and the headers, then detaches the connection from the request.
+    // nullptr when STREAM_MAX_CLIENTS streams are already open.
+    virtual HttpStream* beginStream(const char* contentType) = 0;
+};
+
+struct HttpResponse {
+    int status;                                     // HTTP status, negative for connection errors and timeouts
+    unsigned long retryAfterMs;                     // Retry-After from the server, 0 if not given
+};
+
+class HttpClient {
+public:
+    virtual ~HttpClient() = default;
+
+    // Blocking, only call it from a task that is allowed to wait up to timeoutMs
+    virtual HttpResponse post(const char* url, const char* contentType, const char* body, size_t length, unsigned long timeoutMs) = 0;
+};
+
+// Runs function(arg) on its own FreeRTOS task (a thread on the host). The
+// function must never return. core -1 leaves the choice to the scheduler.
+using TaskFunction = void (*)(void* arg);
+bool startTask(const char* name, TaskFunction function, void* arg, uint32_t stackSize, uint8_t priority, int core = -1);
+
+Clock& clock();
+Gpio& gpio();
+TempBus& tempBus();
+PulseInput& pulseInput();
+Power& power();
+System& system();
+FlashRegion& journalFlash();
+SettingsStore& settings();
+HttpServer& httpServer();
+HttpClient& httpClient();
+
+} // namespace hal
+
+#endif // HAL_h
@@ -0,0 +1,801 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "hal/common/SocketHttpServer.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <lwip/sockets.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace hal {
+
+static const char UPLOAD_FORM[] =
+    "<!DOCTYPE html><html><body><form method='POST' enctype='multipart/form-data'>"
+    "<input type='file' name='firmware'> <input type='submit' value='Update'></form></body></html>";
+
+static bool wouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+SocketHttpServer::SocketHttpServer(uint16_t port, FirmwareSink* firmware)
+    : port_(port),
+    firmware_(firmware),
+    firmwareUri_(nullptr),
+    listenFd_(-1),
+    requestsServed_(0),
+    current_(nullptr),
+    request_(nullptr),
+    responded_(false),
+    chunked_(false),
+    failed_(false),
+    extraHeadersLength_(0),
+    outputLength_(0) {
+
+    for (Connection& connection : connections_) {
+        connection.fd = -1;
+        connection.used = 0;
+        connection.upload = NO_UPLOAD;
+        connection.parsed = false;
+        connection.waiting = false;
+    }
+}
+
+void SocketHttpServer::on(const char* uri, HttpMethod method, Handler handler) {
+    routes_.push_back({ uri, method, handler });
+}
+
+void SocketHttpServer::enableFirmwareUpdate(const char* uri) {
+    if (firmware_) { firmwareUri_ = uri; }
+}
+
+void SocketHttpServer::begin() {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0) { return; }
+
+    int reuse = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port_);
+
+    if (bind(listenFd_, (sockaddr*)&address, sizeof(address)) < 0 || listen(listenFd_, HTTP_MAX_CONNECTIONS) < 0) {
+        ::close(listenFd_);
+        listenFd_ = -1;
+        return;
+    }
+    setNonBlocking(listenFd_);
+}
+
+void SocketHttpServer::handleClient(unsigned long waitMs) {
+    if (listenFd_ < 0) {
+        hal::clock().delay(waitMs);
+        return;
+    }
+
+    // New connections are only taken while there is a slot, or a keep-alive one that has been idle
+    // for HTTP_EVICT_IDLE to give up. Otherwise they wait in the listen backlog.
+    bool canAccept = false;
+    fd_set readable;
+    FD_ZERO(&readable);
+    int maxFd = -1;
+    unsigned long startMillis = hal::clock().millis();
+    for (Connection& connection : connections_) {
+        if (connection.fd < 0 || evictable(connection, startMillis)) { canAccept = true; }
+        if (connection.fd < 0) { continue; }
+
+        FD_SET(connection.fd, &readable);
+        maxFd = connection.fd > maxFd ? connection.fd : maxFd;
+    }
+    if (canAccept) {
+        FD_SET(listenFd_, &readable);
+        maxFd = listenFd_ > maxFd ? listenFd_ : maxFd;
+    }
+
+    timeval timeout = { (long)(waitMs / 1000), (long)(waitMs % 1000) * 1000 };
+    int ready = select(maxFd + 1, &readable, nullptr, nullptr, &timeout);
+    unsigned long currentMillis = hal::clock().millis();
+
+    if (ready > 0) {
+        for (Connection& connection : connections_) {
+            if (connection.fd >= 0 && FD_ISSET(connection.fd, &readable)) {
+                receive(connection, currentMillis);
+            }
+        }
+        if (canAccept && FD_ISSET(listenFd_, &readable)) {
+            acceptConnection(currentMillis);
+        }
+    }
+
+    // Idle keep-alive connections get a while to send their next request. A new connection's
+    // first request must be complete within HTTP_REQUEST_TIMEOUT, as must any request from its
+    // first byte, however slowly it trickles in, so half-open clients can't hold a slot.
+    // An upload only has to keep moving.
+    for (Connection& connection : connections_) {
+        if (connection.fd < 0) { continue; }
+
+        bool expired;
+        if (connection.upload != NO_UPLOAD) {
+            expired = currentMillis - connection.lastActivity >= HTTP_REQUEST_TIMEOUT;
+        } else if (connection.used > 0 || !connection.waiting) {
+            expired = currentMillis - connection.requestStart >= HTTP_REQUEST_TIMEOUT;
+        } else {
+            expired = currentMillis - connection.lastActivity >= HTTP_KEEPALIVE_TIMEOUT;
+        }
+        if (expired) { closeConnection(connection); }
+    }
+}
+
+void SocketHttpServer::acceptConnection(unsigned long currentMillis) {
+    Connection* slot = nullptr;
+    for (Connection& connection : connections_) {
+        if (connection.fd < 0) {
+            slot = &connection;
+            break;
+        }
+        if (evictable(connection, currentMillis) && (!slot || connection.lastActivity < slot->lastActivity)) { slot = &connection; }
+    }
+    if (!slot) { return; }
+
+    int fd = ::accept(listenFd_, nullptr, nullptr);
+    if (fd < 0) { return; }
+
+    if (slot->fd >= 0) { closeConnection(*slot); }     // Longest idle keep-alive connection makes way
+
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    setNonBlocking(fd);
+
+    slot->fd = fd;
+    slot->lastActivity = currentMillis;
+    slot->requestStart = currentMillis;
+    slot->used = 0;
+    slot->upload = NO_UPLOAD;
+    slot->parsed = false;
+    slot->waiting = false;
+}
+
+void SocketHttpServer::receive(Connection& connection, unsigned long currentMillis) {
+    // An upload never reads past its body, whatever follows is the next request
+    size_t room = HTTP_REQUEST_BUFFER - connection.used;
+    if (connection.upload != NO_UPLOAD) {
+        size_t left = connection.bodyRemaining > connection.used ? connection.bodyRemaining - connection.used : 0;
+        room = left < room ? left : room;
+    }
+    if (room == 0) { return; }
+
+    ssize_t received = recv(connection.fd, connection.buffer + connection.used, room, 0);
+    if (received < 0 && wouldBlock()) { return; }
+    if (received <= 0) {
+        closeConnection(connection);
+        return;
+    }
+
+    if (connection.used == 0) { connection.requestStart = currentMillis; }
+    connection.waiting = false;
+    connection.used += received;
+    connection.lastActivity = currentMillis;
+
+    if (connection.upload != NO_UPLOAD) {
+        continueUpload(connection);
+        return;
+    }
+
+    // Pipelined requests are answered in order
+    while (serveNext(connection, currentMillis)) {}
+}
+
+bool SocketHttpServer::serveNext(Connection& connection, unsigned long currentMillis) {
+    Request& request = connection.request;
+
+    if (!connection.parsed) {
+        if (findBlankLine(connection.buffer, connection.used) == SIZE_MAX) {
+            if (connection.used >= HTTP_REQUEST_BUFFER) { reject(connection, 431, "Request headers too large"); }
+            return false;
+        }
+
+        int status = parse(connection);
+        if (status != 0) {
+            reject(connection, status, statusText(status));
+            return false;
+        }
+        connection.parsed = true;
+
+        if (firmwareUri_ && request.method == HttpMethod::Post && strcmp(request.path, firmwareUri_) == 0) {
+            startUpload(connection);
+            return false;
+        }
+        if (request.contentLength > HTTP_REQUEST_BUFFER - request.length) {
+            reject(connection, 413, "Request body too large");
+            return false;
+        }
+    }
+
+    size_t total = request.length + request.contentLength;
+    if (connection.used < total) { return false; }       // Body still arriving
+
+    dispatch(connection);
+    connection.parsed = false;
+
+    if (connection.fd < 0) {                            // Handed to beginStream()
+        connection.used = 0;
+        return false;
+    }
+    if (failed_ || !connection.keepAlive) {
+        closeConnection(connection);
+        return false;
+    }
+
+    consume(connection, total);
+    connection.lastActivity = currentMillis;
+    connection.requestStart = currentMillis;            // For a pipelined request already in the buffer
+    connection.waiting = true;
+    return connection.used > 0;
+}
+
+int SocketHttpServer::parse(Connection& connection) {
+    Request& request = connection.request;
+    char* buffer = connection.buffer;
+    size_t end = findBlankLine(buffer, connection.used);
+    if (memchr(buffer, '\0', end) != nullptr) { return 400; }     // The line parsing below relies on strstr
+    request.length = end + 4;
+    buffer[end + 2] = '\0';                             // Every line below still ends in \r\n
+
+    // Request line: METHOD target HTTP/1.x
+    char* lineEnd = strstr(buffer, "\r\n");
+    *lineEnd = '\0';
+    char* target = strchr(buffer, ' ');
+    if (!target) { return 400; }
+    *target++ = '\0';
+    char* version = strchr(target, ' ');
+    if (!version) { return 400; }
+    *version++ = '\0';
+    if (strncmp(version, "HTTP/1.", 7) != 0) { return 505; }
+
+    request.head = strcmp(buffer, "HEAD") == 0;
+    if (strcmp(buffer, "GET") == 0 || request.head) {
+        request.method = HttpMethod::Get;
+    } else if (strcmp(buffer, "POST") == 0) {
+        request.method = HttpMethod::Post;
+    } else {
+        return 405;
+    }
+
+    char* query = strchr(target, '?');
+    if (query) { *query++ = '\0'; }
+    request.path = target;
+    request.argCount = 0;
+    if (query) { parseQuery(query, request); }
+
+    // HTTP/1.1 keeps the connection by default, 1.0 only when asked
+    connection.keepAlive = version[7] != '0';
+    request.headerCount = 0;
+    request.contentLength = 0;
+
+    char* line = lineEnd + 2;
+    while (*line) {
+        lineEnd = strstr(line, "\r\n");
+        *lineEnd = '\0';
+
+        char* colon = strchr(line, ':');
+        if (colon && request.headerCount < MAX_HEADERS) {
+            *colon = '\0';
+            char* value = colon + 1;
+            while (*value == ' ' || *value == '\t') { value++; }
+
+            request.headerNames[request.headerCount] = line;
+            request.headerValues[request.headerCount] = value;
+            request.headerCount++;
+
+            if (strcasecmp(line, "Connection") == 0) {
+                if (strncasecmp(value, "close", 5) == 0) { connection.keepAlive = false; }
+                if (strncasecmp(value, "keep-alive", 10) == 0) { connection.keepAlive = true; }
+            } else if (strcasecmp(line, "Content-Length") == 0) {
+                if (!parseLength(value, request.contentLength)) { return 400; }
+            } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+                return 411;                             // Chunked request bodies aren't supported
+            }
+        }
+        line = lineEnd + 2;
+    }
+    return 0;
+}
+
+void SocketHttpServer::dispatch(Connection& connection) {
+    const Request& request = connection.request;
+    current_ = &connection;
+    request_ = &request;
+    responded_ = false;
+    chunked_ = false;
+    failed_ = false;
+
+    Handler handler = notFound_;
+    for (const Route& route : routes_) {
+        if (strcmp(route.uri, request.path) == 0 && (route.method == HttpMethod::Any || route.method == request.method)) {
+            handler = route.handler;
+            break;
+        }
+    }
+
+    if (firmwareUri_ && strcmp(request.path, firmwareUri_) == 0) {
+        sendUploadForm();
+    } else if (handler) {
+        handler();
+    } else {
+        send(404, "text/plain", "Not found", 9);
+    }
+
+    if (chunked_) { endChunked(); }
+    if (!responded_) { send(500, "text/plain", "No response", 11); }
+    flush();
+
+    requestsServed_++;
+    current_ = nullptr;
+    request_ = nullptr;
+    extraHeadersLength_ = 0;
+}
+
+void SocketHttpServer::consume(Connection& connection, size_t length) {
+    connection.used -= length;
+    memmove(connection.buffer, connection.buffer + length, connection.used);
+}
+
+void SocketHttpServer::reject(Connection& connection, int code, const char* message) {
+    current_ = &connection;
+    request_ = nullptr;
+    responded_ = false;
+    failed_ = false;
+    extraHeadersLength_ = 0;
+    connection.keepAlive = false;
+
+    send(code, "text/plain", message, strlen(message));
+    flush();
+
+    current_ = nullptr;
+    closeConnection(connection);
+}
+
+void SocketHttpServer::closeConnection(Connection& connection) {
+    if (connection.upload == UPLOAD_IMAGE || connection.upload == UPLOAD_TRAILER) {
+        firmware_->abort();                             // Client went away or broke the upload part way
+    }
+    if (connection.fd >= 0) { ::close(connection.fd); }
+    connection.fd = -1;
+    connection.used = 0;
+    connection.upload = NO_UPLOAD;
+    connection.parsed = false;
+    connection.waiting = false;
+}
+
+size_t SocketHttpServer::getOpenConnections() const {
+    size_t open = 0;
+    for (const Connection& connection : connections_) {
+        if (connection.fd >= 0) { open++; }
+    }
+    for (const SocketHttpStream& stream : streams_) {
+        if (stream.inUse()) { open++; }
+    }
+    return open;
+}
+
+
+// Firmware upload, streamed to the sink as it arrives rather than buffered.
+// Takes a raw image body, or multipart/form-data with the image as its only part.
+
+void SocketHttpServer::startUpload(Connection& connection) {
+    const Request& request = connection.request;
+    if (request.contentLength == 0) {
+        reject(connection, 411, "Length required");
+        return;
+    }
+
+    connection.upload = UPLOAD_IMAGE;
+    connection.trailerLength = 0;
+
+    const char* contentType = findHeader(request, "Content-Type");
+    if (contentType && strncasecmp(contentType, "multipart/form-data", 19) == 0) {
+        const char* boundary = strstr(contentType, "boundary=");
+        if (!boundary) {
+            reject(connection, 400, "Missing multipart boundary");
+            return;
+        }
+
+        // The image is followed by \r\n--boundary--\r\n, so its size is known once the part headers are in
+        size_t boundaryLength = strlen(boundary + 9);
+        if (boundary[9] == '"' && boundaryLength >= 2) { boundaryLength -= 2; }
+        connection.trailerLength = boundaryLength + 8;
+        connection.upload = UPLOAD_PREAMBLE;
+    }
+
+    const char* expect = findHeader(request, "Expect");
+    if (expect && strncasecmp(expect, "100-continue", 12) == 0) {
+        static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        sendAll(connection.fd, CONTINUE, sizeof(CONTINUE) - 1);
+    }
+
+    connection.bodyRemaining = request.contentLength;
+    connection.parsed = false;
+    consume(connection, request.length);
+
+    if (connection.upload == UPLOAD_IMAGE) {
+        connection.imageRemaining = connection.bodyRemaining;
+        if (!firmware_->begin(connection.imageRemaining)) {
+            reject(connection, 413, "Image doesn't fit");
+            return;
+        }
+    }
+    continueUpload(connection);
+}
+
+void SocketHttpServer::continueUpload(Connection& connection) {
+    if (connection.upload == UPLOAD_PREAMBLE) {
+        size_t end = findBlankLine(connection.buffer, connection.used);
+        if (end == SIZE_MAX) {
+            if (connection.used >= HTTP_REQUEST_BUFFER || connection.used >= connection.bodyRemaining) {
+                reject(connection, 400, "Malformed multipart body");
+            }
+            return;
+        }
+
+        size_t preamble = end + 4;
+        if (connection.bodyRemaining <= preamble + connection.trailerLength) {
+            reject(connection, 400, "Empty upload");
+            return;
+        }
+
+        connection.bodyRemaining -= preamble;
+        connection.imageRemaining = connection.bodyRemaining - connection.trailerLength;
+        consume(connection, preamble);
+
+        connection.upload = UPLOAD_IMAGE;
+        if (!firmware_->begin(connection.imageRemaining)) {
+            reject(connection, 413, "Image doesn't fit");
+            return;
+        }
+    }
+
+    if (connection.upload == UPLOAD_IMAGE) {
+        size_t take = connection.used < connection.imageRemaining ? connection.used : connection.imageRemaining;
+        if (take > 0 && !firmware_->write((const uint8_t*)connection.buffer, take)) {
+            reject(connection, 500, "Flash write failed");
+            return;
+        }
+
+        connection.imageRemaining -= take;
+        connection.bodyRemaining -= take;
+        consume(connection, take);
+        if (connection.imageRemaining > 0) { return; }
+        connection.upload = UPLOAD_TRAILER;
+    }
+
+    if (connection.used < connection.bodyRemaining) { return; }
+
+    // Whatever follows the image must be the closing boundary, not more of the file
+    bool complete = connection.trailerLength == 0
+        || (strncmp(connection.buffer, "\r\n--", 4) == 0 && strncmp(connection.buffer + connection.bodyRemaining - 4, "--\r\n", 4) == 0);
+    consume(connection, connection.bodyRemaining);
+    connection.bodyRemaining = 0;
+    finishUpload(connection, complete);
+}
+
+void SocketHttpServer::finishUpload(Connection& connection, bool complete) {
+    connection.upload = NO_UPLOAD;
+    bool accepted = false;
+    if (complete) {
+        accepted = firmware_->end();
+    } else {
+        firmware_->abort();
+    }
+
+    current_ = &connection;
+    request_ = nullptr;
+    responded_ = false;
+    failed_ = false;
+    extraHeadersLength_ = 0;
+    connection.keepAlive = false;
+
+    if (accepted) {
+        send(200, "text/plain", "Update complete, restarting", 27);
+    } else {
+        send(500, "text/plain", "Update failed", 13);
+    }
+    flush();
+
+    current_ = nullptr;
+    closeConnection(connection);
+    if (accepted) { firmware_->apply(); }
+}
+
+void SocketHttpServer::sendUploadForm() {
+    send(200, "text/html", UPLOAD_FORM, sizeof(UPLOAD_FORM) - 1);
+}
+
+
+// Responses
+
+bool SocketHttpServer::hasArg(const char* name) {
+    return request_ && findArg(*request_, name);
+}
+
+const char* SocketHttpServer::arg(const char* name) {
+    const char* value = request_ ? findArg(*request_, name) : nullptr;
+    return value ? value : "";
+}
+
+const char* SocketHttpServer::header(const char* name) {
+    const char* value = request_ ? findHeader(*request_, name) : nullptr;
+    return value ? value : "";
+}
+
+void SocketHttpServer::sendHeader(const char* name, const char* value) {
+    int length = snprintf(extraHeaders_ + extraHeadersLength_, sizeof(extraHeaders_) - extraHeadersLength_, "%s: %s\r\n", name, value);
+    if (length > 0 && extraHeadersLength_ + length < sizeof(extraHeaders_)) {
+        extraHeadersLength_ += length;
+    }
+}
+
+void SocketHttpServer::send(int code, const char* contentType, const String& content) {
+    send(code, contentType, content.c_str(), content.length());
+}
+
+void SocketHttpServer::send(int code, const char* contentType, const char* content, size_t length) {
+    if (!current_ || responded_) { return; }
+
+    writeHead(code, contentType, length);
+    if (!request_ || !request_->head) {
+        write(content, length);
+    }
+}
+
+void SocketHttpServer::beginChunked(int code, const char* contentType) {
+    if (!current_ || responded_) { return; }
+
+    writeHead(code, contentType, -1);
+    chunked_ = true;
+}
+
+void SocketHttpServer::sendChunk(const char* data, size_t length) {
+    if (!chunked_ || length == 0 || (request_ && request_->head)) { return; }
+
+    char size[12];
+    write(size, snprintf(size, sizeof(size), "%lx\r\n", (unsigned long)length));
+    write(data, length);
+    write("\r\n", 2);
+}
+
+void SocketHttpServer::endChunked() {
+    if (!chunked_) { return; }
+
+    chunked_ = false;
+    if (!request_ || !request_->head) {
+        write("0\r\n\r\n", 5);
+    }
+}
+
+HttpStream* SocketHttpServer::beginStream(const char* contentType) {
+    if (!current_ || responded_) { return nullptr; }
+
+    for (SocketHttpStream& stream : streams_) {
+        if (stream.inUse()) { continue; }
+
+        sendHeader("Cache-Control", "no-cache");
+        writeHead(200, contentType, -2);
+        flush();
+        if (failed_) { return nullptr; }
+
+        // The socket is the stream's from here on, the connection slot is free again
+        stream.open(current_->fd);
+        current_->fd = -1;
+        return &stream;
+    }
+    return nullptr;
+}
+
+void SocketHttpServer::writeHead(int code, const char* contentType, long contentLength) {
+    char head[160];
+    int length = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n", code, statusText(code), contentType);
+    if (contentLength == -1) {
+        length += snprintf(head + length, sizeof(head) - length, "Transfer-Encoding: chunked\r\n");
+    } else if (contentLength >= 0 && code != 204 && code != 304) {
+        length += snprintf(head + length, sizeof(head) - length, "Content-Length: %ld\r\n", contentLength);
+    }
+
+    // A stream's end is the connection closing
+    bool keepAlive = current_->keepAlive && contentLength != -2;
+    length += snprintf(head + length, sizeof(head) - length, "Connection: %s\r\n", keepAlive ? "keep-alive" : "close");
+    current_->keepAlive = keepAlive;
+
+    write(head, length < (int)sizeof(head) ? length : sizeof(head) - 1);
+    write(extraHeaders_, extraHeadersLength_);
+    write("\r\n", 2);
+    extraHeadersLength_ = 0;
+    responded_ = true;
+}
+
+void SocketHttpServer::write(const char* data, size_t length) {
+    if (failed_ || !current_ || current_->fd < 0) { return; }
+
+    // Small writes are gathered so a response goes out in as few segments as it can
+    if (outputLength_ + length > OUTPUT_BUFFER_SIZE) { flush(); }
+    if (length > OUTPUT_BUFFER_SIZE) {
+        failed_ = failed_ || !sendAll(current_->fd, data, length);
+        return;
+    }
+
+    memcpy(output_ + outputLength_, data, length);
+    outputLength_ += length;
+}
+
+void SocketHttpServer::flush() {
+    if (outputLength_ > 0 && !failed_ && current_ && current_->fd >= 0) {
+        failed_ = !sendAll(current_->fd, output_, outputLength_);
+    }
+    outputLength_ = 0;
+}
+
+bool SocketHttpServer::sendAll(int fd, const char* data, size_t length) {
+    // Waits for the client to make room, but gives up once it has taken nothing for HTTP_SEND_TIMEOUT
+    unsigned long lastProgress = hal::clock().millis();
+    while (length > 0) {
+        ssize_t sent = ::send(fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent > 0) {
+            data += sent;
+            length -= sent;
+            lastProgress = hal::clock().millis();
+            continue;
+        }
+        if (sent < 0 && !wouldBlock()) { return false; }
+
+        unsigned long waited = hal::clock().millis() - lastProgress;
+        if (waited >= HTTP_SEND_TIMEOUT) { return false; }
+
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(fd, &writable);
+        unsigned long remaining = HTTP_SEND_TIMEOUT - waited;
+        timeval timeout = { (long)(remaining / 1000), (long)(remaining % 1000) * 1000 };
+        select(fd + 1, nullptr, &writable, nullptr, &timeout);
+    }
+    return true;
+}
+
+size_t SocketHttpServer::findBlankLine(const char* data, size_t length) {
+    for (size_t i = 0; i + 4 <= length; i++) {
+        if (data[i] == '\r' && data[i + 1] == '\n' && data[i + 2] == '\r' && data[i + 3] == '\n') { return i; }
+    }
+    return SIZE_MAX;
+}
+
+bool SocketHttpServer::parseLength(const char* value, size_t& length) {
+    length = 0;
+    const char* digit = value;
+    for (; *digit >= '0' && *digit <= '9'; digit++) {
+        size_t next = length * 10 + (size_t)(*digit - '0');
+        if (length > SIZE_MAX / 10 || next < length * 10) { return false; }
+        length = next;
+    }
+    while (*digit == ' ' || *digit == '\t') { digit++; }
+    return digit != value && *digit == '\0';
+}
+
+const char* SocketHttpServer::findHeader(const Request& request, const char* name) {
+    for (uint8_t i = 0; i < request.headerCount; i++) {
+        if (strcasecmp(request.headerNames[i], name) == 0) { return request.headerValues[i]; }
+    }
+    return nullptr;
+}
+
+void SocketHttpServer::parseQuery(char* query, Request& request) {
+    while (*query && request.argCount < MAX_ARGS) {
+        char* end = strchr(query, '&');
+        if (end) { *end++ = '\0'; } else { end = query + strlen(query); }
+        char* value = strchr(query, '=');
+        if (value) { *value++ = '\0'; } else { value = query + strlen(query); }
+
+        request.argNames[request.argCount] = query;
+        request.argValues[request.argCount] = value;
+        request.argCount++;
+
+        // Percent decoding, + is a space in query strings. Never longer than the original
+        char* out = value;
+        for (const char* c = value; *c; c++) {
+            if (*c == '+') {
+                *out++ = ' ';
+            } else if (*c == '%' && isxdigit((unsigned char)c[1]) && isxdigit((unsigned char)c[2])) {
+                char hex[3] = { c[1], c[2], '\0' };
+                *out++ = (char)strtol(hex, nullptr, 16);
+                c += 2;
+            } else {
+                *out++ = *c;
+            }
+        }
+        *out = '\0';
+        query = end;
+    }
+}
+
+const char* SocketHttpServer::findArg(const Request& request, const char* name) {
+    for (uint8_t i = 0; i < request.argCount; i++) {
+        if (strcmp(request.argNames[i], name) == 0) { return request.argValues[i]; }
+    }
+    return nullptr;
+}
+
+const char* SocketHttpServer::statusText(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
+        default: return "Unknown";
+    }
+}
+
+
+// Event streams
+
+bool SocketHttpStream::connected() {
+    if (fd_ < 0) { return false; }
+
+    // A closed peer reads as end of file, anything it sent on a stream is ignored
+    char byte;
+    ssize_t peeked = recv(fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return peeked > 0 || (peeked < 0 && wouldBlock());
+}
+
+size_t SocketHttpStream::write(const char* data, size_t length) {
+    if (fd_ < 0) { return 0; }
+
+    ssize_t sent = ::send(fd_, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return sent > 0 ? sent : 0;
+}
+
+void SocketHttpStream::close() {
+    if (fd_ >= 0) { ::close(fd_); }
+    fd_ = -1;
+}
+
+} // namespace hal
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef SocketHttpServer_h
+#define SocketHttpServer_h
+
+#include <Arduino.h>
+#include <vector>
+#include "hal/HAL.h"
+#include "util/config.h"
+
+namespace hal {
+
+// Takes the firmware image posted to the enableFirmwareUpdate() URI, a piece
+// at a time as it arrives.
+class FirmwareSink {
+public:
+    virtual ~FirmwareSink() = default;
+
+    virtual bool begin(size_t size) = 0;            // false if an image of this size can't be taken
+    virtual bool write(const uint8_t* data, size_t length) = 0;
+    virtual bool end() = 0;                         // true if the whole image checked out
+    virtual void abort() = 0;                       // Upload failed or the client went away
+    virtual void apply() = 0;                       // Once the response is out, boots the new image
+};
+
+// A connection handed over by beginStream(), the server no longer reads it
+class SocketHttpStream : public HttpStream {
+public:
+    bool connected() override;
+    size_t write(const char* data, size_t length) override;
+    void close() override;
+
+    void open(int fd) { fd_ = fd; }
+    bool inUse() const { return fd_ >= 0; }
+
+private:
+    int fd_ = -1;
+};
+
+// Event driven HTTP/1.1 server over BSD sockets, lwip on the ESP32 and POSIX
+// on the host. One select() covers the listening socket and every connection,
+// so nothing waits on a slow client while another has a request ready:
+// requests are read and parsed as bytes arrive, keep-alive connections are
+// reused, and half-open or idle ones are closed on timeouts.
+//
+// Responses are not asynchronous. A handler writes its whole response before
+// it returns, so a client that stops reading blocks the server until it makes
+// room again or HTTP_SEND_TIMEOUT passes without progress. No other connection
+// is served in the meantime. That stall repeats for every window the socket
+// won't take, so a slow reader of a large body such as a /api/history CSV can
+// hold the server for far longer. Event streams are the exception: they have
+// outboxes of their own and never block.
+//
+// Handlers run on whichever task calls handleClient(), give the server a task
+// of its own rather than the control loop.
+class SocketHttpServer : public HttpServer {
+public:
+    SocketHttpServer(uint16_t port, FirmwareSink* firmware);
+
+    void on(const char* uri, HttpMethod method, Handler handler) override;
+    void onNotFound(Handler handler) override { notFound_ = handler; }
+    void enableFirmwareUpdate(const char* uri) override;
+    void begin() override;
+    void handleClient(unsigned long waitMs) override;
+
+    bool hasArg(const char* name) override;
+    const char* arg(const char* name) override;
+    const char* header(const char* name) override;
+    void sendHeader(const char* name, const char* value) override;
+    void send(int code, const char* contentType, const String& content) override;
+    void send(int code, const char* contentType, const char* content, size_t length) override;
+
+    void beginChunked(int code, const char* contentType) override;
+    void sendChunk(const char* data, size_t length) override;
+    void endChunked() override;
+    HttpStream* beginStream(const char* contentType) override;
+
+    size_t getOpenConnections() const;
+    uint32_t getRequestsServed() const { return requestsServed_; }
+
+private:
+    static const uint8_t MAX_HEADERS = 16;
+    static const uint8_t MAX_ARGS = 16;
+    static const size_t OUTPUT_BUFFER_SIZE = 1460;  // One TCP segment, headers and small bodies leave in one send
+
+    enum UploadPhase : uint8_t { NO_UPLOAD, UPLOAD_PREAMBLE, UPLOAD_IMAGE, UPLOAD_TRAILER };
+
+    struct Request {
+        HttpMethod method;
+        bool head;                              // HEAD, the body is left out
+        const char* path;
+        const char* argNames[MAX_ARGS];         // Query string, split and decoded in place
+        const char* argValues[MAX_ARGS];
+        uint8_t argCount;
+        const char* headerNames[MAX_HEADERS];
+        const char* headerValues[MAX_HEADERS];
+        uint8_t headerCount;
+        size_t length;                          // Request line and headers, up to and including the blank line
+        size_t contentLength;
+    };
+
+    struct Connection {
+        int fd;                                 // -1 when the slot is free
+        unsigned long lastActivity;             // millis of the last byte in or response out
+        unsigned long requestStart;             // millis the first byte of the pending request arrived
+        size_t used;                            // Bytes held in buffer
+        UploadPhase upload;                     // Firmware upload in progress on this connection
+        size_t bodyRemaining;                   // Upload bytes still to arrive
+        size_t imageRemaining;                  // Of those, image bytes for the sink
+        size_t trailerLength;                   // Multipart closing boundary after the image
+        bool keepAlive;                         // Left open after the current response
+        bool waiting;                           // Kept alive after a response, nothing of the next request yet
+        bool parsed;                            // request holds the headers, the body is still arriving
+        Request request;                        // Points into buffer
+        char buffer[HTTP_REQUEST_BUFFER + 1];   // +1 so the request can be terminated in place
+    };
+
+    struct Route {
+        const char* uri;
+        HttpMethod method;
+        Handler handler;
+    };
+
+    uint16_t port_;
+    FirmwareSink* firmware_;
+    const char* firmwareUri_;                   // nullptr until enableFirmwareUpdate()
+    int listenFd_;
+    std::vector<Route> routes_;
+    Handler notFound_;
+    Connection connections_[HTTP_MAX_CONNECTIONS];
+    SocketHttpStream streams_[STREAM_MAX_CLIENTS];
+    uint32_t requestsServed_;
+
+    // The request being served, only set while a handler runs
+    Connection* current_;
+    const Request* request_;
+    bool responded_;                            // Status line is out
+    bool chunked_;                              // Chunked response still open
+    bool failed_;                               // Client stopped taking bytes, the connection is closed after the handler
+    char extraHeaders_[512];                    // sendHeader() lines for the next response
+    size_t extraHeadersLength_;
+    char output_[OUTPUT_BUFFER_SIZE];
+    size_t outputLength_;
+
+    void acceptConnection(unsigned long currentMillis);
+    void receive(Connection& connection, unsigned long currentMillis);
+    bool serveNext(Connection& connection, unsigned long currentMillis);
+    int parse(Connection& connection);                  // 0, or the status to reject the request with
+    void dispatch(Connection& connection);
+    void consume(Connection& connection, size_t length);
+    void reject(Connection& connection, int code, const char* message);
+    void closeConnection(Connection& connection);
+    static bool evictable(const Connection& connection, unsigned long currentMillis) {     // Idle keep-alive a newcomer may take over
+        return connection.waiting && connection.used == 0 && currentMillis - connection.lastActivity >= HTTP_EVICT_IDLE;
+    }
+
+    void startUpload(Connection& connection);
+    void continueUpload(Connection& connection);
+    void finishUpload(Connection& connection, bool complete);
+    void sendUploadForm();
+
+    void writeHead(int code, const char* contentType, long contentLength);     // -1 chunked, -2 left open
+    void write(const char* data, size_t length);
+    void flush();
+    bool sendAll(int fd, const char* data, size_t length);
+    static size_t findBlankLine(const char* data, size_t length);    // Offset of the \r\n\r\n ending the headers, SIZE_MAX if none yet
+    static bool parseLength(const char* value, size_t& length);     // Digits only, false if empty, malformed or past SIZE_MAX
+    static const char* findHeader(const Request& request, const char* name);
+    static void parseQuery(char* query, Request& request);
+    static const char* findArg(const Request& request, const char* name);
+    static const char* statusText(int code);
+};
+
+} // namespace hal
+
+#endif // SocketHttpServer_h
@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "hal/esp32/ESP32HAL.h"
+
+namespace hal {
+
+// Clock
+
+ESP32Clock::ESP32Clock()
+    : ntpUDP_(),
+    timeClient_(ntpUDP_, NTP_SERVER, TIMEZONE_OFFSET) {}
+
+unsigned long ESP32Clock::millis() { return ::millis(); }
+unsigned long ESP32Clock::micros() { return ::micros(); }
+uint32_t ESP32Clock::cycles() { return ESP.getCycleCount(); }
+uint32_t ESP32Clock::cyclesPerMicro() { return ets_get_cpu_frequency(); }
+void ESP32Clock::delay(unsigned long ms) { ::delay(ms); }
+
+bool ESP32Clock::delayUntil(unsigned long& wakeMs, unsigned long periodMs) {
+    // Wakes on the RTOS tick itself rather than a delay from whenever the caller got round to it
+    TickType_t wake = wakeMs / portTICK_PERIOD_MS;
+    TickType_t period = periodMs / portTICK_PERIOD_MS;
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(now - (wake + period)) > 0) {
+        wakeMs = now * portTICK_PERIOD_MS;
+        return false;
+    }
+
+    vTaskDelayUntil(&wake, period);
+    wakeMs = wake * portTICK_PERIOD_MS;
+    return true;
+}
+
+void ESP32Clock::beginNetworkTime() {
+    timeClient_.begin();
+}
+
+bool ESP32Clock::networkTimeReady() {
+    return WiFi.status() == WL_CONNECTED;
+}
+
+bool ESP32Clock::syncNetworkTime() {
+    return timeClient_.forceUpdate();
+}
+
+unsigned long ESP32Clock::epochTime() {
+    return timeClient_.getEpochTime();
+}
+
+
+// GPIO
+
+void ESP32Gpio::setMode(uint8_t pin, PinMode mode) {
+    switch (mode) {
+        case PinMode::Input: pinMode(pin, INPUT); break;
+        case PinMode::InputPullup: pinMode(pin, INPUT_PULLUP); break;
+        case PinMode::Output: pinMode(pin, OUTPUT); break;
+    }
+}
+
+void ESP32Gpio::write(uint8_t pin, bool high) {
+    digitalWrite(pin, high ? HIGH : LOW);
+}
+
+bool ESP32Gpio::read(uint8_t pin) {
+    return digitalRead(pin) == HIGH;
+}
+
+
+// OneWire temperature bus
+
+ESP32TempBus::ESP32TempBus()
+    : oneWire_(ONE_WIRE_BUS_PIN),
+    sensors_(&oneWire_) {}
+
+void ESP32TempBus::begin() {
+    sensors_.begin();
+    sensors_.setWaitForConversion(false);   // requestTemperatures() returns straight away, callers time the conversion
+}
+
+unsigned long ESP32TempBus::conversionTime() {
+    return sensors_.millisToWaitForConversion(sensors_.getResolution());
+}
+
+void ESP32TempBus::startConversion() {
+    sensors_.requestTemperatures();
+}
+
+bool ESP32TempBus::readScratchpad(const uint8_t* address, uint8_t* scratchPad) {
+    return sensors_.readScratchPad(address, scratchPad);
+}
+
+size_t ESP32TempBus::search(uint8_t (*addresses)[8], size_t max) {
+    uint8_t address[8];
+    size_t found = 0;
+
+    oneWire_.reset_search();
+    while (found < max && oneWire_.search(address)) {
+        if (crc8(address, 7) != address[7]) { continue; }      // Garbled by noise, the next search will see it
+        memcpy(addresses[found++], address, 8);
+    }
+
+    sensors_.begin();                           // Picks up the resolution of anything newly attached
+    return found;
+}
+
+
+// Pulse input
+
+void IRAM_ATTR ESP32PulseInput::onPulse(void* arg) {
+    Channel* channel = static_cast<Channel*>(arg);
+    uint32_t now = esp_timer_get_time();
+
+    // take() can run on either core, the spinlock keeps count and timestamp together
+    portENTER_CRITICAL_ISR(channel->mux);
+    if (!channel->levelTriggered) {
+        channel->count++;
+        channel->lastMicros = now;
+    } else {
+        // Fired on the level opposite to the last one seen, wait for the next change
+        // from here so each edge interrupts once
+        channel->high = !channel->high;
+        if (channel->high) {
+            channel->count++;
+            channel->lastMicros = now;
+        }
+        GPIO.pin[channel->pin].int_type = channel->high ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
+    }
+    portEXIT_CRITICAL_ISR(channel->mux);
+}
+
+bool ESP32PulseInput::attach(uint8_t pin) {
+    if (channelCount_ >= MAX_CHANNELS) { return false; }
+
+    Channel& channel = channels_[channelCount_++];
+    channel.pin = pin;
+    channel.mux = &mux_;
+    channel.count = 0;
+    channel.lastMicros = 0;
+    channel.levelTriggered = false;
+
+    pinMode(pin, INPUT_PULLUP);
+    attachInterruptArg(digitalPinToInterrupt(pin), ESP32PulseInput::onPulse, &channel, RISING);
+    return true;
+}
+
+PulseReading ESP32PulseInput::take(uint8_t pin) {
+    for (uint8_t i = 0; i < channelCount_; i++) {
+        if (channels_[i].pin != pin) { continue; }
+
+        // Count and timestamp from the same interrupt, the ISR takes mux_ too so nothing lands between them on either core
+        portENTER_CRITICAL(&mux_);
+        PulseReading reading = { channels_[i].count, channels_[i].lastMicros };
+        channels_[i].count = 0;
+        portEXIT_CRITICAL(&mux_);
+        return reading;
+    }
+    return { 0, 0 };
+}
+
+void ESP32PulseInput::setWakeOnPulse(bool enabled) {
+    for (uint8_t i = 0; i < channelCount_; i++) {
+        Channel& channel = channels_[i];
+        gpio_num_t pin = (gpio_num_t)channel.pin;
+
+        portENTER_CRITICAL(&mux_);
+        if (enabled) {
+            channel.high = gpio_get_level(pin);
+            channel.levelTriggered = true;
+            gpio_wakeup_enable(pin, channel.high ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+        } else {
+            gpio_wakeup_disable(pin);
+            channel.levelTriggered = false;
+            gpio_set_intr_type(pin, GPIO_INTR_POSEDGE);
+        }
+        portEXIT_CRITICAL(&mux_);
+    }
+
+    if (enabled) {
+        esp_sleep_enable_gpio_wakeup();
+    }
+}
+
+
+// Power
+
+bool ESP32Power::setLowPower(bool enabled) {
+    // Full speed whenever a driver holds a lock (WiFi does while it's busy), otherwise
+    // the clock drops to LOW_POWER_MIN_CPU_FREQ and idle light sleeps
+    esp_pm_config_esp32_t config = {};
+    config.max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+    config.min_freq_mhz = enabled ? LOW_POWER_MIN_CPU_FREQ : CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+    config.light_sleep_enable = enabled;
+
+    esp_err_t err = esp_pm_configure(&config);
+    if (err == ESP_ERR_NOT_SUPPORTED && enabled) {
+        // Light sleep needs tickless idle, which the stock Arduino core is built without
+        config.light_sleep_enable = false;
+        err = esp_pm_configure(&config);
+    }
+
+    if (enabled) {
+        WiFi.setSleep(WIFI_PS_MIN_MODEM);       // Radio off between DTIM beacons, the AP keeps us associated
+    }
+
+    lowPower_.store(enabled, std::memory_order_relaxed);
+    return err == ESP_OK && config.light_sleep_enable;
+}
+
+
+// System
+
+static ESP32System systemInstance;
+
+// Survives a software restart, not a power cycle. magic is only valid for a
+// restart asked for through restart(), anything else may leave garbage here.
+struct RetainedState {
+    uint32_t magic;
+    uint32_t length;
+    uint32_t checksum;
+    uint8_t data[System::RETAINED_STATE_SIZE];
+};
+
+static const uint32_t RETAINED_MAGIC = 0x52535431;     // "RST1"
+RTC_NOINIT_ATTR static RetainedState retained;
+
+static uint32_t retainedChecksum(const uint8_t* data, size_t length) {
+    uint32_t hash = 2166136261u;                // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+HeapInfo ESP32System::heap() {
+    HeapInfo info;
+    info.freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    info.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    info.minimumFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    return info;
+}
+
+size_t ESP32System::tasks(TaskInfo* tasks, size_t max) {
+    size_t count = taskCount_.load(std::memory_order_acquire);
+    if (count > max) { count = max; }
+
+    for (size_t i = 0; i < count; i++) {
+        tasks[i].name = tasks_[i].name;
+        tasks[i].stackFreeBytes = uxTaskGetStackHighWaterMark(tasks_[i].handle);     // Stack is counted in bytes on the ESP32
+        tasks[i].allocations = tasks_[i].allocations.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+void ESP32System::addTask(const char* name, TaskHandle_t handle) {
+    // Only startTask() adds, and tasks are started one at a time during setup
+    uint8_t count = taskCount_.load(std::memory_order_relaxed);
+    if (count >= MAX_TASKS) { return; }
+
+    tasks_[count].name = name;
+    tasks_[count].handle = handle;
+    taskCount_.store(count + 1, std::memory_order_release);
+}
+
+void IRAM_ATTR ESP32System::countAllocation() {
+    // NULL before the scheduler starts, which counts as other
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    uint8_t count = taskCount_.load(std::memory_order_acquire);
+    for (uint8_t i = 0; i < count; i++) {
+        if (tasks_[i].handle == current) {
+            tasks_[i].allocations.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    otherAllocations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ESP32System::restart(const void* state, size_t length) {
+    if (length > sizeof(retained.data)) { length = 0; }
+
+    memcpy(retained.data, state, length);
+    retained.length = length;
+    retained.checksum = retainedChecksum(retained.data, length);
+    retained.magic = RETAINED_MAGIC;
+    esp_restart();
+}
+
+size_t ESP32System::restoredState(void* state, size_t length) {
+    bool valid = retained.magic == RETAINED_MAGIC && esp_reset_reason() == ESP_RST_SW &&
+        retained.length <= sizeof(retained.data) && retained.checksum == retainedChecksum(retained.data, retained.length);
+    retained.magic = 0;                         // Handed back once
+
+    if (!valid || retained.length > length) { return 0; }
+    memcpy(state, retained.data, retained.length);
+    return retained.length;
+}
+
+} // namespace hal
+
+// Linked with --wrap (see platformio.ini) so every heap allocation, the
+// framework's included, is counted against the task that made it
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+void* IRAM_ATTR __wrap_malloc(size_t size) {
+    hal::systemInstance.countAllocation();
+    return __real_malloc(size);
+}
+
+void* IRAM_ATTR __wrap_calloc(size_t count, size_t size) {
+    hal::systemInstance.countAllocation();
+    return __real_calloc(count, size);
+}
+
+void* IRAM_ATTR __wrap_realloc(void* pointer, size_t size) {
+    hal::systemInstance.countAllocation();
+    return __real_realloc(pointer, size);
+}
+}
+
+namespace hal {
+
+
+// Journal flash
+
+bool ESP32FlashRegion::begin() {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, JOURNAL_PARTITION_LABEL);
+    return partition_ != nullptr;
+}
+
+bool ESP32FlashRegion::read(size_t offset, void* buffer, size_t length) {
+    return partition_ && esp_partition_read(partition_, offset, buffer, length) == ESP_OK;
+}
+
+bool ESP32FlashRegion::write(size_t offset, const void* data, size_t length) {
+    return partition_ && esp_partition_write(partition_, offset, data, length) == ESP_OK;
+}
+
+bool ESP32FlashRegion::eraseSector(size_t sector) {
+    return partition_ && esp_partition_erase_range(partition_, sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE) == ESP_OK;
+}
+
+
+// Settings
+
+bool ESP32SettingsStore::begin() {
+    if (!ready_) { ready_ = preferences_.begin(SETTINGS_NAMESPACE, false); }
+    return ready_;
+}
+
+size_t ESP32SettingsStore::get(const char* key, void* value, size_t length) {
+    if (!ready_ || !preferences_.isKey(key)) { return 0; }
+
+    size_t stored = preferences_.getBytesLength(key);
+    if (stored == 0 || stored > length) { return 0; }
+    return preferences_.getBytes(key, value, stored);
+}
+
+bool ESP32SettingsStore::set(const char* key, const void* value, size_t length) {
+    return ready_ && preferences_.putBytes(key, value, length) == length;
+}
+
+
+// Firmware update
+
+bool ESP32FirmwareSink::begin(size_t size) {
+    return Update.begin(size);
+}
+
+bool ESP32FirmwareSink::write(const uint8_t* data, size_t length) {
+    return Update.write((uint8_t*)data, length) == length;
+}
+
+bool ESP32FirmwareSink::end() {
+    return Update.end();                                // Checks the image and marks it for the next boot
+}
+
+void ESP32FirmwareSink::abort() {
+    Update.abort();
+}
+
+void ESP32FirmwareSink::apply() {
+    ::delay(100);                                       // Let the response leave before the radio goes down
+    ESP.restart();
+}
+
+
+// HTTP client
+
+HttpResponse ESP32HttpClient::post(const char* url, const char* contentType, const char* body, size_t length, unsigned long timeoutMs) {
+    if (WiFi.status() != WL_CONNECTED) { return { HTTPC_ERROR_NOT_CONNECTED, 0 }; }
+
+    WiFiClient plainClient;
+    WiFiClientSecure secureClient;
+    bool secure = strncmp(url, "https://", 8) == 0;
+    if (secure) {
+        secureClient.setInsecure();     // Webhook payloads aren't secret, skip shipping a CA bundle
+    }
+
+    HTTPClient http;
+    const char* headers[] = { "Retry-After" };
+    http.setConnectTimeout(timeoutMs);
+    http.setTimeout(timeoutMs);
+
+    if (!http.begin(secure ? (WiFiClient&)secureClient : plainClient, url)) {
+        return { HTTPC_ERROR_CONNECTION_REFUSED, 0 };
+    }
+
+    http.collectHeaders(headers, 1);
+    http.addHeader("Content-Type", contentType);
+
+    HttpResponse response = { http.POST((uint8_t*)body, length), 0 };
+    if (http.hasHeader("Retry-After")) {
+        response.retryAfterMs = http.header("Retry-After").toInt() * 1000UL;
+    }
+
+    http.end();
+    return response;
+}
+
+
+// Tasks
+
+bool startTask(const char* name, TaskFunction function, void* arg, uint32_t stackSize, uint8_t priority, int core) {
+    BaseType_t affinity = core < 0 ? tskNO_AFFINITY : core;
+    TaskHandle_t handle;
+    if (xTaskCreatePinnedToCore(function, name, stackSize, arg, priority, &handle, affinity) != pdPASS) { return false; }
+
+    systemInstance.addTask(name, handle);
+    return true;
+}
+
+
+// Accessors
+
+Clock& clock() { static ESP32Clock instance; return instance; }
+Gpio& gpio() { static ESP32Gpio instance; return instance; }
+TempBus& tempBus() { static ESP32TempBus instance; return instance; }
+PulseInput& pulseInput() { static ESP32PulseInput instance; return instance; }
+Power& power() { static ESP32Power instance; return instance; }
+System& system() { return systemInstance; }
+FlashRegion& journalFlash() { static ESP32FlashRegion instance; return instance; }
+SettingsStore& settings() { static ESP32SettingsStore instance; return instance; }
+HttpServer& httpServer() { static ESP32FirmwareSink firmware; static SocketHttpServer instance(80, &firmware); return instance; }
+HttpClient& httpClient() { static ESP32HttpClient instance; return instance; }
+
+} // namespace hal
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef ESP32HAL_h
+#define ESP32HAL_h
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <esp_partition.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_heap_caps.h>
+#include <esp32/rom/ets_sys.h>
+#include <driver/gpio.h>
+#include <soc/gpio_struct.h>
+#include <atomic>
+#include <Update.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+#include <WiFiClientSecure.h>
+#include <NTPClient.h>
+#include <OneWire.h>
+#include <DallasTemperature.h>
+#include "hal/HAL.h"
+#include "hal/common/SocketHttpServer.h"
+#include "util/config.h"
+
+namespace hal {
+
+class ESP32Clock : public Clock {
+public:
+    ESP32Clock();
+
+    unsigned long millis() override;
+    unsigned long micros() override;
+    uint32_t cycles() override;
+    uint32_t cyclesPerMicro() override;
+    void delay(unsigned long ms) override;
+    bool delayUntil(unsigned long& wakeMs, unsigned long periodMs) override;
+
+    void beginNetworkTime() override;
+    bool networkTimeReady() override;
+    bool syncNetworkTime() override;
+    unsigned long epochTime() override;
+
+private:
+    WiFiUDP ntpUDP_;
+    NTPClient timeClient_;
+};
+
+class ESP32Gpio : public Gpio {
+public:
+    void setMode(uint8_t pin, PinMode mode) override;
+    void write(uint8_t pin, bool high) override;
+    bool read(uint8_t pin) override;
+};
+
+class ESP32TempBus : public TempBus {
+public:
+    ESP32TempBus();
+
+    void begin() override;
+    unsigned long conversionTime() override;
+    void startConversion() override;
+    bool readScratchpad(const uint8_t* address, uint8_t* scratchPad) override;
+    size_t search(uint8_t (*addresses)[8], size_t max) override;
+
+private:
+    OneWire oneWire_;
+    DallasTemperature sensors_;
+};
+
+class ESP32PulseInput : public PulseInput {
+public:
+    bool attach(uint8_t pin) override;
+    PulseReading take(uint8_t pin) override;
+    void setWakeOnPulse(bool enabled) override;
+
+private:
+    // Light sleep can only wake on a GPIO level, not an edge, so while waking
+    // the interrupt follows the pin level instead and counts each low to high
+    struct Channel {
+        uint8_t pin;
+        portMUX_TYPE* mux;                      // The owner's mux_, the interrupt is only handed the Channel
+        volatile uint32_t count;
+        volatile uint32_t lastMicros;           // Of the latest pulse, from the interrupt
+        volatile bool levelTriggered;           // Waking from light sleep, see onPulse
+        volatile bool high;                     // Level the pin was last seen at while levelTriggered
+    };
+
+    static const uint8_t MAX_CHANNELS = 4;
+    Channel channels_[MAX_CHANNELS] = {};
+    uint8_t channelCount_ = 0;
+    portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;     // Spinlock, the interrupt may run on the other core to take()
+
+    static void IRAM_ATTR onPulse(void* arg);     // Interrupt service routine, arg is the Channel
+};
+
+class ESP32Power : public Power {
+public:
+    bool setLowPower(bool enabled) override;
+    bool lowPower() override { return lowPower_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> lowPower_{false};
+};
+
+// Constant initialised, the malloc wrappers use it from before static
+// constructors run
+class ESP32System : public System {
+public:
+    HeapInfo heap() override;
+    size_t tasks(TaskInfo* tasks, size_t max) override;
+    uint32_t otherAllocations() override { return otherAllocations_.load(std::memory_order_relaxed); }
+    void restart(const void* state, size_t length) override;
+    size_t restoredState(void* state, size_t length) override;
+
+    void addTask(const char* name, TaskHandle_t handle);     // From startTask()
+    void IRAM_ATTR countAllocation();                       // From the malloc wrappers, must not allocate itself
+
+private:
+    struct Task {
+        const char* name;
+        TaskHandle_t handle;
+        std::atomic<uint32_t> allocations;
+    };
+
+    static const uint8_t MAX_TASKS = 8;
+    Task tasks_[MAX_TASKS] = {};
+    std::atomic<uint8_t> taskCount_{0};         // Entries in tasks_ that are filled in
+    std::atomic<uint32_t> otherAllocations_{0};
+};
+
+// Data partition labelled JOURNAL_PARTITION_LABEL in partitions.csv
+class ESP32FlashRegion : public FlashRegion {
+public:
+    bool begin() override;
+    size_t size() override { return partition_ ? partition_->size : 0; }
+    size_t sectorSize() override { return SPI_FLASH_SEC_SIZE; }
+    bool read(size_t offset, void* buffer, size_t length) override;
+    bool write(size_t offset, const void* data, size_t length) override;
+    bool eraseSector(size_t sector) override;
+
+private:
+    const esp_partition_t* partition_ = nullptr;
+};
+
+// NVS namespace SETTINGS_NAMESPACE through the Preferences library
+class ESP32SettingsStore : public SettingsStore {
+public:
+    bool begin() override;
+    size_t get(const char* key, void* value, size_t length) override;
+    bool set(const char* key, const void* value, size_t length) override;
+
+private:
+    Preferences preferences_;
+    bool ready_ = false;
+};
+
+// Flashes an uploaded image to the idle OTA partition with the Update library
+class ESP32FirmwareSink : public FirmwareSink {
+public:
+    bool begin(size_t size) override;
+    bool write(const uint8_t* data, size_t length) override;
+    bool end() override;
+    void abort() override;
+    void apply() override;
+};
+
+class ESP32HttpClient : public HttpClient {
+public:
+    HttpResponse post(const char* url, const char* contentType, const char* body, size_t length, unsigned long timeoutMs) override;
+};
+
+} // namespace hal
+
+#endif // ESP32HAL_h
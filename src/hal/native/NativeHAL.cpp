@@ -0,0 +1,714 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "hal/native/NativeHAL.h"
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace hal {
+
+// Clock
+
+FakeClock::FakeClock()
+    : manual_(false),
+    manualMicros_(0),
+    start_(std::chrono::steady_clock::now()),
+    networkAvailable_(true),
+    synced_(false),
+    epochAtSync_(1704067200),       // 2024-01-01 00:00:00 UTC
+    millisAtSync_(0) {}
+
+uint64_t FakeClock::nowMicros() {
+    if (manual_) { return manualMicros_; }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+}
+
+unsigned long FakeClock::millis() { return nowMicros() / 1000; }
+unsigned long FakeClock::micros() { return nowMicros(); }
+
+uint32_t FakeClock::cycles() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+}
+
+void FakeClock::delay(unsigned long ms) {
+    // Only the thread driving manual time moves it, background tasks still sleep in real time
+    if (manual_ && std::this_thread::get_id() == driver_) {
+        advance(ms);
+    } else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+}
+
+bool FakeClock::delayUntil(unsigned long& wakeMs, unsigned long periodMs) {
+    long remaining = (long)(wakeMs + periodMs - millis());
+    if (remaining < 0) {
+        wakeMs = millis();
+        return false;
+    }
+
+    wakeMs += periodMs;
+    delay(remaining);
+    return true;
+}
+
+void FakeClock::setManual(bool manual) {
+    manualMicros_ = nowMicros();
+    driver_ = std::this_thread::get_id();
+    manual_ = manual;
+}
+
+void FakeClock::advanceMicros(uint64_t us) {
+    manualMicros_ += us;
+}
+
+bool FakeClock::syncNetworkTime() {
+    if (!networkAvailable_) { return false; }
+    if (!synced_) {
+        millisAtSync_ = millis();
+        synced_ = true;
+    }
+    return true;
+}
+
+unsigned long FakeClock::epochTime() {
+    return epochAtSync_ + (millis() - millisAtSync_) / 1000;
+}
+
+void FakeClock::setEpoch(unsigned long epoch) {
+    epochAtSync_ = epoch;
+    millisAtSync_ = millis();
+}
+
+
+// GPIO
+
+void FakeGpio::setMode(uint8_t pin, PinMode mode) {
+    if (pin >= PIN_COUNT) { return; }
+    modes_[pin] = mode;
+    if (mode == PinMode::InputPullup) { levels_[pin] = true; }
+}
+
+void FakeGpio::write(uint8_t pin, bool high) {
+    if (pin >= PIN_COUNT || modes_[pin] != PinMode::Output) { return; }
+    levels_[pin] = high;
+}
+
+bool FakeGpio::read(uint8_t pin) {
+    return pin < PIN_COUNT && levels_[pin];
+}
+
+void FakeGpio::setInput(uint8_t pin, bool high) {
+    if (pin >= PIN_COUNT || modes_[pin] == PinMode::Output) { return; }
+    levels_[pin] = high;
+}
+
+
+// OneWire temperature bus
+
+FakeTempBus::Device& FakeTempBus::device(const uint8_t* address) {
+    for (Device& existing : devices_) {
+        if (memcmp(existing.address, address, 8) == 0) { return existing; }
+    }
+
+    Device added = {};
+    memcpy(added.address, address, 8);
+    added.celsius = 85.0f;
+    added.latched = 85 * 16;                        // DS18B20 power-on reset value
+    added.present = true;
+    devices_.push_back(added);
+    return devices_.back();
+}
+
+void FakeTempBus::startConversion() {
+    for (Device& sensor : devices_) {
+        sensor.latched = (int16_t)lroundf(sensor.celsius * 16.0f);
+    }
+}
+
+bool FakeTempBus::readScratchpad(const uint8_t* address, uint8_t* scratchPad) {
+    Device* sensor = nullptr;
+    for (Device& existing : devices_) {
+        if (memcmp(existing.address, address, 8) == 0) { sensor = &existing; }
+    }
+    if (sensor == nullptr || !sensor->present) { return false; }
+
+    scratchPad[0] = sensor->latched & 0xFF;
+    scratchPad[1] = (sensor->latched >> 8) & 0xFF;
+    scratchPad[2] = 0x4B;                           // TH
+    scratchPad[3] = 0x46;                           // TL
+    scratchPad[4] = 0x7F;                           // Config, 12-bit
+    scratchPad[5] = 0xFF;
+    scratchPad[6] = 0x0C;
+    scratchPad[7] = 0x10;
+    scratchPad[8] = crc8(scratchPad, 8);
+
+    if (sensor->corruptNext) {
+        scratchPad[0] ^= 0x01;
+        sensor->corruptNext = false;
+    }
+    return true;
+}
+
+size_t FakeTempBus::search(uint8_t (*addresses)[8], size_t max) {
+    size_t found = 0;
+    for (const Device& sensor : devices_) {
+        if (found == max) { break; }
+        if (sensor.present) { memcpy(addresses[found++], sensor.address, 8); }
+    }
+    return found;
+}
+
+void FakeTempBus::setTemperature(const uint8_t* address, float celsius) {
+    device(address).celsius = celsius;
+}
+
+void FakeTempBus::setPresent(const uint8_t* address, bool present) {
+    device(address).present = present;
+}
+
+void FakeTempBus::corruptNextRead(const uint8_t* address) {
+    device(address).corruptNext = true;
+}
+
+
+// Pulse input
+
+bool FakePulseInput::attach(uint8_t pin) {
+    channels_[pin] = { 0, 0 };
+    return true;
+}
+
+PulseReading FakePulseInput::take(uint8_t pin) {
+    auto channel = channels_.find(pin);
+    if (channel == channels_.end()) { return { 0, 0 }; }
+
+    PulseReading reading = channel->second;
+    channel->second.count = 0;
+    return reading;
+}
+
+void FakePulseInput::addPulses(uint8_t pin, uint32_t pulses) {
+    addPulses(pin, pulses, fakeClock().micros());
+}
+
+void FakePulseInput::addPulses(uint8_t pin, uint32_t pulses, unsigned long lastMicros) {
+    auto channel = channels_.find(pin);
+    if (channel == channels_.end() || pulses == 0) { return; }
+
+    channel->second.count += pulses;
+    channel->second.lastMicros = lastMicros;
+}
+
+
+// Power
+
+bool FakePower::setLowPower(bool enabled) {
+    lowPower_.store(enabled, std::memory_order_relaxed);
+    return false;
+}
+
+
+// System
+
+HeapInfo FakeSystem::heap() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return { freeBytes_, largestFreeBlock_, minimumFreeBytes_ };
+}
+
+void FakeSystem::setHeap(uint32_t freeBytes, uint32_t largestFreeBlock) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    freeBytes_ = freeBytes;
+    largestFreeBlock_ = largestFreeBlock;
+    if (freeBytes < minimumFreeBytes_) { minimumFreeBytes_ = freeBytes; }
+}
+
+size_t FakeSystem::tasks(TaskInfo* tasks, size_t max) {
+    size_t count = taskCount_.load(std::memory_order_acquire);
+    if (count > max) { count = max; }
+
+    for (size_t i = 0; i < count; i++) {
+        tasks[i].name = tasks_[i].name;
+        tasks[i].stackFreeBytes = 0;            // Threads don't report it
+        tasks[i].allocations = tasks_[i].allocations.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+void FakeSystem::addTask(const char* name, std::thread::id id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint8_t count = taskCount_.load(std::memory_order_relaxed);
+    if (count >= MAX_TASKS) { return; }
+
+    tasks_[count].name = name;
+    tasks_[count].id = id;
+    taskCount_.store(count + 1, std::memory_order_release);
+}
+
+void FakeSystem::countAllocation() {
+    std::thread::id current = std::this_thread::get_id();
+    uint8_t count = taskCount_.load(std::memory_order_acquire);
+    for (uint8_t i = 0; i < count; i++) {
+        if (tasks_[i].id == current) {
+            tasks_[i].allocations.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    otherAllocations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FakeSystem::restart(const void* state, size_t length) {
+    setRestoredState(state, length);            // Into the retained buffer, as ESP32System does
+    printf("Restart requested, %zu bytes of state kept\n", length);
+    fflush(stdout);
+    std::_Exit(0);                              // Tasks are still running, skip the static destructors
+}
+
+size_t FakeSystem::restoredState(void* state, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t kept = retained_.size();
+    if (kept == 0 || kept > length) { return 0; }
+
+    memcpy(state, retained_.data(), kept);
+    retained_.clear();
+    return kept;
+}
+
+void FakeSystem::setRestoredState(const void* state, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint8_t* bytes = static_cast<const uint8_t*>(state);
+    retained_.assign(bytes, bytes + length);
+}
+
+
+// HTTP server
+
+void FakeHttpServer::on(const char* uri, HttpMethod method, Handler handler) {
+    routes_.push_back({ uri, method, handler });
+}
+
+bool FakeHttpServer::hasArg(const char* name) {
+    return args_ && args_->count(name) > 0;
+}
+
+const char* FakeHttpServer::arg(const char* name) {
+    if (!args_) { return ""; }
+
+    auto value = args_->find(name);
+    return value == args_->end() ? "" : value->second.c_str();
+}
+
+const char* FakeHttpServer::header(const char* name) {
+    if (!headers_) { return ""; }
+
+    auto value = headers_->find(name);
+    return value == headers_->end() ? "" : value->second.c_str();
+}
+
+void FakeHttpServer::sendHeader(const char* name, const char* value) {
+    response_.headers[name] = value;
+}
+
+void FakeHttpServer::send(int code, const char* contentType, const String& content) {
+    response_.code = code;
+    response_.contentType = contentType;
+    response_.body = content.str();
+}
+
+void FakeHttpServer::send(int code, const char* contentType, const char* content, size_t length) {
+    response_.code = code;
+    response_.contentType = contentType;
+    response_.body.assign(content, length);
+}
+
+void FakeHttpServer::beginChunked(int code, const char* contentType) {
+    response_.code = code;
+    response_.contentType = contentType;
+    response_.body.clear();
+}
+
+void FakeHttpServer::sendChunk(const char* data, size_t length) {
+    response_.body.append(data, length);
+}
+
+HttpStream* FakeHttpServer::beginStream(const char* contentType) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t open = 0;
+    for (const auto& stream : streams_) {
+        if (stream->isOpen()) { open++; }
+    }
+    if (open >= STREAM_MAX_CLIENTS) { return nullptr; }
+
+    response_.code = 200;
+    response_.contentType = contentType;
+    streams_.emplace_back(new FakeHttpStream());
+    return streams_.back().get();
+}
+
+FakeHttpStream* FakeHttpServer::lastStream() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_.empty() ? nullptr : streams_.back().get();
+}
+
+FakeHttpServer::Response FakeHttpServer::request(HttpMethod method, const std::string& uri, const std::map<std::string, std::string>& args,
+    const std::map<std::string, std::string>& headers) {
+    Pending pending = { method, uri, args, headers, { 0, "", "", {} }, false };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_.push_back(&pending);
+    queued_.notify_all();
+    served_.wait(lock, [&pending]() { return pending.done; });
+    return pending.response;
+}
+
+void FakeHttpServer::handleClient(unsigned long waitMs) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queued_.wait_for(lock, std::chrono::milliseconds(waitMs), [this]() { return !pending_.empty(); });
+
+    while (!pending_.empty()) {
+        Pending* pending = pending_.front();
+        pending_.pop_front();
+
+        lock.unlock();                                  // Handlers open streams, which takes the lock
+        serve(*pending);
+        lock.lock();
+
+        pending->done = true;
+        served_.notify_all();
+    }
+}
+
+void FakeHttpServer::serve(Pending& pending) {
+    response_ = { 0, "", "", {} };
+    args_ = &pending.args;
+    headers_ = &pending.headers;
+
+    Handler handler = notFound_;
+    for (const Route& route : routes_) {
+        if (route.uri == pending.uri && (route.method == HttpMethod::Any || pending.method == HttpMethod::Any || route.method == pending.method)) {
+            handler = route.handler;
+            break;
+        }
+    }
+
+    if (handler) {
+        handler();
+    } else {
+        response_ = { 404, "text/plain", "", {} };
+    }
+
+    args_ = nullptr;
+    headers_ = nullptr;
+    pending.response = response_;
+}
+
+bool FakeHttpStream::connected() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return open_ && !hungUp_;
+}
+
+size_t FakeHttpStream::write(const char* data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_ || hungUp_) { return 0; }
+
+    length = length < window_ ? length : window_;
+    received_.append(data, length);
+    if (window_ != SIZE_MAX) { window_ -= length; }
+    return length;
+}
+
+void FakeHttpStream::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_ = false;
+}
+
+void FakeHttpStream::setWindow(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_ = bytes;
+}
+
+void FakeHttpStream::hangUp() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hungUp_ = true;
+}
+
+bool FakeHttpStream::isOpen() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return open_;
+}
+
+std::string FakeHttpStream::received() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return received_;
+}
+
+
+// Firmware update
+
+bool FakeFirmwareSink::begin(size_t size) {
+    expected_ = size;
+    written_ = 0;
+    return true;
+}
+
+bool FakeFirmwareSink::write(const uint8_t* data, size_t length) {
+    (void)data;
+    written_ += length;
+    return written_ <= expected_;
+}
+
+
+// Journal flash
+
+bool FileFlashRegion::begin() {
+    if (file_) { return true; }
+
+    contents_.assign(size_, 0xFF);
+    file_ = fopen(path_.c_str(), "r+b");
+    if (file_) {
+        size_t loaded = fread(contents_.data(), 1, size_, file_);
+        (void)loaded;                                   // A short file just reads as erased past its end
+        return true;
+    }
+
+    file_ = fopen(path_.c_str(), "w+b");
+    return file_ && persist(0, size_);
+}
+
+bool FileFlashRegion::read(size_t offset, void* buffer, size_t length) {
+    if (!file_ || offset + length > size_) { return false; }
+
+    memcpy(buffer, contents_.data() + offset, length);
+    bytesRead_ += length;
+    return true;
+}
+
+bool FileFlashRegion::write(size_t offset, const void* data, size_t length) {
+    if (!file_ || offset + length > size_) { return false; }
+
+    size_t allowed = length < powerBudget_ ? length : powerBudget_;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < allowed; i++) {
+        contents_[offset + i] &= bytes[i];              // NOR programming only clears bits
+    }
+    if (powerBudget_ != SIZE_MAX) { powerBudget_ -= allowed; }
+    bytesWritten_ += allowed;
+
+    return persist(offset, allowed) && allowed == length;
+}
+
+bool FileFlashRegion::eraseSector(size_t sector) {
+    size_t offset = sector * sectorSize();
+    if (!file_ || offset + sectorSize() > size_ || powerBudget_ == 0) { return false; }
+
+    memset(contents_.data() + offset, 0xFF, sectorSize());
+    sectorErases_++;
+    return persist(offset, sectorSize());
+}
+
+bool FileFlashRegion::persist(size_t offset, size_t length) {
+    if (length == 0) { return true; }
+    if (fseek(file_, offset, SEEK_SET) != 0) { return false; }
+
+    bool ok = fwrite(contents_.data() + offset, 1, length, file_) == length;
+    fflush(file_);
+    return ok;
+}
+
+
+// Settings
+
+bool FileSettingsStore::begin() {
+    if (loaded_ || path_.empty()) { return loaded_ = true; }
+    loaded_ = true;
+
+    FILE* file = fopen(path_.c_str(), "rb");
+    if (!file) { return true; }                         // First run
+
+    // [key length][key][value length, 2 bytes][value], repeated
+    uint8_t keyLength;
+    while (fread(&keyLength, 1, 1, file) == 1) {
+        std::string key(keyLength, '\0');
+        uint16_t length;
+        if (fread(&key[0], 1, keyLength, file) != keyLength || fread(&length, sizeof(length), 1, file) != 1) { break; }
+
+        std::vector<uint8_t> value(length);
+        if (length > 0 && fread(value.data(), 1, length, file) != length) { break; }
+        values_[key] = value;
+    }
+    fclose(file);
+    return true;
+}
+
+size_t FileSettingsStore::get(const char* key, void* value, size_t length) {
+    auto stored = values_.find(key);
+    if (!loaded_ || stored == values_.end() || stored->second.size() > length) { return 0; }
+
+    memcpy(value, stored->second.data(), stored->second.size());
+    return stored->second.size();
+}
+
+bool FileSettingsStore::set(const char* key, const void* value, size_t length) {
+    if (!loaded_ || strlen(key) > 255 || length > 0xFFFF) { return false; }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(value);
+    values_[key].assign(bytes, bytes + length);
+    writes_++;
+    return persist();
+}
+
+bool FileSettingsStore::persist() {
+    if (path_.empty()) { return true; }
+
+    FILE* file = fopen(path_.c_str(), "wb");
+    if (!file) { return false; }
+
+    bool ok = true;
+    for (const auto& entry : values_) {
+        uint8_t keyLength = (uint8_t)entry.first.size();
+        uint16_t length = (uint16_t)entry.second.size();
+        ok = ok && fwrite(&keyLength, 1, 1, file) == 1
+            && fwrite(entry.first.data(), 1, keyLength, file) == keyLength
+            && fwrite(&length, sizeof(length), 1, file) == 1
+            && fwrite(entry.second.data(), 1, length, file) == length;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+
+// HTTP client
+
+HttpResponse PosixHttpClient::post(const char* url, const char* contentType, const char* body, size_t length, unsigned long timeoutMs) {
+    // http://host[:port]/path
+    if (strncmp(url, "http://", 7) != 0) { return { ERROR_CONNECT, 0 }; }
+
+    std::string rest(url + 7);
+    size_t slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+    size_t colon = authority.find(':');
+    std::string host = authority.substr(0, colon);
+    std::string port = colon == std::string::npos ? "80" : authority.substr(colon + 1);
+
+    addrinfo hints = {};
+    addrinfo* address = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &address) != 0) { return { ERROR_CONNECT, 0 }; }
+
+    int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(address);
+        return { ERROR_CONNECT, 0 };
+    }
+
+    // On Linux the send timeout also bounds connect()
+    timeval timeout = { (time_t)(timeoutMs / 1000), (suseconds_t)((timeoutMs % 1000) * 1000) };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    bool connected = connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+    freeaddrinfo(address);
+    if (!connected) {
+        close(fd);
+        return { ERROR_CONNECT, 0 };
+    }
+
+    std::string request = "POST " + path + " HTTP/1.1\r\nHost: " + authority
+        + "\r\nContent-Type: " + contentType
+        + "\r\nContent-Length: " + std::to_string(length)
+        + "\r\nConnection: close\r\n\r\n";
+    request.append(body, length);
+
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) {
+        close(fd);
+        return { ERROR_TIMEOUT, 0 };
+    }
+
+    // Only the status line and headers matter
+    std::string received;
+    char buffer[512];
+    while (received.find("\r\n\r\n") == std::string::npos && received.size() < 8192) {
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if (count <= 0) {
+            close(fd);
+            return { count < 0 ? ERROR_TIMEOUT : ERROR_PROTOCOL, 0 };
+        }
+        received.append(buffer, count);
+    }
+    close(fd);
+
+    HttpResponse response = { ERROR_PROTOCOL, 0 };
+    if (sscanf(received.c_str(), "HTTP/%*d.%*d %d", &response.status) != 1) { return { ERROR_PROTOCOL, 0 }; }
+
+    size_t retryAfter = received.find("\r\nRetry-After:");
+    if (retryAfter == std::string::npos) { retryAfter = received.find("\r\nretry-after:"); }
+    if (retryAfter != std::string::npos) {
+        response.retryAfterMs = strtoul(received.c_str() + retryAfter + 14, nullptr, 10) * 1000UL;
+    }
+    return response;
+}
+
+
+// Tasks
+
+bool startTask(const char* name, TaskFunction function, void* arg, uint32_t stackSize, uint8_t priority, int core) {
+    (void)stackSize; (void)priority; (void)core;    // Plain threads, the host scheduler decides
+    std::thread thread(function, arg);
+    fakeSystem().addTask(name, thread.get_id());
+    thread.detach();
+    return true;
+}
+
+
+// Accessors
+
+FakeClock& fakeClock() { static FakeClock instance; return instance; }
+FakeGpio& fakeGpio() { static FakeGpio instance; return instance; }
+FakeTempBus& fakeTempBus() { static FakeTempBus instance; return instance; }
+FakePulseInput& fakePulseInput() { static FakePulseInput instance; return instance; }
+FakePower& fakePower() { static FakePower instance; return instance; }
+FakeSystem& fakeSystem() { static FakeSystem instance; return instance; }
+FakeHttpServer& fakeHttpServer() { static FakeHttpServer instance; return instance; }
+FileFlashRegion& fileFlashRegion() { static FileFlashRegion instance; return instance; }
+FileSettingsStore& fileSettingsStore() { static FileSettingsStore instance; return instance; }
+FakeFirmwareSink& fakeFirmwareSink() { static FakeFirmwareSink instance; return instance; }
+
+static HttpServer* socketHttpServer = nullptr;
+
+void serveHttpOn(uint16_t port) {
+    static SocketHttpServer instance(port, &fakeFirmwareSink());
+    socketHttpServer = &instance;
+}
+
+Clock& clock() { return fakeClock(); }
+Gpio& gpio() { return fakeGpio(); }
+TempBus& tempBus() { return fakeTempBus(); }
+PulseInput& pulseInput() { return fakePulseInput(); }
+Power& power() { return fakePower(); }
+System& system() { return fakeSystem(); }
+FlashRegion& journalFlash() { return fileFlashRegion(); }
+SettingsStore& settings() { return fileSettingsStore(); }
+HttpServer& httpServer() { return socketHttpServer ? *socketHttpServer : fakeHttpServer(); }
+HttpClient& httpClient() { static PosixHttpClient instance; return instance; }
+
+} // namespace hal
@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef NativeHAL_h
+#define NativeHAL_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hal/HAL.h"
+#include "hal/common/SocketHttpServer.h"
+#include "util/config.h"
+
+namespace hal {
+
+// Follows the host clock by default. In manual mode time only moves when
+// advance() is called, or delay() from the thread that enabled it, which is
+// what the simulator and benchmarks use.
+class FakeClock : public Clock {
+public:
+    FakeClock();
+
+    unsigned long millis() override;
+    unsigned long micros() override;
+    uint32_t cycles() override;                     // Real nanoseconds, even in manual mode
+    uint32_t cyclesPerMicro() override { return 1000; }
+    void delay(unsigned long ms) override;
+    bool delayUntil(unsigned long& wakeMs, unsigned long periodMs) override;
+
+    void beginNetworkTime() override {}
+    bool networkTimeReady() override { return networkAvailable_; }
+    bool syncNetworkTime() override;
+    unsigned long epochTime() override;
+
+    void setManual(bool manual);
+    void advance(unsigned long ms) { advanceMicros((uint64_t)ms * 1000); }
+    void advanceMicros(uint64_t us);
+    void setNetworkAvailable(bool available) { networkAvailable_ = available; }
+    void setEpoch(unsigned long epoch);             // Epoch reported once synced, counted from the current millis()
+
+private:
+    std::atomic<bool> manual_;
+    std::atomic<uint64_t> manualMicros_;        // Read from task threads too
+    std::thread::id driver_;                    // Thread that enabled manual mode
+    std::chrono::steady_clock::time_point start_;
+    bool networkAvailable_;
+    bool synced_;
+    unsigned long epochAtSync_;
+    unsigned long millisAtSync_;
+
+    uint64_t nowMicros();
+};
+
+class FakeGpio : public Gpio {
+public:
+    void setMode(uint8_t pin, PinMode mode) override;
+    void write(uint8_t pin, bool high) override;
+    bool read(uint8_t pin) override;
+
+    void setInput(uint8_t pin, bool high);          // Drive an input pin from outside
+
+private:
+    static const uint8_t PIN_COUNT = 64;
+    PinMode modes_[PIN_COUNT] = {};
+    bool levels_[PIN_COUNT] = {};
+};
+
+// Emulates DS18B20s: readings latch at startConversion(), sensors report the
+// 85 C power-on value until their first conversion, like the real parts.
+class FakeTempBus : public TempBus {
+public:
+    void begin() override {}
+    unsigned long conversionTime() override { return 750; }    // 12-bit
+    void startConversion() override;
+    bool readScratchpad(const uint8_t* address, uint8_t* scratchPad) override;
+    size_t search(uint8_t (*addresses)[8], size_t max) override;     // Present devices, in the order first seen
+
+    void setTemperature(const uint8_t* address, float celsius);
+    void setPresent(const uint8_t* address, bool present);
+    void corruptNextRead(const uint8_t* address);   // Flip a bit so the next read fails its CRC
+
+private:
+    struct Device {
+        uint8_t address[8];
+        float celsius;
+        int16_t latched;
+        bool present;
+        bool corruptNext;
+    };
+
+    std::vector<Device> devices_;
+
+    Device& device(const uint8_t* address);
+};
+
+class FakePulseInput : public PulseInput {
+public:
+    bool attach(uint8_t pin) override;
+    PulseReading take(uint8_t pin) override;
+    void setWakeOnPulse(bool enabled) override { (void)enabled; }     // Counting never stops on the host
+
+    void addPulses(uint8_t pin, uint32_t pulses);                           // The latest at the clock's micros()
+    void addPulses(uint8_t pin, uint32_t pulses, unsigned long lastMicros);
+
+private:
+    std::map<uint8_t, PulseReading> channels_;
+};
+
+// Only records the mode, the host has no light sleep
+class FakePower : public Power {
+public:
+    bool setLowPower(bool enabled) override;
+    bool lowPower() override { return lowPower_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> lowPower_{false};
+};
+
+// Heap figures are set from outside, the host's own allocator has no
+// equivalent. restart() exits the process, as close as the host gets.
+class FakeSystem : public System {
+public:
+    HeapInfo heap() override;
+    size_t tasks(TaskInfo* tasks, size_t max) override;
+    uint32_t otherAllocations() override { return otherAllocations_.load(std::memory_order_relaxed); }
+    void restart(const void* state, size_t length) override;
+    size_t restoredState(void* state, size_t length) override;
+
+    void setHeap(uint32_t freeBytes, uint32_t largestFreeBlock);
+    void setRestoredState(const void* state, size_t length);   // As if the last restart had kept it
+    void addTask(const char* name, std::thread::id id);         // From startTask()
+    void countAllocation();                                     // Call from an operator new replacement
+
+private:
+    struct Task {
+        const char* name;
+        std::thread::id id;
+        std::atomic<uint32_t> allocations;
+    };
+
+    static const uint8_t MAX_TASKS = 8;
+    std::mutex mutex_;                          // Guards the heap figures and retained state
+    uint32_t freeBytes_ = 200 * 1024;
+    uint32_t largestFreeBlock_ = 110 * 1024;
+    uint32_t minimumFreeBytes_ = 200 * 1024;
+    std::vector<uint8_t> retained_;
+    Task tasks_[MAX_TASKS] = {};
+    std::atomic<uint8_t> taskCount_{0};
+    std::atomic<uint32_t> otherAllocations_{0};
+};
+
+// NOR flash emulated in a host file (created erased), so journal contents
+// survive between runs the same way they survive a reboot. Counts every
+// program and erase for write amplification figures, and can cut the power
+// part way through a write.
+class FileFlashRegion : public FlashRegion {
+public:
+    FileFlashRegion() : path_("journal.bin"), size_(64 * 1024) {}
+    ~FileFlashRegion() override { if (file_) { fclose(file_); } }
+    FileFlashRegion(const FileFlashRegion&) = delete;
+    FileFlashRegion& operator=(const FileFlashRegion&) = delete;
+
+    bool begin() override;
+    size_t size() override { return size_; }
+    size_t sectorSize() override { return 4096; }
+    bool read(size_t offset, void* buffer, size_t length) override;
+    bool write(size_t offset, const void* data, size_t length) override;
+    bool eraseSector(size_t sector) override;
+
+    void setPath(const std::string& path) { path_ = path; }     // Call before begin()
+    void setSize(size_t size) { size_ = size; }
+    void cutPowerAfter(size_t bytes) { powerBudget_ = bytes; }  // Later writes stop after this many bytes
+
+    uint64_t getBytesWritten() const { return bytesWritten_; }
+    uint64_t getBytesRead() const { return bytesRead_; }
+    uint32_t getSectorErases() const { return sectorErases_; }
+
+private:
+    std::string path_;
+    size_t size_;
+    std::vector<uint8_t> contents_;
+    FILE* file_ = nullptr;
+    size_t powerBudget_ = SIZE_MAX;
+    uint64_t bytesWritten_ = 0;
+    uint64_t bytesRead_ = 0;
+    uint32_t sectorErases_ = 0;
+
+    bool persist(size_t offset, size_t length);
+};
+
+// Settings held in memory and rewritten whole to a file on every set(), so a
+// host run picks up where the last one left off. No path keeps them in memory.
+class FileSettingsStore : public SettingsStore {
+public:
+    FileSettingsStore() : path_("settings.bin") {}
+
+    bool begin() override;
+    size_t get(const char* key, void* value, size_t length) override;
+    bool set(const char* key, const void* value, size_t length) override;
+
+    void setPath(const std::string& path) { path_ = path; }     // Call before begin()
+    uint32_t getWrites() const { return writes_; }
+
+private:
+    std::string path_;
+    bool loaded_ = false;
+    std::map<std::string, std::vector<uint8_t>> values_;
+    uint32_t writes_ = 0;
+
+    bool persist();
+};
+
+// Captures what is written. The socket buffer is unlimited unless setWindow()
+// is used to make the client a slow reader. Written by the web task, so the
+// test side only sees it through the locked accessors.
+class FakeHttpStream : public HttpStream {
+public:
+    bool connected() override;
+    size_t write(const char* data, size_t length) override;
+    void close() override;
+
+    void setWindow(size_t bytes);                       // Bytes the socket takes before it is full
+    void hangUp();                                      // Client went away
+    bool isOpen();
+    std::string received();
+
+private:
+    std::mutex mutex_;
+    std::string received_;
+    bool open_ = true;
+    bool hungUp_ = false;
+    size_t window_ = SIZE_MAX;
+};
+
+// No sockets, requests are injected with request() and the response captured.
+// Like the real server, handlers only run inside handleClient(): request()
+// queues the request and waits for the task serving the web to answer it.
+class FakeHttpServer : public HttpServer {
+public:
+    struct Response {
+        int code;
+        std::string contentType;
+        std::string body;
+        std::map<std::string, std::string> headers;
+    };
+
+    void on(const char* uri, HttpMethod method, Handler handler) override;
+    void onNotFound(Handler handler) override { notFound_ = handler; }
+    void enableFirmwareUpdate(const char* uri) override { (void)uri; }    // No OTA on the host
+    void begin() override {}
+    void handleClient(unsigned long waitMs) override;
+
+    bool hasArg(const char* name) override;
+    const char* arg(const char* name) override;
+    const char* header(const char* name) override;
+    void sendHeader(const char* name, const char* value) override;
+    void send(int code, const char* contentType, const String& content) override;
+    void send(int code, const char* contentType, const char* content, size_t length) override;
+
+    void beginChunked(int code, const char* contentType) override;
+    void sendChunk(const char* data, size_t length) override;
+    void endChunked() override {}
+    HttpStream* beginStream(const char* contentType) override;
+
+    Response request(HttpMethod method, const std::string& uri, const std::map<std::string, std::string>& args = {},
+        const std::map<std::string, std::string>& headers = {});
+    FakeHttpStream* lastStream();
+
+private:
+    struct Route {
+        std::string uri;
+        HttpMethod method;
+        Handler handler;
+    };
+
+    struct Pending {
+        HttpMethod method;
+        const std::string& uri;
+        const std::map<std::string, std::string>& args;
+        const std::map<std::string, std::string>& headers;
+        Response response;
+        bool done;
+    };
+
+    std::vector<Route> routes_;
+    Handler notFound_;
+    const std::map<std::string, std::string>* args_ = nullptr;
+    const std::map<std::string, std::string>* headers_ = nullptr;
+    Response response_;
+    std::vector<std::unique_ptr<FakeHttpStream>> streams_;     // Closed ones are kept for inspection
+
+    std::mutex mutex_;                          // Guards pending_ and streams_
+    std::condition_variable queued_;
+    std::condition_variable served_;
+    std::deque<Pending*> pending_;
+
+    void serve(Pending& pending);
+};
+
+// Accepts any image and counts it, there is nothing to boot into on the host
+class FakeFirmwareSink : public FirmwareSink {
+public:
+    bool begin(size_t size) override;
+    bool write(const uint8_t* data, size_t length) override;
+    bool end() override { return expected_ == written_; }
+    void abort() override { aborted_++; }
+    void apply() override { applied_++; }
+
+    size_t getBytesWritten() const { return written_; }
+    uint32_t getApplied() const { return applied_; }
+    uint32_t getAborted() const { return aborted_; }
+
+private:
+    size_t expected_ = 0;
+    size_t written_ = 0;
+    uint32_t applied_ = 0;
+    uint32_t aborted_ = 0;
+};
+
+// Real plain-HTTP client over POSIX sockets, so outbound code can be run against
+// a local stand-in server. No TLS, https:// URLs fail with status -1.
+class PosixHttpClient : public HttpClient {
+public:
+    HttpResponse post(const char* url, const char* contentType, const char* body, size_t length, unsigned long timeoutMs) override;
+
+    static const int ERROR_CONNECT = -1;
+    static const int ERROR_TIMEOUT = -2;
+    static const int ERROR_PROTOCOL = -3;
+};
+
+FakeClock& fakeClock();
+FakeGpio& fakeGpio();
+FakeTempBus& fakeTempBus();
+FakePulseInput& fakePulseInput();
+FakePower& fakePower();
+FakeSystem& fakeSystem();
+FileFlashRegion& fileFlashRegion();
+FileSettingsStore& fileSettingsStore();
+FakeHttpServer& fakeHttpServer();
+FakeFirmwareSink& fakeFirmwareSink();
+
+// Makes httpServer() a real SocketHttpServer on port instead of the fake, so
+// the host build can be driven by a browser or a load generator. Call it
+// before anything takes hold of httpServer().
+void serveHttpOn(uint16_t port);
+
+} // namespace hal
+
+#endif // NativeHAL_h
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include <Arduino.h>
+
+HostSerial Serial;
+
+String::String(double value, unsigned int decimalPlaces) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.*f", (int)decimalPlaces, value);
+    value_ = buffer;
+}
+
+size_t HostSerial::print(const char* value) {
+    if (!enabled_) { return 0; }
+    return fputs(value, stdout) < 0 ? 0 : strlen(value);
+}
+
+size_t HostSerial::println(const char* value) {
+    if (!enabled_) { return 0; }
+    size_t written = print(value);
+    fputc('\n', stdout);
+    return written + 1;
+}
+
+size_t HostSerial::printf(const char* format, ...) {
+    if (!enabled_) { return 0; }
+
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written < 0 ? 0 : written;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+// Host stand-in for the Arduino core, only used by env:native. It provides the
+// language level pieces the managers share (String, Serial, byte) and nothing
+// that touches hardware, that all goes through hal/HAL.h so a stray millis() or
+// digitalWrite() fails to compile here instead of silently doing nothing.
+
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+typedef uint8_t byte;
+
+using std::round;
+
+class String {
+public:
+    String() = default;
+    String(const char* value) : value_(value ? value : "") {}
+    String(const std::string& value) : value_(value) {}
+    explicit String(char value) : value_(1, value) {}
+    explicit String(int value) : value_(std::to_string(value)) {}
+    explicit String(unsigned int value) : value_(std::to_string(value)) {}
+    explicit String(long value) : value_(std::to_string(value)) {}
+    explicit String(unsigned long value) : value_(std::to_string(value)) {}
+    explicit String(long long value) : value_(std::to_string(value)) {}
+    explicit String(unsigned long long value) : value_(std::to_string(value)) {}
+    explicit String(float value, unsigned int decimalPlaces = 2) : String((double)value, decimalPlaces) {}
+    explicit String(double value, unsigned int decimalPlaces = 2);
+
+    const char* c_str() const { return value_.c_str(); }
+    unsigned int length() const { return value_.length(); }
+    bool isEmpty() const { return value_.empty(); }
+    bool reserve(unsigned int size) { value_.reserve(size); return true; }
+    long toInt() const { return std::strtol(value_.c_str(), nullptr, 10); }
+    float toFloat() const { return std::strtof(value_.c_str(), nullptr); }
+    bool equals(const String& other) const { return value_ == other.value_; }
+
+    bool concat(const String& other) { value_ += other.value_; return true; }
+    bool concat(const char* other) { if (other) { value_ += other; } return true; }
+    bool concat(const char* other, unsigned int length) { value_.append(other, length); return true; }
+    bool concat(char other) { value_ += other; return true; }
+
+    String& operator+=(const String& other) { value_ += other.value_; return *this; }
+    String& operator+=(const char* other) { concat(other); return *this; }
+    String& operator+=(char other) { value_ += other; return *this; }
+
+    bool operator==(const String& other) const { return value_ == other.value_; }
+    bool operator==(const char* other) const { return value_ == (other ? other : ""); }
+    bool operator!=(const String& other) const { return !(*this == other); }
+    bool operator!=(const char* other) const { return !(*this == other); }
+    char operator[](unsigned int index) const { return index < value_.size() ? value_[index] : 0; }
+
+    const std::string& str() const { return value_; }
+
+private:
+    std::string value_;
+};
+
+inline String operator+(const String& lhs, const String& rhs) { String result(lhs); result += rhs; return result; }
+inline String operator+(const String& lhs, const char* rhs) { String result(lhs); result += rhs; return result; }
+inline String operator+(const char* lhs, const String& rhs) { String result(lhs); result += rhs; return result; }
+
+class HostSerial {
+public:
+    void begin(unsigned long baud) { (void)baud; }
+    void setEnabled(bool enabled) { enabled_ = enabled; }   // Mute console output, e.g. for the simulator
+
+    size_t print(const String& value) { return print(value.c_str()); }
+    size_t print(const char* value);
+    size_t println(const String& value) { return println(value.c_str()); }
+    size_t println(const char* value);
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+    bool enabled_ = true;
+};
+
+extern HostSerial Serial;
+
+#endif // Arduino_h
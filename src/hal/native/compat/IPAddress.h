@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include <Arduino.h>
+
+// Host stand-in so util/config.h builds under env:native
+class IPAddress {
+public:
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets_{ a, b, c, d } {}
+
+    String toString() const {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", octets_[0], octets_[1], octets_[2], octets_[3]);
+        return String(buffer);
+    }
+
+private:
+    uint8_t octets_[4];
+};
+
+#endif // IPAddress_h
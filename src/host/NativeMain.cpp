@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+// env:native entry point, runs the managers on Linux against the fake HAL.
+// Usage: program [seconds]  (runs forever when no duration is given)
+// Set POOL_HEATER_WEBHOOK=http://host:port/path to post notifications there.
+// Set POOL_HEATER_HTTP_PORT=8080 to serve the dashboard on a real socket
+// (tools/http_load.py drives it), otherwise requests only come from the fake.
+
+#include <Arduino.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "hal/native/NativeHAL.h"
+#include "util/LogManager/LogManager.h"
+#include "util/MemoryMonitor/MemoryMonitor.h"
+#include "util/NotificationManager/NotificationManager.h"
+#include "util/LEDStatusManager/LEDStatusManager.h"
+#include "util/TimeManager/TimeManager.h"
+#include "util/Scheduler/Scheduler.h"
+#include "PumpManager/PumpManager.h"
+
+// Counts allocations per task like the malloc wrappers do on the board
+void* operator new(size_t size) {
+    hal::fakeSystem().countAllocation();
+    void* block = malloc(size ? size : 1);
+    if (!block) { throw std::bad_alloc(); }
+    return block;
+}
+
+void operator delete(void* pointer) noexcept { free(pointer); }
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { free(pointer); }
+
+int main(int argc, char** argv) {
+    unsigned long runSeconds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 0;
+
+    const char* httpPort = getenv("POOL_HEATER_HTTP_PORT");
+    if (httpPort) {
+        hal::serveHttpOn(strtoul(httpPort, nullptr, 10));
+    }
+
+    const uint8_t inputAddr[8] = INPUT_TEMP_ADDR;
+    const uint8_t outputAddr[8] = OUTPUT_TEMP_ADDR;
+    const uint8_t enclosureAddr[8] = ENCLOSURE_TEMP_ADDR;
+    hal::fakeTempBus().setTemperature(inputAddr, 24.0f);
+    hal::fakeTempBus().setTemperature(outputAddr, 27.5f);
+    hal::fakeTempBus().setTemperature(enclosureAddr, 31.0f);
+
+    hal::Clock& clock = hal::clock();
+    Scheduler scheduler(clock);
+    LEDStatusManager::getInstance().setup(scheduler);
+    LogManager::getInstance().setup(scheduler);
+
+    const char* webhook = getenv("POOL_HEATER_WEBHOOK");
+    if (webhook) {
+        NotificationManager::getInstance().setEndpoint(webhook);
+    }
+    NotificationManager::getInstance().setup();
+
+    TimeManager::getInstance().setup(scheduler);
+    PumpManager::getInstance().setup();
+    MemoryMonitor::getInstance().setup(scheduler);
+    bool controlTaskRunning = PumpManager::getInstance().startControlTask();
+
+    LEDStatusManager::getInstance().setStatus(0);
+    LogManager::getInstance().log(INFO, "Setup finished");
+
+    // This thread stands in for the network task and sleeps until its next job,
+    // the control tick runs on its own
+    while (runSeconds == 0 || clock.millis() < runSeconds * 1000) {
+        scheduler.run();
+        if (!controlTaskRunning) {
+            PumpManager::getInstance().update();
+            clock.delay(1);
+            continue;
+        }
+
+        unsigned long idle = scheduler.idleTime();
+        clock.delay(idle < 100 ? idle : 100);
+    }
+
+    // Whether anything, web traffic included, held up the control tick
+    ControlTiming timing = PumpManager::getInstance().getControlTiming();
+    printf("Control loop: %lu ticks, longest %.3f ms, jitter max %.3f ms, %lu late, %lu overruns\n",
+        (unsigned long)timing.ticks, timing.maxTickMicros / 1000.0, timing.maxJitterMicros / 1000.0,
+        (unsigned long)timing.lateTicks, (unsigned long)timing.overruns);
+
+    PowerStats power = PumpManager::getInstance().getPowerStats();
+    printf("Power: full %.1f s (%.3f s active), low power %.1f s (%.3f s active) over %lu hibernations\n",
+        (power.activeMicros + power.asleepMicros) / 1e6, power.activeMicros / 1e6,
+        (power.lowPowerActiveMicros + power.lowPowerAsleepMicros) / 1e6, power.lowPowerActiveMicros / 1e6,
+        (unsigned long)power.lowPowerEntries);
+    return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef Bench_h
+#define Bench_h
+
+// Host benchmarks, one entry point per subsystem. Each takes the arguments
+// after its name and returns the process exit code.
+int runJournalBench(int argc, char** argv);
+int runHistoryBench(int argc, char** argv);
+int runDataBench(int argc, char** argv);
+int runFlowBench(int argc, char** argv);
+int runFilterBench(int argc, char** argv);
+
+// Heap use by operator new, tracked by BenchMain for the whole process
+size_t benchHeapInUse();
+size_t benchHeapPeak();
+uint64_t benchHeapAllocations();                    // operator new calls since start
+void benchHeapResetPeak();                          // Peak restarts from the current use
+
+#endif // Bench_h
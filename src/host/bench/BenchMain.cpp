@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+// env:bench entry point, host measurements of firmware subsystems:
+//
+//   bench journal --years 5
+//   bench history [repeats]
+//   bench data [requests]
+//   bench flow [seconds per rate]
+//   bench filter [million samples]
+//
+// Figures are for the host, they show scaling and flash traffic rather than
+// ESP32 timings.
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "host/bench/Bench.h"
+
+// Every allocation carries its size in front so frees can be counted
+static std::atomic<size_t> heapInUse(0);
+static std::atomic<size_t> heapPeak(0);
+static std::atomic<uint64_t> heapAllocations(0);
+static const size_t HEADER = alignof(std::max_align_t);
+
+void* operator new(size_t size) {
+    char* block = static_cast<char*>(malloc(size + HEADER));
+    if (!block) { throw std::bad_alloc(); }
+
+    *reinterpret_cast<size_t*>(block) = size;
+    heapAllocations++;
+    size_t inUse = heapInUse += size;
+    size_t peak = heapPeak.load();
+    while (inUse > peak && !heapPeak.compare_exchange_weak(peak, inUse)) {}
+    return block + HEADER;
+}
+
+void operator delete(void* pointer) noexcept {
+    if (!pointer) { return; }
+
+    char* block = static_cast<char*>(pointer) - HEADER;
+    heapInUse -= *reinterpret_cast<size_t*>(block);
+    free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* pointer) noexcept { operator delete(pointer); }
+void operator delete(void* pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { operator delete(pointer); }
+
+size_t benchHeapInUse() { return heapInUse.load(); }
+size_t benchHeapPeak() { return heapPeak.load(); }
+uint64_t benchHeapAllocations() { return heapAllocations.load(); }
+void benchHeapResetPeak() { heapPeak.store(heapInUse.load()); }
+
+struct Bench {
+    const char* name;
+    int (*run)(int argc, char** argv);
+    const char* description;
+};
+
+static const Bench benches[] = {
+    { "journal", runJournalBench, "Totals journal wear, write amplification and replay time" },
+    { "history", runHistoryBench, "/api/history encoding throughput and heap use" },
+    { "data", runDataBench, "/api/data serialization, String concatenation against the snapshot" },
+    { "flow", runFlowBench, "Flow rate and volume error over synthetic pulse trains" },
+    { "filter", runFilterBench, "Temperature filter cost per sample, templated chain against virtual stages" },
+};
+
+int main(int argc, char** argv) {
+    for (const Bench& bench : benches) {
+        if (argc > 1 && strcmp(argv[1], bench.name) == 0) {
+            return bench.run(argc - 2, argv + 2);
+        }
+    }
+
+    printf("Usage: bench <name> [options]\n");
+    for (const Bench& bench : benches) {
+        printf("  %-12s %s\n", bench.name, bench.description);
+    }
+    return 1;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+// /api/data body, the String concatenation handleData() used to do against
+// formatTelemetry() on the published snapshot. Both run over the same
+// Telemetry and must produce the same bytes.
+
+#include <Arduino.h>
+#include <chrono>
+#include "host/bench/Bench.h"
+#include "PumpManager/PumpManager.h"
+
+// handleData() as it was, with its String helpers, reading the snapshot instead of members
+static String legacyUptime(unsigned long uptimeMillis) {
+    unsigned long seconds = uptimeMillis / 1000;
+    unsigned long minutes = seconds / 60;
+    unsigned long hours = minutes / 60;
+    unsigned long days = hours / 24;
+    hours = hours % 24;
+    minutes = minutes % 60;
+    seconds = seconds % 60;
+    return String(days) + "d " + String(hours) + "h " + String(minutes) + "m " + String(seconds) + "s";
+}
+
+static String legacyPower(double powerInWatts) {
+    if (powerInWatts < 1000) {
+        return String(round(powerInWatts)) + " W";
+    }
+    return String(powerInWatts / 1000.0, 2) + " kW";
+}
+
+// Fields added since, built the same way so the comparison still covers the whole body
+static String legacyCop(const EnergyMeter::Totals& totals) {
+    if (totals.pumpMilliJoules <= 0) { return "-"; }
+    return String((float)totals.heatMilliJoules / totals.pumpMilliJoules, 1);
+}
+
+static String legacyData(const Telemetry& telemetry, unsigned long currentMillis) {
+    EnergyMeter::Totals lifetime;
+    lifetime.heatMilliJoules = telemetry.lifetimeJoules * 1000;
+    lifetime.pumpMilliJoules = (int64_t)telemetry.pumpSeconds * PUMP_POWER_WATTS * 1000;
+
+    return "{"
+        "\"controllerUptime\":\"" + String(legacyUptime(currentMillis)) + "\","
+        "\"firmwareVersion\":\""  + String(FIRMWARE_VERSION) + "\","
+        "\"enclosureTemp\":\""    + String(telemetry.enclosureTemp) + " C\","
+        "\"localTime\":\""        + TimeManager::getInstance().getLongDate() + "\","
+        "\"pumpStatus\":\""       + String(PumpManager::pumpStateToString(telemetry.pumpState)) + "\","
+        "\"targetTemp\":\""       + String(telemetry.targetTemp) + " C\","
+        "\"poolTemp\":\""         + String(telemetry.poolTemp) + " C\","
+        "\"poolTempTime\":\""     + String((currentMillis - telemetry.poolTempTime) / 1000 / 60) + " mins ago\","
+        "\"inputTemp\":\""        + String(telemetry.inputTemp) + " C\","
+        "\"outputTemp\":\""       + String(telemetry.outputTemp) + " C\","
+        "\"flowRate\":\""         + String(telemetry.flowRate) + " L/min\","
+        "\"energyCapture\":\""    + legacyPower(telemetry.energyCapture) + "\","
+        "\"energy24h\":\""        + String(telemetry.energy24h, 2) + " kWh\","
+        "\"energy72h\":\""        + String(telemetry.energy72h, 2) + " kWh\","
+        "\"energyWeek\":\""       + String(telemetry.energyWeek, 2) + " kWh\","
+        "\"lifetimeLitres\":\""   + String((unsigned long)(telemetry.lifetimeMilliLitres / 1000)) + " L\","
+        "\"lifetimeEnergy\":\""   + String(telemetry.lifetimeJoules / 3.6e6, 2) + " kWh\","
+        "\"pumpHours\":\""        + String(telemetry.pumpSeconds / 3600.0, 1) + " h\","
+        "\"cycleEnergy\":\""      + String(telemetry.cycleEnergy.netKWh(), 2) + " kWh\","
+        "\"cycleCop\":\""         + legacyCop(telemetry.cycleEnergy) + "\","
+        "\"todayEnergy\":\""      + String(telemetry.todayEnergy.netKWh(), 2) + " kWh\","
+        "\"todayCop\":\""         + legacyCop(telemetry.todayEnergy) + "\","
+        "\"lifetimeNetEnergy\":\"" + String(lifetime.netKWh(), 2) + " kWh\","
+        "\"lifetimeCop\":\""      + legacyCop(lifetime) + "\""
+        + "}";
+}
+
+int runDataBench(int argc, char** argv) {
+    long requests = argc > 0 ? atol(argv[0]) : 200000;
+    if (requests <= 0) { requests = 200000; }
+
+    Telemetry telemetry = {};
+    telemetry.pumpState = 2;
+    telemetry.targetTemp = 30;
+    telemetry.enclosureTemp = 31.5f;
+    telemetry.poolTemp = 26.25f;
+    telemetry.poolTempTime = 90 * 60 * 1000UL;
+    telemetry.inputTemp = 26.25f;
+    telemetry.outputTemp = 27.9375f;
+    telemetry.flowRate = 22.41f;
+    telemetry.energyCapture = 2641.3f;
+    telemetry.energy24h = 18.42f;
+    telemetry.energy72h = 51.07f;
+    telemetry.energyWeek = 113.9f;
+    telemetry.lifetimeMilliLitres = 912345678ULL;
+    telemetry.lifetimeJoules = 1234567890LL;
+    telemetry.pumpSeconds = 734512;
+    telemetry.cycleEnergy = { 41230000LL, 5328000LL };
+    telemetry.todayEnergy = { 66310000LL, 9990000LL };
+    unsigned long now = 3 * 86400000UL + 5 * 3600000UL + 7 * 60000UL + 11000UL;
+
+    static char buffer[PumpManager::TELEMETRY_JSON_MAX_LENGTH];
+    size_t length = PumpManager::formatTelemetry(buffer, sizeof(buffer), telemetry, now);
+    String legacy = legacyData(telemetry, now);
+    if (legacy.length() != length || memcmp(legacy.c_str(), buffer, length) != 0) {
+        printf("Output differs\n  legacy: %s\n  now:    %.*s\n", legacy.c_str(), (int)length, buffer);
+        return 1;
+    }
+
+    printf("%-10s %12s %14s %10s\n", "method", "requests/s", "allocs/request", "bytes");
+
+    uint64_t allocations = benchHeapAllocations();
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < requests; i++) {
+        bytes = legacyData(telemetry, now + i).length();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-10s %12.0f %14.1f %10zu\n", "String", requests / seconds,
+        (benchHeapAllocations() - allocations) / (double)requests, bytes);
+
+    allocations = benchHeapAllocations();
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < requests; i++) {
+        bytes = PumpManager::formatTelemetry(buffer, sizeof(buffer), telemetry, now + i);
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-10s %12.0f %14.1f %10zu\n", "snapshot", requests / seconds,
+        (benchHeapAllocations() - allocations) / (double)requests, bytes);
+    return 0;
+}
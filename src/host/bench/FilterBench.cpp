@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+// Temperature filter cost per sample, each stage alone and the whole chain
+// PumpManager uses, against the same stages behind virtual calls. The input
+// is a slow drift with sensor noise, spikes and the odd 85 C power on read.
+// Then checks what the chains do with a few known inputs, exiting non-zero if
+// any of them is wrong.
+//
+//   bench filter [million samples]
+
+#include <Arduino.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "host/bench/Bench.h"
+#include "PumpManager/PumpManager.h"
+
+// The chain as it would be written with a stage interface, for comparison
+class VirtualStage {
+public:
+    virtual ~VirtualStage() = default;
+    virtual bool apply(int32_t& sample) = 0;
+};
+
+template <typename Stage>
+class VirtualAdapter : public VirtualStage {
+public:
+    bool apply(int32_t& sample) override { return stage_.apply(sample); }
+
+private:
+    Stage stage_;
+};
+
+template <typename Filter>
+static double timeFilter(Filter& filter, const std::vector<int32_t>& samples, int64_t& checksum) {
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t sample : samples) {
+        int32_t value = sample;
+        if (filter.apply(value)) { checksum += value; }
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples.size();
+}
+
+static bool check(const char* what, bool pass) {
+    printf("  %-56s %s\n", what, pass ? "ok" : "FAIL");
+    return pass;
+}
+
+// Steady readings at from, then to, returning how many of the to readings were rejected
+template <typename Filter>
+static int rejectedAfter(Filter& filter, double from, double to, int count, int32_t* last) {
+    for (int i = 0; i < 10; i++) {
+        int32_t sample = lround(from * 16);
+        filter.apply(sample);
+    }
+    int rejected = 0;
+    for (int i = 0; i < count; i++) {
+        int32_t sample = lround(to * 16);
+        if (filter.apply(sample)) { *last = sample; } else { rejected++; }
+    }
+    return rejected;
+}
+
+static int runFilterChecks() {
+    int failures = 0;
+    int32_t last = 0;
+    printf("\nChecks:\n");
+
+    {
+        TempFilter water;
+        bool rejected = rejectedAfter(water, 26, 85, 1, &last) == 1;
+        failures += !check("85 C power on read rejected by the water range", rejected && water.getRejections(0) == 1);
+    }
+    {
+        // A collector warming a degree a reading past the water range still passes
+        SurfaceTempFilter surface;
+        int rejected = 0;
+        for (int temp = 40; temp <= 110; temp++) {
+            int32_t sample = temp * 16;
+            if (surface.apply(sample)) { last = sample; } else { rejected++; }
+        }
+        failures += !check("Collector climbing to 110 C passes the surface range", rejected == 0 && last > 100 * 16);
+    }
+    {
+        SurfaceTempFilter surface;
+        bool rejected = rejectedAfter(surface, 40, 85, 1, &last) == 1;
+        failures += !check("85 C power on read on a 40 C collector rejected", rejected && surface.getRejections(1) == 1);
+    }
+    {
+        // Held at the new level the spike is taken as real once Resync in a row were dropped
+        TempFilter water;
+        int rejected = rejectedAfter(water, 26, 40, TEMP_FILTER_RESYNC + 1 + 8 * TEMP_FILTER_MEDIAN, &last);
+        failures += !check("Step of 14 C rejected as a spike, then resynced",
+            rejected == TEMP_FILTER_RESYNC && water.getRejections(1) == TEMP_FILTER_RESYNC && abs(last - 40 * 16) <= 1);
+    }
+    {
+        filter::Median<TEMP_FILTER_MEDIAN> median;
+        bool pass = true;
+        for (int i = 0; i < 10; i++) {
+            int32_t sample = i == 5 ? 30 * 16 : 26 * 16;
+            median.apply(sample);
+            pass = pass && (TEMP_FILTER_MEDIAN < 3 || sample == 26 * 16);
+        }
+        failures += !check("Median drops a lone outlier", pass);
+    }
+    {
+        filter::Ema<TEMP_FILTER_EMA_SHIFT> ema;
+        int32_t sample = 26 * 16;
+        ema.apply(sample);
+        sample = 30 * 16;
+        ema.apply(sample);
+        int32_t first = sample;
+        for (int i = 0; i < 16 << TEMP_FILTER_EMA_SHIFT; i++) {
+            sample = 30 * 16;
+            ema.apply(sample);
+        }
+        bool between = TEMP_FILTER_EMA_SHIFT == 0 ? first == 30 * 16 : first > 26 * 16 && first < 30 * 16;
+        failures += !check("Moving average steps part way, then settles", between && sample == 30 * 16);
+    }
+    {
+        TempFilter water;
+        bool pass = true;
+        for (int i = 0; i < 20; i++) {
+            int32_t sample = lround(26.5 * 16);
+            pass = pass && water.apply(sample) && sample == lround(26.5 * 16);
+        }
+        failures += !check("Steady 26.5 C comes out of the chain unchanged", pass);
+    }
+
+    if (failures > 0) { printf("%d check(s) failed\n", failures); }
+    return failures;
+}
+
+int runFilterBench(int argc, char** argv) {
+    long millions = argc > 0 ? atol(argv[0]) : 20;
+    if (millions <= 0) { millions = 20; }
+
+    // 1/16 C, one reading a second of a pool drifting by a few degrees a day
+    std::vector<int32_t> samples(millions * 1000000);
+    std::mt19937 rng(1);
+    std::normal_distribution<double> noise(0, 1.5);
+    std::uniform_int_distribution<int> event(0, 9999);
+    for (size_t i = 0; i < samples.size(); i++) {
+        double temp = 26 + 3 * sin(i / 86400.0 * 6.283);
+        int roll = event(rng);
+        if (roll == 0) { temp = 85; }                           // Power on value
+        else if (roll < 10) { temp += roll % 2 ? 12 : -12; }    // Spike
+        samples[i] = (int32_t)lround(temp * 16 + noise(rng));
+    }
+
+    typedef filter::RangeCheck<TEMP_FILTER_MIN * 16, TEMP_FILTER_MAX * 16> Range;
+    typedef filter::RateLimit<TEMP_FILTER_MAX_STEP * 16, TEMP_FILTER_RESYNC> Rate;
+    typedef filter::Median<TEMP_FILTER_MEDIAN> Median;
+    typedef filter::Ema<TEMP_FILTER_EMA_SHIFT> Ema;
+
+    int64_t checksum = 0;
+    printf("%-16s %10s\n", "filter", "ns/sample");
+
+    struct Pass { bool apply(int32_t& sample) { (void)sample; return true; } } pass;
+    printf("%-16s %10.2f\n", "none", timeFilter(pass, samples, checksum));
+
+    Range range; printf("%-16s %10.2f\n", Range::name(), timeFilter(range, samples, checksum));
+    Rate rate; printf("%-16s %10.2f\n", Rate::name(), timeFilter(rate, samples, checksum));
+    Median median; printf("%-16s %10.2f\n", Median::name(), timeFilter(median, samples, checksum));
+    Ema ema; printf("%-16s %10.2f\n", Ema::name(), timeFilter(ema, samples, checksum));
+
+    TempFilter chain;
+    printf("%-16s %10.2f\n", "chain", timeFilter(chain, samples, checksum));
+
+    // Same four stages through a vtable, stopping at the first rejection
+    struct VirtualChain {
+        VirtualAdapter<Range> range;
+        VirtualAdapter<Rate> rate;
+        VirtualAdapter<Median> median;
+        VirtualAdapter<Ema> ema;
+        VirtualStage* stages[4] = { &range, &rate, &median, &ema };
+        uint32_t rejections[4] = {};
+
+        bool apply(int32_t& sample) {
+            for (size_t i = 0; i < 4; i++) {
+                if (!stages[i]->apply(sample)) { rejections[i]++; return false; }
+            }
+            return true;
+        }
+    } virtualChain;
+    printf("%-16s %10.2f\n", "virtual chain", timeFilter(virtualChain, samples, checksum));
+
+    printf("\nChain rejections over %zu samples:", samples.size());
+    for (size_t stage = 0; stage < TempFilter::STAGE_COUNT; stage++) {
+        printf(" %s %lu", TempFilter::stageName(stage), (unsigned long)chain.getRejections(stage));
+    }
+    printf("\n(checksum %lld)\n", (long long)checksum);
+    return runFilterChecks() > 0 ? 1 : 0;
+}
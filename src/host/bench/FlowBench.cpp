@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+// Flow acquisition, synthetic pulse trains replayed through the fake pulse
+// input at a range of rates. Each train has jittered pulse periods and a flow
+// job that runs late by a random amount, like a busy control task. Compares
+// the old pulses-per-window rate against FlowMeter and checks the volume
+// counted from pulses, then times how long a stopped pump takes to read zero.
+// Exits 1 if FlowMeter's error, the volume error or the stop time is past its
+// bound below, so the bench doubles as a host test.
+//
+//   bench flow [seconds per rate]
+
+#include <Arduino.h>
+#include <cmath>
+#include <random>
+#include "host/bench/Bench.h"
+#include "hal/native/NativeHAL.h"
+#include "PumpManager/FlowMeter.h"
+
+static const uint8_t BENCH_PIN = 0;
+static const unsigned long JOB_INTERVAL_US = 1000000;
+
+// Pass bounds, with some room over what the meter does at the default config
+static const double MAX_MEAN_ERROR_PERCENT = 2;
+static const double MAX_ERROR_PERCENT = 6;
+static const double MAX_VOLUME_ERROR_PULSES = 1;      // Volume is whole pulses, only the one in progress may be missing
+static const unsigned long MAX_STOP_MS = FLOW_TIMEOUT + JOB_INTERVAL_US / 1000;    // Noticed on the first job past the timeout
+
+struct FlowErrors {
+    double meanPercent = 0;
+    double maxPercent = 0;
+    uint32_t windows = 0;
+
+    void add(double measured, double actual) {
+        double percent = fabs(measured - actual) / actual * 100;
+        meanPercent += percent;
+        if (percent > maxPercent) { maxPercent = percent; }
+        windows++;
+    }
+};
+
+int runFlowBench(int argc, char** argv) {
+    int seconds = argc > 0 ? atoi(argv[0]) : 600;
+    if (seconds <= 0) { seconds = 600; }
+
+    hal::FakePulseInput& pulses = hal::fakePulseInput();
+    pulses.attach(BENCH_PIN);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> periodJitter(0.95, 1.05);      // Sensor and turbulence
+    std::uniform_int_distribution<unsigned long> jobLateness(0, 150000);  // Control task running behind
+
+    const double rates[] = { 0.1, 0.3, 1, 3, 10, 25 };     // L/min
+    int failures = 0;
+    printf("%-8s %8s %12s %12s %12s %12s %10s\n", "L/min", "Hz", "old mean %", "old max %", "new mean %", "new max %", "volume %");
+
+    for (double rate : rates) {
+        double period = 1e6 / (rate * FLOW_CALIBRATION_FACTOR);
+        FlowMeter meter(FLOW_CALIBRATION_FACTOR);
+        FlowErrors oldErrors, newErrors;
+
+        unsigned long lastJob = 0;
+        unsigned long nextJob = JOB_INTERVAL_US;
+        double nextEdge = period * periodJitter(rng);
+        uint64_t milliLitres = 0;
+        uint64_t edges = 0;
+        meter.begin(0);
+
+        while (nextJob < (unsigned long)seconds * 1000000UL) {
+            unsigned long jobTime = nextJob + jobLateness(rng);
+            while (nextEdge <= jobTime) {
+                pulses.addPulses(BENCH_PIN, 1, (unsigned long)nextEdge);
+                edges++;
+                nextEdge += period * periodJitter(rng);
+            }
+
+            hal::PulseReading reading = pulses.take(BENCH_PIN);
+            double oldRate = reading.count * 1e6 / (jobTime - lastJob) / FLOW_CALIBRATION_FACTOR;
+            meter.update(reading, jobTime);
+            milliLitres += meter.takeMilliLitres();
+
+            // Skip the first few windows, both need a pulse or two to start
+            if (jobTime > 10 * JOB_INTERVAL_US + 3 * period) {
+                oldErrors.add(oldRate, rate);
+                newErrors.add(meter.getRate(), rate);
+            }
+            lastJob = jobTime;
+            nextJob += JOB_INTERVAL_US;
+        }
+
+        // Too short a run for this rate to get past the warm-up, nothing to compare
+        if (newErrors.windows == 0) {
+            printf("%-8.1f %8.2f   no windows\n", rate, 1e6 / period);
+            continue;
+        }
+
+        double actualMilliLitres = edges * 1000.0 / (FLOW_CALIBRATION_FACTOR * 60);
+        double meanPercent = newErrors.meanPercent / newErrors.windows;
+        double volumePercent = (milliLitres - actualMilliLitres) / actualMilliLitres * 100;
+        bool pass = meanPercent <= MAX_MEAN_ERROR_PERCENT && newErrors.maxPercent <= MAX_ERROR_PERCENT
+            && fabs(milliLitres - actualMilliLitres) <= MAX_VOLUME_ERROR_PULSES * 1000.0 / (FLOW_CALIBRATION_FACTOR * 60);
+        printf("%-8.1f %8.2f %12.1f %12.1f %12.1f %12.1f %10.3f%s\n",
+            rate, 1e6 / period,
+            oldErrors.meanPercent / oldErrors.windows, oldErrors.maxPercent,
+            meanPercent, newErrors.maxPercent, volumePercent, pass ? "" : "  FAIL");
+        if (!pass) { failures++; }
+    }
+
+    // Pump stops dead after a steady 20 L/min, how long until the meter agrees
+    FlowMeter meter(FLOW_CALIBRATION_FACTOR);
+    double period = 1e6 / (20 * FLOW_CALIBRATION_FACTOR);
+    unsigned long stopAt = 30 * JOB_INTERVAL_US + 400000;
+    double edge = period;
+    unsigned long stopMs = 0;
+    meter.begin(0);
+
+    for (unsigned long jobTime = JOB_INTERVAL_US; jobTime < stopAt + 10 * JOB_INTERVAL_US; jobTime += JOB_INTERVAL_US) {
+        for (; edge <= jobTime && edge < stopAt; edge += period) {
+            pulses.addPulses(BENCH_PIN, 1, (unsigned long)edge);
+        }
+        meter.update(pulses.take(BENCH_PIN), jobTime);
+        if (jobTime > stopAt && meter.getRate() == 0) {
+            stopMs = (jobTime - (unsigned long)(edge - period)) / 1000;
+            break;
+        }
+    }
+
+    bool stopPass = stopMs > 0 && stopMs <= MAX_STOP_MS;
+    printf("\nStop at 20 L/min reads zero %lu ms after the last pulse (timeout %d ms)%s\n", stopMs, FLOW_TIMEOUT, stopPass ? "" : "  FAIL");
+    if (!stopPass) { failures++; }
+
+    if (failures > 0) {
+        printf("%d check(s) failed: mean error over %.1f %%, max over %.1f %%, volume off by more than %.0f pulse or stop later than %lu ms\n",
+            failures, MAX_MEAN_ERROR_PERCENT, MAX_ERROR_PERCENT, MAX_VOLUME_ERROR_PULSES, MAX_STOP_MS);
+        return 1;
+    }
+    return 0;
+}
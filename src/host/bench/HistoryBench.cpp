@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+// /api/history encoding, a week of history streamed into a server that only
+// counts bytes. Reports output size, encode throughput and the heap the
+// stream allocated on top of what was in use before it started.
+
+#include <Arduino.h>
+#include <chrono>
+#include "host/bench/Bench.h"
+#include "PumpManager/EnergyHistory.h"
+#include "PumpManager/EnergyMeter.h"
+
+// Swallows the response, nothing buffered so heap figures are the encoder's alone
+class CountingServer : public hal::HttpServer {
+public:
+    size_t bytes = 0;
+    size_t chunks = 0;
+
+    void on(const char*, hal::HttpMethod, Handler) override {}
+    void onNotFound(Handler) override {}
+    void enableFirmwareUpdate(const char*) override {}
+    void begin() override {}
+    void handleClient(unsigned long) override {}
+    bool hasArg(const char*) override { return false; }
+    const char* arg(const char*) override { return ""; }
+    const char* header(const char*) override { return ""; }
+    void sendHeader(const char*, const char*) override {}
+    void send(int, const char*, const String& content) override { bytes += content.length(); }
+    void send(int, const char*, const char*, size_t length) override { bytes += length; }
+    void beginChunked(int, const char*) override { bytes = 0; chunks = 0; }
+    void sendChunk(const char*, size_t length) override { bytes += length; chunks++; }
+    void endChunked() override {}
+    hal::HttpStream* beginStream(const char*) override { return nullptr; }
+};
+
+static EnergyHistory history;        // Static like the firmware's, 93 KB
+
+int runHistoryBench(int argc, char** argv) {
+    int repeats = argc > 0 ? atoi(argv[0]) : 20;
+    if (repeats <= 0) { repeats = 20; }
+
+    // Eight days of a daily heating cycle, enough to fill every tier
+    for (uint32_t second = 0; second < 8 * 86400; second++) {
+        uint32_t daySecond = second % 86400;
+        bool pumpOn = daySecond > 9 * 3600 && daySecond < 17 * 3600;
+        float poolTemp = 26 + 2 * sinf(daySecond / 86400.0f * 6.283f);
+        float rise = pumpOn ? 1.5f + (second % 97) / 200.0f : 0;
+        float flow = pumpOn ? 21.5f + (second % 13) / 10.0f : 0;
+        history.record(poolTemp, poolTemp + rise, flow, flow / 60 * EnergyMeter::WATER_HEAT_CAPACITY * rise, pumpOn ? 2 : 3, pumpOn);
+    }
+
+    struct Case {
+        const char* name;
+        long from;
+        uint32_t res;
+    };
+    const Case cases[] = {
+        { "week, 1 h", -7 * 86400L, 3600 },
+        { "day, 1 min", -86400L, 60 },
+        { "15 min, 1 s", -900, 1 },
+    };
+
+    printf("%-12s %-6s %8s %10s %8s %12s %10s\n", "range", "format", "points", "bytes", "chunks", "MB/s", "heap");
+    for (const Case& test : cases) {
+        for (EnergyHistory::Format format : { EnergyHistory::BINARY, EnergyHistory::CSV }) {
+            CountingServer server;
+            benchHeapResetPeak();
+            size_t heapBefore = benchHeapInUse();
+
+            uint32_t points = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < repeats; i++) {
+                points = history.stream(server, format, EnergyHistory::ALL_CHANNELS, test.from, history.now(), test.res, 0);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            printf("%-12s %-6s %8u %10zu %8zu %12.1f %10zu\n",
+                test.name, format == EnergyHistory::CSV ? "csv" : "binary", points, server.bytes, server.chunks,
+                server.bytes * repeats / seconds / 1e6, benchHeapPeak() - heapBefore);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+// Totals journal on a file backed flash region:
+//   wear        years of appends, erases per sector and flash bytes per logical byte
+//   replay      time and flash reads for begin() with a full newest sector
+//   power cuts  writes cut off at random points, every reboot must recover
+//               either the totals before or after the interrupted record
+
+#include <Arduino.h>
+#include <chrono>
+#include <random>
+#include "hal/native/NativeHAL.h"
+#include "host/bench/Bench.h"
+#include "PumpManager/TotalsJournal.h"
+
+static const double FLASH_ERASE_CYCLES = 100000;        // Typical NOR endurance per sector
+static const size_t TOTALS_BYTES = 8 + 8 + 4;           // Logical payload of one set of totals
+
+static bool sameTotals(const TotalsJournal::Totals& a, const TotalsJournal::Totals& b) {
+    return a.milliLitres == b.milliLitres && a.energyJoules == b.energyJoules && a.pumpSeconds == b.pumpSeconds;
+}
+
+int runJournalBench(int argc, char** argv) {
+    double years = 5;
+    unsigned long intervalMinutes = JOURNAL_INTERVAL / 60000;
+    unsigned long cuts = 500;
+    const char* path = "bench-journal.bin";
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--years") == 0) { years = atof(argv[i + 1]); }
+        else if (strcmp(argv[i], "--interval-min") == 0) { intervalMinutes = strtoul(argv[i + 1], nullptr, 10); }
+        else if (strcmp(argv[i], "--cuts") == 0) { cuts = strtoul(argv[i + 1], nullptr, 10); }
+        else if (strcmp(argv[i], "--path") == 0) { path = argv[i + 1]; }
+        else {
+            printf("Usage: bench journal [--years N] [--interval-min N] [--cuts N] [--path file]\n");
+            return 1;
+        }
+    }
+    if (intervalMinutes == 0) { intervalMinutes = 1; }
+    remove(path);
+
+    // Wear, the pump runs 8 hours a day so only a third of the intervals have anything to write
+    uint64_t intervals = (uint64_t)(years * 365 * 24 * 60 / intervalMinutes);
+    uint64_t intervalsPerDay = 24 * 60 / intervalMinutes;
+    hal::FileFlashRegion flash;
+    flash.setPath(path);
+    TotalsJournal journal(flash);
+    if (!journal.begin()) {
+        printf("Could not open %s\n", path);
+        return 1;
+    }
+
+    for (uint64_t i = 0; i < intervals; i++) {
+        if (i % intervalsPerDay < intervalsPerDay / 3) {
+            uint32_t seconds = intervalMinutes * 60;
+            journal.add(seconds * 20000 / 60, seconds * 3000, seconds);     // 20 L/min, 3 kW
+        }
+        journal.flush();
+    }
+
+    size_t sectors = flash.size() / flash.sectorSize();
+    uint64_t touched = flash.getBytesWritten() + (uint64_t)flash.getSectorErases() * flash.sectorSize();
+    double erasesPerSectorYear = flash.getSectorErases() / (double)sectors / years;
+    printf("wear: %.1f years, %lu min interval, %u records, %llu bytes programmed, %u sector erases\n",
+        years, intervalMinutes, journal.getRecordsWritten(), (unsigned long long)flash.getBytesWritten(), flash.getSectorErases());
+    printf("wear: %.1f erases per sector per year, %.0f years to %.0f cycles\n",
+        erasesPerSectorYear, erasesPerSectorYear > 0 ? FLASH_ERASE_CYCLES / erasesPerSectorYear : 0.0, FLASH_ERASE_CYCLES);
+    printf("wear: write amplification %.1fx programmed, %.1fx including erases\n",
+        flash.getBytesWritten() / (double)(journal.getRecordsWritten() * TOTALS_BYTES),
+        touched / (double)(journal.getRecordsWritten() * TOTALS_BYTES));
+
+    // Replay, fill the newest sector so begin() walks the longest possible chain
+    TotalsJournal::Totals expected = journal.getTotals();
+    while (journal.getRecordsWritten() % (flash.sectorSize() / 32) != 0) {
+        journal.add(1, 1, 1);
+        journal.flush();
+    }
+    expected = journal.getTotals();
+
+    const int replays = 1000;
+    uint64_t replayedRecords = 0;
+    uint64_t bytesRead = 0;
+    double replayMicros = 0;
+    for (int i = 0; i < replays; i++) {
+        hal::FileFlashRegion rebooted;
+        rebooted.setPath(path);
+        rebooted.begin();
+        TotalsJournal recovered(rebooted);
+
+        auto start = std::chrono::steady_clock::now();
+        recovered.begin();
+        replayMicros += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        if (!sameTotals(recovered.getTotals(), expected)) {
+            printf("replay: totals mismatch\n");
+            return 1;
+        }
+        replayedRecords = recovered.getReplayedRecords();
+        bytesRead = rebooted.getBytesRead();
+    }
+    printf("replay: %llu records, %llu bytes read, %.1f us per boot on this host\n",
+        (unsigned long long)replayedRecords, (unsigned long long)bytesRead, replayMicros / replays);
+
+    // Power cuts, each trial is a boot, one interrupted append, then another boot
+    std::mt19937 random(1);
+    unsigned long failures = 0;
+    unsigned long lostRecords = 0;
+    for (unsigned long trial = 0; trial < cuts; trial++) {
+        TotalsJournal::Totals before;
+        TotalsJournal::Totals after;
+        {
+            hal::FileFlashRegion booted;
+            booted.setPath(path);
+            TotalsJournal live(booted);
+            live.begin();
+
+            before = live.getTotals();
+            live.add(random() % 100000, (int32_t)(random() % 200000) - 50000, random() % 600);
+            after = live.getTotals();
+
+            booted.cutPowerAfter(random() % 40);            // Record is 32 bytes, sometimes it makes it
+            live.flush();
+        }
+
+        hal::FileFlashRegion rebooted;
+        rebooted.setPath(path);
+        TotalsJournal recovered(rebooted);
+        recovered.begin();
+
+        if (sameTotals(recovered.getTotals(), after)) { continue; }
+        if (sameTotals(recovered.getTotals(), before)) { lostRecords++; continue; }
+        failures++;
+    }
+    printf("power cuts: %lu trials, %lu lost the interrupted record, %lu bad recoveries\n", cuts, lostRecords, failures);
+
+    remove(path);
+    return failures == 0 ? 0 : 1;
+}
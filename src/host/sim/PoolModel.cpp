@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "host/sim/PoolModel.h"
+#include <cmath>
+
+static const double WATER_HEAT_CAPACITY = 4180;     // J/kgK, one litre taken as one kg
+static const double PROBE_TIME_CONSTANT = 5;        // s, probe and pipe lag with water moving
+
+PoolModel::PoolModel(const PoolModelParams& params)
+    : params_(params),
+    rng_(params.seed ? params.seed : 1),
+    day_(-1),
+    dayClearness_(1),
+    time_(0),
+    irradiance_(0),
+    ambient_(params.ambientMean),
+    poolTemp_(params.startPoolTemp),
+    collectorTemp_(params.ambientMean),
+    inputPipeTemp_(params.ambientMean),
+    outputPipeTemp_(params.ambientMean),
+    flow_(0),
+    heatCaptured_(0),
+    heatLost_(0) {}
+
+double PoolModel::nextRandom() {
+    // xorshift32, plenty for weather
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 17;
+    rng_ ^= rng_ << 5;
+    return rng_ / 4294967296.0;
+}
+
+void PoolModel::updateWeather() {
+    int day = (int)(time_ / 86400);
+    if (day != day_) {
+        day_ = day;
+        double clearness = 1.0 - params_.cloudiness * 2.0 * nextRandom();
+        dayClearness_ = clearness < 0.1 ? 0.1 : (clearness > 1.0 ? 1.0 : clearness);
+    }
+
+    double hour = fmod(time_, 86400) / 3600;
+    double sunrise = 12 - params_.daylightHours / 2;
+    double sunAngle = M_PI * (hour - sunrise) / params_.daylightHours;
+
+    irradiance_ = (sunAngle > 0 && sunAngle < M_PI) ? params_.peakIrradiance * dayClearness_ * sin(sunAngle) : 0;
+    ambient_ = params_.ambientMean + params_.ambientSwing * sin(2 * M_PI * (hour - 9) / 24);     // Warmest mid afternoon
+}
+
+void PoolModel::step(double dtSeconds, bool pumpOn) {
+    updateWeather();
+
+    // Pump spin up/down
+    double targetFlow = pumpOn ? params_.nominalFlow : 0;
+    flow_ += (targetFlow - flow_) * (1 - exp(-dtSeconds / params_.flowTimeConstant));
+
+    double massFlow = flow_ / 60;                                           // kg/s
+    double collectorCapacity = params_.collectorMassLitres * WATER_HEAT_CAPACITY;
+    double poolCapacity = params_.poolVolumeLitres * WATER_HEAT_CAPACITY;
+
+    // Collector node, absorbs sun and loses to ambient, the loop carries heat to the pool
+    double collectorGain = params_.collectorArea
+        * (params_.collectorEfficiency * irradiance_ - params_.collectorLossCoefficient * (collectorTemp_ - ambient_));
+    double loopTransfer = massFlow * WATER_HEAT_CAPACITY * (collectorTemp_ - poolTemp_);
+    collectorTemp_ += (collectorGain - loopTransfer) * dtSeconds / collectorCapacity;
+
+    // Pool node
+    double surfaceGain = params_.poolSurfaceArea * params_.poolSolarAbsorptance * irradiance_;
+    double poolLoss = params_.poolSurfaceArea * params_.poolLossCoefficient * (poolTemp_ - ambient_);
+    poolTemp_ += (loopTransfer + surfaceGain - poolLoss) * dtSeconds / poolCapacity;
+
+    heatCaptured_ += loopTransfer * dtSeconds;
+    heatLost_ += poolLoss * dtSeconds;
+
+    // Probes follow the water while it moves, otherwise the pipes drift to ambient
+    if (flow_ > 1) {
+        double follow = 1 - exp(-dtSeconds / PROBE_TIME_CONSTANT);
+        inputPipeTemp_ += (poolTemp_ - inputPipeTemp_) * follow;
+        outputPipeTemp_ += (collectorTemp_ - outputPipeTemp_) * follow;
+    } else {
+        double drift = 1 - exp(-dtSeconds / params_.pipeLossTimeConstant);
+        inputPipeTemp_ += (ambient_ - inputPipeTemp_) * drift;
+        outputPipeTemp_ += (ambient_ - outputPipeTemp_) * drift;
+    }
+
+    time_ += dtSeconds;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef PoolModel_h
+#define PoolModel_h
+
+#include <cstdint>
+
+// Lumped thermal model of the pool, an unglazed solar collector and the pump
+// loop between them. Good enough to rank control parameter sets against each
+// other, not to predict absolute pool temperatures.
+struct PoolModelParams {
+    double poolVolumeLitres = 45000;
+    double poolSurfaceArea = 32;                // m2
+    double poolLossCoefficient = 15;            // W/m2K to air (convection + evaporation, lumped)
+    double poolSolarAbsorptance = 0.6;          // Fraction of irradiance on the surface kept by the water
+
+    double collectorArea = 18;                  // m2
+    double collectorEfficiency = 0.85;          // Optical efficiency (eta0)
+    double collectorLossCoefficient = 18;       // W/m2K, unglazed
+    double collectorMassLitres = 40;            // Water held in the collector and risers
+    double pipeLossTimeConstant = 900;          // s, how fast idle pipes drift towards ambient
+
+    double nominalFlow = 55;                    // L/min with the pump running
+    double flowTimeConstant = 4;                // s, pump spin up/down
+
+    double peakIrradiance = 950;                // W/m2 at solar noon on a clear day
+    double daylightHours = 13;
+    double cloudiness = 0.3;                    // 0 clear every day, 1 heavily overcast on average
+    double ambientMean = 22;                    // C
+    double ambientSwing = 6;                    // C, half the day/night range
+    double startPoolTemp = 21;                  // C
+    uint32_t seed = 1;                          // Weather generator seed
+};
+
+class PoolModel {
+public:
+    explicit PoolModel(const PoolModelParams& params);
+
+    void step(double dtSeconds, bool pumpOn);  // Advance the physics by dt
+
+    double time() const { return time_; }
+    double irradiance() const { return irradiance_; }
+    double ambientTemp() const { return ambient_; }
+    double poolTemp() const { return poolTemp_; }
+    double inputProbeTemp() const { return inputPipeTemp_; }
+    double outputProbeTemp() const { return outputPipeTemp_; }
+    double flowRate() const { return flow_; }   // L/min
+    double heatCapturedJoules() const { return heatCaptured_; }
+    double heatLostJoules() const { return heatLost_; }
+
+private:
+    PoolModelParams params_;
+    uint32_t rng_;
+    int day_;
+    double dayClearness_;
+
+    double time_;
+    double irradiance_;
+    double ambient_;
+    double poolTemp_;
+    double collectorTemp_;
+    double inputPipeTemp_;
+    double outputPipeTemp_;
+    double flow_;
+    double heatCaptured_;
+    double heatLost_;
+
+    double nextRandom();                        // Uniform 0..1, deterministic per seed
+    void updateWeather();
+};
+
+#endif // PoolModel_h
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+// env:sim entry point. Runs the real PumpManager state machine against a
+// virtual clock and the PoolModel physics, one parameter set per run:
+//
+//   sim --days 90 --target 30 --threshold 500 --hibernate-min 30 --csv
+//
+// Pass --csv-header once and --csv on every run to build a comparison table.
+
+#include <Arduino.h>
+#include <chrono>
+#include "hal/native/NativeHAL.h"
+#include "host/sim/PoolModel.h"
+#include "util/LogManager/LogManager.h"
+#include "PumpManager/PumpManager.h"
+
+struct SimOptions {
+    double days = 90;
+    unsigned long stepMs = 250;                 // Controller and physics tick
+    bool csv = false;
+    bool csvHeader = false;
+    bool verbose = false;                       // Show the controller logs
+};
+
+static void printUsage() {
+    printf("Usage: sim [options]\n"
+        "  --days N             Simulated days (default 90)\n"
+        "  --step-ms N          Tick size in ms (default 250)\n"
+        "  --target C           Target pool temp\n"
+        "  --threshold W        Energy capture threshold\n"
+        "  --trigger-s N        Hibernation trigger delay in seconds\n"
+        "  --hibernate-min N    Hibernation period in minutes\n"
+        "  --stability-s N      Sensor stability delay in seconds\n"
+        "  --start-temp C       Initial pool temp\n"
+        "  --cloudiness F       0..1, average cloud cover\n"
+        "  --ambient C          Mean ambient temp\n"
+        "  --seed N             Weather seed\n"
+        "  --csv / --csv-header One line per run for comparisons\n"
+        "  --verbose            Print controller logs\n");
+}
+
+static bool parseArgs(int argc, char** argv, SimOptions& options, PumpSettings& settings, PoolModelParams& model) {
+    for (int i = 1; i < argc; i++) {
+        String flag(argv[i]);
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (flag == "--csv") { options.csv = true; continue; }
+        if (flag == "--csv-header") { options.csvHeader = true; continue; }
+        if (flag == "--verbose") { options.verbose = true; continue; }
+        if (value == nullptr) { return false; }
+        i++;
+
+        if (flag == "--days") { options.days = atof(value); }
+        else if (flag == "--step-ms") { options.stepMs = strtoul(value, nullptr, 10); }
+        else if (flag == "--target") { settings.targetTemp = atof(value); }
+        else if (flag == "--threshold") { settings.energyCaptureThreshold = atof(value); }
+        else if (flag == "--trigger-s") { settings.hibernationTriggerDelay = strtoul(value, nullptr, 10) * 1000; }
+        else if (flag == "--hibernate-min") { settings.hibernationPeriod = strtoul(value, nullptr, 10) * 60 * 1000; }
+        else if (flag == "--stability-s") { settings.sensorStabilityDelay = strtoul(value, nullptr, 10) * 1000; }
+        else if (flag == "--start-temp") { model.startPoolTemp = atof(value); }
+        else if (flag == "--cloudiness") { model.cloudiness = atof(value); }
+        else if (flag == "--ambient") { model.ambientMean = atof(value); }
+        else if (flag == "--seed") { model.seed = strtoul(value, nullptr, 10); }
+        else { return false; }
+    }
+    return options.stepMs > 0 && options.days > 0;
+}
+
+int main(int argc, char** argv) {
+    SimOptions options;
+    PumpSettings settings;
+    PoolModelParams modelParams;
+
+    if (!parseArgs(argc, argv, options, settings, modelParams)) {
+        printUsage();
+        return 1;
+    }
+
+    if (options.csvHeader) {
+        printf("days,target,threshold,trigger_s,hibernate_min,stability_s,heat_kwh,loss_kwh,pump_hours,pump_cycles,"
+            "kwh_per_pump_hour,pool_start,pool_end,pool_max,hours_above_target,wall_ms\n");
+        if (!options.csv) { return 0; }
+    }
+
+    hal::FakeClock& clock = hal::fakeClock();
+    hal::FakeTempBus& tempBus = hal::fakeTempBus();
+    clock.setManual(true);
+    Serial.setEnabled(options.verbose);
+
+    // Every run starts from blank lifetime totals,
+    const char* journalPath = "sim-journal.bin";
+    remove(journalPath);
+    hal::fileFlashRegion().setPath(journalPath);
+
+    // and seeds its sensor roles from the config addresses
+    const char* settingsPath = "sim-settings.bin";
+    remove(settingsPath);
+    hal::fileSettingsStore().setPath(settingsPath);
+
+    const uint8_t inputAddr[8] = INPUT_TEMP_ADDR;
+    const uint8_t outputAddr[8] = OUTPUT_TEMP_ADDR;
+    const uint8_t enclosureAddr[8] = ENCLOSURE_TEMP_ADDR;
+    PoolModel model(modelParams);
+
+    PumpManager& pump = PumpManager::getInstance();
+    Scheduler scheduler(clock);
+    LogManager::getInstance().setup(scheduler);
+    pump.getCircuit(0).setSettings(settings);
+    pump.setup();
+    const CircuitPins& pins = pump.getCircuit(0).getPins();     // The model is one circuit
+
+    auto wallStart = std::chrono::steady_clock::now();
+
+    const double dt = options.stepMs / 1000.0;
+    const uint64_t steps = (uint64_t)(options.days * 86400.0 / dt);
+    double pulseRemainder = 0;
+    uint64_t pumpOnSteps = 0;
+    uint64_t aboveTargetSteps = 0;
+    unsigned long pumpCycles = 0;
+    bool pumpWasOn = false;
+    double poolMax = model.poolTemp();
+
+    for (uint64_t step = 0; step < steps; step++) {
+        bool pumpOn = hal::fakeGpio().read(pins.pumpPin);
+        if (pumpOn && !pumpWasOn) { pumpCycles++; }
+        pumpWasOn = pumpOn;
+        if (pumpOn) { pumpOnSteps++; }
+
+        model.step(dt, pumpOn);
+
+        // Feed the fakes from the physics, the controller only sees what the hardware would
+        tempBus.setTemperature(inputAddr, model.inputProbeTemp());
+        tempBus.setTemperature(outputAddr, model.outputProbeTemp());
+        tempBus.setTemperature(enclosureAddr, model.ambientTemp() + 5);
+
+        pulseRemainder += model.flowRate() * FLOW_CALIBRATION_FACTOR * dt;
+        uint32_t pulses = (uint32_t)pulseRemainder;
+        hal::fakePulseInput().addPulses(pins.flowPin, pulses);
+        pulseRemainder -= pulses;
+
+        if (model.poolTemp() > poolMax) { poolMax = model.poolTemp(); }
+        if (model.poolTemp() > settings.targetTemp) { aboveTargetSteps++; }
+
+        clock.advance(options.stepMs);
+        pump.update();
+        scheduler.run();
+    }
+
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+    double heatKWh = model.heatCapturedJoules() / 3.6e6;
+    double lossKWh = model.heatLostJoules() / 3.6e6;
+    double pumpHours = pumpOnSteps * dt / 3600;
+    double kWhPerPumpHour = pumpHours > 0 ? heatKWh / pumpHours : 0;
+    double hoursAboveTarget = aboveTargetSteps * dt / 3600;
+
+    // What the controller's own energy meter made of it, against the model's exact figure
+    Telemetry telemetry = pump.getTelemetry();
+    double meteredKWh = telemetry.lifetimeJoules / 3.6e6;
+    double pumpKWh = telemetry.pumpSeconds * (double)PUMP_POWER_WATTS / 3.6e6;
+
+    if (options.csv) {
+        printf("%.1f,%.1f,%.0f,%lu,%lu,%lu,%.1f,%.1f,%.1f,%lu,%.2f,%.2f,%.2f,%.2f,%.1f,%.0f\n",
+            options.days, settings.targetTemp, settings.energyCaptureThreshold,
+            settings.hibernationTriggerDelay / 1000, settings.hibernationPeriod / 60000, settings.sensorStabilityDelay / 1000,
+            heatKWh, lossKWh, pumpHours, pumpCycles, kWhPerPumpHour,
+            modelParams.startPoolTemp, model.poolTemp(), poolMax, hoursAboveTarget, wallMs);
+        return 0;
+    }
+
+    printf("Simulated %.1f days in %.0f ms (%lu ms ticks)\n", options.days, wallMs, options.stepMs);
+    printf("  Target %.1f C, threshold %.0f W, trigger %lus, hibernate %lumin, stability %lus\n",
+        settings.targetTemp, settings.energyCaptureThreshold, settings.hibernationTriggerDelay / 1000,
+        settings.hibernationPeriod / 60000, settings.sensorStabilityDelay / 1000);
+    printf("  Heat captured:      %.1f kWh\n", heatKWh);
+    printf("  Pool losses:        %.1f kWh\n", lossKWh);
+    printf("  Pump runtime:       %.1f h over %lu cycles\n", pumpHours, pumpCycles);
+    printf("  Heat per pump hour: %.2f kWh\n", kWhPerPumpHour);
+    printf("  Metered by control: %.1f kWh heat, COP %.1f at %d W\n",
+        meteredKWh, pumpKWh > 0 ? meteredKWh / pumpKWh : 0, PUMP_POWER_WATTS);
+    printf("  Pool temp:          %.2f C -> %.2f C (max %.2f C, %.1f h above target)\n",
+        modelParams.startPoolTemp, model.poolTemp(), poolMax, hoursAboveTarget);
+    return 0;
+}
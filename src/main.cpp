@@ -19,28 +19,73 @@
 
 #include <Arduino.h>
 #include "util/LogManager/LogManager.h"
+#include "util/MemoryMonitor/MemoryMonitor.h"
+#include "util/NotificationManager/NotificationManager.h"
 #include "util/LEDStatusManager/LEDStatusManager.h"
 #include "util/WiFiManager/WiFiManager.h"
 #include "util/TimeManager/TimeManager.h"
+#include "util/Scheduler/Scheduler.h"
 #include "PumpManager/PumpManager.h"
 
+// The control tick runs on its own task pinned to CONTROL_TASK_CORE. WiFi,
+// NTP, the LED and log output share NETWORK_TASK_CORE with the web, log and
+// notifier tasks, so nothing that waits on the network shares a core with it.
+// Their periodic work is jobs on one scheduler, the network task sleeps until
+// the next one is due.
+static const uint32_t NETWORK_TASK_STACK_SIZE = 8192;
+static const unsigned long NETWORK_MAX_IDLE = 1000;    // Sleep when nothing is scheduled
+
+static Scheduler& scheduler() {
+    static Scheduler instance(hal::clock());
+    return instance;
+}
+
+static bool controlTaskRunning = false;
+static bool networkTaskRunning = false;
+
+static void runScheduler() {
+    scheduler().run();
+    unsigned long idle = scheduler().idleTime();
+    hal::clock().delay(idle < NETWORK_MAX_IDLE ? idle : NETWORK_MAX_IDLE);
+}
+
+static void networkTask(void* arg) {
+    for (;;) {
+        runScheduler();
+    }
+}
+
 void setup() {
     Serial.begin(115200);
 
-    LEDStatusManager::getInstance().setup();
-    LogManager::getInstance().setup();
-    WiFiManager::getInstance().setup();
-    TimeManager::getInstance().setup();
+    LEDStatusManager::getInstance().setup(scheduler());
+    LogManager::getInstance().setup(scheduler());
+    WiFiManager::getInstance().setup(scheduler());
+    NotificationManager::getInstance().setup();
+    TimeManager::getInstance().setup(scheduler());
     PumpManager::getInstance().setup();
+    MemoryMonitor::getInstance().setup(scheduler());
 
     LEDStatusManager::getInstance().setStatus(0);
     LogManager::getInstance().log(INFO, "Setup finished");
+
+    // The scheduler belongs to the network task from here on
+    controlTaskRunning = PumpManager::getInstance().startControlTask();
+    networkTaskRunning = hal::startTask("network", networkTask, nullptr, NETWORK_TASK_STACK_SIZE, 1, NETWORK_TASK_CORE);
+    if (!networkTaskRunning) {
+        LogManager::getInstance().log(WARN, "Failed to start network task, running it from the main loop");
+    }
 }
 
 void loop() {
-    LEDStatusManager::getInstance().update();
-    LogManager::getInstance().update();
-    WiFiManager::getInstance().update();
-    TimeManager::getInstance().update();
-    PumpManager::getInstance().update();
+    // Only does anything for a task that couldn't be started
+    if (!controlTaskRunning) {
+        PumpManager::getInstance().update();
+        if (!networkTaskRunning) { scheduler().run(); }
+        hal::clock().delay(1);
+    } else if (!networkTaskRunning) {
+        runScheduler();
+    } else {
+        hal::clock().delay(NETWORK_MAX_IDLE);
+    }
 }
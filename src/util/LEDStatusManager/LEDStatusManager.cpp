@@ -18,39 +18,36 @@
  */
 
 #include "util/LEDStatusManager/LEDStatusManager.h"
+#include "util/Profiler/Profiler.h"
 
 LEDStatusManager::LEDStatusManager()
     : status_(0),
-    lastBlinkTime_(0),
+    scheduler_(nullptr),
+    blinkJob_([this](){ blink(); }),
     blinkCount_(0),
     maxBlinks_(0),
     ledState_(false) {}
 
 
-void LEDStatusManager::setup() {
-    pinMode(INDICATOR_LED_PIN, OUTPUT);
+void LEDStatusManager::setup(Scheduler& scheduler) {
+    scheduler_ = &scheduler;
+    hal::gpio().setMode(INDICATOR_LED_PIN, hal::PinMode::Output);
 }
 
-void LEDStatusManager::update() {
-    unsigned long currentMillis = millis();
+void LEDStatusManager::blink() {
+    Profiler::Scope scope(ProfileSection::Led);
 
-    // Check for pause between sets of blinks
-    if (status_ != 0 && blinkCount_ >= maxBlinks_ * 2 && currentMillis - lastBlinkTime_ < pauseInterval_) {
-        // In pause, do nothing until pause is over
-        return;
-    }
+    if (status_ == 0) { return; }
 
-    // Reset pattern after pause or initially
-    if (status_ != 0 && blinkCount_ >= maxBlinks_ * 2 && currentMillis - lastBlinkTime_ >= pauseInterval_) {
+    // A set of blinks, then the pause before the next set starts
+    if (blinkCount_ >= maxBlinks_ * 2) {
         resetBlinkPattern();
-        return; // Start new set of blinks after pause
+        scheduler_->after(blinkJob_, blinkInterval_);
+        return;
     }
 
-    // Continue with blink logic if not pausing and not resetting
-    if (status_ != 0 && (currentMillis - lastBlinkTime_ >= blinkInterval_) && blinkCount_ < maxBlinks_ * 2) {
-        toggleLED();
-        lastBlinkTime_ = currentMillis;
-    }
+    toggleLED();
+    scheduler_->after(blinkJob_, blinkCount_ < maxBlinks_ * 2 ? blinkInterval_ : pauseInterval_);
 }
 
 void LEDStatusManager::setStatus(int status) {
@@ -64,17 +61,23 @@ void LEDStatusManager::setStatus(int status) {
         case 4: maxBlinks_ = 4; break; // Config Error
         default: maxBlinks_ = 0; break; // LED off for OK status
     }
+
+    if (!scheduler_) { return; }
+    if (status_ != 0) {
+        scheduler_->after(blinkJob_, blinkInterval_);
+    } else {
+        scheduler_->cancel(blinkJob_);
+    }
 }
 
 void LEDStatusManager::toggleLED() {
     ledState_ = !ledState_;
-    digitalWrite(INDICATOR_LED_PIN, ledState_ ? HIGH : LOW);
+    hal::gpio().write(INDICATOR_LED_PIN, ledState_);
     blinkCount_++;
 }
 
 void LEDStatusManager::resetBlinkPattern() {
     blinkCount_ = 0;
-    lastBlinkTime_ = millis();
-    digitalWrite(INDICATOR_LED_PIN, LOW); // Ensure LED is off during pause
+    hal::gpio().write(INDICATOR_LED_PIN, false); // Ensure LED is off during pause
     ledState_ = false;
 }
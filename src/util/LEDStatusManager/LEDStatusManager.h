@@ -21,7 +21,9 @@
 #define LEDStatusManager_h
 
 #include <Arduino.h>
+#include "hal/HAL.h"
 #include "util/config.h"
+#include "util/Scheduler/Scheduler.h"
 
 class LEDStatusManager {
 public:
@@ -30,9 +32,8 @@ public:
         return instance;
     }
 
-    void setup();
-    void update();
-    void setStatus(int status);
+    void setup(Scheduler& scheduler);
+    void setStatus(int status);                 // From the task running the scheduler
 
 private:
     LEDStatusManager();                         // Private constructor/destructor for singleton
@@ -41,13 +42,15 @@ private:
     LEDStatusManager& operator=(const LEDStatusManager&) = delete;
 
     int status_;                                // Current LED status
-    unsigned long lastBlinkTime_;               // Timestamp of the last LED blink
+    Scheduler* scheduler_;                      // Runs blinkJob_, set by setup()
+    Scheduler::Job blinkJob_;                   // Next toggle, or the end of the pause between sets
     const unsigned long blinkInterval_ = 200;   // Duration of each blink in milliseconds
     const unsigned long pauseInterval_ = 2000;  // Pause duration between sets of blinks in milliseconds
     int blinkCount_;                            // Current count of blinks in the ongoing sequence
     int maxBlinks_;                             // Maximum number of blinks in the current pattern
     bool ledState_;                             // Current state of the LED (ON/OFF)
 
+    void blink();                               // Steps the pattern and schedules the next step
     void toggleLED();                           // Toggles the current state of the LED
     void resetBlinkPattern();                   // Resets the blinking pattern based on the current status
 };
@@ -18,17 +18,32 @@
  */
 
 #include "util/LogManager/LogManager.h"
+#include "util/NotificationManager/NotificationManager.h"
+#include "util/Profiler/Profiler.h"
 
 LogManager::LogManager()
-    : currentLogLevel_(INFO) {}
+    : currentLogLevel_(INFO),
+    enqueuePos_(0),
+    dequeuePos_(0),
+    droppedCount_(0),
+    droppedReported_(0),
+    drainJob_([this](){ drainQueue(); }),
+    logBuffer_(),
+    logHead_(0),
+    logCount_(0),
+    nextSequence_(0) {
 
-
-void LogManager::setup() {
-    // Setup stuffs
+    for (uint32_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+        queue_[i].turn.store(i, std::memory_order_relaxed);
+    }
 }
 
-void LogManager::update() {
-    // Placeholder for future needs
+
+void LogManager::setup(Scheduler& scheduler) {
+    if (!hal::startTask("log", LogManager::drainTask, this, LOG_TASK_STACK_SIZE, LOG_TASK_PRIORITY, NETWORK_TASK_CORE)) {
+        scheduler.every(drainJob_, LOG_DRAIN_INTERVAL);
+        log(WARN, "Failed to start log task, draining from the network scheduler");
+    }
 }
 
 const char* logLevelToString(LogLevel level) {
@@ -41,64 +56,265 @@ const char* logLevelToString(LogLevel level) {
     }
 }
 
+size_t escapeJson(char* output, size_t size, const char* text) {
+    // Measure first so the text is either added whole or not at all
+    size_t needed = 0;
+    for (const char* c = text; *c; c++) {
+        switch (*c) {
+            case '"': case '\\': case '\n': case '\r': case '\t': needed += 2; break;
+            default: needed += (uint8_t)*c < 0x20 ? 6 : 1;
+        }
+    }
+    if (needed >= size) { return 0; }
+
+    size_t length = 0;
+    for (const char* c = text; *c; c++) {
+        switch (*c) {
+            case '"': output[length++] = '\\'; output[length++] = '"'; break;
+            case '\\': output[length++] = '\\'; output[length++] = '\\'; break;
+            case '\n': output[length++] = '\\'; output[length++] = 'n'; break;
+            case '\r': output[length++] = '\\'; output[length++] = 'r'; break;
+            case '\t': output[length++] = '\\'; output[length++] = 't'; break;
+            default:
+                if ((uint8_t)*c < 0x20) {
+                    length += snprintf(output + length, size - length, "\\u%04x", (uint8_t)*c);
+                } else {
+                    output[length++] = *c;
+                }
+        }
+    }
+    output[length] = '\0';
+    return length;
+}
+
 void LogManager::log(LogLevel level, const String& message) {
-    // Get current log time from TimeManager
-    String logTime = TimeManager::getInstance().getLogTime();
+    log(level, message.c_str(), level >= WARN);
+}
 
-    // Format the log message for serial/Discord output
-    String formattedMessage = String(logTime + " [" + logLevelToString(level) + "] " + message);
+void LogManager::log(LogLevel level, const String& message, bool notify) {
+    log(level, message.c_str(), notify);
+}
 
-    // Log formatted message to serial
-    Serial.println(formattedMessage);
+void LogManager::log(LogLevel level, const char* message) {
+    log(level, message, level >= WARN);
+}
 
-    // Create a JSON object for the log entry
-    JsonDocument logEntry;
-    logEntry["time"] = logTime;
-    logEntry["level"] = logLevelToString(level);
-    logEntry["message"] = message;
+void LogManager::log(LogLevel level, const char* message, bool notify) {
+    Profiler::Scope scope(ProfileSection::Log);
+    uint32_t pos;
+    QueueSlot* slot = claimSlot(pos);
+    if (!slot) { return; }
 
-    // Add the log entry to the log buffer array
-    logBuffer_.add(logEntry);
+    size_t length = strnlen(message, MAX_LOG_MESSAGE_LENGTH);
+    memcpy(slot->message, message, length);
+    slot->message[length] = '\0';
+
+    publishSlot(slot, pos, level, notify);
+}
 
-    // Limit the number of log entries to MAX_LOG_ENTRIES
-    if (logBuffer_.size() > MAX_BUFFER_SIZE) {
-        logBuffer_.remove(0); // Remove the oldest entry
+void LogManager::logf(LogLevel level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vlogf(level, level >= WARN, format, args);
+    va_end(args);
+}
+
+void LogManager::vlogf(LogLevel level, bool notify, const char* format, va_list args) {
+    Profiler::Scope scope(ProfileSection::Log);
+    uint32_t pos;
+    QueueSlot* slot = claimSlot(pos);
+    if (!slot) { return; }
+
+    vsnprintf(slot->message, sizeof(slot->message), format, args);     // Truncates, always null terminated
+    publishSlot(slot, pos, level, notify);
+}
+
+LogManager::QueueSlot* LogManager::claimSlot(uint32_t& pos) {
+    pos = enqueuePos_.load(std::memory_order_relaxed);
+
+    // Only retries when another task claimed the same slot first
+    for (;;) {
+        QueueSlot* slot = &queue_[pos & (LOG_QUEUE_SIZE - 1)];
+        int32_t lag = (int32_t)(slot->turn.load(std::memory_order_acquire) - pos);
+
+        if (lag == 0) {
+            if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { return slot; }
+        } else if (lag < 0) {
+            droppedCount_.fetch_add(1, std::memory_order_relaxed);     // Full, drop the newest message
+            return nullptr;
+        } else {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
     }
 }
 
-String LogManager::getBuffer() {
-    String output;
-    JsonArray tempBuffer = logBuffer_.to<JsonArray>(); // Create a temporary JsonArray
-    tempBuffer.clear(); // Ensure the temporary buffer is empty
+void LogManager::publishSlot(QueueSlot* slot, uint32_t pos, LogLevel level, bool notify) {
+    slot->timestamp = TimeManager::getInstance().getLogTimestamp();
+    slot->level = level;
+    slot->notify = notify;
+    slot->turn.store(pos + 1, std::memory_order_release);      // Publish to the drain task
+}
 
-    // Iterate over the original logBuffer in reverse and add each element to the temporary buffer
-    for (int i = logBuffer_.size() - 1; i >= 0; --i) {
-        tempBuffer.add(logBuffer_[i]);
+void LogManager::drainTask(void* arg) {
+    LogManager* manager = static_cast<LogManager*>(arg);
+
+    for (;;) {
+        manager->drainQueue();
+        hal::clock().delay(hal::power().lowPower() ? LOW_POWER_POLL_INTERVAL : LOG_DRAIN_INTERVAL);
     }
+}
 
-    serializeJson(tempBuffer, output); // Serialize the temporary buffer, which is now in reverse order
-    return output;
+size_t LogManager::drainQueue() {
+    Profiler::Scope scope(ProfileSection::LogDrain);
+    size_t drained = 0;
+
+    for (;;) {
+        QueueSlot& slot = queue_[dequeuePos_ & (LOG_QUEUE_SIZE - 1)];
+        if (slot.turn.load(std::memory_order_acquire) != dequeuePos_ + 1) { break; }    // Empty or still being written
+
+        writeToSinks((LogLevel)slot.level, slot.timestamp, slot.message, slot.notify);
+
+        slot.turn.store(dequeuePos_ + LOG_QUEUE_SIZE, std::memory_order_release);     // Hand the slot back to producers
+        dequeuePos_++;
+        drained++;
+    }
+
+    uint32_t dropped = droppedCount_.load(std::memory_order_relaxed);
+    if (dropped != droppedReported_) {
+        char message[64];
+        snprintf(message, sizeof(message), "Log queue full, %lu message(s) dropped", (unsigned long)(dropped - droppedReported_));
+        writeToSinks(WARN, TimeManager::getInstance().getLogTimestamp(), message, false);
+        droppedReported_ = dropped;
+    }
+
+    return drained;
+}
+
+void LogManager::writeToSinks(LogLevel level, uint32_t timestamp, const char* message, bool notify) {
+    // Serial first, it doesn't need the lock
+    Serial.printf("%lu [%s] %s\n", (unsigned long)timestamp, logLevelToString(level), message);
+
+    LogRecord* record;
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex_);
+
+        // Overwrite the oldest slot in the ring, no allocation
+        record = &logBuffer_[logHead_];
+        record->sequence = nextSequence_++;
+        record->timestamp = timestamp;
+        record->level = level;
+        strncpy(record->message, message, MAX_LOG_MESSAGE_LENGTH);
+        record->message[MAX_LOG_MESSAGE_LENGTH] = '\0';
+
+        logHead_ = (logHead_ + 1) % MAX_BUFFER_SIZE;
+        if (logCount_ < MAX_BUFFER_SIZE) { logCount_++; }
+    }
+
+    // Only the drain task writes the ring, the record can't change under us
+    if (notify) {
+        sendToDiscord(*record);
+    }
+}
+
+bool LogManager::copyRecord(uint32_t sequence, LogRecord& record) {
+    std::lock_guard<std::mutex> lock(bufferMutex_);
+
+    uint32_t age = nextSequence_ - 1 - sequence;                // 0 is the newest entry
+    if (sequence >= nextSequence_ || age >= logCount_) { return false; }
+
+    record = logBuffer_[(logHead_ + MAX_BUFFER_SIZE - 1 - age) % MAX_BUFFER_SIZE];
+    return true;
+}
+
+size_t LogManager::formatJson(char* output, size_t size, const LogRecord& record) {
+    if (size < LOG_JSON_MAX_LENGTH + 1) { return 0; }
+
+    size_t length = snprintf(output, size, "{\"seq\":%lu,\"time\":%lu,\"level\":\"%s\",\"message\":\"",
+        (unsigned long)record.sequence, (unsigned long)record.timestamp, logLevelToString((LogLevel)record.level));
+
+    length += escapeJson(output + length, size - length, record.message);
+
+    output[length++] = '"';
+    output[length++] = '}';
+    output[length] = '\0';
+    return length;
+}
+
+void LogManager::streamLogs(hal::HttpServer& server, uint32_t since, size_t limit) {
+    char chunk[1024];
+    size_t used = 0;
+    size_t sent = 0;
+    LogRecord record;
+
+    uint32_t next;
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex_);
+        next = nextSequence_;
+    }
+
+    // A since past the newest entry means the device restarted under the poller, send everything
+    if (since > next) { since = 0; }
+
+    server.beginChunked(200, "application/json");
+    chunk[used++] = '[';
+
+    // Newest entry first, one record copied out at a time so a slow client never holds up the drain task
+    for (uint32_t sequence = next; sequence > since && sent < limit; sequence--) {
+        if (!copyRecord(sequence - 1, record)) { break; }
+
+        if (sizeof(chunk) - used < LOG_JSON_MAX_LENGTH + 2) {
+            server.sendChunk(chunk, used);
+            used = 0;
+        }
+
+        if (sent > 0) { chunk[used++] = ','; }
+        used += formatJson(chunk + used, sizeof(chunk) - used, record);
+        sent++;
+    }
+
+    chunk[used++] = ']';
+    server.sendChunk(chunk, used);
+    server.endChunked();
+}
+
+uint32_t LogManager::getNextSequence() {
+    std::lock_guard<std::mutex> lock(bufferMutex_);
+    return nextSequence_;
+}
+
+String LogManager::getBuffer() {
+    return getLastLogs(MAX_BUFFER_SIZE);
 }
 
 String LogManager::getLastLogs(size_t lastCount) {
-    String output;
-    JsonDocument lastLogs;
-    size_t endIndex = logBuffer_.size(); // Determine the end index
-    size_t startIndex = endIndex > lastCount ? endIndex - lastCount : 0; // Calculate the start index based on lastCount
-
-    // Iterate in reverse within the determined range and add each element to lastLogs
-    for (size_t i = endIndex; i > startIndex; --i) {
-        lastLogs.add(logBuffer_[i - 1]); // Adjust index as we're decrementing i
+    char entry[LOG_JSON_MAX_LENGTH + 1];
+    String output = "[";
+    LogRecord record;
+
+    uint32_t next;
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex_);
+        next = nextSequence_;
+    }
+
+    // Newest entry first
+    for (size_t i = 0; i < lastCount && i < next; i++) {
+        if (!copyRecord(next - 1 - i, record)) { break; }
+        if (i > 0) { output += ","; }
+        formatJson(entry, sizeof(entry), record);
+        output += entry;
     }
 
-    serializeJson(lastLogs, output); // Serialize the lastLogs, which now contains the last logs in reverse order
+    output += "]";
     return output;
 }
 
 void LogManager::clearBuffer() {
-    logBuffer_.clear();
+    std::lock_guard<std::mutex> lock(bufferMutex_);
+    logCount_ = 0;
 }
 
-void LogManager::sendToDiscord(const String& message) {
-    // Implement later, must be non-blocking
+void LogManager::sendToDiscord(const LogRecord& record) {
+    // Hand off only, batching and delivery happen on the notifier's own task
+    NotificationManager::getInstance().enqueue(record);
 }
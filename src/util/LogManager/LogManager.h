@@ -20,10 +20,13 @@
 #ifndef LogManager_h
 #define LogManager_h
 
-#include <ArduinoJson.h>
-#include <HTTPClient.h>
-#include <WiFi.h>
+#include <Arduino.h>
+#include <atomic>
+#include <cstdarg>
+#include <mutex>
+#include "hal/HAL.h"
 #include "util/config.h"
+#include "util/Scheduler/Scheduler.h"
 #include "util/TimeManager/TimeManager.h"
 
 enum LogLevel {
@@ -33,6 +36,18 @@ enum LogLevel {
     ERROR
 };
 
+// Fixed size log entry, the buffer is a preallocated ring of these so logging
+// never touches the heap. JSON is only built when the buffer is read.
+struct LogRecord {
+    uint32_t sequence;                              // Increments for every entry logged since boot
+    uint32_t timestamp;                             // TimeManager log timestamp
+    uint8_t level;                                  // LogLevel
+    char message[MAX_LOG_MESSAGE_LENGTH + 1];       // Truncated, always null terminated
+};
+
+const char* logLevelToString(LogLevel level);
+size_t escapeJson(char* output, size_t size, const char* text);    // 0 and nothing written if it doesn't fit
+
 class LogManager {
 public:
     static LogManager& getInstance() {        // Singleton instance
@@ -40,23 +55,67 @@ public:
         return instance;
     }
 
-    void setup();
-    void update();
-    void log(LogLevel level, const String& message);
+    void setup(Scheduler& scheduler);               // Drains from scheduler if the log task can't be started
+    void log(LogLevel level, const String& message);        // Safe from any task, never blocks, WARN and up notify
+    void log(LogLevel level, const String& message, bool notify);
+    void log(LogLevel level, const char* message);          // Copied straight into the queue, no heap
+    void log(LogLevel level, const char* message, bool notify);
+    void logf(LogLevel level, const char* format, ...) __attribute__((format(printf, 3, 4)));   // Formatted straight into the queue
+    void vlogf(LogLevel level, bool notify, const char* format, va_list args);
     String getBuffer();
     String getLastLogs(size_t lastCount);
     void clearBuffer();
 
+    void streamLogs(hal::HttpServer& server, uint32_t since, size_t limit);
+    uint32_t getNextSequence();                                 // Sequence the next entry logged will get
+    bool copyRecord(uint32_t sequence, LogRecord& record);     // false once the entry has been overwritten
+
+    size_t getCount() const { return logCount_; }
+    uint32_t getDroppedCount() const { return droppedCount_.load(std::memory_order_relaxed); }
+    static size_t formatJson(char* output, size_t size, const LogRecord& record);
+
+    static const size_t LOG_JSON_MAX_LENGTH = 96 + MAX_LOG_MESSAGE_LENGTH * 6;   // Every message char escaped as \u00XX
+
 private:
     LogManager();                           // Private constructor/destructor for singleton
     ~LogManager() = default;
     LogManager(const LogManager&) = delete;
     LogManager& operator=(const LogManager&) = delete;
 
+    // Bounded lock-free MPSC queue (Vyukov). log() claims a slot with one CAS,
+    // the drain task is the only consumer. When full the new message is dropped
+    // and counted, the drain task logs how many were lost once it catches up.
+    struct QueueSlot {
+        std::atomic<uint32_t> turn;                 // Slot is writable at pos, readable at pos + 1
+        uint32_t timestamp;
+        uint8_t level;
+        bool notify;                                // Forward to the webhook notifier
+        char message[MAX_LOG_MESSAGE_LENGTH + 1];
+    };
+
+    static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0, "LOG_QUEUE_SIZE must be a power of two");
+    static const uint32_t LOG_TASK_STACK_SIZE = 4096;
+
     LogLevel currentLogLevel_;
-    JsonDocument logBuffer_;
+    QueueSlot queue_[LOG_QUEUE_SIZE];
+    std::atomic<uint32_t> enqueuePos_;
+    uint32_t dequeuePos_;                           // Drain side only
+    std::atomic<uint32_t> droppedCount_;            // Messages lost to a full queue since boot
+    uint32_t droppedReported_;                      // Drops already announced in the log
+    Scheduler::Job drainJob_;                       // Fallback when the drain task couldn't be started
+
+    std::mutex bufferMutex_;                        // Guards the ring below between the drain task and readers
+    LogRecord logBuffer_[MAX_BUFFER_SIZE];
+    size_t logHead_;                                // Slot the next entry is written to
+    size_t logCount_;                               // Entries currently held
+    uint32_t nextSequence_;
 
-    void sendToDiscord(const String& message);
+    QueueSlot* claimSlot(uint32_t& pos);           // nullptr and counted as dropped when the queue is full
+    void publishSlot(QueueSlot* slot, uint32_t pos, LogLevel level, bool notify);
+    static void drainTask(void* arg);
+    size_t drainQueue();
+    void writeToSinks(LogLevel level, uint32_t timestamp, const char* message, bool notify);
+    void sendToDiscord(const LogRecord& record);
 };
 
 #endif // LogManager_h
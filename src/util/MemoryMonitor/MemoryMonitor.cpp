@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "util/MemoryMonitor/MemoryMonitor.h"
+#include "util/LogManager/LogManager.h"
+
+MemoryMonitor::MemoryMonitor()
+    : sampleJob_([this](){ sample(); }),
+    sampling_(),
+    stats_(),
+    restartRequested_(false),
+    restartCount_(0),
+    restartRequestedAt_(0) {}
+
+void MemoryMonitor::setup(Scheduler& scheduler) {
+    sample();
+    scheduler.every(sampleJob_, MEMORY_SAMPLE_INTERVAL, MEMORY_SAMPLE_INTERVAL);
+}
+
+bool MemoryMonitor::belowThreshold(const hal::HeapInfo& heap) const {
+    return (MEMORY_RESTART_FREE_BYTES > 0 && heap.freeBytes < MEMORY_RESTART_FREE_BYTES) ||
+        (MEMORY_RESTART_LARGEST_BLOCK > 0 && heap.largestFreeBlock < MEMORY_RESTART_LARGEST_BLOCK);
+}
+
+void MemoryMonitor::sample() {
+    hal::System& system = hal::system();
+    unsigned long currentMillis = hal::clock().millis();
+
+    sampling_.heap = system.heap();
+    if (sampling_.samples == 0 || sampling_.heap.largestFreeBlock < sampling_.lowestLargestBlock) {
+        sampling_.lowestLargestBlock = sampling_.heap.largestFreeBlock;
+    }
+    sampling_.taskCount = system.tasks(sampling_.tasks, MemoryStats::MAX_TASKS);
+    sampling_.otherAllocations = system.otherAllocations();
+    sampling_.samples++;
+
+    // One low sample can be a burst, a run of them is fragmentation that isn't going away
+    if (belowThreshold(sampling_.heap)) {
+        if (sampling_.lowSamples < 255) { sampling_.lowSamples++; }
+    } else {
+        sampling_.lowSamples = 0;
+    }
+    stats_.write(sampling_);
+
+    if (!restartRequested() && sampling_.lowSamples >= MEMORY_RESTART_SAMPLES) {
+        char message[112];
+        snprintf(message, sizeof(message), "Heap low (%lu free, largest block %lu), restarting before allocations fail",
+            (unsigned long)sampling_.heap.freeBytes, (unsigned long)sampling_.heap.largestFreeBlock);
+        LogManager::getInstance().log(ERROR, message);
+        restartRequestedAt_ = currentMillis;
+        restartRequested_.store(true, std::memory_order_relaxed);
+    }
+
+    if (restartRequested() && currentMillis - restartRequestedAt_ >= MEMORY_RESTART_GRACE) {
+        hal::system().restart(nullptr, 0);
+    }
+}
+
+void MemoryMonitor::writeJson(hal::HttpServer& server) const {
+    MemoryStats stats = getStats();
+    char chunk[1024];
+
+    size_t used = snprintf(chunk, sizeof(chunk),
+        "\"memory\":{\"free\":%lu,\"largest_block\":%lu,\"minimum_free\":%lu,\"lowest_largest_block\":%lu,"
+        "\"restarts\":%lu,\"restart_pending\":%s,\"other_allocations\":%lu,\"tasks\":[",
+        (unsigned long)stats.heap.freeBytes, (unsigned long)stats.heap.largestFreeBlock, (unsigned long)stats.heap.minimumFreeBytes,
+        (unsigned long)stats.lowestLargestBlock, (unsigned long)getRestartCount(), restartRequested() ? "true" : "false",
+        (unsigned long)stats.otherAllocations);
+
+    for (uint8_t i = 0; i < stats.taskCount; i++) {
+        used += snprintf(chunk + used, sizeof(chunk) - used, "%s{\"name\":\"%s\",\"stack_free\":%lu,\"allocations\":%lu}",
+            i > 0 ? "," : "", stats.tasks[i].name, (unsigned long)stats.tasks[i].stackFreeBytes, (unsigned long)stats.tasks[i].allocations);
+    }
+
+    used += snprintf(chunk + used, sizeof(chunk) - used, "]}");
+    server.sendChunk(chunk, used);
+}
+
+void MemoryMonitor::writePrometheus(hal::HttpServer& server) const {
+    MemoryStats stats = getStats();
+    char chunk[2048];
+
+    size_t used = snprintf(chunk, sizeof(chunk),
+        "# HELP pool_heater_heap_free_bytes Free heap.\n"
+        "# TYPE pool_heater_heap_free_bytes gauge\n"
+        "pool_heater_heap_free_bytes %lu\n"
+        "# HELP pool_heater_heap_largest_block_bytes Largest allocation that can still succeed.\n"
+        "# TYPE pool_heater_heap_largest_block_bytes gauge\n"
+        "pool_heater_heap_largest_block_bytes %lu\n"
+        "# HELP pool_heater_heap_minimum_free_bytes Lowest free heap since boot.\n"
+        "# TYPE pool_heater_heap_minimum_free_bytes gauge\n"
+        "pool_heater_heap_minimum_free_bytes %lu\n"
+        "# HELP pool_heater_heap_lowest_largest_block_bytes Smallest largest free block sampled since boot.\n"
+        "# TYPE pool_heater_heap_lowest_largest_block_bytes gauge\n"
+        "pool_heater_heap_lowest_largest_block_bytes %lu\n"
+        "# HELP pool_heater_memory_restarts_total Restarts made to clear a fragmented heap.\n"
+        "# TYPE pool_heater_memory_restarts_total counter\n"
+        "pool_heater_memory_restarts_total %lu\n"
+        "# HELP pool_heater_task_stack_free_bytes Least unused stack each task has had.\n"
+        "# TYPE pool_heater_task_stack_free_bytes gauge\n",
+        (unsigned long)stats.heap.freeBytes, (unsigned long)stats.heap.largestFreeBlock, (unsigned long)stats.heap.minimumFreeBytes,
+        (unsigned long)stats.lowestLargestBlock, (unsigned long)getRestartCount());
+
+    for (uint8_t i = 0; i < stats.taskCount; i++) {
+        used += snprintf(chunk + used, sizeof(chunk) - used, "pool_heater_task_stack_free_bytes{task=\"%s\"} %lu\n",
+            stats.tasks[i].name, (unsigned long)stats.tasks[i].stackFreeBytes);
+    }
+
+    used += snprintf(chunk + used, sizeof(chunk) - used,
+        "# HELP pool_heater_allocations_total Heap allocations by the task that made them.\n"
+        "# TYPE pool_heater_allocations_total counter\n");
+    for (uint8_t i = 0; i < stats.taskCount; i++) {
+        used += snprintf(chunk + used, sizeof(chunk) - used, "pool_heater_allocations_total{task=\"%s\"} %lu\n",
+            stats.tasks[i].name, (unsigned long)stats.tasks[i].allocations);
+    }
+    used += snprintf(chunk + used, sizeof(chunk) - used, "pool_heater_allocations_total{task=\"other\"} %lu\n",
+        (unsigned long)stats.otherAllocations);
+
+    server.sendChunk(chunk, used);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef MemoryMonitor_h
+#define MemoryMonitor_h
+
+#include <Arduino.h>
+#include <atomic>
+#include "hal/HAL.h"
+#include "util/config.h"
+#include "util/Scheduler/Scheduler.h"
+#include "util/Seqlock/Seqlock.h"
+
+// Heap, stack and allocation figures as of the last sample
+struct MemoryStats {
+    static const uint8_t MAX_TASKS = 8;
+
+    hal::HeapInfo heap;
+    uint32_t lowestLargestBlock;                // Smallest largest free block sampled, how fragmented the heap has got
+    uint32_t otherAllocations;                  // Made outside the tasks below, setup and the framework's tasks
+    uint32_t samples;
+    uint8_t lowSamples;                         // Consecutive samples under a restart threshold
+    uint8_t taskCount;
+    hal::TaskInfo tasks[MAX_TASKS];
+};
+
+// Samples the heap every MEMORY_SAMPLE_INTERVAL for /api/metrics, and watches
+// for the slow fragmentation a long uptime brings. Once free heap or the
+// largest free block has stayed under its threshold for MEMORY_RESTART_SAMPLES
+// samples it asks for a restart, while allocations still succeed. The owner of
+// the pump state is expected to save it and restart, see restartRequested().
+// If nothing has after MEMORY_RESTART_GRACE the monitor restarts the board
+// without saving anything.
+class MemoryMonitor {
+public:
+    static MemoryMonitor& getInstance() {      // Singleton instance
+        static MemoryMonitor instance;
+        return instance;
+    }
+
+    void setup(Scheduler& scheduler);
+    MemoryStats getStats() const { return stats_.read(); }
+    bool restartRequested() const { return restartRequested_.load(std::memory_order_relaxed); }
+
+    // Restarts since power on, carried across each restart by whoever does it
+    uint32_t getRestartCount() const { return restartCount_.load(std::memory_order_relaxed); }
+    void setRestartCount(uint32_t count) { restartCount_.store(count, std::memory_order_relaxed); }
+
+    // Parts of the /api/metrics response
+    void writeJson(hal::HttpServer& server) const;
+    void writePrometheus(hal::HttpServer& server) const;
+
+private:
+    MemoryMonitor();                            // Private constructor/destructor for singleton
+    ~MemoryMonitor() = default;
+    MemoryMonitor(const MemoryMonitor&) = delete;
+    MemoryMonitor& operator=(const MemoryMonitor&) = delete;
+
+    Scheduler::Job sampleJob_;                  // Every MEMORY_SAMPLE_INTERVAL
+    MemoryStats sampling_;                      // Scheduler task copy, written whole to stats_
+    Seqlock<MemoryStats> stats_;
+    std::atomic<bool> restartRequested_;
+    std::atomic<uint32_t> restartCount_;
+    unsigned long restartRequestedAt_;          // millis, for the grace period
+
+    void sample();
+    bool belowThreshold(const hal::HeapInfo& heap) const;
+};
+
+#endif // MemoryMonitor_h
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "util/NotificationManager/NotificationManager.h"
+#include "util/Profiler/Profiler.h"
+
+NotificationManager::NotificationManager()
+    : endpoint_(),
+    running_(false),
+    events_(),
+    head_(0),
+    tail_(0),
+    droppedCount_(0),
+    droppedReported_(0),
+    payloadLength_(0),
+    payloadEvents_(0),
+    attempts_(0),
+    nextAttemptAt_(0),
+    lastPostAt_(0),
+    sentCount_(0),
+    failedCount_(0) {
+    setEndpoint(WEBHOOK_URL);
+}
+
+
+void NotificationManager::setup() {
+    if (endpoint_[0] == '\0') {
+        LogManager::getInstance().log(INFO, "Webhook notifications disabled");
+        return;
+    }
+
+    running_ = hal::startTask("notify", NotificationManager::notifyTask, this, NOTIFY_TASK_STACK_SIZE, 1, NETWORK_TASK_CORE);
+    if (!running_) {
+        LogManager::getInstance().log(ERROR, "Failed to start notification task", false);
+    }
+}
+
+void NotificationManager::setEndpoint(const char* url) {
+    strncpy(endpoint_, url, sizeof(endpoint_) - 1);
+    endpoint_[sizeof(endpoint_) - 1] = '\0';
+}
+
+bool NotificationManager::enqueue(const LogRecord& record) {
+    if (!running_) { return false; }
+
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= NOTIFY_QUEUE_SIZE) {
+        droppedCount_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    events_[head & (NOTIFY_QUEUE_SIZE - 1)] = record;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+void NotificationManager::notifyTask(void* arg) {
+    NotificationManager* manager = static_cast<NotificationManager*>(arg);
+
+    for (;;) {
+        manager->process();
+        hal::clock().delay(hal::power().lowPower() ? LOW_POWER_POLL_INTERVAL : IDLE_POLL_INTERVAL);
+    }
+}
+
+void NotificationManager::process() {
+    Profiler::Scope scope(ProfileSection::Notify);
+    unsigned long now = hal::clock().millis();
+
+    // Start a new batch once the current one is delivered or abandoned
+    if (payloadLength_ == 0) {
+        if (!batchReady(now)) { return; }
+
+        buildBatch();
+        attempts_ = 0;
+        bool rateLimited = lastPostAt_ != 0 && now - lastPostAt_ < NOTIFY_MIN_INTERVAL;
+        nextAttemptAt_ = rateLimited ? lastPostAt_ + NOTIFY_MIN_INTERVAL : now;
+    }
+
+    if ((long)(now - nextAttemptAt_) >= 0) {
+        deliver();
+    }
+}
+
+bool NotificationManager::batchReady(unsigned long now) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    uint32_t head = head_.load(std::memory_order_acquire);
+    if (head == tail) { return false; }
+
+    // Coalesce: wait for the batch window from the oldest event, unless the queue is filling up
+    if (head - tail >= NOTIFY_QUEUE_SIZE / 2) { return true; }
+    return now - events_[tail & (NOTIFY_QUEUE_SIZE - 1)].timestamp >= NOTIFY_BATCH_WINDOW;
+}
+
+void NotificationManager::buildBatch() {
+    const size_t limit = MAX_PAYLOAD_LENGTH;
+    char line[MAX_LOG_MESSAGE_LENGTH + 48];
+    size_t length = snprintf(payload_, sizeof(payload_), "{\"content\":\"");
+
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    uint32_t head = head_.load(std::memory_order_acquire);
+    payloadEvents_ = 0;
+
+    while (tail != head) {
+        const LogRecord& event = events_[tail & (NOTIFY_QUEUE_SIZE - 1)];
+        snprintf(line, sizeof(line), "**%s** `%lu` %s\n",
+            logLevelToString((LogLevel)event.level), (unsigned long)event.timestamp, event.message);
+
+        size_t written = escapeJson(payload_ + length, limit - length, line);
+        if (written == 0) { break; }       // Full, the rest goes in the next batch
+
+        length += written;
+        payloadEvents_++;
+        tail_.store(++tail, std::memory_order_release);
+    }
+
+    uint32_t dropped = droppedCount_.load(std::memory_order_relaxed);
+    if (dropped != droppedReported_) {
+        snprintf(line, sizeof(line), "_%lu event(s) dropped_", (unsigned long)(dropped - droppedReported_));
+        length += escapeJson(payload_ + length, sizeof(payload_) - 3 - length, line);
+        droppedReported_ = dropped;
+    }
+
+    payload_[length++] = '"';
+    payload_[length++] = '}';
+    payload_[length] = '\0';
+    payloadLength_ = length;
+}
+
+void NotificationManager::deliver() {
+    hal::HttpResponse response = hal::httpClient().post(endpoint_, "application/json", payload_, payloadLength_, NOTIFY_HTTP_TIMEOUT);
+    lastPostAt_ = hal::clock().millis();
+
+    if (response.status >= 200 && response.status < 300) {
+        sentCount_++;
+        payloadLength_ = 0;
+        return;
+    }
+
+    attempts_++;
+    bool permanent = response.status >= 400 && response.status < 500 && response.status != 429;
+    unsigned long delay = backoff();
+
+    // Rate limited, the server's Retry-After wins over our backoff. Posting
+    // sooner would only be refused again, waiting longer than
+    // NOTIFY_MAX_RETRY_AFTER isn't worth holding the batch for
+    if (response.status == 429 && response.retryAfterMs > delay) {
+        delay = response.retryAfterMs;
+        if (delay > NOTIFY_MAX_RETRY_AFTER) { permanent = true; }
+    }
+
+    if (permanent || attempts_ >= NOTIFY_MAX_ATTEMPTS) {
+        failedCount_++;
+        payloadLength_ = 0;
+        droppedCount_.fetch_add(payloadEvents_, std::memory_order_relaxed);    // Reported in the next batch that gets through
+
+        // Not forwarded, a failing webhook must not feed itself
+        char message[96];
+        snprintf(message, sizeof(message), "Webhook notification dropped after %u attempt(s), last status %d",
+            (unsigned)attempts_, response.status);
+        LogManager::getInstance().log(WARN, message, false);
+        return;
+    }
+
+    nextAttemptAt_ = lastPostAt_ + delay;
+}
+
+unsigned long NotificationManager::backoff() const {
+    // NOTIFY_MIN_INTERVAL doubling per attempt, capped, with up to 25% jitter
+    unsigned long delay = NOTIFY_MIN_INTERVAL;
+    for (uint8_t i = 1; i < attempts_ && delay < NOTIFY_MAX_BACKOFF; i++) {
+        delay *= 2;
+    }
+    if (delay > NOTIFY_MAX_BACKOFF) { delay = NOTIFY_MAX_BACKOFF; }
+
+    return delay + hal::clock().micros() % (delay / 4 + 1);
+}
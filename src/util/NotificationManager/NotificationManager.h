@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef NotificationManager_h
+#define NotificationManager_h
+
+#include <Arduino.h>
+#include <atomic>
+#include "hal/HAL.h"
+#include "util/config.h"
+#include "util/LogManager/LogManager.h"
+
+// Posts batches of log events to a webhook from its own task. The log drain
+// task hands events over through a lock-free SPSC queue, so a slow or dead
+// endpoint never adds latency anywhere else.
+class NotificationManager {
+public:
+    static NotificationManager& getInstance() {     // Singleton instance
+        static NotificationManager instance;
+        return instance;
+    }
+
+    void setup();
+    void setEndpoint(const char* url);              // Overrides WEBHOOK_URL, call before setup()
+    bool enqueue(const LogRecord& record);          // Log drain task only, false if the event was dropped
+
+    uint32_t getSentCount() const { return sentCount_; }
+    uint32_t getFailedCount() const { return failedCount_; }
+    uint32_t getDroppedCount() const { return droppedCount_.load(std::memory_order_relaxed); }
+
+private:
+    NotificationManager();                          // Private constructor/destructor for singleton
+    ~NotificationManager() = default;
+    NotificationManager(const NotificationManager&) = delete;
+    NotificationManager& operator=(const NotificationManager&) = delete;
+
+    static_assert((NOTIFY_QUEUE_SIZE & (NOTIFY_QUEUE_SIZE - 1)) == 0, "NOTIFY_QUEUE_SIZE must be a power of two");
+    static const uint32_t NOTIFY_TASK_STACK_SIZE = 8192;    // TLS handshakes need the room
+    static const size_t MAX_PAYLOAD_LENGTH = 1900;           // Discord caps content at 2000 chars
+    static const unsigned long IDLE_POLL_INTERVAL = 250;
+
+    char endpoint_[192];
+    bool running_;
+
+    LogRecord events_[NOTIFY_QUEUE_SIZE];
+    std::atomic<uint32_t> head_;                    // Written by the producer
+    std::atomic<uint32_t> tail_;                    // Written by the notifier task
+    std::atomic<uint32_t> droppedCount_;            // Events lost to a full queue or an abandoned batch
+    uint32_t droppedReported_;
+
+    char payload_[MAX_PAYLOAD_LENGTH + 64];         // Batch being delivered, kept for retries
+    size_t payloadLength_;
+    uint32_t payloadEvents_;                        // Events in the batch, counted as dropped if it's abandoned
+    uint8_t attempts_;
+    unsigned long nextAttemptAt_;
+    unsigned long lastPostAt_;
+    uint32_t sentCount_;
+    uint32_t failedCount_;
+
+    static void notifyTask(void* arg);
+    void process();
+    bool batchReady(unsigned long now);
+    void buildBatch();
+    void deliver();
+    unsigned long backoff() const;
+};
+
+#endif // NotificationManager_h
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#include "util/Profiler/Profiler.h"
+#include "util/LogManager/LogManager.h"
+
+struct SectionInfo {
+    const char* name;
+    uint32_t slowLimitMicros;                   // Longer than this counts as slow
+};
+
+// In ProfileSection order. Control task work has to fit well inside a tick,
+// anything that waits on the network or flash gets what a round trip needs.
+static const SectionInfo SECTIONS[] = {
+    { "control_tick", CONTROL_TICK_INTERVAL * 1000UL },
+    { "temp_conversion", 5000 },
+    { "temp_read", 5000 },
+    { "flow", 5000 },
+    { "pump_control", 5000 },
+    { "history", 5000 },
+    { "journal_flush", 100000 },                // A sector erase takes tens of ms
+    { "http_request", 100000 },
+    { "stream", 20000 },
+    { "time_sync", 1100000 },                   // The NTP client waits up to a second for its reply
+    { "wifi_check", 50000 },
+    { "led", 5000 },
+    { "log", 1000 },
+    { "log_drain", 100000 },                    // Serial output at 115200 baud
+    { "notify", NOTIFY_HTTP_TIMEOUT * 1000UL },     // A post that used its whole timeout
+};
+
+static_assert(sizeof(SECTIONS) / sizeof(SECTIONS[0]) == (size_t)ProfileSection::COUNT, "One SECTIONS entry per ProfileSection");
+
+const char* Profiler::sectionName(ProfileSection section) {
+    return SECTIONS[(uint8_t)section].name;
+}
+
+uint32_t Profiler::slowLimitMicros(ProfileSection section) {
+    return SECTIONS[(uint8_t)section].slowLimitMicros;
+}
+
+void Profiler::record(ProfileSection section, uint32_t micros) {
+    Histogram& histogram = histograms_[(uint8_t)section];
+
+    histogram.buckets[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+    histogram.sumMicros.fetch_add(micros, std::memory_order_relaxed);
+
+    uint32_t max = histogram.maxMicros.load(std::memory_order_relaxed);
+    while (micros > max && !histogram.maxMicros.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {}
+
+    if (micros > slowLimitMicros(section)) {
+        reportSlow(section, micros);
+    }
+}
+
+void Profiler::reportSlow(ProfileSection section, uint32_t micros) {
+    Histogram& histogram = histograms_[(uint8_t)section];
+    uint32_t slow = histogram.slow.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    // Whichever task wins the exchange logs it, the rest only count
+    uint32_t now = hal::clock().millis() | 1;       // 0 is kept for never logged
+    uint32_t last = histogram.lastSlowLog.load(std::memory_order_relaxed);
+    if (last != 0 && now - last < PROFILE_SLOW_LOG_INTERVAL) { return; }
+    if (!histogram.lastSlowLog.compare_exchange_strong(last, now, std::memory_order_relaxed)) { return; }
+
+    char message[112];
+    snprintf(message, sizeof(message), "Slow %s: %lu.%03lu ms against a %lu ms limit, %lu slow so far",
+        sectionName(section), (unsigned long)(micros / 1000), (unsigned long)(micros % 1000),
+        (unsigned long)(slowLimitMicros(section) / 1000), (unsigned long)slow);
+    LogManager::getInstance().log(WARN, message, false);
+}
+
+uint32_t Profiler::copyBuckets(ProfileSection section, uint32_t* buckets) const {
+    const Histogram& histogram = histograms_[(uint8_t)section];
+    uint32_t total = 0;
+    for (uint8_t b = 0; b < BUCKETS; b++) {
+        buckets[b] = histogram.buckets[b].load(std::memory_order_relaxed);
+        total += buckets[b];
+    }
+    return total;
+}
+
+Profiler::Summary Profiler::summarize(ProfileSection section) const {
+    const Histogram& histogram = histograms_[(uint8_t)section];
+    uint32_t buckets[BUCKETS];
+
+    Summary summary;
+    summary.count = copyBuckets(section, buckets);
+    summary.slow = histogram.slow.load(std::memory_order_relaxed);
+    summary.maxMicros = histogram.maxMicros.load(std::memory_order_relaxed);
+    summary.sumMicros = histogram.sumMicros.load(std::memory_order_relaxed);
+    summary.p50Micros = 0;
+    summary.p99Micros = 0;
+
+    // Smallest bucket holding at least the percentile's share of calls, capped at the max seen
+    uint32_t p50Target = summary.count - summary.count / 2;
+    uint32_t p99Target = summary.count - summary.count / 100;
+    uint32_t seen = 0;
+    for (uint8_t b = 0; b < BUCKETS && summary.count > 0; b++) {
+        seen += buckets[b];
+        uint32_t bound = b < BUCKETS - 1 && (1UL << b) < summary.maxMicros ? (1UL << b) : summary.maxMicros;
+        if (summary.p50Micros == 0 && seen >= p50Target) { summary.p50Micros = bound; }
+        if (seen >= p99Target) {
+            summary.p99Micros = bound;
+            break;
+        }
+    }
+    return summary;
+}
+
+// Seconds from microseconds without floating point formatting
+static size_t formatSeconds(char* output, size_t size, uint64_t micros) {
+    return snprintf(output, size, "%llu.%06lu", (unsigned long long)(micros / 1000000), (unsigned long)(micros % 1000000));
+}
+
+void Profiler::writeJson(hal::HttpServer& server) const {
+    char chunk[512];
+    size_t used = 0;
+    auto reserve = [&](size_t needed) {         // Sends what's buffered when needed bytes might not fit
+        if (sizeof(chunk) - used < needed) {
+            server.sendChunk(chunk, used);
+            used = 0;
+        }
+    };
+
+    used += snprintf(chunk, sizeof(chunk), "\"sections\":[");
+
+    for (uint8_t i = 0; i < SECTION_COUNT; i++) {
+        ProfileSection section = (ProfileSection)i;
+        Summary summary = summarize(section);
+
+        used += snprintf(chunk + used, sizeof(chunk) - used,
+            "%s{\"name\":\"%s\",\"count\":%lu,\"slow\":%lu,\"limit_us\":%lu,\"p50_us\":%lu,\"p99_us\":%lu,\"max_us\":%lu,\"sum_us\":%llu}",
+            i > 0 ? "," : "", sectionName(section), (unsigned long)summary.count, (unsigned long)summary.slow,
+            (unsigned long)slowLimitMicros(section), (unsigned long)summary.p50Micros, (unsigned long)summary.p99Micros,
+            (unsigned long)summary.maxMicros, (unsigned long long)summary.sumMicros);
+
+        reserve(256);
+    }
+
+    used += snprintf(chunk + used, sizeof(chunk) - used, "]");
+    server.sendChunk(chunk, used);
+}
+
+void Profiler::writePrometheus(hal::HttpServer& server) const {
+    char chunk[1024];
+    size_t used = 0;
+    auto reserve = [&](size_t needed) {
+        if (sizeof(chunk) - used < needed) {
+            server.sendChunk(chunk, used);
+            used = 0;
+        }
+    };
+    char seconds[24];
+
+    used += snprintf(chunk, sizeof(chunk),
+        "# HELP pool_heater_section_seconds Time taken per call, by subsystem.\n"
+        "# TYPE pool_heater_section_seconds histogram\n");
+
+    for (uint8_t i = 0; i < SECTION_COUNT; i++) {
+        ProfileSection section = (ProfileSection)i;
+        const char* name = sectionName(section);
+        uint32_t buckets[BUCKETS];
+        uint32_t count = copyBuckets(section, buckets);
+
+        // Cumulative, up to the longest bucket in use, +Inf covers the rest
+        uint8_t last = BUCKETS - 1;
+        while (last > 0 && buckets[last] == 0) { last--; }
+        if (last == BUCKETS - 1) { last--; }
+
+        uint32_t cumulative = 0;
+        for (uint8_t b = 0; b <= last; b++) {
+            reserve(128);
+            cumulative += buckets[b];
+            formatSeconds(seconds, sizeof(seconds), 1UL << b);
+            used += snprintf(chunk + used, sizeof(chunk) - used, "pool_heater_section_seconds_bucket{section=\"%s\",le=\"%s\"} %lu\n",
+                name, seconds, (unsigned long)cumulative);
+        }
+
+        reserve(256);
+        formatSeconds(seconds, sizeof(seconds), histograms_[i].sumMicros.load(std::memory_order_relaxed));
+        used += snprintf(chunk + used, sizeof(chunk) - used,
+            "pool_heater_section_seconds_bucket{section=\"%s\",le=\"+Inf\"} %lu\n"
+            "pool_heater_section_seconds_sum{section=\"%s\"} %s\n"
+            "pool_heater_section_seconds_count{section=\"%s\"} %lu\n",
+            name, (unsigned long)count, name, seconds, name, (unsigned long)count);
+    }
+
+    // Families can't interleave, so max and slow get their own pass
+    reserve(256);
+    used += snprintf(chunk + used, sizeof(chunk) - used,
+        "# HELP pool_heater_section_max_seconds Longest call since boot, by subsystem.\n"
+        "# TYPE pool_heater_section_max_seconds gauge\n");
+    for (uint8_t i = 0; i < SECTION_COUNT; i++) {
+        reserve(128);
+        formatSeconds(seconds, sizeof(seconds), histograms_[i].maxMicros.load(std::memory_order_relaxed));
+        used += snprintf(chunk + used, sizeof(chunk) - used, "pool_heater_section_max_seconds{section=\"%s\"} %s\n",
+            sectionName((ProfileSection)i), seconds);
+    }
+
+    reserve(256);
+    used += snprintf(chunk + used, sizeof(chunk) - used,
+        "# HELP pool_heater_section_slow_total Calls over the subsystem's limit.\n"
+        "# TYPE pool_heater_section_slow_total counter\n");
+    for (uint8_t i = 0; i < SECTION_COUNT; i++) {
+        reserve(128);
+        used += snprintf(chunk + used, sizeof(chunk) - used, "pool_heater_section_slow_total{section=\"%s\"} %lu\n",
+            sectionName((ProfileSection)i), (unsigned long)histograms_[i].slow.load(std::memory_order_relaxed));
+    }
+
+    server.sendChunk(chunk, used);
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef Profiler_h
+#define Profiler_h
+
+#include <Arduino.h>
+#include <atomic>
+#include "hal/HAL.h"
+#include "util/config.h"
+
+// Subsystems timed by the profiler, one histogram each
+enum class ProfileSection : uint8_t {
+    ControlTick,                // PumpManager::update() on the control task
+    TempConversion,             // Broadcast convert T (requestTemperatures)
+    TempRead,                   // One probe's scratchpad
+    Flow,
+    PumpControl,                // Control decisions and the telemetry snapshot
+    History,
+    JournalFlush,
+    HttpRequest,                // One request handler, the wait for the network isn't counted
+    Stream,                     // Telemetry events to /api/stream subscribers
+    TimeSync,
+    WiFiCheck,
+    Led,
+    Log,                        // LogManager::log() from any task
+    LogDrain,
+    Notify,                     // Notifier batch, includes the webhook round trip
+    COUNT
+};
+
+// Per subsystem latency histograms. Sections are timed with the cycle counter
+// and binned into fixed log2 buckets of microseconds, so recording is a few
+// relaxed atomic adds from any task and never allocates. A call over its
+// section's limit counts as slow and is logged, at most once per
+// PROFILE_SLOW_LOG_INTERVAL per section, naming the subsystem that stalled.
+class Profiler {
+public:
+    static Profiler& getInstance() {        // Singleton instance
+        static Profiler instance;
+        return instance;
+    }
+
+    // Times its own lifetime, declare one at the top of the code to profile.
+    // The cycle counter wraps (17.9 s at 240 MHz) and its rate follows the CPU
+    // clock, so a scope that ran past half a wrap or saw the clock change is
+    // timed with micros() instead. A clock change and back again isn't caught.
+    class Scope {
+    public:
+        explicit Scope(ProfileSection section)
+            : section_(section), startMicros_(hal::clock().micros()), startCycles_(hal::clock().cycles()),
+            cyclesPerMicro_(hal::clock().cyclesPerMicro()) {}
+        ~Scope() { Profiler::getInstance().record(section_, elapsedMicros()); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        ProfileSection section_;
+        uint32_t startMicros_;
+        uint32_t startCycles_;
+        uint32_t cyclesPerMicro_;               // At the start
+
+        uint32_t elapsedMicros() const {
+            hal::Clock& clock = hal::clock();
+            uint32_t cycles = clock.cycles() - startCycles_;
+            uint32_t micros = clock.micros() - startMicros_;
+            if (clock.cyclesPerMicro() != cyclesPerMicro_ || micros >= UINT32_MAX / 2 / cyclesPerMicro_) { return micros; }
+            return cycles / cyclesPerMicro_;
+        }
+    };
+
+    struct Summary {
+        uint32_t count;
+        uint32_t slow;                          // Calls over the section's limit
+        uint32_t p50Micros;                     // Upper bound of the bucket the percentile falls in
+        uint32_t p99Micros;
+        uint32_t maxMicros;
+        uint64_t sumMicros;                     // The Prometheus _sum, 32 bits wraps after 71.6 minutes in the section
+    };
+
+    void record(ProfileSection section, uint32_t micros);
+    Summary summarize(ProfileSection section) const;
+
+    // Parts of the /api/metrics response
+    void writeJson(hal::HttpServer& server) const;
+    void writePrometheus(hal::HttpServer& server) const;
+
+    static const char* sectionName(ProfileSection section);
+    static uint32_t slowLimitMicros(ProfileSection section);
+
+    // Bucket b holds durations up to 2^b us, the last one everything longer
+    static const uint8_t BUCKETS = 25;
+    static uint8_t bucketFor(uint32_t micros) {
+        if (micros <= 1) { return 0; }
+        uint8_t bucket = 32 - __builtin_clz(micros - 1);
+        return bucket < BUCKETS - 1 ? bucket : BUCKETS - 1;
+    }
+
+private:
+    Profiler() = default;                   // Private constructor/destructor for singleton
+    ~Profiler() = default;
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // Buckets are read one by one, a scrape racing a record can be a count off
+    struct Histogram {
+        std::atomic<uint32_t> buckets[BUCKETS];        // Their total is the call count
+        std::atomic<uint64_t> sumMicros;
+        std::atomic<uint32_t> maxMicros;
+        std::atomic<uint32_t> slow;
+        std::atomic<uint32_t> lastSlowLog;      // millis, 0 before the first
+    };
+
+    static const uint8_t SECTION_COUNT = (uint8_t)ProfileSection::COUNT;
+
+    Histogram histograms_[SECTION_COUNT] = {};
+
+    void reportSlow(ProfileSection section, uint32_t micros);
+    uint32_t copyBuckets(ProfileSection section, uint32_t* buckets) const;     // Returns the total
+};
+
+#endif // Profiler_h
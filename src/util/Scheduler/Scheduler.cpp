@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+
+#include "util/Scheduler/Scheduler.h"
+
+Scheduler::Scheduler(hal::Clock& clock)
+    : clock_(clock),
+    started_(false),
+    now_(0),
+    wheel_(),
+    levelCount_() {}
+
+void Scheduler::start() {
+    // Deferred so a scheduler can be a static, the clock may not be running yet
+    if (started_) { return; }
+    now_ = clock_.millis();
+    started_ = true;
+}
+
+void Scheduler::every(Job& job, unsigned long periodMs, unsigned long firstDelayMs) {
+    schedule(job, firstDelayMs, periodMs > 0 ? periodMs : 1);
+}
+
+void Scheduler::after(Job& job, unsigned long delayMs) {
+    schedule(job, delayMs, 0);
+}
+
+void Scheduler::cancel(Job& job) {
+    if (job.pending()) { unlink(job); }
+}
+
+void Scheduler::schedule(Job& job, unsigned long delayMs, unsigned long periodMs) {
+    start();
+    cancel(job);
+    job.deadline_ = (uint32_t)clock_.millis() + (uint32_t)delayMs;
+    job.period_ = periodMs;
+    place(job);
+}
+
+void Scheduler::place(Job& job) {
+    // Overdue jobs go in the slot run() covers next
+    uint32_t delta = job.deadline_ - now_;
+    uint32_t expires = job.deadline_;
+    if ((int32_t)delta < 0) {
+        delta = 0;
+        expires = now_;
+    } else if (delta > MAX_DELTA) {
+        delta = MAX_DELTA;
+        expires = now_ + MAX_DELTA;
+    }
+
+    uint8_t level = 0;
+    while (level + 1 < LEVELS && delta >= (1UL << (SLOT_BITS * (level + 1)))) { level++; }
+
+    Job*& slot = wheel_[level][(expires >> (SLOT_BITS * level)) & SLOT_MASK];
+    job.next_ = slot;
+    if (slot) { slot->pprev_ = &job.next_; }
+    slot = &job;
+    job.pprev_ = &slot;
+    job.level_ = level;
+    levelCount_[level]++;
+}
+
+void Scheduler::unlink(Job& job) {
+    *job.pprev_ = job.next_;
+    if (job.next_) { job.next_->pprev_ = job.pprev_; }
+    job.next_ = nullptr;
+    job.pprev_ = nullptr;
+    levelCount_[job.level_]--;
+}
+
+void Scheduler::take(Job*& slot, Job*& list) {
+    // Moves a slot to a local list, a job on it can still be cancelled
+    list = slot;
+    slot = nullptr;
+    if (list) { list->pprev_ = &list; }
+}
+
+void Scheduler::cascade(uint8_t level) {
+    // At a level boundary the slot coming due is spread over the levels below
+    uint32_t index = (now_ >> (SLOT_BITS * level)) & SLOT_MASK;
+    Job* list;
+    take(wheel_[level][index], list);
+    while (list) {
+        Job& job = *list;
+        unlink(job);
+        place(job);
+    }
+
+    if (index == 0 && level + 1 < LEVELS) { cascade(level + 1); }
+}
+
+void Scheduler::run() {
+    start();
+    uint32_t now = clock_.millis();
+
+    while ((int32_t)(now - now_) >= 0) {
+        uint32_t index = now_ & SLOT_MASK;
+        if (index == 0) { cascade(1); }
+
+        if (levelCount_[0] == 0) {
+            // Nothing in the first level, skip to its next wrap
+            uint32_t skip = SLOTS - index;
+            uint32_t left = now - now_ + 1;
+            now_ += skip < left ? skip : left;
+            continue;
+        }
+
+        Job* due;
+        take(wheel_[0][index], due);
+        now_++;
+
+        while (due) {
+            Job& job = *due;
+            unlink(job);
+            if (job.period_ > 0) {
+                job.deadline_ += job.period_;
+                uint32_t behind = now_ - job.deadline_;
+                if ((int32_t)behind > 0) { job.deadline_ += (behind + job.period_ - 1) / job.period_ * job.period_; }
+                place(job);
+            }
+            job.callback_();
+        }
+    }
+}
+
+unsigned long Scheduler::idleTime() {
+    start();
+
+    // Distance from now_ to the first slot with work, a higher level counts from the boundary it cascades at
+    uint32_t best = UINT32_MAX;
+    if (levelCount_[0] > 0) {
+        for (uint32_t distance = 0; distance < SLOTS; distance++) {
+            if (wheel_[0][(now_ + distance) & SLOT_MASK]) {
+                best = distance;
+                break;
+            }
+        }
+    }
+    for (uint8_t level = 1; level < LEVELS; level++) {
+        if (levelCount_[level] == 0) { continue; }
+
+        // The current slot only still holds jobs if its boundary is the next millisecond to run
+        uint8_t shift = SLOT_BITS * level;
+        uint32_t base = now_ >> shift;
+        uint32_t first = (now_ & ((1UL << shift) - 1)) == 0 ? 0 : 1;
+        for (uint32_t distance = first; distance <= SLOTS; distance++) {
+            if (wheel_[level][(base + distance) & SLOT_MASK]) {
+                uint32_t boundary = ((base + distance) << shift) - now_;
+                best = boundary < best ? boundary : best;
+                break;
+            }
+        }
+    }
+    if (best == UINT32_MAX) { return NOTHING_SCHEDULED; }
+
+    int32_t wait = (int32_t)(now_ + best - (uint32_t)clock_.millis());
+    return wait > 0 ? wait : 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+
+#ifndef Scheduler_h
+#define Scheduler_h
+
+#include <Arduino.h>
+#include <climits>
+#include <functional>
+#include "hal/HAL.h"
+
+// Millisecond timer wheel for the periodic and one-shot work of a task. Jobs
+// live in their owner and are linked into the wheel, nothing is allocated.
+// Four levels of 64 slots cover 1 ms, 64 ms, 4 s and 4.4 min per slot; a job
+// sits in the level its delay falls into and moves down as its time nears, so
+// scheduling, cancelling and each millisecond run() covers are O(1).
+// Deadlines are 32 bit millis and compared by difference, rollover is fine.
+//
+// Not thread safe, one task schedules and runs. A job may reschedule or
+// cancel itself or any other job from its callback.
+class Scheduler {
+public:
+    using Callback = std::function<void()>;
+
+    class Job {
+    public:
+        explicit Job(Callback callback)
+            : callback_(callback), next_(nullptr), pprev_(nullptr), deadline_(0), period_(0), level_(0) {}
+
+        bool pending() const { return pprev_ != nullptr; }
+
+    private:
+        friend class Scheduler;
+
+        Callback callback_;
+        Job* next_;                             // In its wheel slot
+        Job** pprev_;                           // Whatever points at this job, nullptr when not scheduled
+        uint32_t deadline_;                     // millis it's due
+        uint32_t period_;                       // 0 for one-shot
+        uint8_t level_;
+    };
+
+    static const unsigned long NOTHING_SCHEDULED = ULONG_MAX;
+
+    explicit Scheduler(hal::Clock& clock);
+
+    // Runs every periodMs from firstDelayMs on, keeping its phase. A job that
+    // runs late runs once, the periods it missed are dropped.
+    void every(Job& job, unsigned long periodMs, unsigned long firstDelayMs = 0);
+    void after(Job& job, unsigned long delayMs);    // Once, replaces anything already scheduled for job
+    void cancel(Job& job);
+
+    // Runs the jobs due by now in deadline order. Scheduling a job from a
+    // callback at least 1 ms out always leaves it for a later run().
+    void run();
+
+    // ms the caller can sleep before run() has anything to do
+    unsigned long idleTime();
+
+private:
+    static const uint8_t LEVELS = 4;
+    static const uint8_t SLOT_BITS = 6;
+    static const uint32_t SLOTS = 1 << SLOT_BITS;
+    static const uint32_t SLOT_MASK = SLOTS - 1;
+    static const uint32_t MAX_DELTA = (1UL << (SLOT_BITS * LEVELS)) - 1;    // Further out is parked at the top and placed again
+
+    hal::Clock& clock_;
+    bool started_;
+    uint32_t now_;                              // Next millisecond run() covers
+    Job* wheel_[LEVELS][SLOTS];
+    uint16_t levelCount_[LEVELS];               // Jobs in each level, an empty first level is skipped through
+
+    void start();
+    void schedule(Job& job, unsigned long delayMs, unsigned long periodMs);
+    void place(Job& job);
+    void unlink(Job& job);
+    void cascade(uint8_t level);
+    static void take(Job*& slot, Job*& list);
+};
+
+#endif // Scheduler_h
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef SensorFilter_h
+#define SensorFilter_h
+
+#include <Arduino.h>
+
+// Per channel sensor filtering, put together at compile time.
+//
+// A chain is a list of stages, FilterChain<RangeCheck<..>, RateLimit<..>, ..>.
+// Samples are integers in the sensor's own units (1/16 C for a DS18B20) so
+// every limit can be a template argument and nothing needs floats. Each stage
+// either passes the sample on, possibly changed, or rejects it. A rejected
+// sample goes no further and is counted against the stage that dropped it.
+// Stages are members, not pointers, so the compiler sees the whole chain and
+// inlines it: there is no dispatch and no storage beyond each stage's state.
+//
+// A stage is any type with
+//   bool apply(int32_t& sample);     // false rejects
+//   static const char* name();       // For metrics and logs
+namespace filter {
+
+// Rejects anything outside [Min, Max], the DS18B20's 85 C power on value with
+// a water range
+template <int32_t Min, int32_t Max>
+class RangeCheck {
+    static_assert(Min <= Max, "RangeCheck needs Min <= Max");
+
+public:
+    bool apply(int32_t& sample) { return sample >= Min && sample <= Max; }
+    static const char* name() { return "range"; }
+};
+
+// Rejects a sample more than MaxStep from the last one accepted, a spike. Once
+// Resync samples in a row have been rejected the level has really moved, the
+// next one is accepted and the limit follows from there.
+template <int32_t MaxStep, uint8_t Resync>
+class RateLimit {
+    static_assert(MaxStep > 0 && Resync > 0, "RateLimit needs a step and a resync count");
+
+public:
+    RateLimit() : last_(0), seeded_(false), rejected_(0) {}
+
+    bool apply(int32_t& sample) {
+        int32_t step = sample - last_;
+        if (seeded_ && (step > MaxStep || step < -MaxStep) && rejected_ < Resync) {
+            rejected_++;
+            return false;
+        }
+        last_ = sample;
+        seeded_ = true;
+        rejected_ = 0;
+        return true;
+    }
+    static const char* name() { return "rate"; }
+
+private:
+    int32_t last_;
+    bool seeded_;
+    uint8_t rejected_;                          // In a row
+};
+
+// Median of the last N samples, N odd. Until N have been seen it's the median
+// of those there are.
+template <uint8_t N>
+class Median {
+    static_assert(N % 2 == 1, "Median needs an odd window");
+
+public:
+    Median() : window_(), head_(0), count_(0) {}
+
+    bool apply(int32_t& sample) {
+        window_[head_] = sample;
+        head_ = (head_ + 1) % N;
+        if (count_ < N) { count_++; }
+
+        // Insertion sort of a copy, N is a handful
+        int32_t sorted[N];
+        for (uint8_t i = 0; i < count_; i++) {
+            int32_t value = window_[i];
+            uint8_t j = i;
+            for (; j > 0 && sorted[j - 1] > value; j--) { sorted[j] = sorted[j - 1]; }
+            sorted[j] = value;
+        }
+        sample = sorted[count_ / 2];
+        return true;
+    }
+    static const char* name() { return "median"; }
+
+private:
+    int32_t window_[N];                         // Ring of the latest samples
+    uint8_t head_;
+    uint8_t count_;
+};
+
+// Exponential moving average with a weight of 1 / 2^Shift on each new sample.
+// The state keeps Shift extra bits so small steps aren't lost to rounding.
+template <uint8_t Shift>
+class Ema {
+    static_assert(Shift < 16, "Ema shift leaves too few bits for the sample");
+
+public:
+    Ema() : state_(0), seeded_(false) {}
+
+    bool apply(int32_t& sample) {
+        if (!seeded_) {
+            state_ = sample * (1 << Shift);
+            seeded_ = true;
+        } else {
+            state_ += sample - roundShift(state_);
+        }
+        sample = roundShift(state_);
+        return true;
+    }
+    static const char* name() { return "ema"; }
+
+private:
+    int32_t state_;                             // Average << Shift
+    bool seeded_;
+
+    static int32_t roundShift(int32_t value) {
+        return Shift == 0 ? value : (value + (1 << Shift >> 1)) >> Shift;     // Arithmetic shift, rounds half up
+    }
+};
+
+template <typename... Stages>
+class FilterChain;
+
+// End of the chain
+template <>
+class FilterChain<> {
+public:
+    static const size_t STAGE_COUNT = 0;
+
+    bool apply(int32_t& sample) { (void)sample; return true; }
+    uint32_t getRejections(size_t stage) const { (void)stage; return 0; }
+    static const char* stageName(size_t stage) { (void)stage; return ""; }
+};
+
+template <typename Stage, typename... Rest>
+class FilterChain<Stage, Rest...> {
+public:
+    static const size_t STAGE_COUNT = 1 + sizeof...(Rest);
+
+    FilterChain() : rejections_(0) {}
+
+    bool apply(int32_t& sample) {           // false if a stage rejected it, sample is then unchanged
+        int32_t value = sample;
+        if (!stage_.apply(value)) {
+            rejections_++;
+            return false;
+        }
+        if (!rest_.apply(value)) { return false; }
+        sample = value;
+        return true;
+    }
+
+    uint32_t getRejections(size_t stage) const { return stage == 0 ? rejections_ : rest_.getRejections(stage - 1); }
+    static const char* stageName(size_t stage) { return stage == 0 ? Stage::name() : FilterChain<Rest...>::stageName(stage - 1); }
+
+private:
+    Stage stage_;
+    FilterChain<Rest...> rest_;
+    uint32_t rejections_;                       // Samples stage_ dropped
+};
+
+} // namespace filter
+
+#endif // SensorFilter_h
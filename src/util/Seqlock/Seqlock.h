@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+
+#ifndef Seqlock_h
+#define Seqlock_h
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+#include <type_traits>
+
+// Sequence counter for state with a single writer and readers on other tasks.
+// The writer never waits: the count is odd while it writes and moves on by two
+// per write. Readers copy what they need and retry if the count moved under
+// them, so a reader can spin but can never hold the writer up.
+class SequenceCounter {
+public:
+    SequenceCounter() : sequence_(0) {}
+
+    void beginWrite() {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endWrite() {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint32_t beginRead() const {
+        uint32_t sequence;
+        while ((sequence = sequence_.load(std::memory_order_acquire)) & 1) {}   // A write is under way, it's a few µs
+        return sequence;
+    }
+
+    // True if a write overlapped the read started at sequence, copy again
+    bool retry(uint32_t sequence) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence_.load(std::memory_order_relaxed) != sequence;
+    }
+
+private:
+    std::atomic<uint32_t> sequence_;
+};
+
+// A value published whole by one writer, read(), write() copy it with memcpy
+template <typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied bytewise");
+
+public:
+    Seqlock() : value_() {}
+
+    void write(const T& value) {
+        counter_.beginWrite();
+        memcpy((void*)&value_, &value, sizeof(T));
+        counter_.endWrite();
+    }
+
+    T read() const {
+        T value;
+        uint32_t sequence;
+        do {
+            sequence = counter_.beginRead();
+            memcpy((void*)&value, (const void*)&value_, sizeof(T));
+        } while (counter_.retry(sequence));
+        return value;
+    }
+
+private:
+    SequenceCounter counter_;
+    T value_;
+};
+
+#endif // Seqlock_h
@@ -18,59 +18,90 @@
  */
 
 #include "util/TimeManager/TimeManager.h"
+#include "util/Profiler/Profiler.h"
 
 TimeManager::TimeManager() 
-    : ntpUDP_(), 
-      timeClient_(ntpUDP_, NTP_SERVER, TIMEZONE_OFFSET, updateInterval_), 
-      updateInterval_((1000 * 60) * 120), // 120 minutes in milliseconds
-      lastSyncTime_(0) {}
+    : updateInterval_((1000 * 60) * 120), // 120 minutes in milliseconds
+      scheduler_(nullptr),
+      syncJob_([this](){ sync(); }) {}
       
 
-void TimeManager::setup() {
-    timeClient_.begin();
+void TimeManager::setup(Scheduler& scheduler) {
+    scheduler_ = &scheduler;
+    hal::clock().beginNetworkTime();
+    publishEpochBase();
+    scheduler.after(syncJob_, 0);
 }
 
-void TimeManager::update() {
-    unsigned long currentMillis = millis();
-    if (lastSyncTime_ == 0 || currentMillis - lastSyncTime_ >= updateInterval_) {
-        if (WiFi.status() == WL_CONNECTED) {
-            syncTime();
-            lastSyncTime_ = currentMillis;
-        }
+void TimeManager::sync() {
+    Profiler::Scope scope(ProfileSection::TimeSync);
+
+    // Waits for the network, then syncs every updateInterval_ whether or not the last one worked
+    if (!hal::clock().networkTimeReady()) {
+        scheduler_->after(syncJob_, RETRY_INTERVAL);
+        return;
     }
 
-    // Any other time keeping update code
+    syncTime();
+    scheduler_->after(syncJob_, updateInterval_);
 }
 
 void TimeManager::syncTime() {
     LogManager::getInstance().log(INFO, "Attempting time synchronization...");
-    if (!timeClient_.forceUpdate()) {
+    if (!hal::clock().syncNetworkTime()) {
         LogManager::getInstance().log(WARN, "Failed to sync time with NTP server.");
     }
     else {
+        publishEpochBase();
         LogManager::getInstance().log(INFO, "Time synchronization sucessful.");
     }
 }
 
+void TimeManager::publishEpochBase() {
+    unsigned long currentMillis = hal::clock().millis();
+    epochBase_.write({ hal::clock().epochTime(), currentMillis });
+}
+
 unsigned long TimeManager::getCurrentTimestamp() {
-    return timeClient_.getEpochTime();
+    // Worked out from the last sync so no other task ever reads the NTP client mid update
+    EpochBase base = epochBase_.read();
+    if (base.epoch == 0) { return 0; }                             // setup() hasn't published a base yet
+    return base.epoch + (hal::clock().millis() - base.millis) / 1000;
 }
 
 String TimeManager::getLogTime() {
+    return String(getLogTimestamp());
+}
+
+unsigned long TimeManager::getLogTimestamp() {
     // TODO: This should provide millis until we have time sync, then correct unix timestamps.
     // TODO: Might be good to log both millis() AND unix stamp.
 
-    return String(millis());
+    return hal::clock().millis();
 }
 
 String TimeManager::getLongDate() {
-    return "Unavailable";//timeClient_.getFormattedTime() + " - " + timeClient_.getDay() + ", " + timeClient_.getFormattedTime();
+    char formatted[32];
+    formatLongDate(formatted, sizeof(formatted));
+    return String(formatted);
+}
+
+size_t TimeManager::formatLongDate(char* output, size_t size) {
+    return snprintf(output, size, "Unavailable");//timeClient_.getFormattedTime() + " - " + timeClient_.getDay() + ", " + timeClient_.getFormattedTime();
 }
 
 String TimeManager::getShortDate() {
-    return timeClient_.getFormattedTime() + " - " + timeClient_.getDay();
+    return getTimeString() + " - " + String(getDay());
 }
 
 String TimeManager::getTimeString() {
-    return timeClient_.getFormattedTime();
+    unsigned long epoch = getCurrentTimestamp();
+    char formatted[9];
+
+    snprintf(formatted, sizeof(formatted), "%02lu:%02lu:%02lu", (epoch % 86400L) / 3600, (epoch % 3600) / 60, epoch % 60);
+    return String(formatted);
+}
+
+int TimeManager::getDay() {
+    return ((getCurrentTimestamp() / 86400L) + 4) % 7;     // 0 is Sunday, the epoch was a Thursday
 }
\ No newline at end of file
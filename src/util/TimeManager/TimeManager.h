@@ -20,10 +20,11 @@
 #ifndef TimeManager_h
 #define TimeManager_h
 
-#include <NTPClient.h>
-#include <WiFi.h>
-#include <WiFiUdp.h>
+#include <Arduino.h>
+#include "hal/HAL.h"
 #include "util/LogManager/LogManager.h"
+#include "util/Scheduler/Scheduler.h"
+#include "util/Seqlock/Seqlock.h"
 
 class TimeManager {
 public:
@@ -32,14 +33,16 @@ public:
         return instance;
     }
 
-    void setup();
-    void update();
+    void setup(Scheduler& scheduler);
 
     String getLogTime();
+    unsigned long getLogTimestamp();
     String getLongDate();
+    size_t formatLongDate(char* output, size_t size);
     String getShortDate();
     String getTimeString();
-    unsigned long getCurrentTimestamp();
+    int getDay();
+    unsigned long getCurrentTimestamp();            // Safe from any task, 0 before setup(). Only sync() on the network scheduler touches the NTP client
 
 private:
     TimeManager();                                  // Private constructor/destructor for singleton
@@ -47,12 +50,21 @@ private:
     TimeManager(const TimeManager&) = delete;
     TimeManager& operator=(const TimeManager&) = delete;
 
-    WiFiUDP ntpUDP_;
-    NTPClient timeClient_;
-    const long updateInterval_; // Sync interval in milliseconds
-    unsigned long lastSyncTime_;
+    static const unsigned long RETRY_INTERVAL = 1000;  // How often to look for the network before the first sync (milliseconds)
 
+    const unsigned long updateInterval_;            // Sync interval in milliseconds
+    Scheduler* scheduler_;                          // Runs syncJob_, set by setup()
+    Scheduler::Job syncJob_;                        // Next sync, or next look for the network
+
+    struct EpochBase {
+        unsigned long epoch;                        // Wall time at millis
+        unsigned long millis;
+    };
+    Seqlock<EpochBase> epochBase_;                  // Republished after each sync
+
+    void sync();                                    // syncJob_, reschedules itself
     void syncTime();
+    void publishEpochBase();
 };
 
 #endif // TimeManager_h
\ No newline at end of file
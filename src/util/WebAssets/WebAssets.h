@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+
+#ifndef WebAssets_h
+#define WebAssets_h
+
+#include <Arduino.h>
+
+// Dashboard files, gzipped into flash at build time by tools/embed_assets.py.
+// WebAssetData.cpp is generated from data/ before every build, edit data/.
+struct WebAsset {
+    const char* uri;                            // Route the file is served on
+    const char* contentType;
+    const uint8_t* gzipped;                     // Sent as is with Content-Encoding: gzip
+    size_t length;
+    const char* etag;                           // Strong, quoted hash of the uncompressed file
+    bool versioned;                             // Linked as ?v=WEB_ASSET_VERSION, pages are not
+};
+
+extern const char WEB_ASSET_VERSION[];          // ?v= of versioned asset links, changes with any non page file
+extern const WebAsset WEB_ASSETS[];
+extern const size_t WEB_ASSET_COUNT;
+
+const WebAsset* findWebAsset(const char* uri);  // nullptr if nothing is served on uri
+
+#endif // WebAssets_h
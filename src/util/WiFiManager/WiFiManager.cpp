@@ -19,15 +19,18 @@
 
 #include "util/WiFiManager/WiFiManager.h"
 #include "util/config.h"
+#include "util/Profiler/Profiler.h"
 
 WiFiManager::WiFiManager()
-    : lastCheckTime_(0),
+    : checkJob_([this](){ checkConnection(); }),
+    lastCheckTime_(0),
     attemptingConnection_(false),
     reconnectionAttempts_(0) {}
 
 
-void WiFiManager::setup() {
+void WiFiManager::setup(Scheduler& scheduler) {
     WiFi.mode(WIFI_STA);
+    scheduler.every(checkJob_, CHECK_INTERVAL);
 
     if (!MDNS.begin(HOSTNAME)) {
         LogManager::getInstance().log(WARN, "Failed to start mDNS responder");
@@ -44,7 +47,9 @@ void WiFiManager::setup() {
     LogManager::getInstance().log(INFO, "WiFiManager setup complete");
 }
 
-void WiFiManager::update() {
+void WiFiManager::checkConnection() {
+    Profiler::Scope scope(ProfileSection::WiFiCheck);
+
     if (WiFi.status() == WL_CONNECTED && !attemptingConnection_) { return; }  // If connected, no further action needed
 
     if (reconnectionAttempts_ > 5) {  // After 5 failed attempts, reset the WiFi module
@@ -25,6 +25,7 @@
 #include <ESPmDNS.h>
 #include "util/LEDStatusManager/LEDStatusManager.h"
 #include "util/LogManager/LogManager.h"
+#include "util/Scheduler/Scheduler.h"
 
 class WiFiManager {
 public:
@@ -33,8 +34,7 @@ public:
         return instance;
     }
     
-    void setup();                                   // Takes care of anything that needs to be initialized in setup()
-    void update();                                  // Periodically called to manage WiFi connection
+    void setup(Scheduler& scheduler);               // Takes care of anything that needs to be initialized in setup()
 
 private:
     WiFiManager();                                  // Private constructor/destructor for singleton
@@ -42,10 +42,14 @@ private:
     WiFiManager(const WiFiManager&) = delete;
     WiFiManager& operator=(const WiFiManager&) = delete;
 
+    static const unsigned long CHECK_INTERVAL = 500;   // How often the connection is looked at (milliseconds)
+
+    Scheduler::Job checkJob_;                       // Manages the WiFi connection every CHECK_INTERVAL
     unsigned long lastCheckTime_;                   // Tracks time for managing connection attempts
     bool attemptingConnection_;                     // Indicates if a connection attempt is underway
     int reconnectionAttempts_;                      // Counts the number of reconnection attempts
 
+    void checkConnection();                         // Reconnects with backoff while the connection is down
     unsigned long calculateBackoffDuration();       // Calculates the backoff duration for reconnection attempts
     void attemptConnection();                       // Initiates a WiFi connection attempt
     void rebootDevice();                            // Reboots the device in an attempt to correct WiFi module issues
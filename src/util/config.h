@@ -23,6 +23,21 @@ struct MDNSService {
 
 #define INDICATOR_LED_PIN 2             // Pin to use for indicator LED
 #define MAX_BUFFER_SIZE 100             // Max log lines to keep in the buffer
+#define MAX_LOG_MESSAGE_LENGTH 119      // Longer log messages are truncated in the buffer
+#define LOG_QUEUE_SIZE 32               // Pending log messages before new ones are dropped, power of two
+#define LOG_TASK_PRIORITY 1             // Log drain task, just above idle
+#define LOG_DRAIN_INTERVAL 20           // How often the log task empties the queue (milliseconds)
+#define PROFILE_SLOW_LOG_INTERVAL 60000 // Each subsystem logs a slow call at most this often (milliseconds)
+
+// Webhook notifications (Discord compatible), WARN/ERROR logs and pump state changes
+#define WEBHOOK_URL ""                          // Empty disables notifications
+#define NOTIFY_QUEUE_SIZE 16                    // Events waiting for the notifier task
+#define NOTIFY_BATCH_WINDOW 5000                // Collect events this long before posting (milliseconds)
+#define NOTIFY_MIN_INTERVAL 10000               // Minimum time between posts (milliseconds)
+#define NOTIFY_HTTP_TIMEOUT 5000                // Connect/response timeout per post (milliseconds)
+#define NOTIFY_MAX_ATTEMPTS 6                   // Give up on a batch after this many failed posts
+#define NOTIFY_MAX_BACKOFF (1000 * 60 * 5)      // Retry delay cap (milliseconds)
+#define NOTIFY_MAX_RETRY_AFTER (1000 * 60 * 30) // A 429 asking for a longer wait drops the batch (milliseconds)
 #define NTP_SERVER "pool.ntp.org"       // NTP time sync server
 #define TIMEZONE_OFFSET 0               // Timezone offset in seconds
 
@@ -35,6 +50,28 @@ const MDNSService mdnsServices[] = {
 #define FLOW_SENSOR_PIN 35
 #define ONE_WIRE_BUS_PIN 21
 #define PUMP_CONTROL_PIN 14
+#define FLOW_CALIBRATION_FACTOR 7.319   // Flow sensor pulses per second per L/min
+#define FLOW_TIMEOUT 2000               // ms without a flow pulse before the rate reads zero
+#define FLOW_AVERAGE_SAMPLES 4          // Flow rate updates in the moving average
+
+// Collector circuits, each with its own pump, flow sensor, input/output probes and controller
+#define CIRCUIT_COUNT 1                 // Circuits run by this board, up to 4
+#define CIRCUIT_PINS { { PUMP_CONTROL_PIN, FLOW_SENSOR_PIN } }     // { pump pin, flow sensor pin } per circuit
+
+// DS18B20 ROM addresses
+#define INPUT_TEMP_ADDR { 0x28, 0x37, 0xB0, 0x57, 0x04, 0xE1, 0x3C, 0x55 }
+#define OUTPUT_TEMP_ADDR { 0x28, 0x43, 0xE7, 0x57, 0x04, 0xE1, 0x3C, 0xD5 }
+#define ENCLOSURE_TEMP_ADDR { 0x28, 0xAF, 0x1A, 0x57, 0x04, 0xE1, 0x3C, 0xCB }
+
+// Temperature filtering, every probe reading passes these in order
+#define TEMP_FILTER_MIN -10                            // C, outside the range is a bad read, including the DS18B20's 85 C power on value
+#define TEMP_FILTER_MAX 70
+#define TEMP_FILTER_MAX_STEP 5                         // C between readings before one is treated as a spike
+#define TEMP_FILTER_RESYNC 3                           // Spikes in a row that are taken as a real change
+#define TEMP_FILTER_MEDIAN 3                           // Readings in the median, odd
+#define TEMP_FILTER_EMA_SHIFT 1                        // Moving average weight of 1 / 2^N on each new reading
+#define TEMP_SURFACE_FILTER_MIN -40                    // C, range for the collector surface and outside air, which pass the water's
+#define TEMP_SURFACE_FILTER_MAX 125                    // DS18B20 limit, an 85 C power on read there is left to the rate limit
 
 // Pump control config
 #define TARGET_TEMP 30
@@ -45,5 +82,53 @@ const MDNSService mdnsServices[] = {
 #define HIBERNATION_PERIOD (1000 * 60 * 30)            // 30 min - time to hibernate between cycles
 #define PUMP_UPDATE_INTERVAL 3000                      // How often the pump control code will update
 #define MAINTENANCE_PERIOD (1000 * 60 * 60)            // How long to disarm the system if maintenace mode toggled
+#define PUMP_POWER_WATTS 370                           // Pump electrical draw, for net energy and COP
+
+// History config, RAM is 9 bytes per second and 12 bytes per minute or hour kept
+#define HISTORY_SECONDS 900                            // 1 s samples, last 15 minutes
+#define HISTORY_MINUTES (60 * 24)                      // 1 min rollups, last 24 hours
+#define HISTORY_HOURS (24 * 14)                        // 1 h rollups, last 14 days
+
+// Totals journal config
+#define JOURNAL_PARTITION_LABEL "journal"              // Data partition in partitions.csv
+#define JOURNAL_INTERVAL (1000 * 60 * 10)              // How often changed totals are appended, at most this much is lost on power loss
+
+// Settings kept in NVS
+#define SETTINGS_NAMESPACE "pool-heater"               // Preferences namespace, at most 15 characters
+#define MAX_TEMP_SENSORS 8                             // Probes the sensor registry remembers
+
+// Event stream config (/api/stream), RAM is STREAM_OUTBOX_SIZE per subscriber
+#define STREAM_MAX_CLIENTS 4                           // Open streams at once, more are turned away with a 503
+#define STREAM_OUTBOX_SIZE 1536                        // Unsent bytes held per subscriber before events are dropped
+#define STREAM_HEARTBEAT_INTERVAL (1000 * 15)          // Comment line sent on an idle stream so dead clients are noticed
+#define STREAM_STALL_TIMEOUT (1000 * 30)               // Drop a subscriber whose socket hasn't taken a byte for this long
+
+// Web server config, RAM is HTTP_REQUEST_BUFFER per connection
+#define HTTP_MAX_CONNECTIONS 4                         // Request connections at once, event streams don't count against it
+#define HTTP_REQUEST_BUFFER 1536                       // Request line and headers must fit, larger requests get a 431
+#define HTTP_KEEPALIVE_TIMEOUT (1000 * 10)             // Idle keep-alive connections are closed after this
+#define HTTP_EVICT_IDLE 1000                           // A keep-alive connection idle this long may be closed for a new one when every slot is taken
+#define HTTP_REQUEST_TIMEOUT (1000 * 5)                // A started request must keep arriving, half-open clients are dropped after this
+#define HTTP_SEND_TIMEOUT (1000 * 5)                   // Give up on a response once the client has taken nothing for this long, every other connection waits meanwhile
+#define WEB_TASK_PRIORITY 1                            // Web task, it spends its time blocked in select()
+
+// Task layout, the control tick has a core to itself and everything that waits on the network shares the other
+#define CONTROL_TASK_CORE 1                            // The WiFi driver and lwIP run on core 0
+#define CONTROL_TASK_PRIORITY 5                        // Above every other application task
+#define CONTROL_TICK_INTERVAL 10                       // Fixed period of the control tick (milliseconds)
+#define CONTROL_JITTER_LIMIT 1000                      // A tick further than this off its period counts as late (microseconds)
+#define NETWORK_TASK_CORE 0                            // WiFi, NTP, web, logs and notifications
+
+// Memory watchdog, restarts the board keeping the pump state before a fragmented heap fails an allocation
+#define MEMORY_SAMPLE_INTERVAL 5000                    // Heap and stack sampling for /api/metrics (milliseconds)
+#define MEMORY_RESTART_FREE_BYTES 16384                // Restart once free heap stays under this (bytes), 0 disables
+#define MEMORY_RESTART_LARGEST_BLOCK 8192              // Or once the largest free block does (bytes), 0 disables
+#define MEMORY_RESTART_SAMPLES 3                       // Consecutive samples under a threshold before restarting
+#define MEMORY_RESTART_GRACE 10000                     // Restart without saving state if the pump controller hasn't by then (milliseconds)
+
+// Power config, used while HIBERNATING
+#define LOW_POWER_HIBERNATION true                     // Scale the CPU clock down and light sleep between wakeups
+#define LOW_POWER_MIN_CPU_FREQ 80                      // Lowest the CPU clock drops to (MHz), 80 keeps WiFi running
+#define LOW_POWER_POLL_INTERVAL 1000                   // Polling tasks stretch their interval to this (milliseconds)
 
 #endif // config_h
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# Gzips the dashboard files in data/ into src/util/WebAssets/WebAssetData.cpp,
+# byte arrays in flash plus the route table WebAssets.h declares.
+#
+#   tools/embed_assets.py            (also run by PlatformIO before every build)
+#
+# Routes: index.html is "/", other pages drop .html ("/maintenance"), anything
+# else keeps its name ("/style.css"). {{v}} in a page becomes WEB_ASSET_VERSION,
+# the hash of everything that isn't a page, so pages link versioned asset URLs.
+# The output is only rewritten when it changes, so builds stay incremental.
+
+import gzip
+import hashlib
+import os
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".png": "image/png",
+    ".ico": "image/x-icon",
+}
+
+LICENSE = """/*
+ * Copyright (C) [2024] Bradley James Hammond / Distracted Labs
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * For inquiries, please contact martiantux@proton.me | hello@distractedlabs.cc.
+ */
+"""
+
+
+def route(name):
+    if name == "index.html":
+        return "/"
+    if name.endswith(".html"):
+        return "/" + name[:-len(".html")]
+    return "/" + name
+
+
+def symbol(name):
+    return "".join(c.upper() if c.isalnum() else "_" for c in name)
+
+
+def short_hash(data):
+    return hashlib.sha256(data).hexdigest()[:8]
+
+
+def generate(project_dir):
+    data_dir = os.path.join(project_dir, "data")
+    output = os.path.join(project_dir, "src", "util", "WebAssets", "WebAssetData.cpp")
+
+    files = {}
+    for name in sorted(os.listdir(data_dir)):
+        path = os.path.join(data_dir, name)
+        extension = os.path.splitext(name)[1]
+        if not os.path.isfile(path) or extension not in CONTENT_TYPES:
+            continue
+        with open(path, "rb") as f:
+            files[name] = f.read()
+
+    # Pages are revalidated on every load, everything they link is versioned by this
+    linked = b"".join(name.encode() + b"\0" + content for name, content in files.items() if not name.endswith(".html"))
+    version = short_hash(linked)
+
+    lines = [LICENSE, "// Generated by tools/embed_assets.py from data/, do not edit.", "",
+             '#include "util/WebAssets/WebAssets.h"', ""]
+    table = []
+    for name, content in files.items():
+        if name.endswith(".html"):
+            content = content.replace(b"{{v}}", version.encode())
+        compressed = gzip.compress(content, compresslevel=9, mtime=0)
+        array = symbol(name) + "_GZ"
+
+        lines.append("// %s, %d bytes, %d gzipped" % (name, len(content), len(compressed)))
+        lines.append("static constexpr uint8_t %s[] = {" % array)
+        for offset in range(0, len(compressed), 16):
+            lines.append("    " + ", ".join("0x%02x" % b for b in compressed[offset:offset + 16]) + ",")
+        lines.append("};")
+        lines.append("")
+        table.append('    { "%s", "%s", %s, sizeof(%s), "\\"%s\\"", %s },'
+                     % (route(name), CONTENT_TYPES[os.path.splitext(name)[1]], array, array, short_hash(content),
+                        "false" if name.endswith(".html") else "true"))
+
+    lines.append('const char WEB_ASSET_VERSION[] = "%s";' % version)
+    lines.append("")
+    lines.append("const WebAsset WEB_ASSETS[] = {")
+    lines.extend(table)
+    lines.append("};")
+    lines.append("")
+    lines.append("const size_t WEB_ASSET_COUNT = sizeof(WEB_ASSETS) / sizeof(WEB_ASSETS[0]);")
+    generated = "\n".join(lines) + "\n"
+
+    try:
+        with open(output) as f:
+            if f.read() == generated:
+                return output
+    except FileNotFoundError:
+        pass
+
+    with open(output, "w") as f:
+        f.write(generated)
+    print("embed_assets: %d files from data/ -> %s (version %s)" % (len(files), os.path.relpath(output, project_dir), version))
+    return output
+
+
+try:
+    Import   # noqa: F821, only defined when PlatformIO runs this as extra_scripts = pre:tools/embed_assets.py
+except NameError:
+    generate(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+else:
+    Import("env")   # noqa: F821
+    generate(env["PROJECT_DIR"])   # noqa: F821
@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+# Load test for the web server of the host build.
+#
+#   tools/http_load.py --program .pio/build/native/program [--port 8080] [--seconds 20]
+#   tools/http_load.py --port 8080               (against a build already running)
+#
+# Keep-alive clients fetch a dashboard-like mix of URLs as fast as they are
+# answered while event stream subscribers, half-open clients trickling their
+# headers and a slow firmware upload run alongside. With --program the build is
+# started with POOL_HEATER_HTTP_PORT and its "Control loop" line is reported,
+# the control tick should keep its period whatever the web load.
+#
+# Exits 1 on any request error, a half-open client the server never dropped in
+# a run longer than the request timeout, an upload that didn't get a 200, or
+# more than --max-retries requests retried after an idle close.
+
+import argparse
+import http.client
+import os
+import socket
+import subprocess
+import threading
+import time
+
+REQUEST_TIMEOUT = 5                     # HTTP_REQUEST_TIMEOUT in config.h, seconds
+PATHS = ["/api/data", "/", "/style.css", "/script.js", "/api/logs?limit=10", "/api/history?from=-600&res=10"]
+
+lock = threading.Lock()
+latencies = {}
+errors = []
+stop = threading.Event()
+
+
+def record(path, seconds, status):
+    with lock:
+        latencies.setdefault(path, []).append(seconds)
+        if status >= 400 and status != 404:
+            errors.append("%s -> %d" % (path, status))
+
+
+def client(port, index):
+    # One keep-alive connection, reopened only if the server closes it. The server may
+    # close an idle one to make room for a newcomer, the request is then retried on a
+    # fresh connection like a browser would.
+    connection = None
+    connections = 0
+    retries = 0
+    request = index
+    while not stop.is_set():
+        path = PATHS[request % len(PATHS)]
+        request += 1
+        for attempt in range(2):
+            reused = connection is not None
+            try:
+                if connection is None:
+                    connection = http.client.HTTPConnection("127.0.0.1", port, timeout=10)
+                    connections += 1
+                start = time.perf_counter()
+                connection.request("GET", path, headers={"Accept-Encoding": "gzip"})
+                response = connection.getresponse()
+                response.read()
+                record(path, time.perf_counter() - start, response.status)
+                if response.getheader("Connection", "").lower() == "close":
+                    connection.close()
+                    connection = None
+                break
+            except (OSError, http.client.HTTPException) as error:
+                connection = None
+                if reused and attempt == 0:
+                    retries += 1
+                    continue
+                with lock:
+                    errors.append("%s: %s" % (path, error))
+                time.sleep(0.1)
+    with lock:
+        latencies.setdefault("connections", []).append(connections)
+        latencies.setdefault("retries", []).append(retries)
+
+
+def subscriber(port, results):
+    # Reads /api/stream like an EventSource, counting events
+    events = 0
+    try:
+        sock = socket.create_connection(("127.0.0.1", port), timeout=30)
+        sock.sendall(b"GET /api/stream?logs=0 HTTP/1.1\r\nHost: load\r\n\r\n")
+        sock.settimeout(1)
+        while not stop.is_set():
+            try:
+                data = sock.recv(4096)
+            except socket.timeout:
+                continue
+            if not data:
+                break
+            events += data.count(b"\nevent: ")
+        sock.close()
+    except OSError as error:
+        with lock:
+            errors.append("stream: %s" % error)
+    results.append(events)
+
+
+def half_open(port, results):
+    # Sends a header line a byte every 200 ms and never finishes, the server should give up on it
+    start = time.monotonic()
+    try:
+        sock = socket.create_connection(("127.0.0.1", port), timeout=30)
+        for byte in b"GET /api/data HTTP/1.1\r\nX-Slow: " + b"x" * 1000:
+            if stop.is_set():
+                break
+            sock.send(bytes([byte]))
+            time.sleep(0.2)
+        results.append(None)
+    except OSError:
+        results.append(time.monotonic() - start)
+
+
+def upload(port, kilobytes, results):
+    # A slow firmware upload, 4 KB every 50 ms, streamed to the sink as it arrives
+    body = os.urandom(kilobytes * 1024)
+    start = time.monotonic()
+    try:
+        sock = socket.create_connection(("127.0.0.1", port), timeout=30)
+        sock.sendall(b"POST /update HTTP/1.1\r\nHost: load\r\nContent-Type: application/octet-stream\r\n"
+                     b"Content-Length: %d\r\n\r\n" % len(body))
+        for offset in range(0, len(body), 4096):
+            sock.sendall(body[offset:offset + 4096])
+            time.sleep(0.05)
+        response = sock.recv(4096).split(b"\r\n", 1)[0].decode()
+        sock.close()
+        results.append((response.split(" ")[1:2] == ["200"], "%s after %.1f s" % (response, time.monotonic() - start)))
+    except OSError as error:
+        results.append((False, "failed: %s" % error))
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))] * 1000
+
+
+def wait_for_port(port, timeout):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return True
+        except OSError:
+            time.sleep(0.1)
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--program", help="host build to start, e.g. .pio/build/native/program")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--seconds", type=int, default=20, help="length of the load phase")
+    parser.add_argument("--clients", type=int, default=3, help="keep-alive request clients")
+    parser.add_argument("--streams", type=int, default=2, help="/api/stream subscribers")
+    parser.add_argument("--half-open", type=int, default=1, help="clients that never finish their request")
+    parser.add_argument("--upload-kb", type=int, default=0, help="size of a slow /update upload, 0 for none")
+    parser.add_argument("--max-retries", type=int, default=10, help="idle close retries allowed before the run fails")
+    args = parser.parse_args()
+
+    program = None
+    if args.program:
+        env = dict(os.environ, POOL_HEATER_HTTP_PORT=str(args.port))
+        program = subprocess.Popen([args.program, str(args.seconds + 5)], env=env,
+                                   stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    if not wait_for_port(args.port, 10):
+        raise SystemExit("Nothing listening on port %d" % args.port)
+
+    stream_events, half_open_drops, uploads = [], [], []
+    threads = [threading.Thread(target=subscriber, args=(args.port, stream_events)) for _ in range(args.streams)]
+    threads += [threading.Thread(target=half_open, args=(args.port, half_open_drops)) for _ in range(args.half_open)]
+    if args.upload_kb:
+        threads.append(threading.Thread(target=upload, args=(args.port, args.upload_kb, uploads)))
+    threads += [threading.Thread(target=client, args=(args.port, i)) for i in range(args.clients)]
+
+    start = time.monotonic()
+    for thread in threads:
+        thread.start()
+    time.sleep(args.seconds)
+    stop.set()
+    for thread in threads:
+        thread.join()
+    elapsed = time.monotonic() - start
+
+    total = sum(len(latencies.get(path, [])) for path in PATHS)
+    retries = sum(latencies.get("retries", []))
+    print("%d requests in %.1f s, %.0f req/s over %d connections, %d retried after an idle close"
+          % (total, elapsed, total / elapsed, sum(latencies.get("connections", [])), retries))
+    for path in PATHS:
+        values = latencies.get(path, [])
+        if values:
+            print("  %-32s %6d  p50 %6.2f ms  p99 %6.2f ms  max %7.2f ms"
+                  % (path, len(values), percentile(values, 0.5), percentile(values, 0.99), max(values) * 1000))
+    print("Stream events received: %s" % (stream_events or "none"))
+    for dropped in half_open_drops:
+        print("Half-open client: %s" % ("dropped after %.1f s" % dropped if dropped is not None else "never dropped"))
+    for ok, result in uploads:
+        print("Upload: %s" % result)
+    print("Errors: %d" % len(errors))
+    for error in errors[:10]:
+        print("  " + error)
+
+    if program:
+        output, _ = program.communicate()
+        for line in output.splitlines():
+            if line.startswith("Control loop"):
+                print(line)
+
+    failures = []
+    if errors:
+        failures.append("%d request errors" % len(errors))
+    if None in half_open_drops and args.seconds > REQUEST_TIMEOUT + 1:
+        failures.append("half-open client never dropped")
+    if any(not ok for ok, _ in uploads):
+        failures.append("upload failed")
+    if retries > args.max_retries:
+        failures.append("%d retries after an idle close, more than %d" % (retries, args.max_retries))
+    if failures:
+        print("FAILED: " + ", ".join(failures))
+        raise SystemExit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# Checks the notifier's retry timing against tools/webhook_standin.py.
+#
+#   tools/webhook_check.py --program .pio/build/native/program [--port 8099]
+#
+# Each scenario starts the stand-in in a given mode and the host build pointed
+# at it, then checks when the posts arrived. The first batch goes out
+# NOTIFY_BATCH_WINDOW after boot.
+#
+#   backoff      500 then ok, the retry comes NOTIFY_MIN_INTERVAL later plus jitter
+#   retry-after  429 with a Retry-After longer than the backoff, twice, then ok.
+#                Both retries wait the full Retry-After
+#   give-up      429 with a Retry-After past NOTIFY_MAX_RETRY_AFTER, the batch is
+#                dropped and never retried
+#
+# Takes about two minutes. Exits 1 if any scenario fails.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+NOTIFY_MIN_INTERVAL = 10                # Seconds, as in config.h
+NOTIFY_MAX_RETRY_AFTER = 30 * 60
+JITTER = 0.25                           # Of the backoff
+SLACK = 2.0                             # Notifier poll interval and the round trip
+STANDIN = os.path.join(os.path.dirname(os.path.abspath(__file__)), "webhook_standin.py")
+POST_LINE = re.compile(r"\[\s*([\d.]+)s\] #(\d+) (\S+)")
+
+
+def run(program, port, mode, retry_after, seconds):
+    """Returns the arrival times of the posts and the program's output."""
+    standin = subprocess.Popen([sys.executable, "-u", STANDIN, "--port", str(port), "--mode", mode,
+                                "--retry-after", str(retry_after)], stdout=subprocess.PIPE, text=True)
+    posts = []
+
+    def read():
+        for line in standin.stdout:
+            match = POST_LINE.match(line)
+            if match:
+                posts.append(float(match.group(1)))
+
+    reader = threading.Thread(target=read)
+    reader.start()
+    time.sleep(0.5)
+
+    # Journal and settings files land in a scratch directory, not the caller's
+    with tempfile.TemporaryDirectory() as scratch:
+        env = dict(os.environ, POOL_HEATER_WEBHOOK="http://127.0.0.1:%d/hook" % port)
+        with open(os.path.join(scratch, "output.txt"), "w+") as output:
+            subprocess.run([program, str(seconds)], env=env, cwd=scratch, stdout=output, stderr=subprocess.STDOUT)
+            output.seek(0)
+            text = output.read()
+
+    standin.terminate()
+    reader.join()
+    return posts, text
+
+
+def gaps(posts):
+    return [later - earlier for earlier, later in zip(posts, posts[1:])]
+
+
+def check(name, failures, ok, detail):
+    print("%-12s %s  %s" % (name, "ok  " if ok else "FAIL", detail))
+    if not ok:
+        failures.append(name)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--program", required=True, help="host build to start, e.g. .pio/build/native/program")
+    parser.add_argument("--port", type=int, default=8099)
+    args = parser.parse_args()
+    program = os.path.abspath(args.program)
+    failures = []
+
+    posts, _ = run(program, args.port, "500,ok", 0, 25)
+    backoff = gaps(posts)[:1]
+    check("backoff", failures,
+          len(backoff) == 1 and NOTIFY_MIN_INTERVAL <= backoff[0] <= NOTIFY_MIN_INTERVAL * (1 + JITTER) + SLACK,
+          "retry after %s s, expected %d to %.1f s" % (["%.1f" % gap for gap in backoff],
+                                                      NOTIFY_MIN_INTERVAL, NOTIFY_MIN_INTERVAL * (1 + JITTER)))
+
+    retry_after = 30
+    posts, _ = run(program, args.port, "429,429,ok", retry_after, 75)
+    retries = gaps(posts)[:2]
+    check("retry-after", failures,
+          len(retries) == 2 and all(retry_after <= gap <= retry_after + SLACK for gap in retries),
+          "retries after %s s, expected %d s each" % (["%.1f" % gap for gap in retries], retry_after))
+
+    posts, output = run(program, args.port, "429", NOTIFY_MAX_RETRY_AFTER + 60, 14)
+    dropped = "Webhook notification dropped after 1 attempt(s), last status 429" in output
+    check("give-up", failures, len(posts) == 1 and dropped,
+          "%d post(s), %s" % (len(posts), "batch dropped" if dropped else "no drop logged"))
+
+    if failures:
+        print("FAILED: " + ", ".join(failures))
+        raise SystemExit(1)
+
+
+if __name__ == "__main__":
+    main()
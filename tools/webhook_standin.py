@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+# Local stand-in for the notification webhook, for running env:native against.
+#
+#   tools/webhook_standin.py [--port 8099] [--mode ok|429|stall|500|400] [--retry-after 3]
+#   POOL_HEATER_WEBHOOK=http://127.0.0.1:8099/hook .pio/build/native/program 120
+#
+# Every POST is printed with its arrival time so batching, backoff and
+# Retry-After handling can be checked by eye. --mode can be a comma separated
+# list that is cycled through per request, e.g. "429,stall,ok".
+# tools/webhook_check.py runs it through scripted retry scenarios.
+
+import argparse
+import json
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+args = None
+start = time.monotonic()
+count = 0
+
+
+class Handler(BaseHTTPRequestHandler):
+    def do_POST(self):
+        global count
+        modes = args.mode.split(",")
+        mode = modes[count % len(modes)]
+        count += 1
+
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        try:
+            content = json.loads(body)["content"]
+        except (ValueError, KeyError) as error:
+            content = "<invalid payload: %s>" % error
+
+        print("[%8.1fs] #%d %s (%d bytes)" % (time.monotonic() - start, count, mode, len(body)))
+        for line in content.splitlines():
+            print("    " + line)
+
+        if mode == "stall":
+            time.sleep(args.stall)      # Longer than NOTIFY_HTTP_TIMEOUT, the client gives up first
+            return
+        if mode == "429":
+            self.send_response(429)
+            self.send_header("Retry-After", str(args.retry_after))
+        elif mode in ("400", "500"):
+            self.send_response(int(mode))
+        else:
+            self.send_response(204)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+    def log_message(self, format, *values):
+        pass
+
+
+def main():
+    global args
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--port", type=int, default=8099)
+    parser.add_argument("--mode", default="ok")
+    parser.add_argument("--retry-after", type=int, default=3)
+    parser.add_argument("--stall", type=float, default=10.0)
+    args = parser.parse_args()
+
+    HTTPServer(("127.0.0.1", args.port), Handler).serve_forever()
+
+
+if __name__ == "__main__":
+    main()